@@ -27,15 +27,25 @@
 #include "settings_file.h"
 
 rppicomidi::Backup_view::Backup_view(Mono_graphics& screen_) : 
-    View{screen_, screen_.get_clip_rect()}, font{screen.get_font_12()}, menu{screen, static_cast<uint8_t>(font.height*2), font}
+    View{screen_, screen_.get_clip_rect()}, font{screen.get_font_12()}, menu{screen, static_cast<uint8_t>(font.height*2), font},
+    dirname_ok{false}, active{false}, backup_running{false}
 {
-    backup_all = new Callback_menu_item("Backup All Presets",screen, font, this, static_start_backup, Select_result::exit_view);
+    backup_all = new Callback_menu_item("Backup All Presets",screen, font, this, static_start_backup, Select_result::no_op);
     assert(backup_all);
     menu.add_menu_item(backup_all);
+    backup_changes = new Callback_menu_item("Backup Changes",screen, font, this, static_start_changes_backup, Select_result::no_op);
+    assert(backup_changes);
+    menu.add_menu_item(backup_changes);
+    backup_archive = new Callback_menu_item("Backup to Archive",screen, font, this, static_start_archive_backup, Select_result::no_op);
+    assert(backup_archive);
+    menu.add_menu_item(backup_archive);
 }
 
 void rppicomidi::Backup_view::entry()
 {
+    // Find the folder name once rather than on every draw(); it reads the USB drive
+    dirname_ok = Settings_file::instance().get_next_backup_directory_name(dirname, sizeof(dirname));
+    active = true;
     menu.entry();
 }
 
@@ -43,9 +53,7 @@ void rppicomidi::Backup_view::draw()
 {
     screen.clear_canvas();
     screen.center_string(font, "Next Backup Folder", 0);
-    char dirname[20];
-    bool result = Settings_file::instance().get_next_backup_directory_name(dirname, sizeof(dirname));
-    if (result) {
+    if (dirname_ok) {
         screen.center_string(font, "Next Backup Folder", 0);
         screen.center_string(font, dirname, font.height);
         menu.draw();
@@ -55,15 +63,69 @@ void rppicomidi::Backup_view::draw()
         screen.draw_rectangle(0, 0, screen.get_screen_width(),font.height,Pixel_state::PIXEL_ZERO, Pixel_state::PIXEL_ZERO);
         screen.center_string(font, "Backup Failed", 0);
     }
+    if (backup_running)
+        show_status("Backing up");
 }
 
-void rppicomidi::Backup_view::static_start_backup(View* view_, View**)
+void rppicomidi::Backup_view::show_status(const char* status)
 {
-    FRESULT res = Settings_file::instance().backup_all_presets();
-    if (res != FR_OK) {
-        printf("error %u backing up presets\r\n", res);
-        auto me = reinterpret_cast<Backup_view*>(view_);
-        me->backup_all->set_select_action(Select_result::no_op);
-        me->screen.center_string(me->font, "Backup Failed",0);
+    if (!active)
+        return; // another view is on the screen
+    // clear the top line
+    screen.draw_rectangle(0, 0, screen.get_screen_width(),font.height,Pixel_state::PIXEL_ZERO, Pixel_state::PIXEL_ZERO);
+    screen.center_string(font, status, 0);
+}
+
+void rppicomidi::Backup_view::static_backup_progress(void* context, Fs_job& job, Fs_job::Step_result result)
+{
+    auto me = reinterpret_cast<Backup_view*>(context);
+    if (result == Fs_job::STEP_MORE) {
+        char status[22];
+        snprintf(status, sizeof(status), "Backing up %u/%u", job.get_steps_done(), job.get_num_steps());
+        me->show_status(status);
+        return;
+    }
+    me->backup_running = false;
+    if (result == Fs_job::STEP_ERROR) {
+        printf("error backing up presets\r\n");
+        me->show_status("Backup Failed");
+        return;
     }
+    me->show_status("Backup Done");
+    // The folder name just used is taken
+    me->dirname_ok = Settings_file::instance().get_next_backup_directory_name(me->dirname, sizeof(me->dirname));
+    if (me->active && me->dirname_ok) {
+        me->screen.draw_rectangle(0, me->font.height, me->screen.get_screen_width(), me->font.height, Pixel_state::PIXEL_ZERO, Pixel_state::PIXEL_ZERO);
+        me->screen.center_string(me->font, me->dirname, me->font.height);
+    }
+}
+
+bool rppicomidi::Backup_view::begin_backup()
+{
+    if (backup_running)
+        return false; // one backup at a time
+    backup_running = true;
+    show_status("Backing up");
+    return true;
+}
+
+void rppicomidi::Backup_view::static_start_changes_backup(View* view_, View**)
+{
+    auto me = reinterpret_cast<Backup_view*>(view_);
+    if (me->begin_backup())
+        Settings_file::instance().start_backup(true, static_backup_progress, me);
+}
+
+void rppicomidi::Backup_view::static_start_archive_backup(View* view_, View**)
+{
+    auto me = reinterpret_cast<Backup_view*>(view_);
+    if (me->begin_backup())
+        Settings_file::instance().start_archive_backup(static_backup_progress, me);
+}
+
+void rppicomidi::Backup_view::static_start_backup(View* view_, View**)
+{
+    auto me = reinterpret_cast<Backup_view*>(view_);
+    if (me->begin_backup())
+        Settings_file::instance().start_backup(false, static_backup_progress, me);
 }
@@ -26,6 +26,7 @@
 #pragma once
 #include "menu.h"
 #include "callback_menu_item.h"
+#include "fs_job_queue.h"
 namespace rppicomidi {
 class Backup_view : public View
 {
@@ -37,14 +38,36 @@ public:
     virtual ~Backup_view()=default;
 
     void entry() final;
+    void exit() final {active = false;}
     void draw() final;
     Select_result on_select(View** new_view) final {return menu.on_select(new_view);}
     void on_increment(uint32_t delta, bool is_shifted) final {menu.on_increment(delta, is_shifted); };
     void on_decrement(uint32_t delta, bool is_shifted) final {menu.on_decrement(delta, is_shifted); };
 private:
     static void static_start_backup(View* view_, View**);
+    static void static_start_changes_backup(View* view_, View**);
+    static void static_start_archive_backup(View* view_, View**);
+    static void static_backup_progress(void* context, Fs_job& job, Fs_job::Step_result result);
+
+    /**
+     * @brief mark a backup job as running unless one already is
+     *
+     * @return true if the caller should start the backup job
+     */
+    bool begin_backup();
+
+    /**
+     * @brief show status on the top line if this view is on the screen
+     */
+    void show_status(const char* status);
     const Mono_mono_font& font;
     Menu menu;
     Callback_menu_item* backup_all;
+    Callback_menu_item* backup_changes;
+    Callback_menu_item* backup_archive;
+    char dirname[20];   // the next backup folder name
+    bool dirname_ok;    // true if dirname is valid
+    bool active;        // true if this view is on the screen
+    bool backup_running; // true from the start of a backup job until it finishes
 };
 }
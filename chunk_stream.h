@@ -0,0 +1,155 @@
+/**
+ * @file chunk_stream.h
+ * @brief this file contains the Chunk_stream class, which copies
+ * a file in fixed-size chunks
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+namespace rppicomidi
+{
+/**
+ * @brief Copy a file in fixed-size chunks from a read function or from
+ * many small writes to a write function
+ *
+ * The caller owns the chunk buffer. Make the chunk size a multiple of the
+ * 512 byte USB flash drive sector size so FatFs can write whole sectors
+ * without first copying them into its file buffer.
+ */
+class Chunk_stream
+{
+public:
+    /**
+     * @brief the function that writes one chunk to its destination
+     *
+     * @param context the context pointer passed to the constructor
+     * @param data the bytes to write
+     * @param len the number of bytes to write
+     * @return true if successful, false if there was an error
+     */
+    typedef bool (*Write_fn)(void* context, const uint8_t* data, size_t len);
+
+    /**
+     * @brief the function that reads the next chunk from the source
+     *
+     * @param context the context pointer passed to copy()
+     * @param data the buffer to fill
+     * @param maxlen the size of the buffer
+     * @return the number of bytes read, 0 at the end of the source, or
+     * a negative number if there was an error
+     */
+    typedef int32_t (*Read_fn)(void* context, uint8_t* data, size_t maxlen);
+
+    Chunk_stream(uint8_t* chunk_, size_t chunk_size_, Write_fn write_fn_, void* context_) :
+        chunk{chunk_}, chunk_size{chunk_size_}, write_fn{write_fn_}, context{context_},
+        nbuffered{0}, nwritten{0}, error{false} {}
+
+    /**
+     * @brief add bytes to the stream; each full chunk is written
+     *
+     * @return false if there was an error
+     */
+    bool write(const void* data, size_t len)
+    {
+        auto bytes = reinterpret_cast<const uint8_t*>(data);
+        while (len > 0 && !error) {
+            size_t ncopy = chunk_size - nbuffered;
+            if (ncopy > len)
+                ncopy = len;
+            memcpy(chunk + nbuffered, bytes, ncopy);
+            nbuffered += ncopy;
+            bytes += ncopy;
+            len -= ncopy;
+            if (nbuffered == chunk_size)
+                flush();
+        }
+        return !error;
+    }
+
+    /**
+     * @brief write the partial chunk, if any
+     *
+     * @return false if there was an error
+     */
+    bool flush()
+    {
+        if (nbuffered != 0 && !error) {
+            error = !write_fn(context, chunk, nbuffered);
+            nwritten += nbuffered;
+        }
+        nbuffered = 0;
+        return !error;
+    }
+
+    /**
+     * @brief copy everything read_fn returns, one chunk at a time, then flush
+     *
+     * @return false if reading or writing failed
+     */
+    bool copy(Read_fn read_fn, void* read_context)
+    {
+        flush();
+        while (!error) {
+            int32_t nread = read_fn(read_context, chunk, chunk_size);
+            if (nread < 0)
+                error = true;
+            else if (nread == 0)
+                break;
+            else {
+                nbuffered = nread;
+                flush();
+            }
+        }
+        return !error;
+    }
+
+    /**
+     * @brief get the number of bytes passed to the write function so far
+     */
+    size_t get_nwritten() const { return nwritten; }
+
+    /**
+     * @brief return true if a read or write failed
+     */
+    bool is_error() const { return error; }
+
+    /**
+     * @brief Json_stream_writer write function for a Chunk_stream context
+     */
+    static bool static_write(void* context, const char* data, size_t len)
+    {
+        return reinterpret_cast<Chunk_stream*>(context)->write(data, len);
+    }
+private:
+    uint8_t* chunk;
+    const size_t chunk_size;
+    Write_fn write_fn;
+    void* context;
+    size_t nbuffered;
+    size_t nwritten;
+    bool error;
+};
+}
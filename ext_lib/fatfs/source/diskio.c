@@ -34,18 +34,344 @@
  * RP2040 core 0 and the MSC USB host stack is running on core 1. Otherwise, the
  * API needs some mechanism to block until the USB transfers between the USB drive
  * and the RP2040 complete (e.g., an RTOS or manually task calls in a loop)
+ *
+ * Transfers go through a small queue of sector buffers so that FatFs does not
+ * have to wait for every USB command to finish. Adjacent disk_write() calls are
+ * coalesced into one WRITE10 command that is sent when the buffer is full or when
+ * the next non-adjacent request arrives, and FatFs continues while it completes.
+ * Sequential disk_read() calls start a READ10 for the sectors that follow so the
+ * next read is usually already done. Write errors are reported by the next
+ * disk_write() or CTRL_SYNC. The USB MSC host only runs one command per drive at
+ * a time, so there is never more than one command in flight.
+ *
+ * Above the queue, an LRU cache of MSC_FAT_CACHE_SECTORS sectors holds single
+ * sector reads and writes, which are mostly FAT and directory sectors. Writes to
+ * it are written back on eviction or CTRL_SYNC. FatFs issues CTRL_SYNC from
+ * f_sync(), f_close() and every other function that changes the volume.
+ *
+ * Define MSC_FAT_RAMDISK_SECTORS to replace the USB drive with a RAM disk with a
+ * simulated command latency, so backup and restore throughput, with and without
+ * the cache, can be measured without a drive. This tree has no host build or
+ * benchmark harness for it, so those measurements have not been made.
  */
 
 #include "ff.h"			/* Obtains integer types */
 #include "diskio.h"		/* Declarations of disk functions */
+#include <string.h>
+#if MSC_FAT_RAMDISK_SECTORS
+#include <assert.h>
+#include <time.h>
+#define mutex_init(m) (void)(m)
+#define mutex_enter_blocking(m) (void)(m)
+#define mutex_exit(m) (void)(m)
+typedef int mutex_t;
+static uint64_t time_us_64()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+#else
 #include "tusb.h"
 #include "pico/mutex.h"
-#if CFG_TUH_MSC
+#include "pico/time.h"
+#endif
+#if CFG_TUH_MSC || MSC_FAT_RAMDISK_SECTORS
 
 static DSTATUS disk_state[CFG_TUH_DEVICE_MAX];
 static mutex_t msc_fat_mutex;
 
-static msc_fat_xfer_status_t msc_fat_status;
+/*-----------------------------------------------------------------------*/
+/* MSC transfer queue                                                    */
+/*-----------------------------------------------------------------------*/
+typedef struct {
+    msc_fat_xfer_status_t status;
+    bool is_write;
+    BYTE pdrv;
+    LBA_t lba;
+    UINT count;
+    BYTE buf[MSC_FAT_XFER_SECTORS * FF_MAX_SS];
+} msc_fat_xfer_t;
+
+static msc_fat_xfer_t msc_fat_queue[MSC_FAT_QUEUE_DEPTH];
+// The completion status of transfers to or from a FatFs buffer use this slot number
+#define MSC_FAT_DIRECT_SLOT MSC_FAT_QUEUE_DEPTH
+static msc_fat_xfer_status_t msc_fat_direct_status;
+// The sector that follows the last disk_read() on each drive, to detect sequential reads
+static LBA_t msc_fat_next_read_lba[CFG_TUH_DEVICE_MAX];
+// true if a write that FatFs already thinks is done failed
+static bool msc_fat_write_failed[CFG_TUH_DEVICE_MAX];
+static msc_fat_stats_t msc_fat_stats;
+
+#if MSC_FAT_RAMDISK_SECTORS
+static BYTE ramdisk[MSC_FAT_RAMDISK_SECTORS][FF_MAX_SS];
+static uint8_t ramdisk_pending_slot;
+static uint64_t ramdisk_done_us;
+
+static void ramdisk_task()
+{
+    if (ramdisk_pending_slot <= MSC_FAT_DIRECT_SLOT && time_us_64() >= ramdisk_done_us)
+    {
+        uint8_t slot = ramdisk_pending_slot;
+        ramdisk_pending_slot = UINT8_MAX;
+        msc_fat_set_status(slot, MSC_FAT_COMPLETE);
+    }
+}
+#endif
+
+/**
+ * @brief send a READ10 or WRITE10 command; the bus must be idle
+ *
+ * @return true if the command was sent
+ */
+static bool msc_fat_xfer_start(BYTE pdrv, bool is_write, BYTE* buf, LBA_t lba, UINT count, uint8_t slot)
+{
+    bool started;
+    msc_fat_set_status(slot, MSC_FAT_IN_PROGRESS);
+#if MSC_FAT_RAMDISK_SECTORS
+    (void)pdrv;
+    started = lba + count <= MSC_FAT_RAMDISK_SECTORS;
+    if (started)
+    {
+        if (is_write)
+            memcpy(ramdisk[lba], buf, count * FF_MAX_SS);
+        else
+            memcpy(buf, ramdisk[lba], count * FF_MAX_SS);
+        ramdisk_pending_slot = slot;
+        ramdisk_done_us = time_us_64() + MSC_FAT_RAMDISK_CMD_US + count * MSC_FAT_RAMDISK_SECTOR_US;
+    }
+#else
+    uint8_t dev_addr = msc_pdrv_to_daddr(pdrv);
+    if (is_write)
+        started = tuh_msc_write10(dev_addr, 0, buf, lba, count, msc_fat_complete_cb, slot);
+    else
+        started = tuh_msc_read10(dev_addr, 0, buf, lba, count, msc_fat_complete_cb, slot);
+#endif
+    if (started)
+    {
+        if (is_write)
+        {
+            ++msc_fat_stats.write_cmds;
+            msc_fat_stats.sectors_written += count;
+        }
+        else
+        {
+            ++msc_fat_stats.read_cmds;
+            msc_fat_stats.sectors_read += count;
+        }
+    }
+    else
+    {
+        msc_fat_set_status(slot, MSC_FAT_ERROR);
+    }
+    return started;
+}
+
+/**
+ * @brief wait for a slot's command to finish and return its status
+ */
+static msc_fat_xfer_status_t msc_fat_wait_slot(uint8_t slot)
+{
+    msc_fat_xfer_status_t stat = msc_fat_get_xfer_status(slot);
+    if (stat == MSC_FAT_IN_PROGRESS)
+    {
+        uint64_t start = time_us_64();
+        while ((stat = msc_fat_get_xfer_status(slot)) == MSC_FAT_IN_PROGRESS)
+        {
+#if MSC_FAT_RAMDISK_SECTORS
+            ramdisk_task();
+#endif
+            main_loop_task();
+        }
+        msc_fat_stats.wait_us += time_us_64() - start;
+    }
+    return stat;
+}
+
+/**
+ * @brief free queue slots for writes that have finished and note any errors
+ */
+static void msc_fat_reap_writes()
+{
+    for (uint8_t slot = 0; slot < MSC_FAT_QUEUE_DEPTH; slot++)
+    {
+        msc_fat_xfer_t* xfer = msc_fat_queue + slot;
+        if (!xfer->is_write)
+            continue;
+        msc_fat_xfer_status_t stat = msc_fat_get_xfer_status(slot);
+        if (stat == MSC_FAT_COMPLETE || stat == MSC_FAT_ERROR)
+        {
+            if (stat == MSC_FAT_ERROR)
+                msc_fat_write_failed[xfer->pdrv] = true;
+            msc_fat_set_status(slot, MSC_FAT_IDLE);
+        }
+    }
+}
+
+/**
+ * @brief send the staged write buffer, if there is one, after any command in flight
+ */
+static void msc_fat_issue_staged()
+{
+    for (uint8_t slot = 0; slot < MSC_FAT_QUEUE_DEPTH; slot++)
+    {
+        msc_fat_xfer_t* xfer = msc_fat_queue + slot;
+        if (msc_fat_get_xfer_status(slot) == MSC_FAT_STAGED)
+        {
+            msc_fat_wait_transfer_complete();
+            msc_fat_xfer_start(xfer->pdrv, true, xfer->buf, xfer->lba, xfer->count, slot);
+        }
+    }
+}
+
+/**
+ * @brief drop read-ahead data for a drive; only sectors overlapping
+ * [lba, lba+count) if count is not 0
+ */
+static void msc_fat_drop_read_ahead(BYTE pdrv, LBA_t lba, UINT count)
+{
+    for (uint8_t slot = 0; slot < MSC_FAT_QUEUE_DEPTH; slot++)
+    {
+        msc_fat_xfer_t* xfer = msc_fat_queue + slot;
+        if (xfer->is_write || xfer->pdrv != pdrv || msc_fat_get_xfer_status(slot) == MSC_FAT_IDLE)
+            continue;
+        if (count == 0 || (lba < xfer->lba + xfer->count && xfer->lba < lba + count))
+        {
+            if (msc_fat_wait_slot(slot) == MSC_FAT_COMPLETE)
+                ++msc_fat_stats.read_ahead_unused;
+            msc_fat_set_status(slot, MSC_FAT_IDLE);
+        }
+    }
+}
+
+/**
+ * @brief get an idle queue slot, waiting for the command in flight if necessary
+ */
+static uint8_t msc_fat_get_idle_slot()
+{
+    for (;;)
+    {
+        msc_fat_reap_writes();
+        for (uint8_t slot = 0; slot < MSC_FAT_QUEUE_DEPTH; slot++)
+        {
+            if (msc_fat_get_xfer_status(slot) == MSC_FAT_IDLE)
+                return slot;
+        }
+        // Reuse a read-ahead buffer before waiting for a write
+        for (uint8_t slot = 0; slot < MSC_FAT_QUEUE_DEPTH; slot++)
+        {
+            if (!msc_fat_queue[slot].is_write)
+            {
+                msc_fat_drop_read_ahead(msc_fat_queue[slot].pdrv, 0, 0);
+                return slot;
+            }
+        }
+        msc_fat_wait_transfer_complete();
+    }
+}
+
+/**
+ * @brief send all staged writes for every drive and wait for them to finish
+ *
+ * @return RES_ERROR if any write to pdrv failed since the last call
+ */
+static DRESULT msc_fat_flush_writes(BYTE pdrv)
+{
+    msc_fat_issue_staged();
+    msc_fat_wait_transfer_complete();
+    msc_fat_reap_writes();
+    DRESULT res = msc_fat_write_failed[pdrv] ? RES_ERROR : RES_OK;
+    msc_fat_write_failed[pdrv] = false;
+    return res;
+}
+
+/**
+ * @brief send a command for a FatFs buffer and wait for it to finish
+ */
+static DRESULT msc_fat_xfer_direct(BYTE pdrv, bool is_write, BYTE* buff, LBA_t sector, UINT count)
+{
+    msc_fat_wait_transfer_complete();
+    if (!msc_fat_xfer_start(pdrv, is_write, buff, sector, count, MSC_FAT_DIRECT_SLOT))
+        return RES_ERROR;
+    return msc_fat_wait_slot(MSC_FAT_DIRECT_SLOT) == MSC_FAT_COMPLETE ? RES_OK : RES_ERROR;
+}
+
+/**
+ * @brief start reading sectors that follow a sequential read if the bus is idle
+ */
+static void msc_fat_start_read_ahead(BYTE pdrv, LBA_t lba)
+{
+#if MSC_FAT_RAMDISK_SECTORS
+    LBA_t block_count = MSC_FAT_RAMDISK_SECTORS;
+#else
+    LBA_t block_count = tuh_msc_get_block_count(msc_pdrv_to_daddr(pdrv), 0);
+#endif
+    if (lba >= block_count)
+        return;
+    UINT count = MSC_FAT_XFER_SECTORS;
+    if (lba + count > block_count)
+        count = block_count - lba;
+    if (msc_fat_get_xfer_status(MSC_FAT_DIRECT_SLOT) == MSC_FAT_IN_PROGRESS)
+        return;
+    // Use an idle slot or else replace old read-ahead data
+    uint8_t slot = MSC_FAT_QUEUE_DEPTH;
+    for (uint8_t idx = 0; idx < MSC_FAT_QUEUE_DEPTH; idx++)
+    {
+        msc_fat_xfer_t* xfer = msc_fat_queue + idx;
+        msc_fat_xfer_status_t stat = msc_fat_get_xfer_status(idx);
+        if (stat == MSC_FAT_IN_PROGRESS)
+            return; // bus busy
+        if (stat == MSC_FAT_IDLE)
+        {
+            slot = idx;
+        }
+        else if (xfer->is_write)
+        {
+            if (xfer->pdrv == pdrv && xfer->lba < lba + count && lba < xfer->lba + xfer->count)
+                return; // would read sectors that are not written yet
+        }
+        else if (slot == MSC_FAT_QUEUE_DEPTH || msc_fat_get_xfer_status(slot) != MSC_FAT_IDLE)
+        {
+            slot = idx;
+        }
+    }
+    if (slot == MSC_FAT_QUEUE_DEPTH)
+        return;
+    msc_fat_xfer_t* xfer = msc_fat_queue + slot;
+    if (msc_fat_get_xfer_status(slot) == MSC_FAT_COMPLETE)
+        ++msc_fat_stats.read_ahead_unused;
+    xfer->is_write = false;
+    xfer->pdrv = pdrv;
+    xfer->lba = lba;
+    xfer->count = count;
+    if (!msc_fat_xfer_start(pdrv, false, xfer->buf, xfer->lba, xfer->count, slot))
+        msc_fat_set_status(slot, MSC_FAT_IDLE);
+}
+
+/**
+ * @brief discard all queued transfers for a drive
+ */
+static void msc_fat_reset_queue(BYTE pdrv)
+{
+    for (uint8_t slot = 0; slot < MSC_FAT_QUEUE_DEPTH; slot++)
+    {
+        if (msc_fat_queue[slot].pdrv == pdrv && msc_fat_get_xfer_status(slot) != MSC_FAT_IN_PROGRESS)
+            msc_fat_set_status(slot, MSC_FAT_IDLE);
+    }
+    msc_fat_write_failed[pdrv] = false;
+    msc_fat_next_read_lba[pdrv] = 0;
+}
+
+void msc_fat_get_stats(msc_fat_stats_t* stats)
+{
+    *stats = msc_fat_stats;
+}
+
+void msc_fat_reset_stats()
+{
+    memset(&msc_fat_stats, 0, sizeof(msc_fat_stats));
+}
+
 /*-----------------------------------------------------------------------*/
 /* MSC plug status functions                                             */
 /*-----------------------------------------------------------------------*/
@@ -111,8 +437,18 @@ void msc_fat_unplug(
 )
 {
     if (pdrv < CFG_TUH_DEVICE_MAX)
+    {
         disk_state[pdrv] |= STA_NOINIT | STA_NODISK;
-    ;
+        // The drive will never finish a command in flight, so fail it
+        mutex_enter_blocking(&msc_fat_mutex);
+        for (uint8_t slot = 0; slot <= MSC_FAT_DIRECT_SLOT; slot++)
+        {
+            msc_fat_xfer_status_t* stat = slot == MSC_FAT_DIRECT_SLOT ? &msc_fat_direct_status : &msc_fat_queue[slot].status;
+            if (*stat == MSC_FAT_IN_PROGRESS)
+                *stat = MSC_FAT_ERROR;
+        }
+        mutex_exit(&msc_fat_mutex);
+    }
 }
 
 void msc_fat_plug_in(
@@ -138,50 +474,257 @@ bool msc_fat_is_plugged_in(
 void msc_fat_init()
 {
     mutex_init(&msc_fat_mutex);
-    msc_fat_status = MSC_FAT_ERROR;
+    for (uint8_t slot = 0; slot < MSC_FAT_QUEUE_DEPTH; slot++)
+        msc_fat_queue[slot].status = MSC_FAT_IDLE;
+    msc_fat_direct_status = MSC_FAT_IDLE;
+#if MSC_FAT_RAMDISK_SECTORS
+    ramdisk_pending_slot = UINT8_MAX;
+#endif
+    msc_fat_reset_stats();
     for (int pdrv = 0; pdrv < CFG_TUH_DEVICE_MAX; pdrv++)
         msc_fat_unplug(pdrv); // assume no drives are plugged int
     available_pdrv_bitmap = (1 << FF_VOLUMES) - 1;
     memset(pdrv_to_daddr_map, 0, sizeof(pdrv_to_daddr_map));
 }
 
-void msc_fat_set_status(msc_fat_xfer_status_t stat)
+void msc_fat_set_status(uint8_t slot, msc_fat_xfer_status_t stat)
 {
     mutex_enter_blocking(&msc_fat_mutex);
-    msc_fat_status = stat;
+    if (slot == MSC_FAT_DIRECT_SLOT)
+        msc_fat_direct_status = stat;
+    else
+        msc_fat_queue[slot].status = stat;
     mutex_exit(&msc_fat_mutex);
 }
 
-msc_fat_xfer_status_t msc_fat_get_xfer_status()
+msc_fat_xfer_status_t msc_fat_get_xfer_status(uint8_t slot)
 {
     mutex_enter_blocking(&msc_fat_mutex);
-    msc_fat_xfer_status_t res = msc_fat_status;
+    msc_fat_xfer_status_t res = slot == MSC_FAT_DIRECT_SLOT ? msc_fat_direct_status : msc_fat_queue[slot].status;
     mutex_exit(&msc_fat_mutex);
     return res;
 }
 
 void msc_fat_wait_transfer_complete()
 {
-    while (msc_fat_get_xfer_status() == MSC_FAT_IN_PROGRESS)
+    for (uint8_t slot = 0; slot <= MSC_FAT_DIRECT_SLOT; slot++)
     {
-        main_loop_task();
+        msc_fat_wait_slot(slot);
     }
 }
 
+#if !MSC_FAT_RAMDISK_SECTORS
 bool msc_fat_complete_cb(uint8_t dev_addr, tuh_msc_complete_data_t const* cb_data)
 {
-    // TODO does the msc_fat_status have to be address dependent?
     (void)dev_addr;
+    uint8_t slot = (uint8_t)cb_data->user_arg;
     if (cb_data->csw->status == MSC_CSW_STATUS_PASSED)
     {
-        msc_fat_set_status(MSC_FAT_COMPLETE);
+        msc_fat_set_status(slot, MSC_FAT_COMPLETE);
     }
     else
     {
-        msc_fat_set_status(MSC_FAT_ERROR);
+        msc_fat_set_status(slot, MSC_FAT_ERROR);
     }
     return cb_data->csw->status == MSC_CSW_STATUS_PASSED;
 }
+#endif
+
+/**
+ * @brief read sectors through the transfer queue
+ */
+static DRESULT msc_fat_queue_read(BYTE pdrv, BYTE* buff, LBA_t sector, UINT count)
+{
+    // Writes still queued must reach the drive before reading them back
+    for (uint8_t slot = 0; slot < MSC_FAT_QUEUE_DEPTH; slot++)
+    {
+        msc_fat_xfer_t* xfer = msc_fat_queue + slot;
+        if (xfer->is_write && xfer->pdrv == pdrv && msc_fat_get_xfer_status(slot) != MSC_FAT_IDLE &&
+                sector < xfer->lba + xfer->count && xfer->lba < sector + count)
+        {
+            msc_fat_issue_staged();
+            msc_fat_wait_transfer_complete();
+            break;
+        }
+    }
+    DRESULT res = RES_ERROR;
+    bool sequential = sector == msc_fat_next_read_lba[pdrv];
+    LBA_t read_ahead_lba = sector + count;
+    for (uint8_t slot = 0; slot < MSC_FAT_QUEUE_DEPTH; slot++)
+    {
+        msc_fat_xfer_t* xfer = msc_fat_queue + slot;
+        if (xfer->is_write || xfer->pdrv != pdrv || msc_fat_get_xfer_status(slot) == MSC_FAT_IDLE ||
+                sector < xfer->lba || sector + count > xfer->lba + xfer->count)
+            continue;
+        if (msc_fat_wait_slot(slot) == MSC_FAT_COMPLETE)
+        {
+            memcpy(buff, xfer->buf + (sector - xfer->lba) * FF_MAX_SS, count * FF_MAX_SS);
+            ++msc_fat_stats.read_ahead_hits;
+            res = RES_OK;
+            if (sector + count == xfer->lba + xfer->count)
+                msc_fat_set_status(slot, MSC_FAT_IDLE);
+            else
+                sequential = false; // more read-ahead data left in this buffer
+        }
+        else
+        {
+            msc_fat_set_status(slot, MSC_FAT_IDLE);
+        }
+        break;
+    }
+    if (res != RES_OK)
+    {
+        // Keep any read-ahead data; FatFs often reads a FAT sector between data sectors
+        res = msc_fat_xfer_direct(pdrv, false, buff, sector, count);
+    }
+    if (res == RES_OK)
+    {
+        msc_fat_next_read_lba[pdrv] = sector + count;
+        if (sequential)
+            msc_fat_start_read_ahead(pdrv, read_ahead_lba);
+    }
+    return res;
+}
+
+/**
+ * @brief write sectors through the transfer queue
+ */
+static DRESULT msc_fat_queue_write(BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count)
+{
+    DRESULT res = RES_ERROR;
+    msc_fat_reap_writes();
+    msc_fat_drop_read_ahead(pdrv, sector, count);
+    msc_fat_xfer_t* staged = NULL;
+    for (uint8_t slot = 0; slot < MSC_FAT_QUEUE_DEPTH; slot++)
+    {
+        if (msc_fat_get_xfer_status(slot) == MSC_FAT_STAGED)
+            staged = msc_fat_queue + slot;
+    }
+    if (staged && staged->pdrv == pdrv && staged->lba + staged->count == sector &&
+            staged->count + count <= MSC_FAT_XFER_SECTORS)
+    {
+        // Extend the staged command
+        memcpy(staged->buf + staged->count * FF_MAX_SS, buff, count * FF_MAX_SS);
+        staged->count += count;
+        ++msc_fat_stats.coalesced_writes;
+        if (staged->count == MSC_FAT_XFER_SECTORS)
+            msc_fat_issue_staged();
+        res = RES_OK;
+    }
+    else
+    {
+        msc_fat_issue_staged();
+        if (count >= MSC_FAT_XFER_SECTORS)
+        {
+            // Already a large command; send it from the FatFs buffer
+            res = msc_fat_xfer_direct(pdrv, true, (BYTE*)buff, sector, count);
+        }
+        else
+        {
+            uint8_t slot = msc_fat_get_idle_slot();
+            msc_fat_xfer_t* xfer = msc_fat_queue + slot;
+            xfer->is_write = true;
+            xfer->pdrv = pdrv;
+            xfer->lba = sector;
+            xfer->count = count;
+            memcpy(xfer->buf, buff, count * FF_MAX_SS);
+            msc_fat_set_status(slot, MSC_FAT_STAGED);
+            res = RES_OK;
+        }
+    }
+    if (msc_fat_write_failed[pdrv])
+    {
+        msc_fat_write_failed[pdrv] = false;
+        res = RES_ERROR;
+    }
+    return res;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Sector cache                                                          */
+/*-----------------------------------------------------------------------*/
+#if MSC_FAT_CACHE_SECTORS
+typedef struct {
+    bool valid;
+    bool dirty;
+    BYTE pdrv;
+    LBA_t lba;
+    uint32_t last_used;
+    BYTE buf[FF_MAX_SS];
+} msc_fat_cache_entry_t;
+
+static msc_fat_cache_entry_t msc_fat_cache[MSC_FAT_CACHE_SECTORS];
+static uint32_t msc_fat_cache_tick;
+
+static msc_fat_cache_entry_t* msc_fat_cache_find(BYTE pdrv, LBA_t lba)
+{
+    for (size_t idx = 0; idx < MSC_FAT_CACHE_SECTORS; idx++)
+    {
+        msc_fat_cache_entry_t* entry = msc_fat_cache + idx;
+        if (entry->valid && entry->pdrv == pdrv && entry->lba == lba)
+            return entry;
+    }
+    return NULL;
+}
+
+/**
+ * @brief get an unused cache entry, writing back the least recently used one if necessary
+ */
+static msc_fat_cache_entry_t* msc_fat_cache_evict()
+{
+    msc_fat_cache_entry_t* lru = msc_fat_cache;
+    for (size_t idx = 0; idx < MSC_FAT_CACHE_SECTORS; idx++)
+    {
+        msc_fat_cache_entry_t* entry = msc_fat_cache + idx;
+        if (!entry->valid)
+            return entry;
+        if ((int32_t)(entry->last_used - lru->last_used) < 0)
+            lru = entry;
+    }
+    if (lru->dirty)
+    {
+        // errors are reported by a later disk_write() or CTRL_SYNC
+        msc_fat_queue_write(lru->pdrv, lru->buf, lru->lba, 1);
+        ++msc_fat_stats.cache_write_backs;
+    }
+    lru->valid = false;
+    return lru;
+}
+
+/**
+ * @brief write all dirty sectors for a drive in LBA order so adjacent ones coalesce
+ */
+static void msc_fat_cache_flush(BYTE pdrv)
+{
+    for (;;)
+    {
+        msc_fat_cache_entry_t* first = NULL;
+        for (size_t idx = 0; idx < MSC_FAT_CACHE_SECTORS; idx++)
+        {
+            msc_fat_cache_entry_t* entry = msc_fat_cache + idx;
+            if (entry->valid && entry->dirty && entry->pdrv == pdrv && (first == NULL || entry->lba < first->lba))
+                first = entry;
+        }
+        if (first == NULL)
+            break;
+        msc_fat_queue_write(pdrv, first->buf, first->lba, 1);
+        first->dirty = false;
+        ++msc_fat_stats.cache_write_backs;
+    }
+}
+
+/**
+ * @brief forget all cached sectors for a drive without writing them
+ */
+static void msc_fat_cache_invalidate(BYTE pdrv)
+{
+    for (size_t idx = 0; idx < MSC_FAT_CACHE_SECTORS; idx++)
+    {
+        if (msc_fat_cache[idx].pdrv == pdrv)
+            msc_fat_cache[idx].valid = false;
+    }
+}
+#endif
 
 /*-----------------------------------------------------------------------*/
 /* Get Drive Status                                                      */
@@ -211,7 +754,10 @@ DSTATUS disk_initialize(
         {
             disk_state[pdrv] = 0;
             stat = 0;
-            msc_fat_set_status(MSC_FAT_COMPLETE);
+            msc_fat_reset_queue(pdrv);
+#if MSC_FAT_CACHE_SECTORS
+            msc_fat_cache_invalidate(pdrv);
+#endif
         }
     }
 
@@ -238,25 +784,48 @@ DRESULT disk_read(
         }
         else
         {
-            assert(msc_fat_get_xfer_status() == MSC_FAT_COMPLETE);
-            uint8_t dev_addr = msc_pdrv_to_daddr(pdrv);
-            msc_fat_set_status(MSC_FAT_IN_PROGRESS);
-            if (!tuh_msc_read10(dev_addr, 0, buff, sector, count, msc_fat_complete_cb, 0))
-            {
-                res = RES_ERROR;
-            }
-            else
+#if MSC_FAT_CACHE_SECTORS
+            if (count == 1)
             {
-                msc_fat_wait_transfer_complete();
-                if (msc_fat_get_xfer_status() == MSC_FAT_ERROR)
+                msc_fat_cache_entry_t* entry = msc_fat_cache_find(pdrv, sector);
+                if (entry)
                 {
-                    res = RES_ERROR;
+                    ++msc_fat_stats.cache_hits;
+                    res = RES_OK;
                 }
                 else
                 {
-                    res = RES_OK;
+                    ++msc_fat_stats.cache_misses;
+                    entry = msc_fat_cache_evict();
+                    res = msc_fat_queue_read(pdrv, entry->buf, sector, 1);
+                    if (res == RES_OK)
+                    {
+                        entry->valid = true;
+                        entry->dirty = false;
+                        entry->pdrv = pdrv;
+                        entry->lba = sector;
+                    }
+                }
+                if (res == RES_OK)
+                {
+                    entry->last_used = ++msc_fat_cache_tick;
+                    memcpy(buff, entry->buf, FF_MAX_SS);
+                }
+            }
+            else
+            {
+                // Large reads bypass the cache, but cached sectors may be newer than the drive's
+                res = msc_fat_queue_read(pdrv, buff, sector, count);
+                for (size_t idx = 0; res == RES_OK && idx < MSC_FAT_CACHE_SECTORS; idx++)
+                {
+                    msc_fat_cache_entry_t* entry = msc_fat_cache + idx;
+                    if (entry->valid && entry->dirty && entry->pdrv == pdrv && entry->lba >= sector && entry->lba < sector + count)
+                        memcpy(buff + (entry->lba - sector) * FF_MAX_SS, entry->buf, FF_MAX_SS);
                 }
             }
+#else
+            res = msc_fat_queue_read(pdrv, buff, sector, count);
+#endif
         }
     }
     return res;
@@ -284,25 +853,45 @@ DRESULT disk_write(
         }
         else
         {
-            assert(msc_fat_get_xfer_status() == MSC_FAT_COMPLETE);
-            uint8_t dev_addr = msc_pdrv_to_daddr(pdrv);
-            msc_fat_set_status(MSC_FAT_IN_PROGRESS);
-            if (!tuh_msc_write10(dev_addr, 0, buff, sector, count, msc_fat_complete_cb, 0))
-            {
-                res = RES_ERROR;
-            }
-            else
+#if MSC_FAT_CACHE_SECTORS
+            if (count == 1)
             {
-                msc_fat_wait_transfer_complete();
-                if (msc_fat_get_xfer_status() == MSC_FAT_ERROR)
+                // Write back later; FatFs rewrites FAT and directory sectors many times
+                msc_fat_cache_entry_t* entry = msc_fat_cache_find(pdrv, sector);
+                if (entry == NULL)
                 {
+                    entry = msc_fat_cache_evict();
+                    entry->valid = true;
+                    entry->pdrv = pdrv;
+                    entry->lba = sector;
+                }
+                memcpy(entry->buf, buff, FF_MAX_SS);
+                entry->dirty = true;
+                entry->last_used = ++msc_fat_cache_tick;
+                res = RES_OK;
+                if (msc_fat_write_failed[pdrv])
+                {
+                    msc_fat_write_failed[pdrv] = false;
                     res = RES_ERROR;
                 }
-                else
+            }
+            else
+            {
+                // Keep cached copies of these sectors up to date
+                for (size_t idx = 0; idx < MSC_FAT_CACHE_SECTORS; idx++)
                 {
-                    res = RES_OK;
+                    msc_fat_cache_entry_t* entry = msc_fat_cache + idx;
+                    if (entry->valid && entry->pdrv == pdrv && entry->lba >= sector && entry->lba < sector + count)
+                    {
+                        memcpy(entry->buf, buff + (entry->lba - sector) * FF_MAX_SS, FF_MAX_SS);
+                        entry->dirty = false;
+                    }
                 }
+                res = msc_fat_queue_write(pdrv, buff, sector, count);
             }
+#else
+            res = msc_fat_queue_write(pdrv, buff, sector, count);
+#endif
         }
     }
     return res;
@@ -332,17 +921,29 @@ DRESULT disk_ioctl(
         switch (cmd)
         {
         case CTRL_SYNC:
+#if MSC_FAT_CACHE_SECTORS
+            msc_fat_cache_flush(pdrv);
+#endif
+            res = msc_fat_flush_writes(pdrv);
             break;
         case GET_SECTOR_COUNT:
         {
             LBA_t *ptr = (LBA_t *)buff;
+#if MSC_FAT_RAMDISK_SECTORS
+            *ptr = MSC_FAT_RAMDISK_SECTORS;
+#else
             *ptr = tuh_msc_get_block_count(pdrv + 1, 0);
+#endif
         }
         break;
         case GET_SECTOR_SIZE:
         {
             WORD *ptr = (WORD *)buff;
+#if MSC_FAT_RAMDISK_SECTORS
+            *ptr = FF_MAX_SS;
+#else
             *ptr = tuh_msc_get_block_size(pdrv + 1, 0);
+#endif
         }
         break;
         case GET_BLOCK_SIZE:
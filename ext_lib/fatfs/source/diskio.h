@@ -4,8 +4,21 @@
 
 #ifndef _DISKIO_DEFINED
 #define _DISKIO_DEFINED
+#if MSC_FAT_RAMDISK_SECTORS
+#include <stdint.h>
+#ifndef CFG_TUH_DEVICE_MAX
+#define CFG_TUH_DEVICE_MAX FF_VOLUMES
+#endif
+#ifndef MSC_FAT_RAMDISK_CMD_US
+#define MSC_FAT_RAMDISK_CMD_US 1000 /* simulated time for a USB flash drive to process one command */
+#endif
+#ifndef MSC_FAT_RAMDISK_SECTOR_US
+#define MSC_FAT_RAMDISK_SECTOR_US 500 /* simulated time to transfer one sector at USB full speed */
+#endif
+#else
 #include "tusb.h"
 #include "pico/multicore.h"
+#endif
 #ifdef __cplusplus
 extern "C" {
 #else
@@ -74,14 +87,41 @@ DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 #define ATA_GET_SN			22	/* Get serial number */
 
 /* Helper functions for managing USB FAT drives in tinyusb */
-typedef enum {MSC_FAT_IN_PROGRESS, MSC_FAT_COMPLETE, MSC_FAT_ERROR} msc_fat_xfer_status_t;
+#ifndef MSC_FAT_XFER_SECTORS
+#define MSC_FAT_XFER_SECTORS	8	/* Most sectors in one coalesced or read-ahead command */
+#endif
+#ifndef MSC_FAT_CACHE_SECTORS
+#define MSC_FAT_CACHE_SECTORS	16	/* Number of sectors in the LRU sector cache; 0 for no cache */
+#endif
+#ifndef MSC_FAT_QUEUE_DEPTH
+#define MSC_FAT_QUEUE_DEPTH		2	/* Number of MSC_FAT_XFER_SECTORS sector transfer buffers */
+#endif
+
+typedef enum {MSC_FAT_IN_PROGRESS, MSC_FAT_COMPLETE, MSC_FAT_ERROR, MSC_FAT_IDLE, MSC_FAT_STAGED} msc_fat_xfer_status_t;
+
+typedef struct {
+    uint32_t read_cmds;         /* READ10 commands sent */
+    uint32_t write_cmds;        /* WRITE10 commands sent */
+    uint32_t sectors_read;
+    uint32_t sectors_written;
+    uint32_t coalesced_writes;  /* disk_write() calls added to an earlier command */
+    uint32_t read_ahead_hits;   /* disk_read() calls served from read-ahead data */
+    uint32_t read_ahead_unused; /* read-ahead commands whose data was never used */
+    uint32_t cache_hits;        /* single sector reads served from the sector cache */
+    uint32_t cache_misses;
+    uint32_t cache_write_backs; /* dirty cached sectors written to the drive */
+    uint64_t wait_us;           /* total time spent waiting for commands to finish */
+} msc_fat_stats_t;
 
 uint8_t msc_map_next_pdrv(uint8_t daddr);
 uint8_t msc_unmap_pdrv(uint8_t daddr);
+uint8_t msc_pdrv_to_daddr(uint8_t pdrv);
 
 /**
  * @brief set the status to drive unplugged
  * 
+ * Any command in flight to the drive fails
+ *
  * @param pdrv the physical drive number
  */
 void msc_fat_unplug(BYTE pdrv);
@@ -108,34 +148,51 @@ bool msc_fat_is_plugged_in(BYTE pdrv);
 void msc_fat_init();
 
 /**
- * @brief set the current transfer status
+ * @brief set the transfer status of a transfer queue slot
  * 
+ * @param slot the queue slot number; MSC_FAT_QUEUE_DEPTH is transfers to or
+ * from FatFs's own buffers
  * @param stat the transfer status
  */
-void msc_fat_set_status(msc_fat_xfer_status_t stat);
+void msc_fat_set_status(uint8_t slot, msc_fat_xfer_status_t stat);
 
 /**
- * @brief get the current transfer status
+ * @brief get the transfer status of a transfer queue slot
  * 
- * @return msc_fat_xfer_status_t the current transfer status
+ * @param slot the queue slot number
+ * @return msc_fat_xfer_status_t the slot's transfer status
  */
-msc_fat_xfer_status_t msc_fat_get_xfer_status();
+msc_fat_xfer_status_t msc_fat_get_xfer_status(uint8_t slot);
 
 /**
- * @brief wait for the current MSC transfer to complete
+ * @brief wait for the MSC transfer in flight, if any, to complete
  * 
  */
 void msc_fat_wait_transfer_complete();
 
+#if !MSC_FAT_RAMDISK_SECTORS
 /**
- * @brief callback when the current pending MSC transfer is complete
+ * @brief callback when an MSC transfer is complete
  * 
  * @param dev_addr the address of the attached MSC device
- * @param cb_data a pointer to the data used by the callback
+ * @param cb_data a pointer to the data used by the callback; user_arg is the queue slot
  * @return true if transfer was successful
  * @return false if the transfer failed or there was a phase error
  */
 bool msc_fat_complete_cb(uint8_t dev_addr, tuh_msc_complete_data_t const* cb_data);
+#endif
+
+/**
+ * @brief copy the transfer statistics since boot or the last msc_fat_reset_stats()
+ *
+ * @param stats the statistics are copied here
+ */
+void msc_fat_get_stats(msc_fat_stats_t* stats);
+
+/**
+ * @brief clear the transfer statistics
+ */
+void msc_fat_reset_stats();
 
 /**
  * @brief The task function for the main() function "superloop"
@@ -5,6 +5,7 @@
 
 
 #include "ff.h"
+#include "mem_stats.h"
 
 
 #if FF_USE_LFN == 3	/* Dynamic memory allocation */
@@ -17,7 +18,7 @@ void* ff_memalloc (	/* Returns pointer to the allocated memory block (null if no
 	UINT msize		/* Number of bytes to allocate */
 )
 {
-	return malloc(msize);	/* Allocate a new memory block with POSIX API */
+	return mem_tag_malloc(MEM_TAG_FATFS, msize);	/* Allocate a new memory block and count it as FatFs memory */
 }
 
 
@@ -29,7 +30,7 @@ void ff_memfree (
 	void* mblock	/* Pointer to the memory block to free (nothing to do if null) */
 )
 {
-	free(mblock);	/* Free the memory block with POSIX API */
+	mem_tag_free(mblock);	/* Free the memory block */
 }
 
 #endif
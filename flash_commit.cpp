@@ -0,0 +1,142 @@
+/* MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "flash_commit.h"
+#include "midi_processor_manager.h"
+
+// The linker wraps the core1 lockout functions so the time every flash
+// write, including the ones littlefs makes, stops core1 is measured
+extern "C" {
+void __real_multicore_lockout_start_blocking(void);
+void __real_multicore_lockout_end_blocking(void);
+
+void __wrap_multicore_lockout_start_blocking(void)
+{
+    rppicomidi::Flash_commit::instance().lockout_starting();
+    __real_multicore_lockout_start_blocking();
+}
+
+void __wrap_multicore_lockout_end_blocking(void)
+{
+    __real_multicore_lockout_end_blocking();
+    rppicomidi::Flash_commit::instance().lockout_ended();
+}
+}
+
+rppicomidi::Flash_commit::Flash_commit() : last_midi_us{0}, waiting_since_us{0}, waiting{false}, lockout_start_us{0}
+{
+    memset(&stats, 0, sizeof(stats));
+    memset(&lockout_histogram, 0, sizeof(lockout_histogram));
+    memset(&op_histogram, 0, sizeof(op_histogram));
+}
+
+bool rppicomidi::Flash_commit::may_write()
+{
+    uint32_t now = time_us_32();
+    if (!waiting) {
+        waiting = true;
+        waiting_since_us = now;
+    }
+    // core1 cannot send the queued MIDI IN packets while it is locked out
+    if (now - last_midi_us < FLASH_COMMIT_QUIET_US || !Midi_processor_manager::instance().is_midi_in_queue_empty()) {
+        // a steady stream of MIDI must not hold off the write forever
+        if (now - waiting_since_us < FLASH_COMMIT_MAX_DEFER_US)
+            return false;
+        ++stats.nforced_steps;
+    }
+    ++stats.nsteps;
+    waiting = false;
+    return true;
+}
+
+void rppicomidi::Flash_commit::midi_activity()
+{
+    last_midi_us = time_us_32();
+}
+
+void rppicomidi::Flash_commit::lockout_starting()
+{
+    lockout_start_us = time_us_32();
+    if (lockout_start_us - last_midi_us < FLASH_COMMIT_QUIET_US)
+        ++stats.nforced_lockouts;
+    ++stats.nlockouts;
+}
+
+void rppicomidi::Flash_commit::lockout_ended()
+{
+    lockout_histogram.add(time_us_32() - lockout_start_us);
+}
+
+void rppicomidi::Flash_commit::Histogram::add(uint32_t elapsed_us)
+{
+    uint8_t bucket = 0;
+    while (bucket < num_buckets - 1 && elapsed_us >= (first_bucket_us << bucket))
+        ++bucket;
+    ++counts[bucket];
+    if (elapsed_us > max_us)
+        max_us = elapsed_us;
+}
+
+void rppicomidi::Flash_commit::Histogram::print(const char* name) const
+{
+    printf("%s, longest %lu us:\r\n", name, max_us);
+    for (uint8_t bucket = 0; bucket < num_buckets; bucket++) {
+        if (counts[bucket] == 0)
+            continue;
+        if (bucket < num_buckets - 1)
+            printf("  < %6lu us: %lu\r\n", first_bucket_us << bucket, counts[bucket]);
+        else
+            printf("  >=%6lu us: %lu\r\n", first_bucket_us << (bucket - 1), counts[bucket]);
+    }
+}
+
+void rppicomidi::Flash_commit::add_all_cli_commands(EmbeddedCli* cli)
+{
+    assert(embeddedCliAddBinding(cli, {
+        "flashcommit",
+        "print flash write lockout histograms. usage: flashcommit [reset]",
+        true,
+        this,
+        static_print_stats
+    }));
+}
+
+void rppicomidi::Flash_commit::static_print_stats(EmbeddedCli*, char* args, void* context)
+{
+    auto me = reinterpret_cast<Flash_commit*>(context);
+    if (embeddedCliGetTokenCount(args) == 1 && strcmp(embeddedCliGetToken(args, 1), "reset") == 0) {
+        memset(&me->stats, 0, sizeof(me->stats));
+        memset(&me->lockout_histogram, 0, sizeof(me->lockout_histogram));
+        memset(&me->op_histogram, 0, sizeof(me->op_histogram));
+        return;
+    }
+    printf("quiet time %u us, max step wait %u us\r\n", FLASH_COMMIT_QUIET_US, FLASH_COMMIT_MAX_DEFER_US);
+    printf("flash writing job steps: %lu, %lu ran during MIDI traffic\r\n", me->stats.nsteps, me->stats.nforced_steps);
+    printf("core1 lockouts: %lu, %lu started during MIDI traffic\r\n", me->stats.nlockouts, me->stats.nforced_lockouts);
+    me->lockout_histogram.print("core1 lockouts");
+    me->op_histogram.print("flash erase and program calls");
+}
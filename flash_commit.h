@@ -0,0 +1,148 @@
+/**
+ * @file flash_commit.h
+ * @brief this file contains the Flash_commit class, which holds off
+ * flash writes until there is a gap in the MIDI traffic
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include "embedded_cli.h"
+
+// How long there must be no MIDI traffic before a flash write starts
+#ifndef FLASH_COMMIT_QUIET_US
+#define FLASH_COMMIT_QUIET_US 2000
+#endif
+// The longest a file system job step that writes flash waits for quiet before it runs anyway
+#ifndef FLASH_COMMIT_MAX_DEFER_US
+#define FLASH_COMMIT_MAX_DEFER_US 100000
+#endif
+namespace rppicomidi
+{
+/**
+ * @brief Time flash writes so they stop MIDI as little as possible
+ *
+ * Writing program flash locks out core1, and with it the USB host and
+ * MIDI IN. The file system job queue only starts a job step that writes
+ * flash after FLASH_COMMIT_QUIET_US with no MIDI packets and no MIDI IN
+ * packets waiting for core1, or after the step has waited
+ * FLASH_COMMIT_MAX_DEFER_US. The linker wraps
+ * multicore_lockout_start_blocking() and multicore_lockout_end_blocking()
+ * so the time core1 spends locked out is measured.
+ *
+ * This only chooses when a step starts. The littlefs erases and programs
+ * inside a step run to completion one after the other, and each one locks
+ * out core1 for its whole duration; a sector erase cannot be split up.
+ * Nothing stages the writes to commit them in slices, and nothing caps how
+ * long a lockout lasts. The flashcommit console command reports how long
+ * the lockouts were.
+ */
+class Flash_commit
+{
+public:
+    // Singleton Pattern
+
+    /**
+     * @brief Get the Instance object
+     *
+     * @return the singleton instance
+     */
+    static Flash_commit& instance()
+    {
+        static Flash_commit _instance; // Guaranteed to be destroyed.
+                                       // Instantiated on first use.
+        return _instance;
+    }
+    Flash_commit(Flash_commit const&) = delete;
+    void operator=(Flash_commit const&) = delete;
+
+    /**
+     * @brief check if a file system job step that writes flash may run now
+     *
+     * @return true if MIDI has been quiet long enough and core1 has sent the
+     * queued MIDI IN packets, or if the step has waited FLASH_COMMIT_MAX_DEFER_US
+     * since the first call that returned false
+     */
+    bool may_write();
+
+    /**
+     * @brief tell the engine that a MIDI packet just passed through
+     *
+     * @note this may be called from either core
+     */
+    void midi_activity();
+
+    /**
+     * @brief note when core1 is locked out and whether MIDI was playing
+     *
+     * The multicore_lockout_start_blocking() wrapper calls this
+     */
+    void lockout_starting();
+
+    /**
+     * @brief record how long core1 was locked out
+     *
+     * The multicore_lockout_end_blocking() wrapper calls this
+     */
+    void lockout_ended();
+
+    /**
+     * @brief record how long a flash erase or program call took
+     *
+     * The flash_range_erase() and flash_range_program() wrappers call this
+     * for every flash write, including the ones littlefs makes.
+     */
+    void record_flash_op(uint32_t elapsed_us) { op_histogram.add(elapsed_us); }
+
+    void add_all_cli_commands(EmbeddedCli* cli);
+private:
+    Flash_commit();
+
+    static void static_print_stats(EmbeddedCli* cli, char* args, void* context);
+
+    /**
+     * @brief counts of durations in power of two buckets
+     */
+    struct Histogram {
+        static const uint8_t num_buckets = 10;
+        static const uint32_t first_bucket_us = 128;
+        uint32_t counts[num_buckets];   // bucket n counts durations below first_bucket_us << n; the last counts the rest
+        uint32_t max_us;
+        void add(uint32_t elapsed_us);
+        void print(const char* name) const;
+    };
+
+    volatile uint32_t last_midi_us;     // when midi_activity() was last called
+    uint32_t waiting_since_us;          // when may_write() first returned false for the next step
+    bool waiting;                       // true if a job step is waiting for quiet
+    uint32_t lockout_start_us;          // when core1 was last locked out
+    struct {
+        uint32_t nsteps;                // the number of job steps may_write() allowed
+        uint32_t nforced_steps;         // the number of those steps that ran during MIDI traffic
+        uint32_t nlockouts;             // the number of times core1 was locked out
+        uint32_t nforced_lockouts;      // the number of lockouts that started within FLASH_COMMIT_QUIET_US of a MIDI packet
+    } stats;
+    Histogram lockout_histogram;        // how long each lockout stopped core1
+    Histogram op_histogram;             // how long each flash erase or program call took
+};
+}
@@ -0,0 +1,121 @@
+/* MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include "pico/stdlib.h"
+#include "fs_job_queue.h"
+#include "flash_commit.h"
+
+rppicomidi::Fs_job_queue::Fs_job_queue() : running{false}, last_midi_us{0}, step_since_midi{false}
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+void rppicomidi::Fs_job_queue::add_job(Fs_job* job, Progress_fn progress_fn, void* context)
+{
+    jobs.push_back(Queued_job{job, progress_fn, context});
+}
+
+void rppicomidi::Fs_job_queue::run_step()
+{
+    // The progress function may add jobs, so do not hold a reference into the queue
+    Queued_job front = jobs.front();
+    uint32_t start = time_us_32();
+    running = true;
+    Fs_job::Step_result result = front.job->step();
+    running = false;
+    uint32_t elapsed = time_us_32() - start;
+    ++stats.nsteps;
+    if (elapsed > stats.max_step_us)
+        stats.max_step_us = elapsed;
+    step_since_midi = true;
+    if (front.progress_fn)
+        front.progress_fn(front.context, *front.job, result);
+    if (result != Fs_job::STEP_MORE) {
+        ++stats.njobs;
+        if (result == Fs_job::STEP_ERROR)
+            ++stats.nerrors;
+        jobs.pop_front();
+        delete front.job;
+    }
+}
+
+void rppicomidi::Fs_job_queue::task(uint32_t budget_us)
+{
+    if (running)
+        return;
+    uint32_t start = time_us_32();
+    while (!jobs.empty()) {
+        // A littlefs write locks out core1, so it waits for a gap in the MIDI traffic.
+        // Backups only read littlefs and write the USB drive, so they do not wait.
+        if (jobs.front().job->next_step_writes_flash() && !Flash_commit::instance().may_write())
+            break;
+        run_step();
+        if (time_us_32() - start >= budget_us)
+            break;
+    }
+}
+
+void rppicomidi::Fs_job_queue::flush()
+{
+    if (running)
+        return; // the step that called this is part of a queued job
+    while (!jobs.empty())
+        run_step();
+}
+
+void rppicomidi::Fs_job_queue::midi_serviced()
+{
+    uint32_t now = time_us_32();
+    if (step_since_midi) {
+        stats.last_stall_us = now - last_midi_us;
+        if (stats.last_stall_us > stats.max_stall_us)
+            stats.max_stall_us = stats.last_stall_us;
+        step_since_midi = false;
+    }
+    last_midi_us = now;
+}
+
+void rppicomidi::Fs_job_queue::add_all_cli_commands(EmbeddedCli* cli)
+{
+    assert(embeddedCliAddBinding(cli, {
+        "fsjobs",
+        "print file system job queue statistics. usage: fsjobs [reset]",
+        true,
+        this,
+        static_print_stats
+    }));
+}
+
+void rppicomidi::Fs_job_queue::static_print_stats(EmbeddedCli*, char* args, void* context)
+{
+    auto me = reinterpret_cast<Fs_job_queue*>(context);
+    if (embeddedCliGetTokenCount(args) == 1 && strcmp(embeddedCliGetToken(args, 1), "reset") == 0) {
+        memset(&me->stats, 0, sizeof(me->stats));
+        return;
+    }
+    printf("file system jobs: %u queued, %lu finished, %lu failed\r\n", me->jobs.size(), me->stats.njobs, me->stats.nerrors);
+    printf("steps: %lu, longest %lu us, budget %u us per main loop\r\n", me->stats.nsteps, me->stats.max_step_us, FS_JOB_BUDGET_US);
+    printf("MIDI stall during jobs: last %lu us, max %lu us\r\n", me->stats.last_stall_us, me->stats.max_stall_us);
+}
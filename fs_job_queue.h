@@ -0,0 +1,199 @@
+/**
+ * @file fs_job_queue.h
+ * @brief this file contains the Fs_job and Fs_job_queue classes, which run long
+ * file system operations a step at a time between MIDI and UI service
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include <deque>
+#include "embedded_cli.h"
+
+// The time the main loop spends on file system job steps each time through
+#ifndef FS_JOB_BUDGET_US
+#define FS_JOB_BUDGET_US 1000
+#endif
+namespace rppicomidi
+{
+/**
+ * @brief A long file system operation broken into short steps
+ *
+ * Each step does a bounded amount of work, such as writing one settings
+ * record or copying one file, and keeps whatever state the next step
+ * needs in the job object.
+ */
+class Fs_job
+{
+public:
+    enum Step_result {STEP_MORE, STEP_DONE, STEP_ERROR};
+
+    Fs_job() : steps_done{0}, num_steps{0} {}
+    virtual ~Fs_job() = default;
+
+    /**
+     * @brief do the next step of the job
+     *
+     * @return STEP_MORE if there are more steps, STEP_DONE if the job is
+     * finished or STEP_ERROR if the job failed. Do not call step() again
+     * after it returns STEP_DONE or STEP_ERROR.
+     */
+    virtual Step_result step() = 0;
+
+    /**
+     * @brief return true if the next step writes the settings flash
+     *
+     * Writing the flash locks out core1, so the queue only starts such a
+     * step in a gap in the MIDI traffic. A step that only reads the flash
+     * or only writes the USB flash drive can start at any time.
+     */
+    virtual bool next_step_writes_flash() const { return false; }
+
+    /**
+     * @brief do all of the remaining steps now
+     *
+     * @return STEP_DONE or STEP_ERROR
+     */
+    Step_result run()
+    {
+        Step_result result;
+        while ((result = step()) == STEP_MORE) {
+        }
+        return result;
+    }
+
+    uint16_t get_steps_done() const { return steps_done; }
+
+    /**
+     * @brief get the number of steps in the job; 0 until the first step finds out
+     */
+    uint16_t get_num_steps() const { return num_steps; }
+protected:
+    uint16_t steps_done;
+    uint16_t num_steps;
+};
+
+/**
+ * @brief Run file system jobs a few steps at a time from the main loop
+ *
+ * The main loop services MIDI and the UI, then calls task(), which runs
+ * job steps until the time budget is used up. A step that writes the
+ * settings flash only starts when Flash_commit::may_write() says the MIDI
+ * traffic has a gap. A step that starts always finishes, so the longest step sets the longest MIDI stall;
+ * the queue measures it.
+ */
+class Fs_job_queue
+{
+public:
+    // Singleton Pattern
+
+    /**
+     * @brief Get the Instance object
+     *
+     * @return the singleton instance
+     */
+    static Fs_job_queue& instance()
+    {
+        static Fs_job_queue _instance; // Guaranteed to be destroyed.
+                                       // Instantiated on first use.
+        return _instance;
+    }
+    Fs_job_queue(Fs_job_queue const&) = delete;
+    void operator=(Fs_job_queue const&) = delete;
+
+    /**
+     * @brief the function called after each step of a job
+     *
+     * @param context the context pointer passed to add_job()
+     * @param job the job; use get_steps_done() and get_num_steps() to show progress
+     * @param result the result of the step. The job is deleted after the
+     * call if result is STEP_DONE or STEP_ERROR.
+     */
+    typedef void (*Progress_fn)(void* context, Fs_job& job, Fs_job::Step_result result);
+
+    /**
+     * @brief add a job to the end of the queue
+     *
+     * @param job the job; the queue deletes it when it is finished
+     * @param progress_fn the function to call after each step, or nullptr
+     * @param context the context pointer for progress_fn
+     */
+    void add_job(Fs_job* job, Progress_fn progress_fn, void* context);
+
+    /**
+     * @brief run job steps until budget_us microseconds have passed or
+     * the queue is empty
+     *
+     * A step that writes the settings flash, and the jobs queued behind it,
+     * wait while Flash_commit::may_write() returns false
+     */
+    void task(uint32_t budget_us = FS_JOB_BUDGET_US);
+
+    /**
+     * @brief run all queued jobs to completion now
+     *
+     * Call this before a file system operation that must not run
+     * between the steps of a queued job. It does nothing if a job step
+     * calls it.
+     */
+    void flush();
+
+    bool is_busy() const { return !jobs.empty(); }
+
+    /**
+     * @brief tell the queue that the main loop just serviced MIDI
+     *
+     * The time between calls that have a job step between them is a MIDI stall
+     */
+    void midi_serviced();
+
+    void add_all_cli_commands(EmbeddedCli* cli);
+private:
+    Fs_job_queue();
+
+    /**
+     * @brief run the next step of the job at the front of the queue
+     */
+    void run_step();
+
+    static void static_print_stats(EmbeddedCli* cli, char* args, void* context);
+
+    struct Queued_job {
+        Fs_job* job;
+        Progress_fn progress_fn;
+        void* context;
+    };
+    std::deque<Queued_job> jobs;
+    bool running;               // true while a step runs, so a step cannot run another step
+    uint32_t last_midi_us;      // when midi_serviced() was last called
+    bool step_since_midi;       // true if a job step ran since midi_serviced() was last called
+    struct {
+        uint32_t njobs;         // the number of jobs finished
+        uint32_t nerrors;       // the number of jobs that failed
+        uint32_t nsteps;        // the number of steps run
+        uint32_t max_step_us;   // how long the longest step took
+        uint32_t max_stall_us;  // the longest time between MIDI service calls with a job step between them
+        uint32_t last_stall_us; // the last such time
+    } stats;
+};
+}
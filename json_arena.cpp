@@ -0,0 +1,145 @@
+/* MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// Make asserts work correctly, even for release builds
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
+#include <cstdio>
+#include <cstdlib>
+#include "parson.h"
+#include "json_arena.h"
+#include "mem_stats.h"
+
+rppicomidi::Json_arena::Json_arena() : chunks{nullptr}, depth{0}, nbytes{0}, nchunk_bytes{0}, max_bytes{0}, max_chunk_bytes{0},
+    nsessions{0}, nallocs{0}, max_allocs{0}
+{
+    json_set_allocation_functions(static_heap_malloc, static_heap_free);
+}
+
+void rppicomidi::Json_arena::begin()
+{
+    if (depth++ == 0) {
+        ++nsessions;
+        nbytes = 0;
+        nchunk_bytes = 0;
+        nallocs = 0;
+        json_set_allocation_functions(static_malloc, static_free);
+    }
+}
+
+void rppicomidi::Json_arena::end()
+{
+    if (depth == 0 || --depth != 0)
+        return;
+    json_set_allocation_functions(static_heap_malloc, static_heap_free);
+    while (chunks) {
+        Chunk* next = chunks->next;
+        mem_tag_free(chunks);
+        chunks = next;
+    }
+}
+
+void* rppicomidi::Json_arena::alloc(size_t size)
+{
+    size = (size + alignment - 1) & ~(alignment - 1);
+    if (chunks == nullptr || chunks->used + size > chunks->size) {
+        // Grow by a whole chunk, or by a chunk just for this allocation if it is bigger
+        size_t new_size = size > chunk_size ? size : chunk_size;
+        auto chunk = reinterpret_cast<Chunk*>(mem_tag_malloc(MEM_TAG_PARSON, sizeof(Chunk) + new_size));
+        if (chunk == nullptr)
+            return nullptr;
+        chunk->size = new_size;
+        chunk->used = 0;
+        nchunk_bytes += sizeof(Chunk) + new_size;
+        if (nchunk_bytes > max_chunk_bytes)
+            max_chunk_bytes = nchunk_bytes;
+        if (chunks && size > chunk_size) {
+            // keep allocating from the current chunk after this one
+            chunk->next = chunks->next;
+            chunks->next = chunk;
+        }
+        else {
+            chunk->next = chunks;
+            chunks = chunk;
+        }
+        chunk->used = size;
+        ++nallocs;
+        nbytes += size;
+        if (nbytes > max_bytes)
+            max_bytes = nbytes;
+        if (nallocs > max_allocs)
+            max_allocs = nallocs;
+        return reinterpret_cast<uint8_t*>(chunk + 1);
+    }
+    void* ptr = reinterpret_cast<uint8_t*>(chunks + 1) + chunks->used;
+    chunks->used += size;
+    ++nallocs;
+    nbytes += size;
+    if (nbytes > max_bytes)
+        max_bytes = nbytes;
+    if (nallocs > max_allocs)
+        max_allocs = nallocs;
+    return ptr;
+}
+
+void* rppicomidi::Json_arena::static_malloc(size_t size)
+{
+    return instance().alloc(size);
+}
+
+void* rppicomidi::Json_arena::static_heap_malloc(size_t size)
+{
+    return mem_tag_malloc(MEM_TAG_PARSON, size);
+}
+
+void rppicomidi::Json_arena::static_heap_free(void* ptr)
+{
+    mem_tag_free(ptr);
+}
+
+void rppicomidi::Json_arena::static_free(void*)
+{
+    // The memory is released when the session ends
+}
+
+void rppicomidi::Json_arena::add_all_cli_commands(EmbeddedCli *cli)
+{
+    assert(embeddedCliAddBinding(cli, {
+        "json-arena",
+        "display JSON arena allocator high-water marks. usage: json-arena",
+        false,
+        this,
+        static_print_status
+    }));
+}
+
+void rppicomidi::Json_arena::static_print_status(EmbeddedCli*, char*, void* context)
+{
+    auto me = reinterpret_cast<Json_arena*>(context);
+    printf("JSON arena sessions %lu\r\n", me->nsessions);
+    printf("high-water: %u bytes allocated in %lu allocations, %u bytes of chunks\r\n",
+        me->max_bytes, me->max_allocs, me->max_chunk_bytes);
+    printf("last session: %u bytes allocated in %lu allocations, %u bytes of chunks\r\n",
+        me->nbytes, me->nallocs, me->nchunk_bytes);
+}
@@ -0,0 +1,113 @@
+/**
+ * @file json_arena.h
+ * @brief this file contains the Json_arena class, an arena allocator
+ * for the parson JSON library
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "embedded_cli.h"
+namespace rppicomidi
+{
+/**
+ * @brief An arena allocator for the parson JSON library
+ *
+ * Between begin() and end(), parson gets its memory from large chunks
+ * that are all released at once by the outermost end(), so the many
+ * small JSON nodes and strings do not fragment the heap. The JSON values
+ * that parson allocates after begin() must be freed before end(), and
+ * the values allocated before begin() must not be freed until after end().
+ */
+class Json_arena
+{
+public:
+    // Singleton Pattern
+
+    /**
+     * @brief Get the Instance object
+     *
+     * @return the singleton instance
+     */
+    static Json_arena& instance()
+    {
+        static Json_arena _instance; // Guaranteed to be destroyed.
+                                     // Instantiated on first use.
+        return _instance;
+    }
+    Json_arena(Json_arena const&) = delete;
+    void operator=(Json_arena const&) = delete;
+
+    /**
+     * @brief route parson allocations to the arena
+     *
+     * Calls may be nested; only the outermost begin() and end() take effect
+     */
+    void begin();
+
+    /**
+     * @brief release all arena memory and route parson allocations to the heap
+     */
+    void end();
+
+    void add_all_cli_commands(EmbeddedCli *cli);
+private:
+    Json_arena();
+    struct Chunk {
+        Chunk* next;
+        size_t size;        // the number of bytes available after the header
+        size_t used;        // the number of bytes allocated after the header
+    };
+    static const size_t chunk_size = 4096;
+    static const size_t alignment = 8;
+    static void* static_malloc(size_t size);
+    static void static_free(void* ptr);
+    // parson uses these outside of an arena session so its memory is counted in the mem report
+    static void* static_heap_malloc(size_t size);
+    static void static_heap_free(void* ptr);
+    static void static_print_status(EmbeddedCli*, char*, void* context);
+    void* alloc(size_t size);
+    Chunk* chunks;          // the chunk to allocate from, followed by older chunks
+    uint8_t depth;          // the number of begin() calls without a matching end()
+    size_t nbytes;          // the number of bytes allocated in this session
+    size_t nchunk_bytes;    // the number of bytes of heap the chunks use in this session
+    size_t max_bytes;       // the high-water mark of nbytes
+    size_t max_chunk_bytes; // the high-water mark of nchunk_bytes
+    uint32_t nsessions;     // the number of outermost begin() calls
+    uint32_t nallocs;       // the number of allocations in this session
+    uint32_t max_allocs;    // the high-water mark of nallocs
+};
+
+/**
+ * @brief Use the Json_arena for the lifetime of this object
+ */
+class Json_arena_scope
+{
+public:
+    Json_arena_scope() { Json_arena::instance().begin(); }
+    ~Json_arena_scope() { Json_arena::instance().end(); }
+    Json_arena_scope(Json_arena_scope const&) = delete;
+    void operator=(Json_arena_scope const&) = delete;
+};
+}
@@ -0,0 +1,252 @@
+/**
+ * @file json_stream_reader.h
+ * @brief this file contains the Json_stream_reader class, which reads
+ * a JSON document without building a DOM
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+namespace rppicomidi
+{
+/**
+ * @brief Read a JSON document one token at a time without building a DOM
+ *
+ * The reader never allocates memory. It returns keys and the spans of
+ * values as pointers into the document, and it can skip over any value,
+ * so a caller can look at only the parts of a document it needs and hand
+ * just those parts to a full JSON parser.
+ */
+class Json_stream_reader
+{
+public:
+    /**
+     * @brief Construct a new Json_stream_reader object
+     *
+     * @param json_ the JSON document; it does not need to be null terminated
+     * @param len_ the number of characters in the JSON document
+     */
+    Json_stream_reader(const char* json_, size_t len_) : json{json_}, len{len_}, pos{0}, error{false} {}
+
+    /**
+     * @brief consume the opening brace of an object
+     *
+     * @return true if the next token is the start of an object
+     */
+    bool begin_object()
+    {
+        return expect('{');
+    }
+
+    /**
+     * @brief read the key of the next member of the current object
+     *
+     * After this returns true, the reader is at the member's value. The caller
+     * must read or skip the value before calling next_member() again.
+     * @param key set to point to the first character of the key in the document
+     * @param key_len set to the number of characters in the key. Escape
+     * sequences in the key are not decoded.
+     * @return true if there is another member; false at the end of the object
+     * or if there is a syntax error (see is_error())
+     */
+    bool next_member(const char*& key, size_t& key_len)
+    {
+        skip_space();
+        if (pos < len && json[pos] == ',') {
+            ++pos;
+            skip_space();
+        }
+        if (pos < len && json[pos] == '}') {
+            ++pos;
+            return false;
+        }
+        const char* start;
+        size_t span;
+        if (!scan_string(start, span) || !expect(':'))
+            return fail();
+        key = start + 1;
+        key_len = span - 2;
+        return true;
+    }
+
+    /**
+     * @brief return true if the key next_member() returned is the C-string name
+     */
+    static bool key_is(const char* key, size_t key_len, const char* name)
+    {
+        return strlen(name) == key_len && strncmp(key, name, key_len) == 0;
+    }
+
+    /**
+     * @brief skip the next value, including all of its members or elements
+     *
+     * @param start if not nullptr, set to point to the first character of the value
+     * @param span if not nullptr, set to the number of characters in the value
+     * @return true if successful, false if there is a syntax error
+     */
+    bool skip_value(const char** start = nullptr, size_t* span = nullptr)
+    {
+        skip_space();
+        size_t first = pos;
+        if (pos >= len)
+            return fail();
+        if (json[pos] == '"') {
+            const char* str;
+            size_t str_len;
+            if (!scan_string(str, str_len))
+                return false;
+        }
+        else if (json[pos] == '{' || json[pos] == '[') {
+            // Count nesting depth; strings may contain braces and brackets
+            int depth = 0;
+            do {
+                char ch = json[pos];
+                if (ch == '"') {
+                    const char* str;
+                    size_t str_len;
+                    if (!scan_string(str, str_len))
+                        return false;
+                    continue;
+                }
+                if (ch == '{' || ch == '[')
+                    ++depth;
+                else if (ch == '}' || ch == ']')
+                    --depth;
+                ++pos;
+            } while (depth > 0 && pos < len);
+            if (depth != 0)
+                return fail();
+        }
+        else {
+            // a number, true, false or null
+            while (pos < len && json[pos] != ',' && json[pos] != '}' && json[pos] != ']' &&
+                    !is_space(json[pos]))
+                ++pos;
+            if (pos == first)
+                return fail();
+        }
+        if (start)
+            *start = json + first;
+        if (span)
+            *span = pos - first;
+        return true;
+    }
+
+    /**
+     * @brief read the next value as a string
+     *
+     * Only the \" and \\ escape sequences are decoded
+     * @param str the buffer for the null terminated string
+     * @param max_str the size of the str buffer
+     * @return true if successful, false if the value is not a string or
+     * if it does not fit in str
+     */
+    bool get_string(char* str, size_t max_str)
+    {
+        const char* start;
+        size_t span;
+        skip_space();
+        if (!scan_string(start, span))
+            return fail();
+        size_t nchars = 0;
+        for (size_t idx = 1; idx < span - 1; idx++) {
+            if (start[idx] == '\\')
+                ++idx;
+            if (nchars + 1 >= max_str)
+                return fail();
+            str[nchars++] = start[idx];
+        }
+        str[nchars] = '\0';
+        return true;
+    }
+
+    /**
+     * @brief read the next value as a number
+     *
+     * @param value set to the number
+     * @return true if successful, false if the value is not a number
+     */
+    bool get_number(double& value)
+    {
+        const char* start;
+        size_t span;
+        char number[32];
+        if (!skip_value(&start, &span) || span >= sizeof(number))
+            return fail();
+        memcpy(number, start, span);
+        number[span] = '\0';
+        char* end;
+        value = strtod(number, &end);
+        return end == number + span ? true : fail();
+    }
+
+    bool is_error() { return error; }
+private:
+    static bool is_space(char ch) { return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n'; }
+    void skip_space()
+    {
+        while (pos < len && is_space(json[pos]))
+            ++pos;
+    }
+    bool fail()
+    {
+        error = true;
+        return false;
+    }
+    bool expect(char ch)
+    {
+        skip_space();
+        if (pos >= len || json[pos] != ch)
+            return fail();
+        ++pos;
+        return true;
+    }
+    /**
+     * @brief scan the string at pos, including the quotes
+     */
+    bool scan_string(const char*& start, size_t& span)
+    {
+        if (pos >= len || json[pos] != '"')
+            return fail();
+        size_t first = pos++;
+        while (pos < len && json[pos] != '"') {
+            if (json[pos] == '\\')
+                ++pos;
+            ++pos;
+        }
+        if (pos >= len)
+            return fail();
+        ++pos;
+        start = json + first;
+        span = pos - first;
+        return true;
+    }
+    const char* json;
+    size_t len;
+    size_t pos;
+    bool error;
+};
+}
@@ -0,0 +1,198 @@
+/**
+ * @file json_stream_writer.h
+ * @brief this file contains the Json_stream_writer class, which writes
+ * a JSON document in small chunks
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include "parson.h"
+namespace rppicomidi
+{
+/**
+ * @brief Write a JSON document to a file or the console in small chunks
+ *
+ * The writer formats the document into a small fixed buffer and passes
+ * each full buffer to a write function, so the whole document is never in
+ * memory at once. The output has no whitespace, like json_serialize_to_string().
+ */
+class Json_stream_writer
+{
+public:
+    /**
+     * @brief the function that writes the formatted JSON to its destination
+     *
+     * @param context the context pointer passed to the constructor
+     * @param data the characters to write
+     * @param len the number of characters in data
+     * @return true if all characters were written, false otherwise
+     */
+    typedef bool (*Write_fn)(void* context, const char* data, size_t len);
+
+    Json_stream_writer(Write_fn write_fn_, void* context_) : write_fn{write_fn_}, context{context_},
+        nbuffered{0}, nwritten{0}, depth{0}, has_members{0}, error{false} {}
+
+    /**
+     * @brief start a JSON object
+     *
+     * @param name the member name if the object is a member of another
+     * object, or nullptr if the object is the root of the document
+     */
+    void begin_object(const char* name = nullptr)
+    {
+        put_name(name);
+        put('{');
+        if (++depth > max_depth)
+            error = true;
+        has_members &= ~(1u << depth);
+    }
+
+    /**
+     * @brief end the JSON object that begin_object() started
+     */
+    void end_object()
+    {
+        put('}');
+        if (depth > 0)
+            --depth;
+    }
+
+    void add_string(const char* name, const char* value)
+    {
+        put_name(name);
+        put_string(value);
+    }
+
+    void add_number(const char* name, long value)
+    {
+        put_name(name);
+        char number[12];
+        int len = snprintf(number, sizeof(number), "%ld", value);
+        put(number, len);
+    }
+
+    /**
+     * @brief add a member whose value is a parson JSON value
+     *
+     * @param name the member name
+     * @param value the value to serialize; nullptr adds a null value
+     */
+    void add_value(const char* name, const JSON_Value* value)
+    {
+        put_name(name);
+        char* serialized_string = value ? json_serialize_to_string(value) : nullptr;
+        if (serialized_string) {
+            put(serialized_string, strlen(serialized_string));
+            json_free_serialized_string(serialized_string);
+        }
+        else {
+            put("null", 4);
+        }
+    }
+
+    /**
+     * @brief write all buffered characters
+     *
+     * @return true if there have been no errors, false otherwise
+     */
+    bool flush()
+    {
+        if (nbuffered != 0 && !error) {
+            error = !write_fn(context, buffer, nbuffered);
+            nwritten += nbuffered;
+        }
+        nbuffered = 0;
+        return !error;
+    }
+
+    bool is_error() { return error; }
+
+    /**
+     * @brief get the number of characters passed to the write function so far
+     */
+    size_t get_nwritten() { return nwritten; }
+private:
+    void put(char ch)
+    {
+        if (nbuffered == sizeof(buffer))
+            flush();
+        buffer[nbuffered++] = ch;
+    }
+
+    void put(const char* str, size_t len)
+    {
+        while (len--)
+            put(*str++);
+    }
+
+    void put_string(const char* str)
+    {
+        put('"');
+        for (; *str; ++str) {
+            char ch = *str;
+            if (ch == '"' || ch == '\\') {
+                put('\\');
+                put(ch);
+            }
+            else if (static_cast<uint8_t>(ch) < 0x20) {
+                char escaped[7];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+                put(escaped, 6);
+            }
+            else {
+                put(ch);
+            }
+        }
+        put('"');
+    }
+
+    /**
+     * @brief write the comma before all but the first member, then the member name
+     */
+    void put_name(const char* name)
+    {
+        if (name == nullptr)
+            return;
+        if (has_members & (1u << depth))
+            put(',');
+        has_members |= (1u << depth);
+        put_string(name);
+        put(':');
+    }
+
+    static const size_t buffer_size = 128;
+    static const uint8_t max_depth = 31;
+    Write_fn write_fn;
+    void* context;
+    char buffer[buffer_size];
+    size_t nbuffered;
+    size_t nwritten;
+    uint8_t depth;
+    uint32_t has_members;   // bit n is set if the object at depth n has a member
+    bool error;
+};
+}
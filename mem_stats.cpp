@@ -0,0 +1,208 @@
+/* MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+// Make asserts work correctly, even for release builds
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <malloc.h>
+#include <unistd.h>
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/sync.h"
+#include "mem_stats.h"
+#include "object_slab.h"
+
+// Every tagged allocation starts with this header so frees can be attributed
+struct Mem_header {
+    uint32_t size;
+    uint16_t magic;
+    uint8_t tag;
+    uint8_t reserved;
+};
+static const uint16_t mem_magic = 0x4D54;
+
+struct Mem_tag_stats {
+    uint32_t nallocs;       // the number of allocations since boot
+    uint32_t nfrees;        // the number of frees since boot
+    uint32_t nbytes;        // the number of bytes allocated now
+    uint32_t max_bytes;     // the high-water mark of nbytes
+};
+static Mem_tag_stats tag_stats[MEM_TAG_COUNT];
+static uint32_t tagged_bytes = 0;       // the number of bytes of all tags allocated now
+static uint32_t peak_tagged_bytes = 0;  // the high-water mark of tagged_bytes
+static volatile uint8_t current_tag[2] = {MEM_TAG_OTHER, MEM_TAG_OTHER};
+static volatile uint8_t no_alloc_depth[2] = {0, 0};
+static critical_section_t stats_cs;
+
+// The heap runs from the end of the static data to the bottom of the stack
+extern "C" char __end__;
+extern "C" char __StackLimit;
+
+static const char* tag_names[MEM_TAG_COUNT] = {"other", "processors", "views", "parson", "fatfs", "descriptors"};
+
+void* mem_tag_malloc(enum Mem_tag tag, size_t size)
+{
+#if MEM_ASSERT_NO_ALLOC_IN_FILTERS
+    assert(no_alloc_depth[get_core_num()] == 0);
+#endif
+    auto header = reinterpret_cast<Mem_header*>(malloc(sizeof(Mem_header) + size));
+    if (header == nullptr)
+        return nullptr;
+    header->size = size;
+    header->magic = mem_magic;
+    header->tag = tag;
+    header->reserved = 0;
+    // Global constructors allocate on core 0 before the other core starts
+    if (!critical_section_is_initialized(&stats_cs))
+        critical_section_init(&stats_cs);
+    critical_section_enter_blocking(&stats_cs);
+    auto& stats = tag_stats[tag];
+    ++stats.nallocs;
+    stats.nbytes += size;
+    if (stats.nbytes > stats.max_bytes)
+        stats.max_bytes = stats.nbytes;
+    tagged_bytes += size;
+    if (tagged_bytes > peak_tagged_bytes)
+        peak_tagged_bytes = tagged_bytes;
+    critical_section_exit(&stats_cs);
+    return header + 1;
+}
+
+void mem_tag_free(void* ptr)
+{
+    if (ptr == nullptr)
+        return;
+    auto header = reinterpret_cast<Mem_header*>(ptr) - 1;
+    assert(header->magic == mem_magic && header->tag < MEM_TAG_COUNT);
+    critical_section_enter_blocking(&stats_cs);
+    auto& stats = tag_stats[header->tag];
+    ++stats.nfrees;
+    stats.nbytes -= header->size;
+    tagged_bytes -= header->size;
+    critical_section_exit(&stats_cs);
+    header->magic = 0;
+    free(header);
+}
+
+uint32_t mem_get_tag_bytes(enum Mem_tag tag)
+{
+    critical_section_enter_blocking(&stats_cs);
+    uint32_t nbytes = tag_stats[tag].nbytes;
+    critical_section_exit(&stats_cs);
+    return nbytes;
+}
+
+enum Mem_tag mem_set_tag(enum Mem_tag tag)
+{
+    auto previous = static_cast<Mem_tag>(current_tag[get_core_num()]);
+    current_tag[get_core_num()] = tag;
+    return previous;
+}
+
+void mem_no_alloc_begin(void)
+{
+    ++no_alloc_depth[get_core_num()];
+}
+
+void mem_no_alloc_end(void)
+{
+    --no_alloc_depth[get_core_num()];
+}
+
+void* operator new(std::size_t n)
+{
+    return mem_tag_malloc(static_cast<Mem_tag>(current_tag[get_core_num()]), n);
+}
+
+void* operator new[](std::size_t n)
+{
+    return mem_tag_malloc(static_cast<Mem_tag>(current_tag[get_core_num()]), n);
+}
+
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept
+{
+    return mem_tag_malloc(static_cast<Mem_tag>(current_tag[get_core_num()]), n);
+}
+
+void* operator new[](std::size_t n, const std::nothrow_t&) noexcept
+{
+    return mem_tag_malloc(static_cast<Mem_tag>(current_tag[get_core_num()]), n);
+}
+
+void operator delete(void* p) noexcept { mem_tag_free(p); }
+void operator delete[](void* p) noexcept { mem_tag_free(p); }
+void operator delete(void* p, std::size_t) noexcept { mem_tag_free(p); }
+void operator delete[](void* p, std::size_t) noexcept { mem_tag_free(p); }
+
+static void static_print_mem(EmbeddedCli*, char*, void*)
+{
+    // Probing with malloc() would panic when a probe fails and would grow the arena,
+    // so work the sizes out from mallinfo() and the break instead
+    struct mallinfo info = mallinfo();
+    size_t heap_size = &__StackLimit - &__end__;
+    size_t unused_heap = &__StackLimit - reinterpret_cast<char*>(sbrk(0));
+    size_t free_heap = unused_heap + info.fordblks;
+    // keepcost is the free chunk at the top of the arena, which can grow into the unused heap
+    size_t top_block = info.keepcost + unused_heap;
+    size_t free_list_bytes = info.fordblks - info.keepcost;
+    printf("heap %u bytes: %u in use, %u free\r\n", heap_size, info.uordblks, free_heap);
+    printf("free block at top of heap %u, %u bytes in %u other free chunks\r\n", top_block, free_list_bytes,
+        info.ordblks > 0 ? info.ordblks - 1 : 0);
+    // No free chunk is bigger than all of the free chunks together
+    if (free_list_bytes <= top_block)
+        printf("largest free block %u\r\n", top_block);
+    else
+        printf("largest free block between %u and %u\r\n", top_block, free_list_bytes);
+    critical_section_enter_blocking(&stats_cs);
+    uint32_t peak = peak_tagged_bytes;
+    critical_section_exit(&stats_cs);
+    printf("peak of all tagged allocations since boot %lu bytes\r\n", peak);
+    uint32_t nallocs = 0, nfrees = 0;
+    printf("%-12s %8s %8s %8s %8s\r\n", "tag", "allocs", "frees", "bytes", "peak");
+    for (int tag = 0; tag < MEM_TAG_COUNT; tag++) {
+        critical_section_enter_blocking(&stats_cs);
+        Mem_tag_stats stats = tag_stats[tag];
+        critical_section_exit(&stats_cs);
+        nallocs += stats.nallocs;
+        nfrees += stats.nfrees;
+        printf("%-12s %8lu %8lu %8lu %8lu\r\n", tag_names[tag], stats.nallocs, stats.nfrees, stats.nbytes, stats.max_bytes);
+    }
+    printf("tagged allocations %lu, live %lu\r\n", nallocs, nallocs - nfrees);
+    printf("processor and settings view slab:\r\n");
+    rppicomidi::Object_slab::instance().print_status();
+}
+
+void rppicomidi::mem_add_cli_commands(EmbeddedCli *cli)
+{
+    assert(embeddedCliAddBinding(cli, {
+        "mem",
+        "display heap use, fragmentation and per-subsystem allocations. usage: mem",
+        false,
+        nullptr,
+        static_print_mem
+    }));
+}
@@ -0,0 +1,130 @@
+/**
+ * @file mem_stats.h
+ * @brief this file contains heap allocation wrappers that attribute
+ * allocations to subsystems, and the mem CLI command
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Set MEM_ASSERT_NO_ALLOC_IN_FILTERS to 1 to assert if any tagged
+ * allocation or operator new happens inside filter_midi_in() or filter_midi_out()
+ */
+#ifndef MEM_ASSERT_NO_ALLOC_IN_FILTERS
+#define MEM_ASSERT_NO_ALLOC_IN_FILTERS 0
+#endif
+
+/**
+ * @brief the subsystems that heap allocations are attributed to
+ */
+enum Mem_tag {
+    MEM_TAG_OTHER,          //!< everything not attributed to another subsystem
+    MEM_TAG_PROCESSORS,     //!< Midi_processor objects
+    MEM_TAG_VIEWS,          //!< Midi_processor_settings_view objects
+    MEM_TAG_PARSON,         //!< the parson JSON library
+    MEM_TAG_FATFS,          //!< FatFs and the file transfer buffers
+    MEM_TAG_DESCRIPTORS,    //!< the cloned USB string descriptors
+    MEM_TAG_COUNT
+};
+
+/**
+ * @brief allocate size bytes from the heap and attribute them to tag
+ *
+ * @return a pointer to the memory or NULL if the heap is full.
+ * Free it with mem_tag_free().
+ */
+void* mem_tag_malloc(enum Mem_tag tag, size_t size);
+
+/**
+ * @brief free memory mem_tag_malloc() allocated. Does nothing if ptr is NULL
+ */
+void mem_tag_free(void* ptr);
+
+/**
+ * @brief get the number of bytes attributed to tag that are allocated now
+ */
+uint32_t mem_get_tag_bytes(enum Mem_tag tag);
+
+/**
+ * @brief set the tag for the allocations operator new makes on this core
+ *
+ * @return the previous tag
+ */
+enum Mem_tag mem_set_tag(enum Mem_tag tag);
+
+/**
+ * @brief start and end a region on this core where allocating is a bug
+ *
+ * Only checked if MEM_ASSERT_NO_ALLOC_IN_FILTERS is 1
+ */
+void mem_no_alloc_begin(void);
+void mem_no_alloc_end(void);
+
+#ifdef __cplusplus
+}
+#include "embedded_cli.h"
+namespace rppicomidi
+{
+/**
+ * @brief Attribute the allocations operator new makes on this core
+ * to a tag for the lifetime of this object
+ */
+class Mem_tag_scope
+{
+public:
+    Mem_tag_scope(Mem_tag tag) : previous{mem_set_tag(tag)} {}
+    ~Mem_tag_scope() { mem_set_tag(previous); }
+    Mem_tag_scope(Mem_tag_scope const&) = delete;
+    void operator=(Mem_tag_scope const&) = delete;
+private:
+    Mem_tag previous;
+};
+
+/**
+ * @brief Mark the lifetime of this object as a region where allocating is a bug
+ */
+class Mem_no_alloc_scope
+{
+public:
+#if MEM_ASSERT_NO_ALLOC_IN_FILTERS
+    Mem_no_alloc_scope() { mem_no_alloc_begin(); }
+    ~Mem_no_alloc_scope() { mem_no_alloc_end(); }
+#else
+    Mem_no_alloc_scope() {}
+#endif
+    Mem_no_alloc_scope(Mem_no_alloc_scope const&) = delete;
+    void operator=(Mem_no_alloc_scope const&) = delete;
+};
+
+/**
+ * @brief add the mem command that reports heap use to the CLI
+ */
+void mem_add_cli_commands(EmbeddedCli *cli);
+}
+#endif
@@ -0,0 +1,181 @@
+/**
+ * @file midi_note_tracker.h
+ * @brief this file contains classes that track sounding notes so that
+ * processors and processor chains can change without causing stuck notes
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include <cstring>
+namespace rppicomidi
+{
+/**
+ * @brief Track which notes are sounding on one virtual cable
+ *
+ * Each of the 16 MIDI channels has one bit per note number, so the
+ * whole table is 256 bytes. The Midi_processor_manager tracks the
+ * packets that leave each processing chain so that it can send
+ * a note off message for every sounding note before it changes the chain.
+ */
+class Midi_note_tracker
+{
+public:
+    Midi_note_tracker() { clear(); }
+
+    /**
+     * @brief update the table if packet is a note on or note off message
+     *
+     * @param packet the 4-byte USB MIDI packet that was sent
+     */
+    void track(const uint8_t* packet)
+    {
+        const uint8_t status = packet[1] & 0xf0;
+        if (status != 0x90 && status != 0x80)
+            return;
+        const uint8_t chan_idx = packet[1] & 0xf;
+        const uint8_t note = packet[2] & 0x7f;
+        const uint8_t mask = 1 << (note & 7);
+        if (status == 0x90 && packet[3] != 0) {
+            if ((active[chan_idx][note >> 3] & mask) == 0) {
+                active[chan_idx][note >> 3] |= mask;
+                ++num_active;
+            }
+        }
+        else if (active[chan_idx][note >> 3] & mask) {
+            active[chan_idx][note >> 3] &= ~mask;
+            --num_active;
+        }
+    }
+
+    bool is_active(uint8_t chan_idx, uint8_t note) const { return (active[chan_idx & 0xf][(note & 0x7f) >> 3] & (1 << (note & 7))) != 0; }
+
+    size_t get_num_active() const { return num_active; }
+
+    /**
+     * @brief send a note off message for every active note and clear the table
+     *
+     * @param cable the virtual cable number for the note off packets
+     * @param writer the function that sends each packet. If nullptr, just clear the table
+     * @return the number of note off messages sent
+     */
+    size_t release_all(uint8_t cable, void (*writer)(uint8_t* packet))
+    {
+        size_t nsent = 0;
+        for (uint8_t chan_idx = 0; num_active != 0 && chan_idx < 16; chan_idx++) {
+            for (uint8_t byte_idx = 0; byte_idx < 16; byte_idx++) {
+                uint8_t bits = active[chan_idx][byte_idx];
+                for (uint8_t bit = 0; bits != 0; bit++, bits >>= 1) {
+                    if ((bits & 1) && writer) {
+                        uint8_t packet[4] = {static_cast<uint8_t>((cable << 4) | 0x8), static_cast<uint8_t>(0x80 | chan_idx),
+                            static_cast<uint8_t>((byte_idx << 3) | bit), 0};
+                        writer(packet);
+                        ++nsent;
+                    }
+                }
+            }
+        }
+        clear();
+        return nsent;
+    }
+
+    /**
+     * @brief add the active notes of another table to this one
+     */
+    void merge(const Midi_note_tracker& other)
+    {
+        if (other.num_active == 0)
+            return;
+        num_active = 0;
+        for (uint8_t chan_idx = 0; chan_idx < 16; chan_idx++) {
+            for (uint8_t byte_idx = 0; byte_idx < 16; byte_idx++) {
+                active[chan_idx][byte_idx] |= other.active[chan_idx][byte_idx];
+                for (uint8_t bits = active[chan_idx][byte_idx]; bits != 0; bits >>= 1)
+                    num_active += bits & 1;
+            }
+        }
+    }
+
+    void clear() { memset(active, 0, sizeof(active)); num_active = 0; }
+private:
+    uint8_t active[16][16];     //!< one bit per note number per MIDI channel
+    size_t num_active;          //!< number of bits set in active
+};
+
+/**
+ * @brief Remember the output note number a processor sent for each
+ * input note on message so that the matching note off goes to the same
+ * output note, even if the processor's settings change while the note sounds.
+ *
+ * A processor only maps the notes of its one MIDI channel, so the map
+ * holds the notes of one channel. When the processor's channel setting
+ * changes, the first note on from the new channel clears the notes of
+ * the old channel, and until then note offs from the new channel are
+ * not mapped.
+ */
+class Midi_note_map
+{
+public:
+    static const uint8_t no_note = 0xFF;        //!< the input note is not sounding
+    static const uint8_t filtered_note = 0x80;  //!< the note on message was filtered out
+
+    Midi_note_map() : map_chan{0} { clear(); }
+
+    /**
+     * @brief record that input note in_note was sent as out_note
+     *
+     * @param chan the MIDI channel 1-16 of the note on message
+     * @param in_note the note number of the note on message the processor received
+     * @param out_note the note number the processor sent or filtered_note
+     */
+    void note_on(uint8_t chan, uint8_t in_note, uint8_t out_note)
+    {
+        if (chan != map_chan) {
+            clear();
+            map_chan = chan;
+        }
+        out_notes[in_note & 0x7f] = out_note;
+    }
+
+    /**
+     * @brief get the output note recorded for in_note and forget it
+     *
+     * @param chan the MIDI channel 1-16 of the note off message
+     * @param in_note the note number of the note off message the processor received
+     * @return the output note number, filtered_note or no_note
+     */
+    uint8_t note_off(uint8_t chan, uint8_t in_note)
+    {
+        if (chan != map_chan)
+            return no_note;
+        uint8_t out_note = out_notes[in_note & 0x7f];
+        out_notes[in_note & 0x7f] = no_note;
+        return out_note;
+    }
+
+    void clear() { memset(out_notes, no_note, sizeof(out_notes)); }
+private:
+    uint8_t out_notes[128];     //!< the output note of each input note on map_chan
+    uint8_t map_chan;           //!< the MIDI channel of the notes in out_notes, or 0
+};
+}
@@ -0,0 +1,84 @@
+/**
+ * @file midi_packet_fifo.h
+ * @brief a fixed size queue of USB MIDI packets for processors that need
+ * to generate more than one packet from the packet they process
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include <cstring>
+namespace rppicomidi
+{
+/**
+ * @brief A fixed capacity first-in-first-out queue of 4-byte USB MIDI packets
+ *
+ * @tparam N the maximum number of packets the queue can hold
+ */
+template<size_t N> class Midi_packet_fifo
+{
+public:
+    Midi_packet_fifo() : rd_idx{0}, count{0} {}
+
+    /**
+     * @brief add a packet to the end of the queue
+     *
+     * @param packet the 4-byte USB MIDI packet to copy to the queue
+     * @return true if the packet was added
+     * @return false if the queue is full; the packet is dropped
+     */
+    bool push(const uint8_t* packet)
+    {
+        if (count >= N)
+            return false;
+        memcpy(packets[(rd_idx + count) % N], packet, 4);
+        ++count;
+        return true;
+    }
+
+    /**
+     * @brief remove the packet at the front of the queue
+     *
+     * @param packet the 4-byte buffer to receive the packet
+     * @return true if a packet was removed
+     * @return false if the queue is empty
+     */
+    bool pop(uint8_t* packet)
+    {
+        if (count == 0)
+            return false;
+        memcpy(packet, packets[rd_idx], 4);
+        rd_idx = (rd_idx + 1) % N;
+        --count;
+        return true;
+    }
+
+    size_t size() const { return count; }
+    size_t get_free() const { return N - count; }
+    void clear() { rd_idx = 0; count = 0; }
+private:
+    uint8_t packets[N][4];
+    size_t rd_idx;
+    size_t count;
+};
+}
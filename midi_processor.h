@@ -31,6 +31,9 @@
 #include <cstring>
 #include <cstdio>
 #include "parson.h"
+#include "settings_blob.h"
+#include "json_stream_writer.h"
+#include "object_slab.h"
 namespace rppicomidi
 {
 class Midi_processor
@@ -53,6 +56,13 @@ public:
 
     virtual ~Midi_processor() = default;
 
+    /**
+     * @brief allocate processor objects from the Object_slab; the ones that
+     * do not fit are attributed to MEM_TAG_PROCESSORS in the mem report
+     */
+    static void* operator new(size_t size) { return Object_slab::instance().alloc(size, MEM_TAG_PROCESSORS); }
+    static void operator delete(void* ptr) { Object_slab::instance().free(ptr); }
+
     /**
      * @brief Get the unique id object
      * 
@@ -112,7 +122,7 @@ public:
      *
      * @return true if the task() method does anything
      */
-    bool has_task() {return false; }
+    virtual bool has_task() {return false; }
 
     /**
      * @brief Perform any periodic processing that this process needs
@@ -120,6 +130,25 @@ public:
      */
     virtual void task() {}
 
+    /**
+     * @brief get the next packet this processor generated in addition to
+     * the packet passed to process() or feedback(), or generated by task()
+     *
+     * Some processors convert one MIDI message into several (or need to
+     * release a message they were holding). Those processors queue the
+     * extra packets internally; the Midi_processor_manager calls this
+     * function after each call to process(), feedback() or task() until
+     * it returns false, and it sends each extra packet through the rest
+     * of the processing chain. Extra packets are sent before the packet
+     * that was passed to process() or feedback().
+     *
+     * @param packet the 4-byte buffer to receive the next extra USB MIDI packet
+     * @return true if packet contains an extra packet
+     * @return false if there are no more extra packets
+     * @note usually there are no extra packets
+     */
+    virtual bool get_extra_packet(uint8_t* packet) {(void)packet; return false; }
+
     /**
      * @brief Determine if any of the processor's settings have changed since
      * they were last loaded or serialized
@@ -152,6 +181,26 @@ public:
         dirty = false;
     }
 
+    /**
+     * @brief write the JSON formatted settings to a JSON stream
+     *
+     * The output is the same as what serialize_settings() adds. The default
+     * implementation serializes the JSON object serialize_settings() makes,
+     * so only one processor's settings are in a DOM at a time.
+     * @param name the processor name
+     * @param writer the stream positioned in the object containing all
+     * processors for this MIDI cable direction
+     * @note calling this function clears the dirty flag
+     */
+    virtual void serialize_settings_stream(const char* name, Json_stream_writer& writer)
+    {
+        JSON_Value *root_value = json_value_init_object();
+        JSON_Object *root_object = json_value_get_object(root_value);
+        serialize_settings(name, root_object);
+        writer.add_value(name, json_object_get_value(root_object, name));
+        json_value_free(root_value);
+    }
+
     /**
      * @brief load the JSON formatted settings to the processor
      * 
@@ -167,6 +216,36 @@ public:
         return true;
     };
 
+    /**
+     * @brief append the settings in compact binary form to the blob
+     *
+     * This is the form the settings take in the local flash file system;
+     * the JSON form is only used for backup and restore to a USB flash drive.
+     * @param blob the writer for this processor's settings blob
+     * @note calling this function clears the dirty flag
+     * @note if the processor has no settings, the default implementation below will suffice
+     */
+    virtual void serialize_blob(Settings_blob_writer& blob)
+    {
+        (void)blob;
+        dirty = false;
+    }
+
+    /**
+     * @brief load the settings from the compact binary form serialize_blob() wrote
+     *
+     * @param blob the reader for this processor's settings blob
+     * @return true if deserialization is successful
+     * @note clears the dirty flag if deserialization was successful
+     * @note if the processor has no settings, the default implementation below will suffice
+     */
+    virtual bool deserialize_blob(Settings_blob_reader& blob)
+    {
+        (void)blob;
+        dirty = false;
+        return true;
+    }
+
     /**
      * @brief load the default settings for this processor
      */
@@ -23,29 +23,20 @@
 
 #include "midi_processor_chan_mes_remap.h"
 #include "class/midi/midi.h"
-rppicomidi::Midi_processor_chan_mes_remap::Midi_processor_chan_mes_remap(const char* name_, uint16_t unique_id) :
-    Midi_processor{name_, unique_id}, note_msg{"Note Number Remap"}, cc_msg{"CC Number Remap"},
-    poly_pressure_msg{"Poly Press Note Remap"}, chan_pressure_msg{"Chan Pressure Remap"}, prog_change_msg{"Program Number Remap"},
-    format_decimal{"Display Decimal"}, format_hex{"Display Hex"},
-    chan{"Channel", 1, 16, 1}, message_type{"Channel Message", {note_msg, cc_msg, poly_pressure_msg, chan_pressure_msg, prog_change_msg}},
-    bimap{"remap",0,128 /* if the remap is 128, it means the message packet should be filtered out */ },
-    display_format{"Display Format", {format_decimal, format_hex}}
-{
-    mutex_init(&processing_mutex);
-}
 
-#if 0
-rppicomidi::Midi_processor_chan_mes_remap::Midi_processor_chan_mes_remap(uint16_t unique_id) :
-    Midi_processor{static_getname(), unique_id}, note_msg{"Note Number Remap"}, cc_msg{"CC Number Remap"},
-    poly_pressure_msg{"Poly Press Note Remap"}, chan_pressure_msg{"Chan Pressure Remap"}, prog_change_msg{"Program Number Remap"},
-    format_decimal{"Display Decimal"}, format_hex{"Display Hex"},
-    chan{"Channel", 1, 16, 1}, message_type{"Channel Message", {note_msg, cc_msg, poly_pressure_msg, chan_pressure_msg, prog_change_msg}},
+const char* const rppicomidi::Midi_processor_chan_mes_remap::message_type_labels[NUM_MESSAGE_TYPES] = {
+    "Note Number Remap", "CC Number Remap", "Poly Press Note Remap", "Chan Pressure Remap", "Program Number Remap"
+};
+const char* const rppicomidi::Midi_processor_chan_mes_remap::display_format_labels[2] = {"Display Decimal", "Display Hex"};
+
+rppicomidi::Midi_processor_chan_mes_remap::Midi_processor_chan_mes_remap(const char* name_, uint16_t unique_id) :
+    Midi_processor{name_, unique_id},
+    chan{"Channel", 1, 16, 1}, message_type{"Channel Message", message_type_labels, NUM_MESSAGE_TYPES},
     bimap{"remap",0,128 /* if the remap is 128, it means the message packet should be filtered out */ },
-    display_format{"Display Format", {format_decimal, format_hex}}
+    display_format{"Display Format", display_format_labels, 2}
 {
     mutex_init(&processing_mutex);
 }
-#endif
 
 bool rppicomidi::Midi_processor_chan_mes_remap::process_internal(uint8_t* packet, size_t first_idx, size_t second_idx)
 {
@@ -54,24 +45,40 @@ bool rppicomidi::Midi_processor_chan_mes_remap::process_internal(uint8_t* packet
     if (msg_chan == chan.get()) {      
         // got a channel message on the right channel. See if it is the right type to process
         uint8_t status = (packet[1] >> 4) & 0xf;
-        if (((status == MIDI_CIN_NOTE_ON || status == MIDI_CIN_NOTE_ON) && message_type == note_msg) ||
-            (status == MIDI_CIN_CONTROL_CHANGE && message_type == cc_msg) ||
-            (status == MIDI_CIN_POLY_KEYPRESS && message_type == poly_pressure_msg) ||
-            (status == MIDI_CIN_CHANNEL_PRESSURE && message_type == chan_pressure_msg) ||
-            (status == MIDI_CIN_PROGRAM_CHANGE && message_type == prog_change_msg))
+        const int type_idx = message_type.get_ivalue();
+        if (((status == MIDI_CIN_NOTE_ON || status == MIDI_CIN_NOTE_OFF) && type_idx == NOTE_IDX) ||
+            (status == MIDI_CIN_CONTROL_CHANGE && type_idx == CC_IDX) ||
+            (status == MIDI_CIN_POLY_KEYPRESS && type_idx == POLY_PRESSURE_IDX) ||
+            (status == MIDI_CIN_CHANNEL_PRESSURE && type_idx == CHAN_PRESSURE_IDX) ||
+            (status == MIDI_CIN_PROGRAM_CHANGE && type_idx == PROG_CHANGE_IDX))
          {
             // found the right channel message type. Remap it
             mutex_enter_blocking(&processing_mutex);
-            int idx = bimap.find(packet[2], first_idx);
-            if (idx != -1) {
-                uint8_t remap=bimap.get(idx, second_idx);
-                if (remap == bimap.get_max()) {
-                    // filter out this packet
-                    donotfilter = false;
-                }
-                else {
-                    packet[2]=remap;
+            const bool is_note = type_idx == NOTE_IDX;
+            const bool is_note_on = is_note && status == MIDI_CIN_NOTE_ON && packet[3] != 0;
+            // a note off goes to the note the note on went to even if the remap changed
+            uint8_t mapped_note = (is_note && !is_note_on) ? note_maps[first_idx].note_off(msg_chan, packet[2]) : Midi_note_map::no_note;
+            if (mapped_note == Midi_note_map::filtered_note) {
+                donotfilter = false;
+            }
+            else if (mapped_note != Midi_note_map::no_note) {
+                packet[2] = mapped_note;
+            }
+            else {
+                uint8_t in_note = packet[2];
+                int idx = bimap.find(packet[2], first_idx);
+                if (idx != -1) {
+                    uint8_t remap=bimap.get(idx, second_idx);
+                    if (remap == bimap.get_max()) {
+                        // filter out this packet
+                        donotfilter = false;
+                    }
+                    else {
+                        packet[2]=remap;
+                    }
                 }
+                if (is_note_on)
+                    note_maps[first_idx].note_on(msg_chan, in_note, donotfilter ? packet[2] : Midi_note_map::filtered_note);
             }
             mutex_exit(&processing_mutex);
         }
@@ -107,5 +114,41 @@ bool rppicomidi::Midi_processor_chan_mes_remap::deserialize_settings(JSON_Object
         result = false;
     if (result)
         dirty = false;
+    note_maps[0].clear();
+    note_maps[1].clear();
+    return result;
+}
+
+void rppicomidi::Midi_processor_chan_mes_remap::serialize_blob(Settings_blob_writer& blob)
+{
+    blob.put(chan.get());
+    blob.put<uint8_t>(message_type.get_ivalue());
+    blob.put<uint8_t>(display_format.get_ivalue());
+    blob.put<uint8_t>(bimap.size());
+    for (size_t idx = 0; idx < bimap.size(); idx++) {
+        blob.put(bimap.get(idx, 0));
+        blob.put(bimap.get(idx, 1));
+    }
+    dirty = false;
+}
+
+bool rppicomidi::Midi_processor_chan_mes_remap::deserialize_blob(Settings_blob_reader& blob)
+{
+    uint8_t chan_, message_type_, format_, nremap;
+    bool result = blob.get(chan_) && blob.get(message_type_) && blob.get(format_) && blob.get(nremap) &&
+        chan.set(chan_) && message_type.set(message_type_) && display_format.set(format_);
+    while (bimap.size() > 0) {
+        bimap.erase(0);
+    }
+    for (uint8_t idx = 0; result && idx < nremap; idx++) {
+        uint8_t first, second;
+        result = blob.get(first) && blob.get(second);
+        if (result)
+            bimap.push_back(first, second);
+    }
+    if (result)
+        dirty = false;
+    note_maps[0].clear();
+    note_maps[1].clear();
     return result;
 }
\ No newline at end of file
@@ -23,8 +23,9 @@
 #pragma once
 #include <map>
 #include "midi_processor.h"
+#include "midi_note_tracker.h"
 #include "setting_number.h"
-#include "setting_string_enum.h"
+#include "setting_label_enum.h"
 #include "setting_bimap.h"
 #include "pico/mutex.h"
 namespace rppicomidi
@@ -61,15 +62,18 @@ public:
     }
     bool process(uint8_t *packet) final { return process_internal(packet, 0, 1); }
     virtual bool has_feedback_process() {return false; }
-    const std::vector<std::string>* get_all_possible_channel_message_types() const { return message_type.get_all_possible_values(); }
+    size_t get_num_channel_message_types() const { return message_type.get_num_values(); }
+    const char* get_channel_message_type_label(size_t idx) const { return message_type.get_label(idx); }
     bool set_message_type(size_t idx) { dirty = message_type.get_ivalue() != (int)idx; return message_type.set(idx); }
     void get_message_type(std::string &typestr) { message_type.get(typestr); }
     bool set_display_format(size_t idx) { dirty = true; return display_format.set(idx); }
     void get_display_format(std::string &typestr) { display_format.get(typestr); }
     size_t get_display_format() {return display_format.get_ivalue(); }
-    const std::vector<std::string>* get_all_possible_display_formats() const { return display_format.get_all_possible_values(); }
+    size_t get_num_display_formats() const { return display_format.get_num_values(); }
     void serialize_settings(const char* name, JSON_Object *root_object) final;
     bool deserialize_settings(JSON_Object *root_object) final;
+    void serialize_blob(Settings_blob_writer& blob) final;
+    bool deserialize_blob(Settings_blob_reader& blob) final;
     size_t get_num_remap() { return bimap.size(); }
     static uint8_t static_get(void *context_, size_t bimap_idx_, size_t element_idx_)
     {
@@ -103,17 +107,17 @@ public:
     static Midi_processor* static_make_new(uint16_t unique_id_) { return new Midi_processor_chan_mes_remap(unique_id_); }
 protected:
     bool process_internal(uint8_t *packet, size_t first_idx, size_t second_idx);
-    const std::string note_msg;
-    const std::string cc_msg;
-    const std::string poly_pressure_msg;
-    const std::string chan_pressure_msg;
-    const std::string prog_change_msg;
-    const std::string format_decimal;
-    const std::string format_hex;
+    /**
+     * @brief the index values of the message_type setting
+     */
+    enum {NOTE_IDX, CC_IDX, POLY_PRESSURE_IDX, CHAN_PRESSURE_IDX, PROG_CHANGE_IDX, NUM_MESSAGE_TYPES};
+    static const char* const message_type_labels[NUM_MESSAGE_TYPES];
+    static const char* const display_format_labels[2];
     Setting_number<uint8_t> chan;
-    Setting_string_enum message_type;
+    Setting_label_enum message_type;
     Setting_bimap<uint8_t> bimap;
-    Setting_string_enum display_format;
+    Setting_label_enum display_format;
+    Midi_note_map note_maps[2];     //!< remapped note number of each sounding note, indexed by first_idx
     mutex processing_mutex;
 };
 }
\ No newline at end of file
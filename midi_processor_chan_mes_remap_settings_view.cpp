@@ -43,10 +43,8 @@ rppicomidi::Midi_processor_chan_mes_remap_settings_view::
         mes_type_menu{screen_, 0, this, static_mes_type_select_callback}
 {
     auto remap_proc = reinterpret_cast<Midi_processor_chan_mes_remap*>(proc);
-    auto mes_type_list = remap_proc->get_all_possible_channel_message_types();
-    assert(mes_type_list);
-    for (auto &mes_type: *mes_type_list) {
-        auto item = new Menu_item{mes_type.c_str(), screen, font};
+    for (size_t idx = 0; idx < remap_proc->get_num_channel_message_types(); idx++) {
+        auto item = new Menu_item{remap_proc->get_channel_message_type_label(idx), screen, font};
         assert(item);
         mes_type_menu.add_menu_item(item);
     }
@@ -55,9 +53,8 @@ rppicomidi::Midi_processor_chan_mes_remap_settings_view::
 void rppicomidi::Midi_processor_chan_mes_remap_settings_view::entry()
 {
     auto remap_proc = reinterpret_cast<Midi_processor_chan_mes_remap*>(proc);
-    auto mes_type_list = remap_proc->get_all_possible_channel_message_types();
     menu.clear();
-    const char* text = (*mes_type_list)[mes_type_menu.get_current_item_idx()].c_str();
+    const char* text = remap_proc->get_channel_message_type_label(mes_type_menu.get_current_item_idx());
     mes_type_menu_item = new View_launch_menu_item(mes_type_menu, text, screen, font);
     assert(mes_type_menu_item);
     menu.add_menu_item(mes_type_menu_item);
@@ -20,7 +20,15 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  */
+// Make asserts work correctly, even for release builds
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <assert.h>
 #include "midi_processor_manager.h"
+#include "json_stream_reader.h"
+#include "json_arena.h"
+#include "mem_stats.h"
 #include "midi_processor_mc_fader_pickup.h"
 #include "midi_processor_transpose.h"
 #include "midi_processor_chan_mes_remap.h"
@@ -28,20 +36,27 @@
 #include "midi_processor_mc_fader_pickup_settings_view.h"
 #include "midi_processor_transpose_view.h"
 #include "midi_processor_chan_mes_remap_settings_view.h"
+#include "midi_processor_param_convert.h"
+#include "midi_processor_param_convert_view.h"
 
 uint16_t rppicomidi::Midi_processor_manager::unique_id = 0;
-rppicomidi::Midi_processor_manager::Midi_processor_manager() : screen{nullptr}, current_preset{"current preset",1,8,1}, dirty{true}
+rppicomidi::Midi_processor_manager::Midi_processor_manager() : midi_in_writer{nullptr}, midi_out_writer{nullptr},
+    midi_in_queue_drops{0}, midi_in_release_pending{false}, triggered_preset{0}, triggered_us{0}, ntriggers{0}, ntriggers_handled{0}, screen{nullptr}, current_preset{"current preset",1,8,1}, dirty{true}, vid{0}, pid{0}
 {
+    memset(&switch_stats, 0, sizeof(switch_stats));
     // Note: try to add new processor types to this list alphabetically
     mutex_init(&processing_mutex);
+    queue_init(&midi_in_queue, 4, midi_in_queue_len);
+    proclist.push_back({Midi_processor_param_convert::static_getname(), Midi_processor_param_convert::static_make_new,
+                        Midi_processor_param_convert_view::static_make_new, sizeof(Midi_processor_param_convert)});
     proclist.push_back({Midi_processor_mc_fader_pickup::static_getname(), Midi_processor_mc_fader_pickup::static_make_new,
-                        Midi_processor_mc_fader_pickup_settings_view::static_make_new});
+                        Midi_processor_mc_fader_pickup_settings_view::static_make_new, sizeof(Midi_processor_mc_fader_pickup)});
     proclist.push_back({Midi_processor_transpose::static_getname(), Midi_processor_transpose::static_make_new,
-                        Midi_processor_transpose_view::static_make_new});
+                        Midi_processor_transpose_view::static_make_new, sizeof(Midi_processor_transpose)});
     proclist.push_back({Midi_processor_chan_mes_remap::static_getname(), Midi_processor_chan_mes_remap::static_make_new,
-                        Midi_processor_chan_mes_remap_settings_view::static_make_new});
+                        Midi_processor_chan_mes_remap_settings_view::static_make_new, sizeof(Midi_processor_chan_mes_remap)});
     proclist.push_back({Midi_processor_chan_button_remap::static_getname(), Midi_processor_chan_button_remap::static_make_new,
-                        Midi_processor_chan_mes_remap_settings_view::static_make_new});
+                        Midi_processor_chan_mes_remap_settings_view::static_make_new, sizeof(Midi_processor_chan_button_remap)});
     *id_str = '\0';
     *prod_str = '\0';
     Settings_file::instance(); // construct the Settings_file instance
@@ -53,19 +68,29 @@ void rppicomidi::Midi_processor_manager::set_connected_device(uint16_t vid_, uin
     for (int cable = 0; cable < num_in_cables_; cable++) {
         midi_in_processors.push_back(std::vector<Mpv_element>());
         midi_in_proc_fns.push_back(std::vector<Midi_processor_fn>());
+        midi_in_notes.push_back(Midi_note_tracker());
+        midi_in_releases.push_back(Midi_note_tracker());
     }
     for (int cable = 0; cable < num_out_cables_; cable++) {
         midi_out_processors.push_back(std::vector<Mpv_element>());
         midi_out_proc_fns.push_back(std::vector<Midi_processor_fn>());
+        midi_out_notes.push_back(Midi_note_tracker());
     }
+    // create an empty image for every preset
+    preset_images.resize(current_preset.get_max() - current_preset.get_min() + 1);
+    for (auto& image: preset_images) {
+        init_preset_image(image);
+    }
+    vid = vid_;
+    pid = pid_;
+    strncpy(prod_str, prod_str_, MAX_PROD_STR_NAME);
+    prod_str[MAX_PROD_STR_NAME] = '\0';
     // Get stored settings for this device if any
     Settings_file::instance().set_vid_pid(vid_, pid_);
+    Settings_file::instance().get_filename(id_str);
     if (!Settings_file::instance().load()) {
         printf("error loading settings for device %04x-%04x\r\n", vid_, pid_);
     }
-    strncpy(prod_str, prod_str_, MAX_PROD_STR_NAME);
-    Settings_file::instance().get_filename(id_str);
-    prod_str[MAX_PROD_STR_NAME] = '\0';
 }
 
 
@@ -77,26 +102,72 @@ size_t rppicomidi::Midi_processor_manager::get_midi_processor_idx_by_name(const
     return idx;
 }
 
-rppicomidi::Midi_processor_settings_view* rppicomidi::Midi_processor_manager::add_new_midi_processor_by_idx(size_t idx, uint8_t cable, bool is_midi_in)
+rppicomidi::Midi_processor* rppicomidi::Midi_processor_manager::add_new_midi_processor_by_idx(size_t idx, uint8_t cable, bool is_midi_in)
 {
-    Midi_processor_settings_view* retview = nullptr;
-    assert(screen);
+    Midi_processor* retproc = nullptr;
     if (idx < proclist.size()) {
-        auto proc = proclist[idx].processor(unique_id++);
-        auto view = proclist[idx].view(*screen, screen->get_clip_rect(), proc);
+        Midi_processor* proc;
+        {
+            Mem_tag_scope tag(MEM_TAG_PROCESSORS);
+            proc = proclist[idx].processor(unique_id++);
+        }
         mutex_enter_blocking(&processing_mutex);
+        release_active_notes();
+        // The settings view is created when the user first opens it
         if (is_midi_in) {
-            midi_in_processors[cable].push_back({proc, view});
+            midi_in_processors[cable].push_back({proc, nullptr});
         }
         else {
-            midi_out_processors[cable].push_back({proc, view});
+            midi_out_processors[cable].push_back({proc, nullptr});
         }
         build_processor_structures();
         dirty = true;
         mutex_exit(&processing_mutex);
-        retview = view;
+        retproc = proc;
+    }
+    return retproc;
+}
+
+rppicomidi::Midi_processor_settings_view* rppicomidi::Midi_processor_manager::open_midi_processor_view(size_t idx, uint8_t cable, bool is_midi_in)
+{
+    assert(screen);
+    Mpv_element* element = nullptr;
+    if (is_midi_in && cable < midi_in_processors.size()) {
+        if (idx < midi_in_processors[cable].size()) {
+            element = &midi_in_processors[cable][idx];
+        }
+    }
+    else if (!is_midi_in && cable < midi_out_processors.size()) {
+        if (idx < midi_out_processors[cable].size()) {
+            element = &midi_out_processors[cable][idx];
+        }
+    }
+    if (element == nullptr) {
+        return nullptr;
+    }
+    if (element->view == nullptr) {
+        size_t type_idx = get_midi_processor_idx_by_name(element->proc->get_name());
+        if (type_idx < proclist.size()) {
+            element->view = proclist[type_idx].view(*screen, screen->get_clip_rect(), element->proc);
+        }
+    }
+    return element->view;
+}
+
+void rppicomidi::Midi_processor_manager::close_midi_processor_views(uint8_t cable, bool is_midi_in)
+{
+    if (is_midi_in && cable < midi_in_processors.size()) {
+        for (auto& proc: midi_in_processors[cable]) {
+            delete proc.view;
+            proc.view = nullptr;
+        }
+    }
+    else if (!is_midi_in && cable < midi_out_processors.size()) {
+        for (auto& proc: midi_out_processors[cable]) {
+            delete proc.view;
+            proc.view = nullptr;
+        }
     }
-    return retview;
 }
 
 void rppicomidi::Midi_processor_manager::delete_midi_processor_by_idx(int idx, uint8_t cable, bool is_midi_in)
@@ -106,6 +177,7 @@ void rppicomidi::Midi_processor_manager::delete_midi_processor_by_idx(int idx, u
         return; // invalid
     }
     mutex_enter_blocking(&processing_mutex);
+    release_active_notes();
     if (is_midi_in) {
         if (cable < midi_in_processors.size()) {
             if (idx < static_cast<int>(midi_in_processors[cable].size())) {
@@ -135,6 +207,7 @@ void rppicomidi::Midi_processor_manager::delete_midi_processor_by_idx(int idx, u
 void rppicomidi::Midi_processor_manager::clear_all_processors()
 {
     mutex_enter_blocking(&processing_mutex); // Don't allow processing while messing with vectors
+    release_active_notes();
     // erase all data structures associated with the processor lists
     for (size_t cable=0; cable < midi_in_processors.size(); cable++) {
         midi_in_proc_fns[cable].clear();
@@ -158,6 +231,19 @@ void rppicomidi::Midi_processor_manager::clear_all_processors()
 }
 
 void rppicomidi::Midi_processor_manager::build_processor_structures()
+{
+    build_processor_structures(midi_in_processors, midi_out_processors, midi_in_proc_fns, midi_out_proc_fns, processors_with_tasks);
+}
+
+void rppicomidi::Midi_processor_manager::build_processor_structures(Preset_image& image)
+{
+    build_processor_structures(image.midi_in_processors, image.midi_out_processors, image.midi_in_proc_fns,
+        image.midi_out_proc_fns, image.processors_with_tasks);
+}
+
+void rppicomidi::Midi_processor_manager::build_processor_structures(std::vector<std::vector<Mpv_element>>& midi_in_processors,
+    std::vector<std::vector<Mpv_element>>& midi_out_processors, std::vector<std::vector<Midi_processor_fn>>& midi_in_proc_fns,
+    std::vector<std::vector<Midi_processor_fn>>& midi_out_proc_fns, std::vector<Midi_processor_task>& processors_with_tasks)
 {
     // erase all data structures associated with the processor lists
     for (size_t cable=0; cable < midi_in_processors.size(); cable++) {
@@ -180,7 +266,7 @@ void rppicomidi::Midi_processor_manager::build_processor_structures()
                 midi_out_proc_fns[cable].push_back(Midi_processor_fn{midi_in_proc.proc, true});
             }
             if (midi_in_proc.proc->has_task()) {
-                processors_with_tasks.push_back(midi_in_proc.proc);
+                processors_with_tasks.push_back(Midi_processor_task{midi_in_proc.proc, static_cast<uint8_t>(cable), true});
             }
         }
     }
@@ -197,27 +283,121 @@ void rppicomidi::Midi_processor_manager::build_processor_structures()
                 midi_in_proc_fns[cable].push_back(Midi_processor_fn{midi_out_proc.proc, true});
             }
             if (midi_out_proc.proc->has_task()) {
-                processors_with_tasks.push_back(midi_out_proc.proc);
+                processors_with_tasks.push_back(Midi_processor_task{midi_out_proc.proc, static_cast<uint8_t>(cable), false});
             }
-            midi_out_proc.proc->set_not_saved();
         }
     }
 }
 
+bool rppicomidi::Midi_processor_manager::run_chain(std::vector<Midi_processor_fn>& fns, size_t first, uint8_t* packet, uint8_t cable, bool is_midi_in)
+{
+    bool donotfilter = true;
+    for (size_t idx = first; donotfilter && idx < fns.size(); idx++) {
+        auto& process = fns[idx];
+        if (process.is_feedback)
+            donotfilter = process.proc->feedback(packet);
+        else
+            donotfilter = process.proc->process(packet);
+        flush_extra_packets(fns, idx, cable, is_midi_in);
+    }
+    return donotfilter;
+}
+
+void rppicomidi::Midi_processor_manager::flush_extra_packets(std::vector<Midi_processor_fn>& fns, size_t idx, uint8_t cable, bool is_midi_in)
+{
+    uint8_t extra[4];
+    while (fns[idx].proc->get_extra_packet(extra)) {
+        if (!run_chain(fns, idx+1, extra, cable, is_midi_in))
+            continue;
+        if (is_midi_in) {
+            midi_in_notes[cable].track(extra);
+            write_midi_in(extra);
+        }
+        else if (midi_out_writer) {
+            midi_out_notes[cable].track(extra);
+            midi_out_writer(extra);
+        }
+    }
+}
+
+void rppicomidi::Midi_processor_manager::write_midi_in(uint8_t* packet)
+{
+    if (midi_in_writer == nullptr)
+        return;
+    if (get_core_num() == 1)
+        midi_in_writer(packet);
+    else if (!queue_try_add(&midi_in_queue, packet))
+        ++midi_in_queue_drops;
+}
+
+// A packet with code index number 0 is reserved, so no processor sends one.
+// In the MIDI IN queue it marks where the note offs in midi_in_releases go.
+static const uint8_t release_marker[4] = {0, 0, 0, 0};
+
+void rppicomidi::Midi_processor_manager::send_queued_midi_in()
+{
+    uint8_t packet[4];
+    while (queue_try_remove(&midi_in_queue, packet)) {
+        if (memcmp(packet, release_marker, sizeof(release_marker)) == 0) {
+            mutex_enter_blocking(&processing_mutex);
+            send_midi_in_releases();
+            mutex_exit(&processing_mutex);
+        }
+        else if (midi_in_writer) {
+            midi_in_writer(packet);
+        }
+    }
+    if (midi_in_release_pending) {
+        // the queue was full when the notes were released
+        mutex_enter_blocking(&processing_mutex);
+        send_midi_in_releases();
+        mutex_exit(&processing_mutex);
+    }
+}
+
+void rppicomidi::Midi_processor_manager::send_midi_in_releases()
+{
+    if (!midi_in_release_pending)
+        return;
+    for (size_t cable = 0; cable < midi_in_releases.size(); cable++) {
+        midi_in_releases[cable].release_all(cable, midi_in_writer);
+    }
+    midi_in_release_pending = false;
+}
+
+void rppicomidi::Midi_processor_manager::release_active_notes()
+{
+    // Core1 sends the MIDI IN note offs in queue order, so hand it the notes
+    bool released = false;
+    for (size_t cable = 0; cable < midi_in_notes.size(); cable++) {
+        if (midi_in_notes[cable].get_num_active() != 0) {
+            midi_in_releases[cable].merge(midi_in_notes[cable]);
+            midi_in_notes[cable].clear();
+            released = true;
+        }
+    }
+    if (released) {
+        midi_in_release_pending = true;
+        queue_try_add(&midi_in_queue, release_marker);
+    }
+    for (size_t cable = 0; cable < midi_out_notes.size(); cable++) {
+        midi_out_notes[cable].release_all(cable, midi_out_writer);
+    }
+}
+
 bool rppicomidi::Midi_processor_manager::filter_midi_in(uint8_t cable, uint8_t* packet)
 {
+    Mem_no_alloc_scope no_alloc;
     bool donotfilter = true;
     //uint8_t cable = Midi_processor::get_cable_num(packet);
     mutex_enter_blocking(&processing_mutex);
-    if (midi_in_proc_fns.size() > cable) {
-        for (auto& process: midi_in_proc_fns[cable]) {
-            if (process.is_feedback)
-                donotfilter = process.proc->feedback(packet);
-            else
-                donotfilter = process.proc->process(packet);
-            if (!donotfilter)
-                break;
-        }
+    if (handle_preset_trigger(cable, true, packet)) {
+        donotfilter = false;
+    }
+    else if (midi_in_proc_fns.size() > cable) {
+        donotfilter = run_chain(midi_in_proc_fns[cable], 0, packet, cable, true);
+        if (donotfilter)
+            midi_in_notes[cable].track(packet);
     }
     mutex_exit(&processing_mutex);
     return donotfilter;
@@ -226,18 +406,17 @@ bool rppicomidi::Midi_processor_manager::filter_midi_in(uint8_t cable, uint8_t*
 
 bool rppicomidi::Midi_processor_manager::filter_midi_out(uint8_t cable, uint8_t* packet)
 {
+    Mem_no_alloc_scope no_alloc;
     bool donotfilter = true;
     //uint8_t cable = Midi_processor::get_cable_num(packet);
     mutex_enter_blocking(&processing_mutex);
-    if (midi_out_proc_fns.size() > cable) {
-        for (auto& process: midi_out_proc_fns[cable]) {
-            if (process.is_feedback)
-                donotfilter = process.proc->feedback(packet);
-            else
-                donotfilter = process.proc->process(packet);
-            if (!donotfilter)
-                break;
-        }
+    if (handle_preset_trigger(cable, false, packet)) {
+        donotfilter = false;
+    }
+    else if (midi_out_proc_fns.size() > cable) {
+        donotfilter = run_chain(midi_out_proc_fns[cable], 0, packet, cable, false);
+        if (donotfilter)
+            midi_out_notes[cable].track(packet);
     }
     mutex_exit(&processing_mutex);
     return donotfilter;
@@ -245,12 +424,21 @@ bool rppicomidi::Midi_processor_manager::filter_midi_out(uint8_t cable, uint8_t*
 
 void rppicomidi::Midi_processor_manager::task()
 {
+    switch_triggered_preset();
     mutex_enter_blocking(&processing_mutex);
-    for (auto& proc: processors_with_tasks) {
-        proc->task();
+    for (auto& proc_task: processors_with_tasks) {
+        proc_task.proc->task();
+        // Extra packets from the task() method follow the process() method's path
+        auto& fns = proc_task.is_midi_in ? midi_in_proc_fns[proc_task.cable] : midi_out_proc_fns[proc_task.cable];
+        for (size_t idx = 0; idx < fns.size(); idx++) {
+            if (fns[idx].proc == proc_task.proc && !fns[idx].is_feedback) {
+                flush_extra_packets(fns, idx, proc_task.cable, proc_task.is_midi_in);
+                break;
+            }
+        }
     }
     mutex_exit(&processing_mutex);
- }
+}
 
 
 bool rppicomidi::Midi_processor_manager::needs_store()
@@ -267,297 +455,818 @@ bool rppicomidi::Midi_processor_manager::needs_store()
             dirty = proc->proc->not_saved();
         }
     }
-    return dirty;
+    return dirty || preset_trigger.not_saved();
 }
 
-char* rppicomidi::Midi_processor_manager::serialize(uint8_t preset_num, char* previous_serialized_string)
+bool rppicomidi::Midi_processor_manager::read_device_record(Settings_blob_reader& file, Device_record& header)
 {
-    if (preset_num < current_preset.get_min() || preset_num > current_preset.get_max())
-        return nullptr;
-    bool free_previous = false;
-    if (previous_serialized_string == nullptr) {
-        previous_serialized_string = serialize_default();
-        free_previous = true;
-    }
-    JSON_Value* root_value= json_parse_string(previous_serialized_string);
-    if (free_previous) {
-        json_free_serialized_string(previous_serialized_string);
-    }
-    if (root_value && json_value_get_type(root_value) == JSONObject) {
-        mutex_enter_blocking(&processing_mutex); // Don't allow processing or changes while serializing
-        JSON_Object* root_object = json_value_get_object(root_value);
-
-        current_preset.set(preset_num);
-        JSON_Value* preset_value = json_object_get_value(root_object, std::to_string(current_preset.get()).c_str());
-        if (preset_value == nullptr) {
-            // something is wrong with the previous_serialized_string
-            char* default_json = serialize_default();
-            if (default_json) {
-                json_value_free(root_value);
-                root_value= json_parse_string(default_json);
-                json_free_serialized_string(default_json);
-                if (root_value) {
-                    root_object = json_value_get_object(root_value);
-                    preset_value = json_object_get_value(root_object, std::to_string(current_preset.get()).c_str());
-                }
-            }
+    uint32_t magic;
+    uint16_t version;
+    if (!file.get(magic) || magic != preset_file_magic || !file.get(version)) {
+        printf("deserialize: not a device settings record\r\n");
+        return false;
+    }
+    if (version != preset_file_version) {
+        printf("deserialize: settings format version %u not supported\r\n", version);
+        return false;
+    }
+    bool result = file.get(header.vid) && file.get(header.pid) && file.get_string(header.prod, sizeof(header.prod)) &&
+        file.get_blob<uint8_t>(header.trigger);
+    if (!result)
+        printf("deserialize: device settings record is truncated\r\n");
+    return result;
+}
+
+void rppicomidi::Midi_processor_manager::serialize_device_record(Settings_blob_writer& file, uint16_t vid_, uint16_t pid_,
+    const char* prod_str_, Preset_trigger& trigger)
+{
+    file.put(preset_file_magic);
+    file.put(preset_file_version);
+    file.put(vid_);
+    file.put(pid_);
+    file.put_string(prod_str_);
+    size_t offset = file.begin_length<uint8_t>();
+    trigger.serialize(file);
+    file.end_length<uint8_t>(offset);
+}
+
+bool rppicomidi::Midi_processor_manager::read_preset_record(Settings_blob_reader& file, uint8_t& preset_num, Settings_blob_reader& body)
+{
+    uint32_t crc;
+    if (!file.get(preset_num) || !file.get_blob<uint32_t>(body) || !file.get(crc)) {
+        printf("deserialize: preset record is truncated\r\n");
+        return false;
+    }
+    if (settings_crc32(body.get_ptr(), body.get_remaining()) != crc) {
+        printf("deserialize: preset %u CRC error\r\n", preset_num);
+        return false;
+    }
+    return true;
+}
+
+void rppicomidi::Midi_processor_manager::serialize_preset_record(Settings_blob_writer& file, uint8_t preset_num)
+{
+    file.put(preset_num);
+    size_t offset = file.begin_length<uint32_t>();
+    file.put<uint8_t>(midi_in_processors.size());
+    file.put<uint8_t>(midi_out_processors.size());
+    for (auto& midi_in_cable_processors: midi_in_processors) {
+        file.put<uint8_t>(midi_in_cable_processors.size());
+        for (auto& proc: midi_in_cable_processors) {
+            serialize_processor(file, proc.proc);
         }
-        if (preset_value && json_value_get_type(preset_value) == JSONObject) {
-            current_preset.serialize(root_object);
-            JSON_Object* preset_object = json_value_get_object(preset_value);
-            int idx = 1;
-            for (auto& midi_in_cable_processors: midi_in_processors) {
-                JSON_Value *midi_value = json_value_init_object();
-                JSON_Object *midi_object = json_value_get_object(midi_value);
-                for (auto& proc: midi_in_cable_processors) {
-                    proc.proc->serialize_settings(proc.proc->get_unique_name(), midi_object);
-                }
-                std::string midi_name = std::string{"MIDI IN"}+std::to_string(idx++);
-                json_object_set_value(preset_object, midi_name.c_str(), midi_value);
-            }
-            idx = 1;
-            for (auto& midi_out_cable_processors: midi_out_processors) {
-                JSON_Value *midi_value = json_value_init_object();
-                JSON_Object *midi_object = json_value_get_object(midi_value);
-                for (auto& proc: midi_out_cable_processors) {
-                    proc.proc->serialize_settings(proc.proc->get_unique_name(), midi_object);
-                }
-                std::string midi_name = std::string{"MIDI OUT"}+std::to_string(idx++);
-                json_object_set_value(preset_object, midi_name.c_str(), midi_value);
-            }
+    }
+    for (auto& midi_out_cable_processors: midi_out_processors) {
+        file.put<uint8_t>(midi_out_cable_processors.size());
+        for (auto& proc: midi_out_cable_processors) {
+            serialize_processor(file, proc.proc);
         }
     }
-    dirty = false;
-    mutex_exit(&processing_mutex);
-    json_set_float_serialization_format("%.0f");
-    char* serialized_string = json_serialize_to_string(root_value);
-    json_value_free(root_value);
-    return serialized_string;
+    file.end_length<uint32_t>(offset);
+    const uint8_t* body = file.get_data() + offset + sizeof(uint32_t);
+    file.put(settings_crc32(body, file.size() - offset - sizeof(uint32_t)));
 }
 
-char* rppicomidi::Midi_processor_manager::serialize_default()
+void rppicomidi::Midi_processor_manager::serialize_processor(Settings_blob_writer& file, Midi_processor* proc)
 {
-    JSON_Value *root_value = json_value_init_object();
-    JSON_Object *root_object = json_value_get_object(root_value);
-    json_object_set_string(root_object, "id", id_str);
-    json_object_set_string(root_object, "prod", prod_str);
+    file.put_string(proc->get_name());
+    size_t offset = file.begin_length<uint16_t>();
+    proc->serialize_blob(file);
+    file.end_length<uint16_t>(offset);
+}
 
+void rppicomidi::Midi_processor_manager::serialize_device(std::vector<uint8_t>& data)
+{
+    data.clear();
+    Settings_blob_writer file(data);
+    serialize_device_record(file, vid, pid, prod_str, preset_trigger);
+}
 
-    current_preset.serialize(root_object);
-    for (uint8_t preset_num = current_preset.get_min(); preset_num <= current_preset.get_max(); preset_num++) {
-        int idx = 1;
-        JSON_Value* preset_value = json_value_init_object();
-        JSON_Object *preset_object = json_value_get_object(preset_value);
-        for (auto midi_in_cable_processors: midi_in_processors) {
-            JSON_Value *midi_value = json_value_init_object();
-            std::string midi_name = std::string{"MIDI IN"}+std::to_string(idx++);
-            json_object_set_value(preset_object, midi_name.c_str(), midi_value);
-        }
-        idx = 1;
-        for (auto midi_out_cable_processors: midi_out_processors) {
-            JSON_Value *midi_value = json_value_init_object();
-            std::string midi_name = std::string{"MIDI OUT"}+std::to_string(idx++);
-            json_object_set_value(preset_object, midi_name.c_str(), midi_value);
-        }
-        json_object_set_value(root_object, std::to_string(preset_num).c_str(), json_object_get_wrapping_value(preset_object));
+bool rppicomidi::Midi_processor_manager::serialize_preset(uint8_t preset_num, std::vector<uint8_t>& data)
+{
+    if (preset_num < current_preset.get_min() || preset_num > current_preset.get_max())
+        return false;
+    data.clear();
+    Settings_blob_writer file(data);
+    mutex_enter_blocking(&processing_mutex); // Don't allow processing or changes while serializing
+    current_preset.set(preset_num);
+    serialize_preset_record(file, preset_num);
+    dirty = false;
+    mutex_exit(&processing_mutex);
+    return true;
+}
+
+bool rppicomidi::Midi_processor_manager::deserialize_preset_data(uint8_t preset_num, const uint8_t* record, size_t len, Preset_image& image)
+{
+    if (len == 0) {
+        // the preset was never stored, so it has no processors
+        return true;
     }
-    json_set_float_serialization_format("%.0f");
-    char* serialized_string = json_serialize_to_string(root_value);
-    json_value_free(root_value);
+    Settings_blob_reader file(record, len);
+    uint8_t record_preset;
+    Settings_blob_reader body;
+    if (!read_preset_record(file, record_preset, body))
+        return false;
+    if (record_preset != preset_num) {
+        printf("deserialize: expected preset %u got preset %u\r\n", preset_num, record_preset);
+        return false;
+    }
+    return deserialize_preset_record(body, image);
+}
 
-    return serialized_string;
+bool rppicomidi::Midi_processor_manager::deserialize_preset(uint8_t preset_num, const uint8_t* record, size_t len)
+{
+    if (preset_num < current_preset.get_min() || preset_num > current_preset.get_max() || preset_images.size() == 0)
+        return false;
+    // Build the new chains where MIDI processing can't see them, then swap them in at once
+    Preset_image image;
+    init_preset_image(image);
+    bool result = deserialize_preset_data(preset_num, record, len, image);
+    if (result) {
+        mutex_enter_blocking(&processing_mutex);
+        stash_and_swap(preset_num);
+        swap_preset_image(image);
+        mutex_exit(&processing_mutex);
+        dirty = false;
+    }
+    // image now holds the chains that were stale, or the partly built chains if the record was bad
+    free_preset_image(image);
+    return result;
+}
 
+bool rppicomidi::Midi_processor_manager::deserialize_preset_record(Settings_blob_reader& body, Preset_image& image)
+{
+    uint8_t nmidi_in, nmidi_out;
+    if (!body.get(nmidi_in) || !body.get(nmidi_out))
+        return false;
+    // There should be as many cables as the connected device has
+    if (nmidi_in != image.midi_in_processors.size() || nmidi_out != image.midi_out_processors.size()) {
+        printf("deserialize: error got %u MIDI IN and %u MIDI OUT cables\r\n", nmidi_in, nmidi_out);
+        return false;
+    }
+    bool result = true;
+    for (uint8_t idx = 0; result && idx < nmidi_in + nmidi_out; idx++) {
+        const bool is_midi_in = idx < nmidi_in;
+        const uint8_t cable = is_midi_in ? idx : idx - nmidi_in;
+        uint8_t nprocs;
+        result = body.get(nprocs);
+        for (uint8_t proc_idx = 0; result && proc_idx < nprocs; proc_idx++) {
+            char proc_type_label[max_type_tag_length+1];
+            Settings_blob_reader settings;
+            if (!body.get_string(proc_type_label, sizeof(proc_type_label)) || !body.get_blob<uint16_t>(settings)) {
+                printf("deserialize: processor record is truncated\r\n");
+                result = false;
+                break;
+            }
+            size_t proc_type_idx = get_midi_processor_idx_by_name(proc_type_label);
+            if (proc_type_idx >= get_num_midi_processor_types()) {
+                printf("deserialize: new processor name %s not found\r\n", proc_type_label);
+                result = false;
+                break;
+            }
+            Midi_processor* proc;
+            {
+                Mem_tag_scope tag(MEM_TAG_PROCESSORS);
+                proc = proclist[proc_type_idx].processor(unique_id++);
+            }
+            auto& cable_processors = is_midi_in ? image.midi_in_processors[cable] : image.midi_out_processors[cable];
+            cable_processors.push_back({proc, nullptr});
+            result = proc->deserialize_blob(settings);
+            if (!result) {
+                printf("deserialize: failed to deserialize settings for %s\r\n", proc_type_label);
+            }
+        }
+    }
+    build_processor_structures(image);
+    return result;
 }
 
-bool rppicomidi::Midi_processor_manager::deserialize_preset(uint8_t preset_num, char* json_format)
+bool rppicomidi::Midi_processor_manager::deserialize(const Device_settings& settings)
 {
-    JSON_Value* root_value= json_parse_string(json_format);
-    JSON_Object *root_object = NULL;
+    if (preset_images.size() == 0)
+        return false;
+    Settings_blob_reader file(settings.device.data(), settings.device.size());
+    Device_record header;
+    if (settings.device.size() != 0 && read_device_record(file, header))
+        preset_trigger.deserialize(header.trigger);
+    else
+        preset_trigger.load_defaults();
+    uint8_t last_preset = settings.current_preset;
+    if (last_preset < current_preset.get_min() || last_preset > current_preset.get_max())
+        last_preset = current_preset.get_min();
+    current_preset.set(last_preset);
+    // clear out the existing data
+    clear_all_processors();
+    mutex_enter_blocking(&processing_mutex);
+    for (auto& image: preset_images) {
+        free_preset_image(image);
+    }
+    mutex_exit(&processing_mutex);
+    // Build an image of every preset so that loading a preset later is
+    // just swapping processing chains. Each image is built where MIDI
+    // processing can't see it and then put in place at once.
     bool result = true;
-    if (root_value && json_value_get_type(root_value) == JSONObject) {
-        root_object = json_value_get_object(root_value);
-        uint8_t last_preset = json_object_get_number(root_object, current_preset.get_name());
-        // make sure the JSON formatted string to deserialize has current_preset set to preset_num
-        if (last_preset != preset_num) {
-            json_object_set_number(root_object, current_preset.get_name(), preset_num);
-            json_set_float_serialization_format("%.0f");
-            char* serialized_string = json_serialize_to_string(root_value);
-            result = deserialize(serialized_string);
-            json_free_serialized_string(serialized_string);
+    for (uint8_t preset_num = current_preset.get_min(); preset_num <= current_preset.get_max(); preset_num++) {
+        if (preset_num - current_preset.get_min() >= static_cast<int>(settings.presets.size()))
+            continue;
+        auto& record = settings.presets[preset_num - current_preset.get_min()];
+        Preset_image image;
+        init_preset_image(image);
+        bool image_ok = deserialize_preset_data(preset_num, record.data(), record.size(), image);
+        mutex_enter_blocking(&processing_mutex);
+        if (preset_num == last_preset) {
+            // the current preset keeps no processors if its record is bad
+            if (image_ok) {
+                release_active_notes();
+                swap_preset_image(image);
+            }
+            result = image_ok;
         }
         else {
-            result = deserialize(json_format);
+            image.is_stale = !image_ok;
+            std::swap(image, get_preset_image(preset_num));
         }
+        mutex_exit(&processing_mutex);
+        // image now holds the empty chains it replaced, or the partly built chains of a bad record
+        free_preset_image(image);
     }
-    else {
-        result = false;
-    }
-    if (root_value)
-        json_value_free(root_value);
     if (result)
         dirty = false;
     return result;
 }
 
-bool rppicomidi::Midi_processor_manager::deserialize(char* json_format)
+bool rppicomidi::Midi_processor_manager::preset_record_to_stream(Settings_blob_reader& body, Json_stream_writer& writer)
 {
-    if (!json_format)
+    uint8_t nmidi_in, nmidi_out;
+    if (!body.get(nmidi_in) || !body.get(nmidi_out))
         return false;
-    JSON_Value* root_value= json_parse_string(json_format);
-    JSON_Object *root_object = NULL;
     bool result = true;
-    if (root_value && json_value_get_type(root_value) == JSONObject) {
-        root_object = json_value_get_object(root_value);
-        // get the last preset number
-        current_preset.deserialize(root_object);
-        uint8_t last_preset = json_object_get_number(root_object, current_preset.get_name());
-        if (last_preset >= current_preset.get_min() && last_preset <= current_preset.get_max()) {
-            JSON_Object* preset = json_object_get_object(root_object, std::to_string(last_preset).c_str());
-            size_t nobjects = json_object_get_count(preset);
-            const size_t nmidi_in = midi_in_processors.size(); 
-            const size_t nmidi_out = midi_out_processors.size();
-            // There should be as many objects as there are MIDI INs and MIDI OUTs
-            if (nobjects == (nmidi_in + nmidi_out)) {
-                printf("deserialize: got %u objects as expected\r\n", nobjects);
-                // clear out the existing data
-                clear_all_processors();
-                // deserialize all processors to all cables in both directions
-                for (size_t idx=0; result && idx < nobjects; idx++) {
-                    const char* label = json_object_get_name(preset, idx);
-                    if (label == nullptr || strlen(label) < 8) {
-                        result = false;
-                        break; // shortest label will be MIDI IN?
-                    }
-                    const char* ptr = strstr(label, "MIDI IN");
-                    if (ptr != nullptr) {
-                        size_t midi_in_port = atoi(ptr+7) - 1;
-                        if (midi_in_port < nmidi_in) {
-                            // Deserialize processors for the specified MIDI IN port
-                            JSON_Value* proc_values = json_object_get_value_at(preset, idx);
-                            JSON_Object* proc_objects = json_value_get_object(proc_values);
-                            size_t nproc_objects = json_object_get_count(proc_objects);
-                            printf("%u processor objects in MIDI IN%u\r\n", nproc_objects, midi_in_port+1);
-
-                            for (size_t proc_idx=0; result && (proc_idx < nproc_objects); proc_idx++) {
-                                const char* proc_label = json_object_get_name(proc_objects, proc_idx);
-                                const size_t proc_label_len = strlen(proc_label);
-                                assert(proc_label_len > 0);
-                                char proc_type_label[proc_label_len+1];
-                                strcpy(proc_type_label, proc_label);
-                                char* dollar_ptr = strrchr(proc_type_label,'$');
-                                if (dollar_ptr != nullptr)
-                                    *dollar_ptr = '\0';
-                                size_t proc_type_idx = get_midi_processor_idx_by_name(proc_type_label);
-                                if (proc_type_idx >= get_num_midi_processor_types() ) {
-                                    printf("deserialize: new processor name %s not found\r\n", proc_label);
-                                    result = false;
-                                    break;
-                                }
-                                else {
-                                    add_new_midi_processor_by_idx(proc_type_idx, midi_in_port, true);
-                                    JSON_Value* setting_values = json_object_get_value_at(proc_objects, proc_idx);
-                                    JSON_Object* setting_objects = json_value_get_object(setting_values);
-                                    result = midi_in_processors[midi_in_port][proc_idx].proc->deserialize_settings(setting_objects);
-                                    if (!result) {
-                                        printf("deserialize: failed to deserialize settings for %s\r\n", proc_type_label);
-                                        break;
-                                    }
-                                }
-                            }
-                        }
-                        else {
-                            printf("deserialize: bad MIDI port number %u\r\n", midi_in_port);
-                            result = false;
-                            break;
-                        }
-                    }
-                    ptr = strstr(label, "MIDI OUT");
-                    if (ptr != nullptr) {
-                        size_t midi_out_port = atoi(ptr+8) - 1;
-                        if (midi_out_port < nmidi_out) {
-                            // Deserialize processors for the specified MIDI IN port
-                            JSON_Value* proc_values = json_object_get_value_at(preset, idx);
-                            JSON_Object* proc_objects = json_value_get_object(proc_values);
-                            size_t nproc_objects = json_object_get_count(proc_objects);
-                            printf("%u processor objects in MIDI OUT%u\r\n", nproc_objects, midi_out_port+1);
-
-                            for (size_t proc_idx=0; result && (proc_idx < nproc_objects); proc_idx++) {
-                                const char* proc_label = json_object_get_name(proc_objects, proc_idx);
-                                const size_t proc_label_len = strlen(proc_label);
-                                assert(proc_label_len > 0);
-                                char proc_type_label[proc_label_len+1];
-                                strcpy(proc_type_label, proc_label);
-                                char* dollar_ptr = strrchr(proc_type_label,'$');
-                                if (dollar_ptr != nullptr)
-                                    *dollar_ptr = '\0';
-                                size_t proc_type_idx = get_midi_processor_idx_by_name(proc_type_label);
-                                if (proc_type_idx >= get_num_midi_processor_types() ) {
-                                    printf("deserialize: new processor name %s not found\r\n", proc_type_label);
-                                    result = false;
-                                    break;
-                                }
-                                else {
-                                    add_new_midi_processor_by_idx(proc_type_idx, midi_out_port, true);
-                                    JSON_Value* setting_values = json_object_get_value_at(proc_objects, proc_idx);
-                                    JSON_Object* setting_objects = json_value_get_object(setting_values);
-                                    result = midi_out_processors[midi_out_port][proc_idx].proc->deserialize_settings(setting_objects);
-                                    if (!result) {
-                                        printf("deserialize: failed to deserialize settings for %s\r\n", proc_type_label);
-                                        break;
-                                    }
-                                }
-                            }
-                        }
-                        else {
-                            printf("deserialize: bad MIDI port number %u\r\n", midi_out_port);
-                            result = false;
-                            break;
-                        }
-                    }
-                }
-            }
-            else {
-                printf("deserialize: error got %u objects\r\n", nobjects);
+    for (uint8_t idx = 0; result && idx < nmidi_in + nmidi_out; idx++) {
+        const bool is_midi_in = idx < nmidi_in;
+        std::string midi_name = is_midi_in ? std::string{"MIDI IN"}+std::to_string(idx+1) :
+            std::string{"MIDI OUT"}+std::to_string(idx-nmidi_in+1);
+        writer.begin_object(midi_name.c_str());
+        uint8_t nprocs;
+        result = body.get(nprocs);
+        for (uint8_t proc_idx = 0; result && proc_idx < nprocs; proc_idx++) {
+            char proc_type_label[max_type_tag_length+1];
+            Settings_blob_reader settings;
+            size_t proc_type_idx = get_num_midi_processor_types();
+            if (body.get_string(proc_type_label, sizeof(proc_type_label)) && body.get_blob<uint16_t>(settings))
+                proc_type_idx = get_midi_processor_idx_by_name(proc_type_label);
+            if (proc_type_idx >= get_num_midi_processor_types()) {
                 result = false;
+                break;
+            }
+            auto proc = proclist[proc_type_idx].processor(unique_id++);
+            result = proc->deserialize_blob(settings);
+            if (result) {
+                Json_arena_scope arena;
+                proc->serialize_settings_stream(proc->get_unique_name(), writer);
             }
+            delete proc;
         }
-        else {
-            printf("deserialize: last preset %u not found\r\n", last_preset);
+        writer.end_object();
+    }
+    return result;
+}
+
+bool rppicomidi::Midi_processor_manager::convert_to_json(const Device_settings& settings, Json_stream_writer& writer)
+{
+    Settings_blob_reader file(settings.device.data(), settings.device.size());
+    Device_record header;
+    if (!read_device_record(file, header))
+        return false;
+    writer.begin_object();
+    char id[10];
+    n2hexstr<uint16_t>(header.vid, id, 4);
+    n2hexstr<uint16_t>(header.pid, id+5, 4);
+    id[4] = '-';
+    id[9] = '\0';
+    writer.add_string("id", id);
+    writer.add_string("prod", header.prod);
+    uint8_t last_preset = settings.current_preset;
+    if (last_preset < current_preset.get_min() || last_preset > current_preset.get_max())
+        last_preset = current_preset.get_min();
+    writer.add_number(current_preset.get_name(), last_preset);
+    // The preset trigger settings are small, so convert them with a DOM
+    Preset_trigger trigger;
+    trigger.deserialize(header.trigger);
+    // parson keeps a copy of the format string, so set it outside of any Json_arena_scope
+    json_set_float_serialization_format("%.0f");
+    {
+        Json_arena_scope arena;
+        JSON_Value *root_value = json_value_init_object();
+        JSON_Object *root_object = json_value_get_object(root_value);
+        trigger.serialize(root_object);
+        writer.add_value("preset trigger", json_object_get_value(root_object, "preset trigger"));
+        json_value_free(root_value);
+    }
+    bool result = true;
+    for (size_t idx = 0; result && idx < settings.presets.size(); idx++) {
+        if (settings.presets[idx].size() == 0)
+            continue; // never stored
+        Settings_blob_reader record(settings.presets[idx].data(), settings.presets[idx].size());
+        uint8_t preset_num;
+        Settings_blob_reader body;
+        result = read_preset_record(record, preset_num, body);
+        if (result) {
+            writer.begin_object(std::to_string(preset_num).c_str());
+            result = preset_record_to_stream(body, writer);
+            writer.end_object();
+            if (!result)
+                printf("convert: error converting preset %u\r\n", preset_num);
+        }
+    }
+    writer.end_object();
+    return writer.flush() && result;
+}
+
+bool rppicomidi::Midi_processor_manager::preset_stream_to_record(char* json_format, const char* preset, size_t preset_span,
+    uint8_t preset_num, Settings_blob_writer& file)
+{
+    // count the MIDI IN and MIDI OUT cables
+    uint8_t nmidi_in = 0, nmidi_out = 0;
+    const char* key;
+    size_t key_len;
+    Json_stream_reader cables(preset, preset_span);
+    bool result = cables.begin_object();
+    while (result && cables.next_member(key, key_len)) {
+        if (key_len >= 7 && strncmp(key, "MIDI IN", 7) == 0)
+            ++nmidi_in;
+        else if (key_len >= 8 && strncmp(key, "MIDI OUT", 8) == 0)
+            ++nmidi_out;
+        result = cables.skip_value();
+    }
+    if (!result || cables.is_error())
+        return false;
+    file.put(preset_num);
+    size_t offset = file.begin_length<uint32_t>();
+    file.put(nmidi_in);
+    file.put(nmidi_out);
+    for (uint8_t idx = 0; result && idx < nmidi_in + nmidi_out; idx++) {
+        const bool is_midi_in = idx < nmidi_in;
+        std::string midi_name = is_midi_in ? std::string{"MIDI IN"}+std::to_string(idx+1) :
+            std::string{"MIDI OUT"}+std::to_string(idx-nmidi_in+1);
+        // the cables may be in any order in the document
+        const char* procs = nullptr;
+        size_t procs_span = 0;
+        Json_stream_reader reader(preset, preset_span);
+        reader.begin_object();
+        while (reader.next_member(key, key_len)) {
+            if (Json_stream_reader::key_is(key, key_len, midi_name.c_str())) {
+                reader.skip_value(&procs, &procs_span);
+                break;
+            }
+            reader.skip_value();
+        }
+        if (procs == nullptr) {
+            printf("convert: %s not found\r\n", midi_name.c_str());
             result = false;
+            break;
         }
+        result = cable_stream_to_record(json_format, procs, procs_span, file);
+    }
+    file.end_length<uint32_t>(offset);
+    const uint8_t* body = file.get_data() + offset + sizeof(uint32_t);
+    file.put(settings_crc32(body, file.size() - offset - sizeof(uint32_t)));
+    return result;
+}
+
+bool rppicomidi::Midi_processor_manager::cable_stream_to_record(char* json_format, const char* procs, size_t procs_span,
+    Settings_blob_writer& file)
+{
+    const char* key;
+    size_t key_len;
+    uint8_t nprocs = 0;
+    Json_stream_reader counter(procs, procs_span);
+    bool result = counter.begin_object();
+    while (result && counter.next_member(key, key_len)) {
+        ++nprocs;
+        result = counter.skip_value();
+    }
+    if (!result || counter.is_error())
+        return false;
+    file.put(nprocs);
+    Json_stream_reader reader(procs, procs_span);
+    reader.begin_object();
+    while (result && reader.next_member(key, key_len)) {
+        const char* value;
+        size_t span;
+        result = reader.skip_value(&value, &span);
+        if (!result)
+            break;
+        char proc_type_label[key_len+1];
+        memcpy(proc_type_label, key, key_len);
+        proc_type_label[key_len] = '\0';
+        char* dollar_ptr = strrchr(proc_type_label,'$');
+        if (dollar_ptr != nullptr)
+            *dollar_ptr = '\0';
+        size_t proc_type_idx = get_midi_processor_idx_by_name(proc_type_label);
+        if (proc_type_idx >= get_num_midi_processor_types() ) {
+            printf("convert: new processor name %s not found\r\n", proc_type_label);
+            result = false;
+            break;
+        }
+        // Only this processor's settings are parsed to a DOM, in the arena
+        Json_arena_scope arena;
+        JSON_Value* proc_value = parse_json_span(json_format, value, span);
+        auto proc = proclist[proc_type_idx].processor(unique_id++);
+        result = proc_value && json_value_get_type(proc_value) == JSONObject &&
+            proc->deserialize_settings(json_value_get_object(proc_value));
+        if (result)
+            serialize_processor(file, proc);
+        else
+            printf("convert: failed to deserialize settings for %s\r\n", proc_type_label);
+        delete proc;
+        if (proc_value)
+            json_value_free(proc_value);
     }
-    if (root_value)
-        json_value_free(root_value);
-    if (result)
-        dirty = false;
     return result;
 }
 
-bool rppicomidi::Midi_processor_manager::get_product_string_from_setting_data(char* json_format, char* product_string, size_t max_string)
+JSON_Value* rppicomidi::Midi_processor_manager::parse_json_span(char* json_format, const char* value, size_t span)
+{
+    // Terminate the value in place so only it gets parsed, then put back the character after it
+    char* value_ptr = json_format + (value - json_format);
+    char saved = value_ptr[span];
+    value_ptr[span] = '\0';
+    JSON_Value* json_value = json_parse_string(value_ptr);
+    value_ptr[span] = saved;
+    return json_value;
+}
+
+bool rppicomidi::Midi_processor_manager::convert_from_json(char* json_format, Device_settings& settings)
+{
+    // Stream through the document so that only one processor's settings at a time are parsed to a DOM
+    Json_stream_reader reader(json_format, strlen(json_format));
+    Json_convert_state state;
+    begin_convert_from_json(state, settings);
+    bool result = reader.begin_object();
+    const char* key;
+    size_t key_len;
+    while (result && reader.next_member(key, key_len)) {
+        const char* value;
+        size_t span;
+        result = reader.skip_value(&value, &span) && convert_json_member(state, json_format, key, key_len, value, span);
+    }
+    if (!result || reader.is_error())
+        state.result = false;
+    return end_convert_from_json(state);
+}
+
+void rppicomidi::Midi_processor_manager::begin_convert_from_json(Json_convert_state& state, Device_settings& settings)
+{
+    state.settings = &settings;
+    state.id[0] = '\0';
+    state.prod[0] = '\0';
+    state.has_id = false;
+    state.has_prod = false;
+    state.result = true;
+    state.trigger.load_defaults();
+    settings.current_preset = 0;
+    settings.presets.clear();
+    settings.presets.resize(current_preset.get_max() - current_preset.get_min() + 1);
+}
+
+bool rppicomidi::Midi_processor_manager::convert_json_member(Json_convert_state& state, char* json_format,
+    const char* key, size_t key_len, const char* value, size_t span)
+{
+    if (!state.result)
+        return false;
+    Json_stream_reader reader(value, span);
+    if (Json_stream_reader::key_is(key, key_len, "id")) {
+        state.result = state.has_id = reader.get_string(state.id, sizeof(state.id));
+    }
+    else if (Json_stream_reader::key_is(key, key_len, "prod")) {
+        state.result = state.has_prod = reader.get_string(state.prod, sizeof(state.prod));
+    }
+    else if (Json_stream_reader::key_is(key, key_len, current_preset.get_name())) {
+        double number;
+        state.result = reader.get_number(number);
+        state.settings->current_preset = number;
+    }
+    else if (Json_stream_reader::key_is(key, key_len, "preset trigger")) {
+        // The trigger's DOM is allocated in the arena and released with it
+        Json_arena_scope arena;
+        JSON_Value* root_value = json_value_init_object();
+        JSON_Value* trigger_value = parse_json_span(json_format, value, span);
+        if (trigger_value)
+            json_object_set_value(json_value_get_object(root_value), "preset trigger", trigger_value);
+        state.trigger.deserialize(json_value_get_object(root_value));
+        json_value_free(root_value);
+    }
+    else {
+        int preset_num = 0;
+        if (key_len == 1)
+            preset_num = key[0] - '0';
+        if (preset_num >= current_preset.get_min() && preset_num <= current_preset.get_max()) {
+            Settings_blob_writer file(state.settings->presets[preset_num - current_preset.get_min()]);
+            state.result = preset_stream_to_record(json_format, value, span, preset_num, file);
+        }
+        // ignore any other member
+    }
+    return state.result;
+}
+
+bool rppicomidi::Midi_processor_manager::end_convert_from_json(Json_convert_state& state)
+{
+    if (!state.result) {
+        printf("convert: could not parse JSON settings\r\n");
+        return false;
+    }
+    unsigned file_vid, file_pid;
+    if (!state.has_id || sscanf(state.id, "%4x-%4x", &file_vid, &file_pid) != 2 || !state.has_prod) {
+        printf("convert: JSON settings have no device ID\r\n");
+        return false;
+    }
+    state.settings->device.clear();
+    Settings_blob_writer device_file(state.settings->device);
+    serialize_device_record(device_file, file_vid, file_pid, state.prod, state.trigger);
+    return true;
+}
+
+void rppicomidi::Midi_processor_manager::free_preset_image(Preset_image& image)
+{
+    for (auto& cable_processors: image.midi_in_processors) {
+        for (auto& proc: cable_processors) {
+            delete proc.proc;
+            delete proc.view;
+        }
+        cable_processors.clear();
+    }
+    for (auto& cable_processors: image.midi_out_processors) {
+        for (auto& proc: cable_processors) {
+            delete proc.proc;
+            delete proc.view;
+        }
+        cable_processors.clear();
+    }
+    for (auto& fns: image.midi_in_proc_fns) {
+        fns.clear();
+    }
+    for (auto& fns: image.midi_out_proc_fns) {
+        fns.clear();
+    }
+    image.processors_with_tasks.clear();
+    image.is_stale = true;
+}
+
+void rppicomidi::Midi_processor_manager::init_preset_image(Preset_image& image)
+{
+    image.midi_in_processors.resize(midi_in_processors.size());
+    image.midi_in_proc_fns.resize(midi_in_processors.size());
+    image.midi_out_processors.resize(midi_out_processors.size());
+    image.midi_out_proc_fns.resize(midi_out_processors.size());
+    image.is_stale = true;
+}
+
+void rppicomidi::Midi_processor_manager::swap_preset_image(Preset_image& image)
+{
+    midi_in_processors.swap(image.midi_in_processors);
+    midi_out_processors.swap(image.midi_out_processors);
+    midi_in_proc_fns.swap(image.midi_in_proc_fns);
+    midi_out_proc_fns.swap(image.midi_out_proc_fns);
+    processors_with_tasks.swap(image.processors_with_tasks);
+}
+
+bool rppicomidi::Midi_processor_manager::is_modified()
+{
+    bool modified = dirty;
+    for (auto in_cable = midi_in_processors.begin(); !modified && in_cable != midi_in_processors.end(); in_cable++) {
+        for (auto proc = in_cable->begin(); !modified && proc != in_cable->end(); proc++) {
+            modified = proc->proc->not_saved();
+        }
+    }
+    for (auto out_cable = midi_out_processors.begin(); !modified && out_cable != midi_out_processors.end(); out_cable++) {
+        for (auto proc = out_cable->begin(); !modified && proc != out_cable->end(); proc++) {
+            modified = proc->proc->not_saved();
+        }
+    }
+    return modified;
+}
+
+void rppicomidi::Midi_processor_manager::stash_and_swap(uint8_t preset_num)
+{
+    release_active_notes();
+    auto& current_image = get_preset_image(current_preset.get());
+    // Unsaved changes to the current preset get discarded next time it is loaded
+    bool current_is_stale = is_modified();
+    swap_preset_image(current_image);
+    current_image.is_stale = current_is_stale;
+    swap_preset_image(get_preset_image(preset_num));
+    current_preset.set(preset_num);
+}
+
+bool rppicomidi::Midi_processor_manager::swap_in_preset(uint8_t preset_num)
 {
-    JSON_Value* root_value= json_parse_string(json_format);
-    JSON_Object *root_object = NULL;
     bool result = false;
-    if (root_value && json_value_get_type(root_value) == JSONObject) {
-        root_object = json_value_get_object(root_value);
-        if (json_object_has_value_of_type(root_object, "prod", JSONString)) {
-            size_t len = json_object_get_string_len(root_object, "prod");
-            if (len < max_string) {
-                const char* prod = json_object_get_string(root_object, "prod");
-                if (prod) {
-                    strncpy(product_string, prod, max_string);
-                    result = true;
-                }
-                else {
-                    printf("error retrieving product string from JSON data\r\n");
-                }
+    if (preset_num >= current_preset.get_min() && preset_num <= current_preset.get_max() && preset_images.size() != 0) {
+        if (preset_num == current_preset.get()) {
+            result = !is_modified();
+        }
+        else if (!get_preset_image(preset_num).is_stale) {
+            stash_and_swap(preset_num);
+            dirty = false;
+            result = true;
+        }
+    }
+    return result;
+}
+
+bool rppicomidi::Midi_processor_manager::select_preset(uint8_t preset_num)
+{
+    mutex_enter_blocking(&processing_mutex);
+    bool result = swap_in_preset(preset_num);
+    mutex_exit(&processing_mutex);
+    return result;
+}
+
+bool rppicomidi::Midi_processor_manager::handle_preset_trigger(uint8_t cable, bool is_midi_in, const uint8_t* packet)
+{
+    uint8_t value;
+    if (!preset_trigger.match(cable, is_midi_in, packet, value))
+        return false;
+    uint8_t preset_num = value + current_preset.get_min();
+    if (preset_num <= current_preset.get_max()) {
+        triggered_us.store(time_us_32());
+        triggered_preset.store(preset_num);
+        ntriggers.store(ntriggers.load() + 1);
+    }
+    return true;
+}
+
+void rppicomidi::Midi_processor_manager::switch_triggered_preset()
+{
+    uint32_t ntriggered = ntriggers.load();
+    if (ntriggered == ntriggers_handled)
+        return;
+    ntriggers_handled = ntriggered;
+    uint8_t preset_num = triggered_preset.load();
+    uint32_t start = triggered_us.load();
+    if (preset_num == current_preset.get())
+        return; // nothing to do
+    mutex_enter_blocking(&processing_mutex);
+    bool swapped = swap_in_preset(preset_num);
+    mutex_exit(&processing_mutex);
+    if (swapped) {
+        uint32_t elapsed = time_us_32() - start;
+        ++switch_stats.nswitches;
+        switch_stats.last_us = elapsed;
+        if (elapsed > switch_stats.max_us)
+            switch_stats.max_us = elapsed;
+    }
+    else {
+        // The preset must be rebuilt from the settings file
+        ++switch_stats.ndeferred;
+        load_preset(preset_num);
+    }
+}
+
+void rppicomidi::Midi_processor_manager::add_all_cli_commands(EmbeddedCli *cli)
+{
+    assert(embeddedCliAddBinding(cli, {
+        "preset-trigger",
+        "display preset trigger settings and preset switch times. usage: preset-trigger",
+        false,
+        this,
+        static_preset_trigger_status
+    }));
+    assert(embeddedCliAddBinding(cli, {
+        "proc-sizes",
+        "display the RAM each MIDI processor type uses per instance. usage: proc-sizes",
+        false,
+        this,
+        static_print_processor_sizes
+    }));
+    assert(embeddedCliAddBinding(cli, {
+        "midi-in-queue",
+        "display the packets core0 queued for the USB device interface. usage: midi-in-queue [reset]",
+        true,
+        this,
+        static_print_midi_in_queue
+    }));
+}
+
+void rppicomidi::Midi_processor_manager::static_print_processor_sizes(EmbeddedCli*, char*, void* context)
+{
+    auto me = reinterpret_cast<Midi_processor_manager*>(context);
+    printf("%-22s %6s %6s %6s\r\n", "processor type", "sizeof", "heap", "in use");
+    for (auto& type: me->proclist) {
+        // Make a throwaway instance to see what its members allocate
+        uint32_t heap_before = mem_get_tag_bytes(MEM_TAG_PROCESSORS);
+        Midi_processor* proc;
+        {
+            Mem_tag_scope tag(MEM_TAG_PROCESSORS);
+            proc = type.processor(0);
+        }
+        uint32_t heap = mem_get_tag_bytes(MEM_TAG_PROCESSORS) - heap_before;
+        delete proc;
+        // count the instances in every cable's processing chain in both directions
+        size_t nused = 0;
+        for (auto& chain: me->midi_in_processors) {
+            for (auto& element: chain) {
+                if (strcmp(element.proc->get_name(), type.name) == 0)
+                    ++nused;
             }
         }
-        else {
-            printf("Could not parse product string from settings\r\n");
+        for (auto& chain: me->midi_out_processors) {
+            for (auto& element: chain) {
+                if (strcmp(element.proc->get_name(), type.name) == 0)
+                    ++nused;
+            }
         }
+        printf("%-22s %6u %6lu %6u\r\n", type.name, type.size, heap, nused);
+    }
+    printf("heap is the memory the members of one instance allocate; a\r\n");
+    printf("processor that does not fit the slab also uses sizeof bytes of heap\r\n");
+}
+
+void rppicomidi::Midi_processor_manager::static_print_midi_in_queue(EmbeddedCli*, char* args, void* context)
+{
+    auto me = reinterpret_cast<Midi_processor_manager*>(context);
+    if (embeddedCliGetTokenCount(args) == 1 && strcmp(embeddedCliGetToken(args, 1), "reset") == 0) {
+        me->midi_in_queue_drops = 0;
+        return;
+    }
+    printf("MIDI IN queue: %u of %u packets waiting, %lu packets dropped because it was full\r\n",
+        queue_get_level(&me->midi_in_queue), midi_in_queue_len, me->midi_in_queue_drops);
+}
+
+void rppicomidi::Midi_processor_manager::static_preset_trigger_status(EmbeddedCli*, char*, void* context)
+{
+    auto me = reinterpret_cast<Midi_processor_manager*>(context);
+    me->preset_trigger.print();
+    printf("current preset %u\r\n", me->current_preset.get());
+    printf("triggered switches: %lu fast, %lu from settings file\r\n", me->switch_stats.nswitches, me->switch_stats.ndeferred);
+    if (me->switch_stats.nswitches > 0) {
+        printf("trigger to fast switch time: last %lu us, max %lu us\r\n", me->switch_stats.last_us, me->switch_stats.max_us);
+    }
+}
+
+bool rppicomidi::Midi_processor_manager::load_preset(uint8_t preset)
+{
+    if (select_preset(preset))
+        return true;
+    bool result = Settings_file::instance().load_preset(preset);
+    if (result) {
+        dirty = false;
     }
-    if (root_value)
-        json_value_free(root_value);
     return result;
-}
\ No newline at end of file
+}
+
+bool rppicomidi::Midi_processor_manager::store_preset(uint8_t preset)
+{
+    bool result = false;
+    uint8_t previous_preset = current_preset.get();
+    if (current_preset.set(preset)) {
+        if (preset != previous_preset && preset_images.size() != 0) {
+            // The current processing chains become the new preset's image. The
+            // previous preset's image is no longer in RAM, so mark it stale.
+            mutex_enter_blocking(&processing_mutex);
+            auto& previous_image = get_preset_image(previous_preset);
+            auto& image = get_preset_image(preset);
+            std::swap(previous_image, image);
+            free_preset_image(previous_image);
+            mutex_exit(&processing_mutex);
+        }
+        result = Settings_file::instance().start_store(static_store_progress, this);
+        dirty = !result;
+    }
+    return result;
+}
+
+void rppicomidi::Midi_processor_manager::static_store_progress(void* context, Fs_job&, Fs_job::Step_result result)
+{
+    if (result == Fs_job::STEP_ERROR) {
+        auto me = reinterpret_cast<Midi_processor_manager*>(context);
+        printf("error storing the preset\r\n");
+        me->dirty = true;
+    }
+}
+
+bool rppicomidi::Midi_processor_manager::get_product_string_from_setting_data(const char* json_format, char* product_string, size_t max_string)
+{
+    // Only the product string is needed, so read the document without parsing it to a DOM
+    Json_stream_reader reader(json_format, strlen(json_format));
+    bool result = reader.begin_object();
+    const char* key;
+    size_t key_len;
+    while (result && reader.next_member(key, key_len)) {
+        if (Json_stream_reader::key_is(key, key_len, "prod"))
+            return reader.get_string(product_string, max_string);
+        result = reader.skip_value();
+    }
+    printf("Could not parse product string from settings\r\n");
+    return false;
+}
+
+bool rppicomidi::Midi_processor_manager::get_product_string_from_setting_data(const uint8_t* data, size_t len, char* product_string, size_t max_string)
+{
+    Settings_blob_reader file(data, len);
+    Device_record header;
+    if (!read_device_record(file, header) || strlen(header.prod) >= max_string)
+        return false;
+    strcpy(product_string, header.prod);
+    return true;
+}
@@ -36,9 +36,14 @@
  */
 #pragma once
 #include <vector>
+#include <atomic>
+#include "settings_blob.h"
 #include "midi_processor.h"
+#include "midi_note_tracker.h"
+#include "preset_trigger.h"
 #include "midi_processor_settings_view.h"
 #include "pico/mutex.h"
+#include "pico/util/queue.h"
 #include "view.h"
 #include "settings_file.h"
 #include "setting_number.h"
@@ -50,6 +55,7 @@ class Midi_processor_manager
 {
 private:
     typedef Midi_processor* (*mp_factory_fn)(uint16_t unique_id);
+    typedef void (*packet_writer_fn)(uint8_t* packet);
     typedef Midi_processor_settings_view* (*mpsv_factory_fn)(Mono_graphics& screen_, const Rectangle& rect_, Midi_processor* proc_);
     /**
      * @brief Midi_processor ptr with a flag to choose whether to call the process() 
@@ -61,6 +67,16 @@ private:
         bool is_feedback;       //!< if true, call proc->feedback(); otherwise call proc->process().
     };
 
+    /**
+     * @brief Midi_processor ptr with the processing chain its task() output feeds
+     */
+    struct Midi_processor_task
+    {
+        Midi_processor* proc;   //!< pointer to the Midi_processor whose task() function is called
+        uint8_t cable;          //!< the virtual cable number of the processing chain
+        bool is_midi_in;        //!< true if the processor is in the MIDI IN chain
+    };
+
 public:
     // Singleton Pattern
 
@@ -78,6 +94,9 @@ public:
     Midi_processor_manager(Midi_processor_manager const&) = delete;
     void operator=(Midi_processor_manager const&) = delete;
 
+    /**
+     * @brief add the manager's CLI commands to the cli
+     */
     void add_all_cli_commands(EmbeddedCli *cli);
     /**
      * @brief Get the number of MIDI Processor types
@@ -115,8 +134,9 @@ public:
      * @param cable is the virtual cable number from 0
      * @param is_midi_in is true if the processor is for the MIDI IN direction, false for the OUT direction
      * @return a pointer to the newly added Midi_processor object
+     * @note the processor's settings view is not created until open_midi_processor_view()
      */
-    Midi_processor_settings_view* add_new_midi_processor_by_idx(size_t idx, uint8_t cable, bool is_midi_in);
+    Midi_processor* add_new_midi_processor_by_idx(size_t idx, uint8_t cable, bool is_midi_in);
 
     /**
      * @brief delete a MIDI processor based on its current index in the processing list
@@ -156,21 +176,25 @@ public:
         return retval;
     }
 
-    Midi_processor_settings_view* get_midi_processor_view_by_index(size_t idx, uint8_t cable, bool is_midi_in)
-    {
-        Midi_processor_settings_view* retval = nullptr;
-        if (is_midi_in && cable < midi_in_processors.size()) {
-            if (idx < midi_in_processors[cable].size()) {
-                retval = midi_in_processors[cable][idx].view;
-            }
-        }
-        else if (!is_midi_in && cable < midi_out_processors.size()) {
-            if (idx < midi_out_processors[cable].size()) {
-                retval = midi_out_processors[cable][idx].view;
-            }
-        }
-        return retval;
-    }
+    /**
+     * @brief get the settings view for a MIDI processor, creating it if this
+     * is the first time the user opened it
+     *
+     * @param idx location in the midi_processors array
+     * @param cable the USB virtual cable number from 0
+     * @param is_midi_in true if direction is MIDI IN, false for MIDI OUT
+     * @return a pointer to the settings view or nullptr if idx is out of range
+     */
+    Midi_processor_settings_view* open_midi_processor_view(size_t idx, uint8_t cable, bool is_midi_in);
+
+    /**
+     * @brief delete every settings view opened for the cable number and
+     * direction. The processors are not affected.
+     *
+     * @param cable the USB virtual cable number from 0
+     * @param is_midi_in true if direction is MIDI IN, false for MIDI OUT
+     */
+    void close_midi_processor_views(uint8_t cable, bool is_midi_in);
 
     /**
      * @brief Initialize the processor lists for the newly connected device
@@ -211,6 +235,34 @@ public:
      */
     void task();
 
+    /**
+     * @brief send the MIDI IN packets that core0 queued to the Pico's USB device interface
+     *
+     * The USB device MIDI FIFO allows only one writer, and core1 writes
+     * the packets that pass filter_midi_in(), so call this from core1.
+     */
+    void send_queued_midi_in();
+
+    /**
+     * @brief return true if core1 has sent every MIDI IN packet core0 queued
+     */
+    bool is_midi_in_queue_empty() { return queue_is_empty(&midi_in_queue); }
+
+    /**
+     * @brief Set the functions that send packets generated by processors
+     * in addition to the packets passed to filter_midi_in() and filter_midi_out()
+     *
+     * @param midi_in_writer_ sends a packet to the Pico's USB device interface;
+     * it is only called on core1
+     * @param midi_out_writer_ sends a packet to the connected MIDI device;
+     * it is only called on core0
+     */
+    void set_packet_writers(packet_writer_fn midi_in_writer_, packet_writer_fn midi_out_writer_)
+    {
+        midi_in_writer = midi_in_writer_;
+        midi_out_writer = midi_out_writer_;
+    }
+
     /**
      * @brief Set the screen object
      *
@@ -221,82 +273,208 @@ public:
     void set_screen(Mono_graphics* screen_) {screen = screen_;}
 
     /**
-     * @brief serialize to a JSON-formatted string the current settings
-     * of all processors on all MIDI INs and MIDI OUTs for the specified
-     * preset number.
+     * @brief serialize the device record: the settings that apply to
+     * every preset of the connected device
+     *
+     * The device record and the preset records are little-endian. The device record is:
+     * - uint32_t magic number preset_file_magic ("PUMP")
+     * - uint16_t format version preset_file_version
+     * - uint16_t idVendor and uint16_t idProduct of the connected device
+     * - the product string: uint8_t length followed by the characters
+     * - the preset trigger settings: uint8_t length followed by the settings blob
+     *
+     * @param data set to the device record
+     */
+    void serialize_device(std::vector<uint8_t>& data);
+
+    /**
+     * @brief serialize the preset record for the current settings of
+     * all processors on all MIDI INs and MIDI OUTs
+     *
+     * The preset record is:
+     * - uint8_t preset number
+     * - uint32_t length of the record body
+     * - the record body: uint8_t number of MIDI IN cables, uint8_t number of
+     * MIDI OUT cables, then for every MIDI IN cable followed by every MIDI OUT cable,
+     * uint8_t number of processors followed by each processor's type tag (its
+     * name as an uint8_t length followed by the characters) and settings blob
+     * (uint16_t length followed by what Midi_processor::serialize_blob() writes)
+     * - uint32_t CRC-32 of the record body
      *
      * @param preset_num the preset number to which the current settings
      * of all processors will be stored.
-     * @param previous_serialized_string the previous serialization string
-     * for this device as read from the Settings_file or nullptr if no
-     * previous value had been stored.
-     * @return char* the serialized string or nullptr if preset_num is out
-     * of range
+     * @param data set to the preset record
+     * @return true if successful or false if preset_num is out of range
      * @note a side effect of this function is to change the current
      * preset to preset_num.
      */
-    char* serialize(uint8_t preset_num, char* previous_serialized_string);
-
-    /**
-     * @brief Create a JSON object with current preset to 1 and all presets
-     * empty of processors, serialize it and return the serialized value
-     * 
-     * @return char* the serialized default JSON object
-     */
-    char* serialize_default();
+    bool serialize_preset(uint8_t preset_num, std::vector<uint8_t>& data);
 
     /**
-     * @brief deserialize the JSON-formatted string to the settings
+     * @brief deserialize the device record and preset records to the settings
      * of all processors on all MIDI INs and MIDI OUTs. If a MIDI IN
      * or MIDI OUT does not have a processor corresponding to the settings,
      * allocate a new one first
      *
-     * @param json_format the device settings formatted as a JSON string
+     * The settings of every preset are deserialized to a preset image
+     * so that load_preset() does not need to read the settings files again.
+     * Presets with no record have no processors. If there is no device record,
+     * the device settings are set to defaults.
+     *
+     * @param settings the records of the connected device
      * @return true if deserialization was successful
      * @return false if deserialization failed
-     * @note this method will change the current preset to the value
-     * specified in json_format string
+     * @note this method will change the current preset to settings.current_preset
      */
-    bool deserialize(char* json_format);
+    bool deserialize(const Device_settings& settings);
 
     /**
      * @brief deserialize a specific preset instead of the serialized
      * value of the current_preset setting
      *
      * @param preset_num the preset number to deserialize
-     * @param json_format the device settings formatted as a JSON string
+     * @param record the preset record or nullptr if the preset
+     * has never been stored
+     * @param len the number of bytes in the preset record
      * @return true true if deserialization was successful
      * @return false false if deserialization failed
-     * @note this method will change the current preset setting to
-     * preset_num. The caller of this function should call serialize
-     * again and store the result so that the current preset setting
-     * is correctly written to flash.
+     * @note if successful, this method will change the current preset setting to
+     * preset_num. If not, the current preset and its processors do not change.
+     */
+    bool deserialize_preset(uint8_t preset_num, const uint8_t* record, size_t len);
+    bool deserialize_preset(uint8_t preset_num, const std::vector<uint8_t>& record)
+    {
+        return deserialize_preset(preset_num, record.data(), record.size());
+    }
+
+    /**
+     * @brief write the records of a device in the JSON format
+     * used for backups on a USB flash drive
+     *
+     * The JSON document is written in small chunks as it is formatted,
+     * so it is never all in memory at once.
+     * @param settings the records of the device
+     * @param writer the stream to write the JSON document to
+     * @return true if successful, false if the records are not valid
+     * or if the writer failed
      */
-    bool deserialize_preset(uint8_t preset_num, char* json_format);
+    bool convert_to_json(const Device_settings& settings, Json_stream_writer& writer);
+
+    /**
+     * @brief convert JSON-formatted settings from a USB flash drive backup
+     * to the records of a device
+     *
+     * The document is read as a stream and only the settings of one
+     * processor at a time are parsed to a DOM, so the peak heap use is
+     * about the size of the largest processor's DOM instead of the DOM of
+     * the whole document.
+     * @param json_format the device settings formatted as a JSON string.
+     * It is modified while this function runs and restored before it returns.
+     * @param settings set to the records of the device
+     * @return true if successful, false if json_format is not valid
+     */
+    bool convert_from_json(char* json_format, Device_settings& settings);
+
+    /**
+     * @brief the state of a JSON conversion that gets the top level
+     * members of the document one at a time
+     */
+    struct Json_convert_state {
+        Device_settings* settings;          //!< the records being built
+        char id[16];                        //!< the "id" member
+        char prod[MAX_PROD_STR_NAME+1];     //!< the "prod" member
+        bool has_id;
+        bool has_prod;
+        bool result;                        //!< false after any member fails to convert
+        Preset_trigger trigger;             //!< the "preset trigger" member
+    };
+
+    /**
+     * @brief start a conversion like convert_from_json() for a document that
+     * is read a member at a time
+     *
+     * Pass each top level member to convert_json_member(), then call
+     * end_convert_from_json().
+     * @param state the conversion state
+     * @param settings the records to build
+     */
+    void begin_convert_from_json(Json_convert_state& state, Device_settings& settings);
+
+    /**
+     * @brief convert one top level member of a JSON settings document
+     *
+     * @param state the conversion state
+     * @param json_format the buffer that holds the member. The character after
+     * the value is changed while this function runs and restored before it returns.
+     * @param key the member's key; it is not null terminated
+     * @param key_len the number of characters in key
+     * @param value points to the first character of the member's value in json_format
+     * @param span the number of characters in the value
+     * @return true if successful, false if the member is not valid
+     */
+    bool convert_json_member(Json_convert_state& state, char* json_format, const char* key, size_t key_len,
+        const char* value, size_t span);
+
+    /**
+     * @brief finish a conversion and write the device record
+     *
+     * @return true if every member converted and the document has a device ID
+     */
+    bool end_convert_from_json(Json_convert_state& state);
 
     uint8_t get_current_preset() {return current_preset.get(); }
 
     bool needs_store();
 
-    bool load_preset(uint8_t preset)
-    {
-        bool result = Settings_file::instance().load_preset(preset);
-        if (result) {
-            dirty = false;
-        }
-        return result;
-    }
-    bool store_preset(uint8_t preset)
-    {   bool result = false;;
-        if (current_preset.set(preset)) {
-            result = Settings_file::instance().store();
-            dirty = result != 0;
-        }
-        return result;
-    }
+    /**
+     * @brief make preset the current preset
+     *
+     * If the preset's cached image matches flash, this just swaps processing
+     * chains. Otherwise, it rebuilds the preset from the settings file.
+     *
+     * @param preset the preset number to load
+     * @return true if successful, false otherwise
+     * @note unsaved changes to the current preset are discarded the next time
+     * the current preset is loaded
+     */
+    bool load_preset(uint8_t preset);
+
+    /**
+     * @brief make preset the current preset and queue a job to store it
+     *
+     * The settings are serialized now and written to flash a record at a
+     * time from the main loop, so MIDI keeps flowing while they are written.
+     * @param preset the preset number to store
+     * @return true if the store job is queued, false otherwise
+     */
+    bool store_preset(uint8_t preset);
+
+    /**
+     * @brief make preset_num the current preset if its cached image matches flash
+     *
+     * Sends note off messages for all sounding notes before it switches
+     * processing chains. It does not access the file system.
+     *
+     * @param preset_num the preset number to select
+     * @return true if the preset is now the current preset
+     * @return false if preset_num is out of range or the preset image must
+     * be rebuilt by calling load_preset()
+     */
+    bool select_preset(uint8_t preset_num);
+
+    /**
+     * @brief Get the preset trigger settings
+     */
+    Preset_trigger& get_preset_trigger() { return preset_trigger; }
     void clear_all_processors();
 
-    bool get_product_string_from_setting_data(char* json_format, char* product_string, size_t max_string);
+    bool get_product_string_from_setting_data(const char* json_format, char* product_string, size_t max_string);
+
+    /**
+     * @brief same as get_product_string_from_setting_data() for the binary
+     * device record
+     */
+    bool get_product_string_from_setting_data(const uint8_t* data, size_t len, char* product_string, size_t max_string);
 private:
     /**
      * @brief Construct a new Midi_processor_manager object
@@ -312,27 +490,338 @@ private:
      */
     void build_processor_structures();
 
+    /**
+     * @brief run packet through the processor functions in fns starting with fns[first]
+     *
+     * Call this with the processing_mutex locked.
+     *
+     * @param fns the processor function list for a cable and direction
+     * @param first the index of the first processor function to run
+     * @param packet the 4-byte USB MIDI packet
+     * @param cable the virtual cable number of the processing chain
+     * @param is_midi_in true if fns is a MIDI IN processing chain
+     * @return true if the packet should be sent on
+     * @return false if the packet should be discarded
+     */
+    bool run_chain(std::vector<Midi_processor_fn>& fns, size_t first, uint8_t* packet, uint8_t cable, bool is_midi_in);
+
+    /**
+     * @brief send all extra packets that fns[idx].proc generated through
+     * the rest of the processor functions in fns and then to the writer
+     * for the cable and direction.
+     *
+     * Call this with the processing_mutex locked.
+     */
+    void flush_extra_packets(std::vector<Midi_processor_fn>& fns, size_t idx, uint8_t cable, bool is_midi_in);
+
+    /**
+     * @brief send a packet to the Pico's USB device interface
+     *
+     * On core1 this calls midi_in_writer. On core0 it queues the packet
+     * for send_queued_midi_in(), or counts it as dropped if the queue is full.
+     */
+    void write_midi_in(uint8_t* packet);
+
+    /**
+     * @brief send a note off message for every note that is sounding
+     * on every cable in both directions
+     *
+     * Call this with the processing_mutex locked before changing any
+     * processing chain so that the note off messages the new chain
+     * sends cannot leave notes stuck on. Call this from core0. The note
+     * off messages to the Pico's USB device interface go in the MIDI IN
+     * queue behind the packets already there.
+     */
+    void release_active_notes();
+
+    /**
+     * @brief send a note off message for every note in midi_in_releases
+     *
+     * Call this from core1 with the processing_mutex locked.
+     */
+    void send_midi_in_releases();
+
     struct Mpf_element {
         const char* name;
         mp_factory_fn processor;
         mpsv_factory_fn view;
+        size_t size;            //!< sizeof the processor class, for the proc-sizes report
     };
     std::vector<Mpf_element> proclist;
     static uint16_t unique_id;
     mutex processing_mutex;
     struct Mpv_element {
         Midi_processor* proc;
-        Midi_processor_settings_view* view;
+        Midi_processor_settings_view* view; //!< nullptr until the user opens the settings view
+    };
+
+    /**
+     * @brief the processors and processing chains of one preset
+     *
+     * Swapping the vectors of a Preset_image with the manager's vectors
+     * of the same name changes the processing chains without allocating
+     * or freeing anything.
+     */
+    struct Preset_image {
+        std::vector<std::vector<Mpv_element>> midi_in_processors;
+        std::vector<std::vector<Mpv_element>> midi_out_processors;
+        std::vector<std::vector<Midi_processor_fn>> midi_in_proc_fns;
+        std::vector<std::vector<Midi_processor_fn>> midi_out_proc_fns;
+        std::vector<Midi_processor_task> processors_with_tasks;
+        bool is_stale;      //!< true if the image must be rebuilt from the settings file
     };
+
+    /**
+     * @brief delete every processor and view in image, empty all of
+     * its lists for every cable and mark it stale
+     *
+     * Call this with the processing_mutex locked if image may be swapped in.
+     */
+    void free_preset_image(Preset_image& image);
+
+    /**
+     * @brief build the lists of the processing chains from the processor lists
+     *
+     * The other build_processor_structures() functions call this for the
+     * current chains or for the chains of a preset image
+     */
+    static void build_processor_structures(std::vector<std::vector<Mpv_element>>& midi_in_processors,
+        std::vector<std::vector<Mpv_element>>& midi_out_processors, std::vector<std::vector<Midi_processor_fn>>& midi_in_proc_fns,
+        std::vector<std::vector<Midi_processor_fn>>& midi_out_proc_fns, std::vector<Midi_processor_task>& processors_with_tasks);
+
+    /**
+     * @brief same as build_processor_structures() for the chains in a preset image
+     */
+    void build_processor_structures(Preset_image& image);
+
+    /**
+     * @brief give image an empty processor list for every cable of the
+     * connected device and mark it stale
+     */
+    void init_preset_image(Preset_image& image);
+
+    /**
+     * @brief exchange the current processing chains with the ones in image
+     *
+     * Call this with the processing_mutex locked.
+     */
+    void swap_preset_image(Preset_image& image);
+
+    /**
+     * @brief Get the cached image for preset_num
+     *
+     * @param preset_num the preset number
+     * @return the image. preset_num must be in range
+     */
+    Preset_image& get_preset_image(uint8_t preset_num) { return preset_images[preset_num - current_preset.get_min()]; }
+
+    /**
+     * @brief move the current processing chains to the image for the current
+     * preset number and move the image for preset_num to the current processing
+     * chains
+     *
+     * Call this with the processing_mutex locked.
+     */
+    void stash_and_swap(uint8_t preset_num);
+
+    /**
+     * @return true if the current processing chains have changed since they were
+     * loaded or stored. Same as needs_store() but without the console output.
+     */
+    bool is_modified();
+
+    /**
+     * @brief same as select_preset() but call this with the processing_mutex locked
+     */
+    bool swap_in_preset(uint8_t preset_num);
+
+    /**
+     * @brief if packet is the preset trigger message, ask task() to select the preset
+     *
+     * The filters run on both cores and the UI reads the processing chains
+     * without the processing_mutex, so this only records the preset number.
+     * Call this with the processing_mutex locked.
+     *
+     * @param cable the virtual cable number from 0
+     * @param is_midi_in true if the packet is from the connected device
+     * @param packet the 4-byte USB MIDI packet
+     * @return true if the packet is the preset trigger message and should be discarded
+     */
+    bool handle_preset_trigger(uint8_t cable, bool is_midi_in, const uint8_t* packet);
+
+    /**
+     * @brief switch to the preset the last preset trigger message selected
+     *
+     * Call this from core0. If the preset image is stale, this loads the
+     * preset from the settings file.
+     */
+    void switch_triggered_preset();
+
+    static void static_preset_trigger_status(EmbeddedCli*, char*, void* context);
+
+    /**
+     * @brief the progress function of the job store_preset() queues
+     */
+    static void static_store_progress(void* context, Fs_job& job, Fs_job::Step_result result);
+    static void static_print_processor_sizes(EmbeddedCli*, char*, void* context);
+    static void static_print_midi_in_queue(EmbeddedCli*, char*, void* context);
+
+    /**
+     * @brief statistics for presets selected by the preset trigger
+     */
+    struct Preset_switch_stats {
+        uint32_t nswitches;     //!< number of switches that swapped preset images
+        uint32_t ndeferred;     //!< number of switches that needed the settings file
+        uint32_t last_us;       //!< microseconds from the last trigger message to the image swap
+        uint32_t max_us;        //!< the longest time from a trigger message to the image swap
+    };
+
+    /**
+     * @brief the decoded device record
+     */
+    struct Device_record {
+        uint16_t vid;                       //!< idVendor of the device
+        uint16_t pid;                       //!< idProduct of the device
+        char prod[MAX_PROD_STR_NAME+1];     //!< product string of the device
+        Settings_blob_reader trigger;       //!< the preset trigger settings blob
+    };
+
+    /**
+     * @brief read and check the device record
+     *
+     * @param file the device record
+     * @param header set to the decoded device record
+     * @return true if the record is valid, false otherwise
+     */
+    bool read_device_record(Settings_blob_reader& file, Device_record& header);
+
+    /**
+     * @brief write a device record
+     */
+    void serialize_device_record(Settings_blob_writer& file, uint16_t vid_, uint16_t pid_, const char* prod_str_, Preset_trigger& trigger);
+
+    /**
+     * @brief read the next preset record and check its CRC
+     *
+     * @param file the settings file positioned at a preset record
+     * @param preset_num set to the record's preset number
+     * @param body set to the record body
+     * @return true if the record is valid, false otherwise
+     */
+    bool read_preset_record(Settings_blob_reader& file, uint8_t& preset_num, Settings_blob_reader& body);
+
+    /**
+     * @brief write a preset record for the current processing chains
+     *
+     * Call this with the processing_mutex locked.
+     * @param file the settings file to write
+     * @param preset_num the preset number of the record
+     */
+    void serialize_preset_record(Settings_blob_writer& file, uint8_t preset_num);
+
+    /**
+     * @brief write the type tag and the settings blob of one processor
+     */
+    void serialize_processor(Settings_blob_writer& file, Midi_processor* proc);
+
+    /**
+     * @brief add the processors from the preset record body to image
+     *
+     * image must not be swapped in, so the processing_mutex does not
+     * need to be locked.
+     * @param body the preset record body
+     * @param image an image that init_preset_image() emptied
+     * @return true if successful, false otherwise. If not successful, image
+     * holds the processors read before the error.
+     */
+    bool deserialize_preset_record(Settings_blob_reader& body, Preset_image& image);
+
+    /**
+     * @brief same as deserialize_preset_record() for a whole preset record
+     *
+     * @param preset_num the expected preset number
+     * @param record the preset record
+     * @param len the number of bytes in record; 0 for a preset with no processors
+     * @param image an image that init_preset_image() emptied
+     * @return true if successful, false otherwise
+     */
+    bool deserialize_preset_data(uint8_t preset_num, const uint8_t* record, size_t len, Preset_image& image);
+
+    /**
+     * @brief parse one value in a JSON document to a DOM
+     *
+     * @param json_format the JSON document
+     * @param value points to the first character of the value in json_format
+     * @param span the number of characters in the value
+     * @return the DOM of the value or nullptr if it is not valid JSON.
+     * Free it with json_value_free().
+     */
+    static JSON_Value* parse_json_span(char* json_format, const char* value, size_t span);
+
+    /**
+     * @brief write the processors in the preset record body to the JSON object
+     * of one preset, in the same form serialize_settings() creates
+     */
+    bool preset_record_to_stream(Settings_blob_reader& body, Json_stream_writer& writer);
+
+    /**
+     * @brief write a preset record for the processors in the JSON object of one preset
+     *
+     * @param json_format the JSON document
+     * @param preset points to the JSON object of the preset in json_format
+     * @param preset_span the number of characters in the preset's JSON object
+     * @param preset_num the preset number
+     * @param file the preset record
+     * @return true if successful, false otherwise
+     */
+    bool preset_stream_to_record(char* json_format, const char* preset, size_t preset_span, uint8_t preset_num,
+        Settings_blob_writer& file);
+
+    /**
+     * @brief add the processors in the JSON object of one cable to a preset record
+     *
+     * Each processor's settings are parsed to a DOM, deserialized and freed
+     * before the next processor's settings are parsed.
+     * @param json_format the JSON document
+     * @param procs points to the JSON object of the cable's processors in json_format
+     * @param procs_span the number of characters in the cable's JSON object
+     * @param file the preset record
+     * @return true if successful, false otherwise
+     */
+    bool cable_stream_to_record(char* json_format, const char* procs, size_t procs_span, Settings_blob_writer& file);
+
+    static const uint32_t preset_file_magic = 0x504D5550;  //!< "PUMP" in little-endian order
+    static const uint16_t preset_file_version = 2;
+    static const size_t max_type_tag_length = 31;           //!< longest processor name in a preset record
+
     std::vector<std::vector<Mpv_element>> midi_in_processors;
     std::vector<std::vector<Mpv_element>> midi_out_processors;
     std::vector<std::vector<Midi_processor_fn>> midi_in_proc_fns;
     std::vector<std::vector<Midi_processor_fn>> midi_out_proc_fns;
-    std::vector<Midi_processor*> processors_with_tasks;
+    std::vector<Midi_processor_task> processors_with_tasks;
+    std::vector<Midi_note_tracker> midi_in_notes;   //!< notes sent to the Pico's USB device interface, per cable
+    std::vector<Midi_note_tracker> midi_out_notes;  //!< notes sent to the connected MIDI device, per cable
+    std::vector<Preset_image> preset_images;        //!< all presets; the current preset's image is empty
+    packet_writer_fn midi_in_writer;
+    packet_writer_fn midi_out_writer;
+    static const size_t midi_in_queue_len = 64;
+    queue_t midi_in_queue;          //!< packets core0 sends to the Pico's USB device interface
+    uint32_t midi_in_queue_drops;   //!< number of packets core0 dropped because midi_in_queue was full
+    std::vector<Midi_note_tracker> midi_in_releases;    //!< notes released on core0 that core1 must send note offs for, per cable
+    volatile bool midi_in_release_pending;              //!< true if midi_in_releases has notes
+    Preset_trigger preset_trigger;
+    Preset_switch_stats switch_stats;
+    // The preset trigger runs in the MIDI filters; task() switches presets on core0
+    std::atomic<uint8_t> triggered_preset;  //!< the preset the last preset trigger message selected
+    std::atomic<uint32_t> triggered_us;     //!< when the last preset trigger message arrived
+    std::atomic<uint32_t> ntriggers;        //!< number of preset trigger messages; changed with the processing_mutex locked
+    uint32_t ntriggers_handled;             //!< value of ntriggers when task() last switched presets
     Mono_graphics* screen;
     //Settings_file settings_file;
     Setting_number<uint8_t> current_preset;
     bool dirty;
+    uint16_t vid;       //!< idVendor of the connected device
+    uint16_t pid;       //!< idProduct of the connected device
     char id_str[10];
     char prod_str[MAX_PROD_STR_NAME+1];
 };
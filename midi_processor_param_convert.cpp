@@ -0,0 +1,330 @@
+/* MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "midi_processor_param_convert.h"
+#include "parson.h"
+
+const char* const rppicomidi::Midi_processor_param_convert::format_labels[NUM_FORMATS] = {"14-bit CC", "NRPN", "RPN", "Pitch Bend"};
+
+rppicomidi::Midi_processor_param_convert::Midi_processor_param_convert(uint16_t unique_id) :
+    Midi_processor{static_getname(), unique_id},
+    min_chan{"min_chan", 1, 16, 1}, max_chan{"max_chan", 1, 16, 16},
+    in_format{"In Format", format_labels, NUM_FORMATS},
+    in_param{"in_param", 0, 16383, 0},
+    out_format{"Out Format", format_labels, NUM_FORMATS},
+    out_param{"out_param", 0, 16383, 0},
+    timeout_ms{"timeout_ms", 1, 250, 20}
+{
+    mutex_init(&processing_mutex);
+    load_defaults();
+}
+
+void rppicomidi::Midi_processor_param_convert::reset_parsers()
+{
+    for (auto& state: parsers) {
+        state.cable = 0;
+        state.sel_msb = no_value;
+        state.sel_lsb = no_value;
+        state.held_select = no_value;
+        state.held_value = 0;
+        state.data_msb = no_value;
+        state.last_msb = 0;
+        state.deadline_ms = 0;
+    }
+    extra_packets.clear();
+}
+
+uint8_t rppicomidi::Midi_processor_param_convert::encode(uint8_t cable, uint8_t chan_idx, uint16_t value, uint8_t msgs[max_msgs_per_value][4])
+{
+    const uint8_t cc_header = (cable << 4) | 0xB;
+    const uint8_t cc_status = 0xB0 | chan_idx;
+    const uint8_t msb = (value >> 7) & 0x7f;
+    const uint8_t lsb = value & 0x7f;
+    uint8_t nmsgs = 0;
+    switch(out_format.get_ivalue()) {
+    case CC14_IDX:
+    {
+        uint8_t cc = out_param.get() & 0x1f;
+        msgs[nmsgs][0] = cc_header; msgs[nmsgs][1] = cc_status; msgs[nmsgs][2] = cc; msgs[nmsgs++][3] = msb;
+        msgs[nmsgs][0] = cc_header; msgs[nmsgs][1] = cc_status; msgs[nmsgs][2] = cc+32; msgs[nmsgs++][3] = lsb;
+        break;
+    }
+    case NRPN_IDX:
+    case RPN_IDX:
+    {
+        bool is_nrpn = out_format.get_ivalue() == NRPN_IDX;
+        msgs[nmsgs][0] = cc_header; msgs[nmsgs][1] = cc_status; msgs[nmsgs][2] = is_nrpn ? 99:101;
+        msgs[nmsgs++][3] = (out_param.get() >> 7) & 0x7f;
+        msgs[nmsgs][0] = cc_header; msgs[nmsgs][1] = cc_status; msgs[nmsgs][2] = is_nrpn ? 98:100;
+        msgs[nmsgs++][3] = out_param.get() & 0x7f;
+        msgs[nmsgs][0] = cc_header; msgs[nmsgs][1] = cc_status; msgs[nmsgs][2] = 6; msgs[nmsgs++][3] = msb;
+        msgs[nmsgs][0] = cc_header; msgs[nmsgs][1] = cc_status; msgs[nmsgs][2] = 38; msgs[nmsgs++][3] = lsb;
+        break;
+    }
+    case PITCH_BEND_IDX:
+    default:
+        msgs[nmsgs][0] = (cable << 4) | 0xE; msgs[nmsgs][1] = 0xE0 | chan_idx; msgs[nmsgs][2] = lsb; msgs[nmsgs++][3] = msb;
+        break;
+    }
+    return nmsgs;
+}
+
+bool rppicomidi::Midi_processor_param_convert::emit(uint8_t* packet, uint8_t chan_idx, uint16_t value)
+{
+    uint8_t msgs[max_msgs_per_value][4];
+    uint8_t nmsgs = encode(get_cable_num(packet), chan_idx, value, msgs);
+    if (extra_packets.get_free() < static_cast<size_t>(nmsgs - 1))
+        return false; // no room; drop the whole value rather than send part of it
+    for (uint8_t idx = 0; idx < nmsgs - 1; idx++) {
+        extra_packets.push(msgs[idx]);
+    }
+    memcpy(packet, msgs[nmsgs-1], 4);
+    return true;
+}
+
+void rppicomidi::Midi_processor_param_convert::emit_extra(uint8_t cable, uint8_t chan_idx, uint16_t value)
+{
+    uint8_t msgs[max_msgs_per_value][4];
+    uint8_t nmsgs = encode(cable, chan_idx, value, msgs);
+    if (extra_packets.get_free() < nmsgs)
+        return;
+    for (uint8_t idx = 0; idx < nmsgs; idx++) {
+        extra_packets.push(msgs[idx]);
+    }
+}
+
+void rppicomidi::Midi_processor_param_convert::release_held_select(uint8_t chan_idx)
+{
+    auto& state = parsers[chan_idx];
+    if (state.held_select != no_value) {
+        uint8_t held[4] = {static_cast<uint8_t>((state.cable << 4) | 0xB), static_cast<uint8_t>(0xB0 | chan_idx),
+            state.held_select, state.held_value};
+        extra_packets.push(held);
+        state.held_select = no_value;
+    }
+}
+
+bool rppicomidi::Midi_processor_param_convert::process_cc14(uint8_t* packet, Parser_state& state)
+{
+    const uint8_t chan_idx = packet[1] & 0xf;
+    const uint8_t cc = packet[2];
+    const uint16_t msb_cc = in_param.get();
+    if (msb_cc > 31)
+        return true; // not a 14-bit controller number; nothing to convert
+    if (cc == msb_cc) {
+        state.data_msb = packet[3];
+        state.deadline_ms = get_deadline();
+        return false; // wait for the LSB
+    }
+    if (cc == msb_cc + 32) {
+        if (state.data_msb != no_value) {
+            state.last_msb = state.data_msb;
+            state.data_msb = no_value;
+        }
+        return emit(packet, chan_idx, (static_cast<uint16_t>(state.last_msb) << 7) | packet[3]);
+    }
+    return true;
+}
+
+bool rppicomidi::Midi_processor_param_convert::process_nrpn(uint8_t* packet, Parser_state& state, uint8_t select_msb_cc, uint8_t select_lsb_cc)
+{
+    const uint8_t chan_idx = packet[1] & 0xf;
+    const uint8_t cc = packet[2];
+    const bool selected = state.sel_msb != no_value && state.sel_lsb != no_value &&
+        ((static_cast<uint16_t>(state.sel_msb) << 7) | state.sel_lsb) == in_param.get();
+    if (cc == select_msb_cc) {
+        // Hold this message until the parameter number LSB shows whether it should be converted
+        release_held_select(chan_idx);
+        state.sel_msb = packet[3];
+        state.sel_lsb = no_value;
+        state.data_msb = no_value;
+        state.held_select = cc;
+        state.held_value = packet[3];
+        state.deadline_ms = get_deadline();
+        return false;
+    }
+    if (cc == select_lsb_cc) {
+        state.sel_lsb = packet[3];
+        state.data_msb = no_value;
+        if (state.sel_msb != no_value && ((static_cast<uint16_t>(state.sel_msb) << 7) | state.sel_lsb) == in_param.get()) {
+            state.held_select = no_value;
+            return false; // this processor consumes the parameter select messages
+        }
+        release_held_select(chan_idx); // not the parameter to convert; pass it on ahead of this one
+        return true;
+    }
+    if (selected && cc == 6) {
+        state.data_msb = packet[3];
+        state.deadline_ms = get_deadline();
+        return false; // wait for the LSB
+    }
+    if (selected && cc == 38) {
+        if (state.data_msb != no_value) {
+            state.last_msb = state.data_msb;
+            state.data_msb = no_value;
+        }
+        return emit(packet, chan_idx, (static_cast<uint16_t>(state.last_msb) << 7) | packet[3]);
+    }
+    return true;
+}
+
+bool rppicomidi::Midi_processor_param_convert::process(uint8_t* packet)
+{
+    uint8_t chan = get_channel_num(packet);
+    if (chan < min_chan.get() || chan > max_chan.get())
+        return true;
+    mutex_enter_blocking(&processing_mutex);
+    auto& state = parsers[chan - 1];
+    state.cable = get_cable_num(packet);
+    uint8_t status = packet[1] & 0xf0;
+    bool result = true;
+    switch(in_format.get_ivalue()) {
+    case CC14_IDX:
+        if (status == 0xB0)
+            result = process_cc14(packet, state);
+        break;
+    case NRPN_IDX:
+        if (status == 0xB0)
+            result = process_nrpn(packet, state, 99, 98);
+        break;
+    case RPN_IDX:
+        if (status == 0xB0)
+            result = process_nrpn(packet, state, 101, 100);
+        break;
+    case PITCH_BEND_IDX:
+        if (status == 0xE0)
+            result = emit(packet, chan - 1, (static_cast<uint16_t>(packet[3] & 0x7f) << 7) | (packet[2] & 0x7f));
+        break;
+    default:
+        break;
+    }
+    mutex_exit(&processing_mutex);
+    return result;
+}
+
+void rppicomidi::Midi_processor_param_convert::task()
+{
+    const uint32_t now = to_ms_since_boot(get_absolute_time());
+    mutex_enter_blocking(&processing_mutex);
+    for (uint8_t chan_idx = min_chan.get() - 1; chan_idx < max_chan.get(); chan_idx++) {
+        auto& state = parsers[chan_idx];
+        if ((state.held_select == no_value && state.data_msb == no_value) ||
+                static_cast<int32_t>(now - state.deadline_ms) < 0) {
+            continue;
+        }
+        // timed out waiting for the rest of the sequence. Flush what arrived.
+        release_held_select(chan_idx);
+        if (state.data_msb != no_value) {
+            state.last_msb = state.data_msb;
+            state.data_msb = no_value;
+            emit_extra(state.cable, chan_idx, static_cast<uint16_t>(state.last_msb) << 7);
+        }
+    }
+    mutex_exit(&processing_mutex);
+}
+
+void rppicomidi::Midi_processor_param_convert::serialize_settings(const char* name, JSON_Object *root_object)
+{
+    JSON_Value *proc_value = json_value_init_object();
+    JSON_Object *proc_object = json_value_get_object(proc_value);
+    min_chan.serialize(proc_object);
+    max_chan.serialize(proc_object);
+    in_format.serialize(proc_object);
+    in_param.serialize(proc_object);
+    out_format.serialize(proc_object);
+    out_param.serialize(proc_object);
+    timeout_ms.serialize(proc_object);
+    json_object_set_value(root_object, name, proc_value);
+    dirty = false;
+}
+
+bool rppicomidi::Midi_processor_param_convert::deserialize_settings(JSON_Object *root_object)
+{
+    bool result = false;
+    if (min_chan.deserialize(root_object))
+        result = true;
+
+    if (!result || !max_chan.deserialize(root_object))
+        result = false;
+
+    if (!result || !in_format.deserialize(root_object))
+        result = false;
+
+    if (!result || !in_param.deserialize(root_object))
+        result = false;
+
+    if (!result || !out_format.deserialize(root_object))
+        result = false;
+
+    if (!result || !out_param.deserialize(root_object))
+        result = false;
+
+    if (!result || !timeout_ms.deserialize(root_object))
+        result = false;
+    if (result) {
+        max_chan.set_min(min_chan.get());
+        dirty = false;
+    }
+    reset_parsers();
+    return result;
+}
+
+void rppicomidi::Midi_processor_param_convert::serialize_blob(Settings_blob_writer& blob)
+{
+    blob.put(min_chan.get());
+    blob.put(max_chan.get());
+    blob.put<uint8_t>(in_format.get_ivalue());
+    blob.put(in_param.get());
+    blob.put<uint8_t>(out_format.get_ivalue());
+    blob.put(out_param.get());
+    blob.put(timeout_ms.get());
+    dirty = false;
+}
+
+bool rppicomidi::Midi_processor_param_convert::deserialize_blob(Settings_blob_reader& blob)
+{
+    uint8_t min_chan_, max_chan_, in_format_, out_format_, timeout_;
+    uint16_t in_param_, out_param_;
+    bool result = blob.get(min_chan_) && blob.get(max_chan_) && blob.get(in_format_) && blob.get(in_param_) &&
+        blob.get(out_format_) && blob.get(out_param_) && blob.get(timeout_) &&
+        min_chan.set(min_chan_) && max_chan.set(max_chan_) && in_format.set(in_format_) && in_param.set(in_param_) &&
+        out_format.set(out_format_) && out_param.set(out_param_) && timeout_ms.set(timeout_);
+    if (result) {
+        max_chan.set_min(min_chan.get());
+        dirty = false;
+    }
+    reset_parsers();
+    return result;
+}
+
+void rppicomidi::Midi_processor_param_convert::load_defaults()
+{
+    min_chan.set_default();
+    max_chan.set_default();
+    in_format.set(NRPN_IDX);
+    in_param.set_default();
+    out_format.set(PITCH_BEND_IDX);
+    out_param.set_default();
+    timeout_ms.set_default();
+    reset_parsers();
+    dirty = false;
+}
@@ -0,0 +1,249 @@
+/**
+ * @file midi_processor_param_convert.h
+ * @brief this class converts 14-bit parameter values between
+ * 14-bit CC, NRPN, RPN and Pitch Bend encodings
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include "pico/stdlib.h"
+#include "midi_processor.h"
+#include "midi_packet_fifo.h"
+#include "setting_number.h"
+#include "setting_label_enum.h"
+#include "pico/mutex.h"
+namespace rppicomidi
+{
+/**
+ * @brief This class assembles a 14-bit parameter value from the MIDI messages
+ * of one encoding and re-encodes it as the MIDI messages of another encoding.
+ *
+ * The supported encodings are
+ * - 14-bit CC: CC n (0-31) carries the value MSB and CC n+32 carries the LSB
+ * - NRPN: CC 99 and CC 98 select the parameter number; CC 6 and CC 38 carry the value
+ * - RPN: same as NRPN except CC 101 and CC 100 select the parameter number
+ * - Pitch Bend: the value is the 14-bit pitch bend value; the parameter number is not used
+ *
+ * For example, to use a controller that sends fader positions as NRPN messages
+ * with a DAW that expects Mackie Control faders, convert the NRPN messages to
+ * Pitch Bend and put an MC Fader Pickup processor after this one.
+ *
+ * Each MIDI channel in the range min_chan to max_chan has its own parser state.
+ * If the value LSB does not arrive before the timeout expires after the value MSB,
+ * or if a parameter number MSB arrives with no LSB before the timeout expires,
+ * then the task() method flushes what the parser has received.
+ */
+class Midi_processor_param_convert : public Midi_processor
+{
+public:
+    Midi_processor_param_convert(uint16_t unique_id);
+    virtual ~Midi_processor_param_convert()=default;
+    bool process(uint8_t* packet) final;
+    bool has_task() final { return true; }
+    void task() final;
+    bool get_extra_packet(uint8_t* packet) final
+    {
+        mutex_enter_blocking(&processing_mutex);
+        bool result = extra_packets.pop(packet);
+        mutex_exit(&processing_mutex);
+        return result;
+    }
+    void serialize_settings(const char* name, JSON_Object *root_object) final;
+    bool deserialize_settings(JSON_Object *root_object) final;
+    void serialize_blob(Settings_blob_writer& blob) final;
+    bool deserialize_blob(Settings_blob_reader& blob) final;
+    void load_defaults() final;
+
+    static uint8_t static_get_min_chan(void* context)
+    {
+        auto me = reinterpret_cast<Midi_processor_param_convert*>(context);
+        return me->min_chan.get();
+    }
+
+    static uint8_t static_incr_min_chan(void* context, int delta)
+    {
+        auto me = reinterpret_cast<Midi_processor_param_convert*>(context);
+        uint8_t oldval = me->min_chan.get();
+        if ((int)me->max_chan.get() < (int)oldval+delta)
+            return oldval; // you can't increment the min past the max
+        uint8_t newval = me->min_chan.incr(delta);
+        me->max_chan.set_min(newval);
+        me->dirty = oldval != newval;
+        return newval;
+    }
+
+    static uint8_t static_get_max_chan(void* context)
+    {
+        auto me = reinterpret_cast<Midi_processor_param_convert*>(context);
+        return me->max_chan.get();
+    }
+
+    static uint8_t static_incr_max_chan(void* context, int delta)
+    {
+        auto me = reinterpret_cast<Midi_processor_param_convert*>(context);
+        uint8_t oldval = me->max_chan.get();
+        uint8_t newval = me->max_chan.incr(delta);
+        me->dirty = oldval != newval;
+        return newval;
+    }
+
+    static uint16_t static_get_in_param(void* context)
+    {
+        auto me = reinterpret_cast<Midi_processor_param_convert*>(context);
+        return me->in_param.get();
+    }
+
+    static uint16_t static_incr_in_param(void* context, int delta)
+    {
+        auto me = reinterpret_cast<Midi_processor_param_convert*>(context);
+        mutex_enter_blocking(&me->processing_mutex);
+        uint16_t oldval = me->in_param.get();
+        uint16_t newval = me->in_param.incr(delta);
+        if (oldval != newval) {
+            me->dirty = true;
+            me->reset_parsers();
+        }
+        mutex_exit(&me->processing_mutex);
+        return newval;
+    }
+
+    static uint16_t static_get_out_param(void* context)
+    {
+        auto me = reinterpret_cast<Midi_processor_param_convert*>(context);
+        return me->out_param.get();
+    }
+
+    static uint16_t static_incr_out_param(void* context, int delta)
+    {
+        auto me = reinterpret_cast<Midi_processor_param_convert*>(context);
+        uint16_t oldval = me->out_param.get();
+        uint16_t newval = me->out_param.incr(delta);
+        me->dirty = oldval != newval;
+        return newval;
+    }
+
+    static uint8_t static_get_timeout(void* context)
+    {
+        auto me = reinterpret_cast<Midi_processor_param_convert*>(context);
+        return me->timeout_ms.get();
+    }
+
+    static uint8_t static_incr_timeout(void* context, int delta)
+    {
+        auto me = reinterpret_cast<Midi_processor_param_convert*>(context);
+        uint8_t oldval = me->timeout_ms.get();
+        uint8_t newval = me->timeout_ms.incr(delta);
+        me->dirty = oldval != newval;
+        return newval;
+    }
+
+    size_t get_num_formats() const { return in_format.get_num_values(); }
+    size_t get_in_format() { return in_format.get_ivalue(); }
+    void get_in_format(std::string &typestr) { in_format.get(typestr); }
+    bool set_in_format(size_t idx)
+    {
+        mutex_enter_blocking(&processing_mutex);
+        dirty = true;
+        reset_parsers();
+        bool result = in_format.set(idx);
+        mutex_exit(&processing_mutex);
+        return result;
+    }
+    size_t get_out_format() { return out_format.get_ivalue(); }
+    void get_out_format(std::string &typestr) { out_format.get(typestr); }
+    bool set_out_format(size_t idx) { dirty = true; return out_format.set(idx); }
+
+    // The following are manditory static methods to enable the Midi_processor_manager class
+    static const char* static_getname() { return "14-bit Param Convert"; }
+    static Midi_processor* static_make_new(uint16_t unique_id_) {return new Midi_processor_param_convert(unique_id_); }
+private:
+    /**
+     * @brief the index values of the in_format and out_format settings
+     */
+    enum Format_idx {CC14_IDX=0, NRPN_IDX, RPN_IDX, PITCH_BEND_IDX, NUM_FORMATS};
+    static const char* const format_labels[NUM_FORMATS];
+
+    static const uint8_t no_value = 0xFF;       //!< data byte value that means "not received"
+    static const uint8_t max_msgs_per_value = 4; //!< NRPN and RPN need 4 CC messages
+
+    /**
+     * @brief The parser state for one MIDI channel
+     */
+    struct Parser_state {
+        uint8_t cable;          //!< the virtual cable of the last message on this channel
+        uint8_t sel_msb;        //!< NRPN/RPN parameter number MSB or no_value
+        uint8_t sel_lsb;        //!< NRPN/RPN parameter number LSB or no_value
+        uint8_t held_select;    //!< CC number of a parameter number MSB message not yet passed on or no_value
+        uint8_t held_value;     //!< the data byte of the held_select message
+        uint8_t data_msb;       //!< value MSB waiting for the value LSB or no_value
+        uint8_t last_msb;       //!< the most recent value MSB, for LSB-only updates
+        uint32_t deadline_ms;   //!< time when the held select or data MSB should be flushed
+    };
+
+    void reset_parsers();
+
+    /**
+     * @brief encode value as USB MIDI packet(s) in the out_format encoding
+     *
+     * @param cable the virtual cable number for the packets
+     * @param chan_idx the MIDI channel number 0-15
+     * @param value the 14-bit value
+     * @param msgs the array of packets to fill
+     * @return uint8_t the number of packets stored in msgs
+     */
+    uint8_t encode(uint8_t cable, uint8_t chan_idx, uint16_t value, uint8_t msgs[max_msgs_per_value][4]);
+
+    /**
+     * @brief encode value in the out_format encoding. The last packet replaces
+     * the packet passed to process(); the others are queued as extra packets
+     *
+     * @return true if the packet should be passed on
+     */
+    bool emit(uint8_t* packet, uint8_t chan_idx, uint16_t value);
+
+    /**
+     * @brief queue value in the out_format encoding as extra packets
+     */
+    void emit_extra(uint8_t cable, uint8_t chan_idx, uint16_t value);
+
+    /**
+     * @brief queue the parameter select message the parser was holding as an extra packet
+     */
+    void release_held_select(uint8_t chan_idx);
+
+    bool process_cc14(uint8_t* packet, Parser_state& state);
+    bool process_nrpn(uint8_t* packet, Parser_state& state, uint8_t select_msb_cc, uint8_t select_lsb_cc);
+    uint32_t get_deadline() { return to_ms_since_boot(get_absolute_time()) + timeout_ms.get(); }
+
+    Setting_number<uint8_t> min_chan;       //!< lowest MIDI Channel Number to convert, from 1
+    Setting_number<uint8_t> max_chan;       //!< highest MIDI Channel Number to convert, min_chan-16
+    Setting_label_enum in_format;           //!< the encoding of the messages this processor converts
+    Setting_number<uint16_t> in_param;      //!< the CC number (0-31) or NRPN/RPN parameter number to convert
+    Setting_label_enum out_format;          //!< the encoding of the messages this processor sends
+    Setting_number<uint16_t> out_param;     //!< the CC number (0-31) or NRPN/RPN parameter number to send
+    Setting_number<uint8_t> timeout_ms;     //!< how long to wait for the rest of a message sequence
+    Parser_state parsers[16];
+    Midi_packet_fifo<8> extra_packets;
+    mutex processing_mutex;                 //!< the UI changes the parsers on core0 while process() runs on core1
+};
+}
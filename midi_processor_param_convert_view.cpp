@@ -0,0 +1,101 @@
+/* MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <cstring>
+#include <string>
+#include "midi_processor_param_convert_view.h"
+rppicomidi::Midi_processor_param_convert_view::Midi_processor_param_convert_view(Mono_graphics& screen_, const Rectangle& rect_, Midi_processor* proc_) :
+        Midi_processor_settings_view{screen_, rect_, proc_},
+        menu{screen, screen.get_font_12().height, screen.get_font_12()},font{screen.get_font_12()}
+{
+    // Make sure that the proc points to a Midi_processor_param_convert object (this c++ does not have dynamic cast)
+    assert(strcmp(proc->get_name(),Midi_processor_param_convert::static_getname()) == 0);
+    auto min_chan = new Int_spinner_menu_item<uint8_t>("Min MIDI chan: ", screen, font, 3, 3, false,
+        Midi_processor_param_convert::static_get_min_chan, Midi_processor_param_convert::static_incr_min_chan, proc_);
+    assert(min_chan);
+    auto max_chan = new Int_spinner_menu_item<uint8_t>("Max MIDI chan: ", screen, font, 3, 3, false,
+        Midi_processor_param_convert::static_get_max_chan, Midi_processor_param_convert::static_incr_max_chan, proc_);
+    assert(max_chan);
+    in_format_item = new Callback_menu_item{"In: ", screen, font, this, static_next_in_format};
+    assert(in_format_item);
+    auto in_param = new Int_spinner_menu_item<uint16_t>("In param: ", screen, font, 5, 4, false,
+        Midi_processor_param_convert::static_get_in_param, Midi_processor_param_convert::static_incr_in_param, proc_);
+    assert(in_param);
+    out_format_item = new Callback_menu_item{"Out: ", screen, font, this, static_next_out_format};
+    assert(out_format_item);
+    auto out_param = new Int_spinner_menu_item<uint16_t>("Out param: ", screen, font, 5, 4, false,
+        Midi_processor_param_convert::static_get_out_param, Midi_processor_param_convert::static_incr_out_param, proc_);
+    assert(out_param);
+    auto timeout = new Int_spinner_menu_item<uint8_t>("Timeout ms: ", screen, font, 3, 2, false,
+        Midi_processor_param_convert::static_get_timeout, Midi_processor_param_convert::static_incr_timeout, proc_);
+    assert(timeout);
+    menu.add_menu_item(min_chan);
+    menu.add_menu_item(max_chan);
+    menu.add_menu_item(in_format_item);
+    menu.add_menu_item(in_param);
+    menu.add_menu_item(out_format_item);
+    menu.add_menu_item(out_param);
+    menu.add_menu_item(timeout);
+}
+
+void rppicomidi::Midi_processor_param_convert_view::draw()
+{
+    screen.clear_canvas();
+    screen.center_string(screen.get_font_12(), "14-bit Param Settings", 0);
+    menu.draw();
+}
+
+void rppicomidi::Midi_processor_param_convert_view::fix_format_text()
+{
+    auto convert_proc = reinterpret_cast<Midi_processor_param_convert*>(proc);
+    std::string fmt_str;
+    convert_proc->get_in_format(fmt_str);
+    in_format_item->set_text((std::string{"In: "}+fmt_str).c_str());
+    convert_proc->get_out_format(fmt_str);
+    out_format_item->set_text((std::string{"Out: "}+fmt_str).c_str());
+}
+
+void rppicomidi::Midi_processor_param_convert_view::entry()
+{
+    fix_format_text();
+    menu.entry();
+}
+
+void rppicomidi::Midi_processor_param_convert_view::static_next_in_format(View* context, View**)
+{
+    auto me=reinterpret_cast<Midi_processor_param_convert_view*>(context);
+    auto convert_proc = reinterpret_cast<Midi_processor_param_convert*>(me->proc);
+    size_t nformats = convert_proc->get_num_formats();
+    convert_proc->set_in_format((convert_proc->get_in_format() + 1) % nformats);
+    me->fix_format_text();
+    me->draw();
+}
+
+void rppicomidi::Midi_processor_param_convert_view::static_next_out_format(View* context, View**)
+{
+    auto me=reinterpret_cast<Midi_processor_param_convert_view*>(context);
+    auto convert_proc = reinterpret_cast<Midi_processor_param_convert*>(me->proc);
+    size_t nformats = convert_proc->get_num_formats();
+    convert_proc->set_out_format((convert_proc->get_out_format() + 1) % nformats);
+    me->fix_format_text();
+    me->draw();
+}
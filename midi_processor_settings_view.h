@@ -23,6 +23,7 @@
 #pragma once
 #include "view.h"
 #include "midi_processor.h"
+#include "object_slab.h"
 namespace rppicomidi
 {
 class Midi_processor_settings_view : public View
@@ -32,6 +33,13 @@ public:
         View{screen_, rect_}, proc{proc_} {}
 
     virtual ~Midi_processor_settings_view()=default;
+
+    /**
+     * @brief allocate settings view objects from the Object_slab; the ones that
+     * do not fit are attributed to MEM_TAG_VIEWS in the mem report
+     */
+    static void* operator new(size_t size) { return Object_slab::instance().alloc(size, MEM_TAG_VIEWS); }
+    static void operator delete(void* ptr) { Object_slab::instance().free(ptr); }
 protected:
     Midi_processor* proc;
 };
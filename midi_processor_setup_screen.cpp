@@ -41,6 +41,8 @@ rppicomidi::Midi_processor_setup_screen::Midi_processor_setup_screen(Mono_graphi
 
 void rppicomidi::Midi_processor_setup_screen::entry()
 {
+    // Returning here means any processor settings view the user opened is done
+    Midi_processor_manager::instance().close_midi_processor_views(cable_num, is_midi_in);
     menu.clear();
     auto item = new View_launch_menu_item(processor_select,"Add new processor...", screen, font);
     assert(item);
@@ -50,9 +52,8 @@ void rppicomidi::Midi_processor_setup_screen::entry()
     size_t nprocessors = Midi_processor_manager::instance().get_num_midi_processors(cable_num, is_midi_in);
     for (size_t idx = 0; idx < nprocessors; idx++) {
         auto proc = Midi_processor_manager::instance().get_midi_processor_by_index(idx, cable_num, is_midi_in);
-        auto newview = Midi_processor_manager::instance().get_midi_processor_view_by_index(idx, cable_num, is_midi_in);
-        if (proc && newview) {
-            auto proc_item = new View_launch_menu_item(*newview, proc->get_name(), screen, font);
+        if (proc) {
+            auto proc_item = new Callback_menu_item(proc->get_name(), screen, font, this, static_open_processor_view, Select_result::new_view);
             menu.insert_menu_item_before_current(proc_item);
             menu.set_current_item_idx(idx+1);
         }
@@ -64,6 +65,7 @@ void rppicomidi::Midi_processor_setup_screen::exit()
 {
     menu.exit();
     menu.clear();
+    Midi_processor_manager::instance().close_midi_processor_views(cable_num, is_midi_in);
 }
 
 void rppicomidi::Midi_processor_setup_screen::draw()
@@ -78,8 +80,19 @@ void rppicomidi::Midi_processor_setup_screen::draw()
 void rppicomidi::Midi_processor_setup_screen::select_callback(rppicomidi::View* view, int idx)
 {
     auto me = reinterpret_cast<Midi_processor_setup_screen*>(view);
-    auto newview = Midi_processor_manager::instance().add_new_midi_processor_by_idx(idx, me->cable_num, me->is_midi_in);
-    me->menu.insert_menu_item_before_current(new View_launch_menu_item(*newview, me->processor_select.get_menu_item_text(idx), me->screen, me->font));
+    auto proc = Midi_processor_manager::instance().add_new_midi_processor_by_idx(idx, me->cable_num, me->is_midi_in);
+    if (proc) {
+        me->menu.insert_menu_item_before_current(new Callback_menu_item(me->processor_select.get_menu_item_text(idx), me->screen, me->font,
+            me, static_open_processor_view, Select_result::new_view));
+    }
+}
+
+void rppicomidi::Midi_processor_setup_screen::static_open_processor_view(View* context, View** new_view)
+{
+    auto me = reinterpret_cast<Midi_processor_setup_screen*>(context);
+    // The processor menu items are in processing order, so the current item index is the processor index
+    int idx = me->menu.get_current_item_idx();
+    *new_view = idx < 0 ? nullptr : Midi_processor_manager::instance().open_midi_processor_view(idx, me->cable_num, me->is_midi_in);
 }
 
 rppicomidi::View::Select_result rppicomidi::Midi_processor_setup_screen::on_select(View** new_view)
@@ -25,6 +25,7 @@
 #include "view.h"
 #include "menu.h"
 #include "view_launch_menu_item.h"
+#include "callback_menu_item.h"
 #include "text_item_chooser_menu.h"
 namespace rppicomidi
 {
@@ -35,6 +36,12 @@ public:
         uint8_t cable_num_, bool is_midi_in_);
     void draw() final;
     static void select_callback(View* me, int idx);
+    /**
+     * @brief create the settings view for the processor the user selected
+     *
+     * The view is deleted when the user returns to this screen.
+     */
+    static void static_open_processor_view(View* context, View** new_view);
     void entry() final;
     void exit() final;
     Select_result on_select(View** new_view) final;
@@ -23,13 +23,29 @@
 #include "midi_processor_transpose.h"
 #include "parson.h"
 
+const char* const rppicomidi::Midi_processor_transpose::display_format_labels[2] = {"Display Decimal", "Display Hex"};
+
 bool rppicomidi::Midi_processor_transpose::process(uint8_t* packet)
  {
     bool success = true; // Only block passing the message on if transposing makes the note out of MIDI range
-    if (get_channel_num(packet) == chan.get()) {
+    uint8_t msg_chan = get_channel_num(packet);
+    if (msg_chan == chan.get()) {
         uint8_t status = packet[1] & 0xf0;
-        if (status == 0x90 || status == 0x80) {
+        bool is_note_on = status == 0x90 && packet[3] != 0;
+        uint8_t mapped_note = Midi_note_map::no_note;
+        if (!is_note_on && (status == 0x90 || status == 0x80)) {
+            // note off: send it to the note the note on went to even if the settings changed
+            mapped_note = note_map.note_off(msg_chan, packet[2]);
+        }
+        if (mapped_note == Midi_note_map::filtered_note) {
+            success = false;
+        }
+        else if (mapped_note != Midi_note_map::no_note) {
+            packet[2] = mapped_note;
+        }
+        else if (status == 0x90 || status == 0x80) {
             // note message
+            uint8_t in_note = packet[2];
             if (packet[2] >= min_note.get() && packet[2] <= max_note.get()) {
                 int new_note = packet[2] + transpose_delta.get();
                 if (new_note >= min_note.get() && new_note <= max_note.get()) {
@@ -39,6 +55,8 @@ bool rppicomidi::Midi_processor_transpose::process(uint8_t* packet)
                     success = false;
                 }
             }
+            if (is_note_on)
+                note_map.note_on(msg_chan, in_note, success ? packet[2] : Midi_note_map::filtered_note);
         }
     }
     return success;
@@ -77,6 +95,31 @@ bool rppicomidi::Midi_processor_transpose::deserialize_settings(JSON_Object *roo
     if (result) {
         dirty = false;
     }
+    note_map.clear();
+    return result;
+}
+
+void rppicomidi::Midi_processor_transpose::serialize_blob(Settings_blob_writer& blob)
+{
+    blob.put(chan.get());
+    blob.put<uint8_t>(display_format.get_ivalue());
+    blob.put(min_note.get());
+    blob.put(max_note.get());
+    blob.put(transpose_delta.get());
+    dirty = false;
+}
+
+bool rppicomidi::Midi_processor_transpose::deserialize_blob(Settings_blob_reader& blob)
+{
+    uint8_t chan_, format_, min_note_, max_note_;
+    int8_t delta_;
+    bool result = blob.get(chan_) && blob.get(format_) && blob.get(min_note_) && blob.get(max_note_) && blob.get(delta_) &&
+        chan.set(chan_) && display_format.set(format_) && min_note.set(min_note_) && max_note.set(max_note_) &&
+        transpose_delta.set(delta_);
+    if (result) {
+        dirty = false;
+    }
+    note_map.clear();
     return result;
 }
 
@@ -86,5 +129,6 @@ void rppicomidi::Midi_processor_transpose::load_defaults()
     min_note.set_default();
     max_note.set_default();
     transpose_delta.set_default();
+    note_map.clear();
     dirty = false;
 }
@@ -23,8 +23,9 @@
 #pragma once
 #include "pico/stdlib.h"
 #include "midi_processor.h"
+#include "midi_note_tracker.h"
 #include "setting_number.h"
-#include "setting_string_enum.h"
+#include "setting_label_enum.h"
 namespace rppicomidi
 {
 class Midi_processor_transpose : public Midi_processor
@@ -33,8 +34,7 @@ public:
     Midi_processor_transpose(uint16_t unique_id) : Midi_processor{static_getname(), unique_id},
         chan{"chan", 1, 16, 1}, min_note{"min_note", 0, 127, 0}, max_note{"max_note", 0, 127, 127},
         transpose_delta("transpose_delta", -12, 12, 0),
-        format_decimal{"Display Decimal"}, format_hex{"Display Hex"},
-        display_format{"Display Format", {format_decimal, format_hex}}
+        display_format{"Display Format", display_format_labels, 2}
 
     {
         load_defaults();
@@ -107,6 +107,8 @@ public:
     int8_t get_transpose_delta() {return transpose_delta.get(); }
     void serialize_settings(const char* name, JSON_Object *root_object) final;
     bool deserialize_settings(JSON_Object *root_object) final;
+    void serialize_blob(Settings_blob_writer& blob) final;
+    bool deserialize_blob(Settings_blob_reader& blob) final;
     void load_defaults() final;
 
     bool set_display_format(size_t idx) { dirty = true; return display_format.set(idx); }
@@ -121,8 +123,8 @@ protected:
     Setting_number<uint8_t> min_note;       //!< Minimum note number to transpose 0-127
     Setting_number<uint8_t> max_note;       //!< Maximum note number to transpose min_note-127
     Setting_number<int8_t> transpose_delta; //!< Number of half-steps to add to the note number -12 to 12
-    const std::string format_decimal;
-    const std::string format_hex;
-    Setting_string_enum display_format;     //!< Decimal or hex
+    static const char* const display_format_labels[2];
+    Setting_label_enum display_format;      //!< Decimal or hex
+    Midi_note_map note_map;                 //!< the transposed note number of each sounding note
 };
 }
\ No newline at end of file
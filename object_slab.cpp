@@ -0,0 +1,97 @@
+/* MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <cstdio>
+#include "object_slab.h"
+
+static uint8_t __attribute__((aligned(8))) slab_64[OBJECT_SLAB_64_SLOTS * 64];
+static uint8_t __attribute__((aligned(8))) slab_128[OBJECT_SLAB_128_SLOTS * 128];
+static uint8_t __attribute__((aligned(8))) slab_256[OBJECT_SLAB_256_SLOTS * 256];
+static uint8_t __attribute__((aligned(8))) slab_512[OBJECT_SLAB_512_SLOTS * 512];
+static uint8_t __attribute__((aligned(8))) slab_1024[OBJECT_SLAB_1024_SLOTS * 1024];
+
+rppicomidi::Object_slab::Object_slab() :
+    size_classes{
+        {64, OBJECT_SLAB_64_SLOTS, slab_64, nullptr, 0, 0, 0},
+        {128, OBJECT_SLAB_128_SLOTS, slab_128, nullptr, 0, 0, 0},
+        {256, OBJECT_SLAB_256_SLOTS, slab_256, nullptr, 0, 0, 0},
+        {512, OBJECT_SLAB_512_SLOTS, slab_512, nullptr, 0, 0, 0},
+        {1024, OBJECT_SLAB_1024_SLOTS, slab_1024, nullptr, 0, 0, 0},
+    }
+{
+    for (auto& size_class: size_classes) {
+        // chain the slots so the first slot is allocated first
+        for (size_t idx = size_class.nslots; idx > 0; idx--) {
+            auto slot = reinterpret_cast<Free_slot*>(size_class.storage + (idx - 1) * size_class.slot_size);
+            slot->next = size_class.free_list;
+            size_class.free_list = slot;
+        }
+    }
+}
+
+void* rppicomidi::Object_slab::alloc(size_t size, Mem_tag tag)
+{
+    bool fits = false;
+    for (auto& size_class: size_classes) {
+        if (size > size_class.slot_size)
+            continue;
+        if (size_class.free_list == nullptr) {
+            // try the next bigger slot size before going to the heap
+            if (!fits)
+                ++size_class.nfull;
+            fits = true;
+            continue;
+        }
+        Free_slot* slot = size_class.free_list;
+        size_class.free_list = slot->next;
+        if (++size_class.nused > size_class.max_used)
+            size_class.max_used = size_class.nused;
+        return slot;
+    }
+    return mem_tag_malloc(tag, size);
+}
+
+void rppicomidi::Object_slab::free(void* ptr)
+{
+    if (ptr == nullptr)
+        return;
+    auto addr = reinterpret_cast<uint8_t*>(ptr);
+    for (auto& size_class: size_classes) {
+        if (addr >= size_class.storage && addr < size_class.storage + size_class.nslots * size_class.slot_size) {
+            auto slot = reinterpret_cast<Free_slot*>(ptr);
+            slot->next = size_class.free_list;
+            size_class.free_list = slot;
+            --size_class.nused;
+            return;
+        }
+    }
+    mem_tag_free(ptr);
+}
+
+void rppicomidi::Object_slab::print_status()
+{
+    printf("%-12s %8s %8s %8s %8s\r\n", "slot size", "slots", "used", "peak", "full");
+    for (auto& size_class: size_classes) {
+        printf("%-12u %8u %8u %8u %8lu\r\n", size_class.slot_size, size_class.nslots, size_class.nused,
+            size_class.max_used, size_class.nfull);
+    }
+}
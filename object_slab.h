@@ -0,0 +1,120 @@
+/**
+ * @file object_slab.h
+ * @brief this file contains the Object_slab class, a slab allocator
+ * for the processor and settings view objects
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "mem_stats.h"
+
+// The number of slots of each size. Override these with compile definitions
+// to fit the number of processors and views a build needs.
+#ifndef OBJECT_SLAB_64_SLOTS
+#define OBJECT_SLAB_64_SLOTS 16
+#endif
+#ifndef OBJECT_SLAB_128_SLOTS
+#define OBJECT_SLAB_128_SLOTS 32
+#endif
+#ifndef OBJECT_SLAB_256_SLOTS
+#define OBJECT_SLAB_256_SLOTS 32
+#endif
+#ifndef OBJECT_SLAB_512_SLOTS
+#define OBJECT_SLAB_512_SLOTS 16
+#endif
+#ifndef OBJECT_SLAB_1024_SLOTS
+#define OBJECT_SLAB_1024_SLOTS 4
+#endif
+
+namespace rppicomidi
+{
+/**
+ * @brief A slab allocator with a free list per slot size for the
+ * processor and settings view objects
+ *
+ * The slots are statically allocated, so allocating and freeing an object
+ * takes constant time, the memory used is known at build time, and creating
+ * and deleting processors in any order does not fragment the heap. If an
+ * object is too big for any slot, or all slots big enough are in use, the
+ * object is allocated from the heap instead.
+ * @note only call alloc() and free() from core 0
+ */
+class Object_slab
+{
+public:
+    // Singleton Pattern
+
+    /**
+     * @brief Get the Instance object
+     *
+     * @return the singleton instance
+     */
+    static Object_slab& instance()
+    {
+        static Object_slab _instance; // Guaranteed to be destroyed.
+                                      // Instantiated on first use.
+        return _instance;
+    }
+    Object_slab(Object_slab const&) = delete;
+    void operator=(Object_slab const&) = delete;
+
+    /**
+     * @brief allocate memory for an object
+     *
+     * @param size the number of bytes the object needs
+     * @param tag the subsystem the heap allocation is attributed to if there is no free slot
+     * @return a pointer to the memory or nullptr if there is no memory
+     */
+    void* alloc(size_t size, Mem_tag tag);
+
+    /**
+     * @brief free the memory alloc() returned
+     *
+     * @param ptr the pointer alloc() returned; does nothing if nullptr
+     */
+    void free(void* ptr);
+
+    /**
+     * @brief print the capacity, use and high-water mark of each slot size
+     */
+    void print_status();
+private:
+    Object_slab();
+    struct Free_slot {
+        Free_slot* next;
+    };
+    struct Size_class {
+        size_t slot_size;
+        size_t nslots;
+        uint8_t* storage;
+        Free_slot* free_list;
+        size_t nused;           // the number of slots in use
+        size_t max_used;        // the high-water mark of nused
+        uint32_t nfull;         // the number of times this was the best fit slot size but all slots were in use
+    };
+    static const size_t num_size_classes = 5;
+    Size_class size_classes[num_size_classes];
+};
+}
@@ -50,11 +50,15 @@
 #include "nav_buttons.h"
 #include "midi_processor.h"
 #include "midi_processor_manager.h"
+#include "json_arena.h"
+#include "mem_stats.h"
 #include "embedded_cli.h"
 #include "ff.h"
 #include "diskio.h"
 #include "rp2040_rtc.h"
 #include "clock_set_view.h"
+#include "fs_job_queue.h"
+#include "flash_commit.h"
 #ifndef OLED_SCL_GPIO
 #define OLED_SCL_GPIO 19
 #endif
@@ -190,6 +194,7 @@ void rppicomidi::Pico_usb_midi_processor::poll_midi_dev_rx()
         }
         if (Midi_processor_manager::instance().filter_midi_out(cable, packet)) {
             tuh_midi_packet_write(rppicomidi::Pico_usb_midi_processor::instance().midi_dev_addr, packet);
+            Flash_commit::instance().midi_activity();
         }
     }
 }
@@ -215,6 +220,7 @@ void rppicomidi::Pico_usb_midi_processor::task()
         tud_task();
         if (tud_midi_mounted()) {
             poll_midi_dev_rx();
+            Fs_job_queue::instance().midi_serviced();
             Midi_processor_manager::instance().task();
         }
     }
@@ -266,6 +272,8 @@ static void midi_host_app_task(void)
         clone_next_string();
     }
     else if (descriptors_are_cloned()) {
+        // core1 is the only writer to the USB device MIDI FIFO
+        rppicomidi::Midi_processor_manager::instance().send_queued_midi_in();
         tuh_midi_stream_flush(rppicomidi::Pico_usb_midi_processor::instance().midi_dev_addr );
     }
 }
@@ -320,6 +328,18 @@ static void writeCharFn(EmbeddedCli *embeddedCli, char c)
     putchar(c);
 }
 
+static void midi_in_packet_writer(uint8_t* packet)
+{
+    tud_midi_packet_write(packet);
+    rppicomidi::Flash_commit::instance().midi_activity();
+}
+
+static void midi_out_packet_writer(uint8_t* packet)
+{
+    tuh_midi_packet_write(rppicomidi::Pico_usb_midi_processor::instance().midi_dev_addr, packet);
+    rppicomidi::Flash_commit::instance().midi_activity();
+}
+
 static void screenshot(EmbeddedCli* cli, char* args, void* context)
 {
     (void)cli;
@@ -351,7 +371,7 @@ int main()
         .rxBufferSize = 64,
         .cmdBufferSize = 64,
         .historyBufferSize = 128,
-        .maxBindingCount = 11,
+        .maxBindingCount = 19,
         .cliBuffer = NULL,
         .cliBufferSize = 0,
         .enableAutoComplete = true,
@@ -361,8 +381,14 @@ int main()
     cli->writeChar = writeCharFn;
     // initialize the Pico_usb_midi_processor object instance and the associated CLI
     auto instance_ptr=&rppicomidi::Pico_usb_midi_processor::instance();
+    rppicomidi::Midi_processor_manager::instance().set_packet_writers(midi_in_packet_writer, midi_out_packet_writer);
 
     rppicomidi::Settings_file::instance().add_all_cli_commands(cli);
+    rppicomidi::Midi_processor_manager::instance().add_all_cli_commands(cli);
+    rppicomidi::Json_arena::instance().add_all_cli_commands(cli);
+    rppicomidi::mem_add_cli_commands(cli);
+    rppicomidi::Fs_job_queue::instance().add_all_cli_commands(cli);
+    rppicomidi::Flash_commit::instance().add_all_cli_commands(cli);
     msc_fat_init();
 
     TU_LOG1("pico-usb-midi-processor\r\n");
@@ -379,6 +405,8 @@ int main()
     assert(embeddedCliAddBinding(cli, ss));
     while (1) {
         instance_ptr->task();
+        // long file system operations run a few steps at a time between MIDI and UI service
+        rppicomidi::Fs_job_queue::instance().task();
         // update the CLI if need be
         int c = getchar_timeout_us(0);
         if (c != PICO_ERROR_TIMEOUT) {
@@ -426,6 +454,7 @@ void tuh_midi_umount_cb(uint8_t dev_addr, uint8_t instance)
 void tuh_midi_rx_cb(uint8_t dev_addr, uint32_t num_packets)
 {
     if (rppicomidi::Pico_usb_midi_processor::instance().midi_dev_addr == dev_addr) {
+        rppicomidi::Midi_processor_manager::instance().send_queued_midi_in();
         while (num_packets>0) {
             --num_packets;
             uint8_t packet[4];
@@ -433,6 +462,7 @@ void tuh_midi_rx_cb(uint8_t dev_addr, uint32_t num_packets)
                 uint8_t cable = rppicomidi::Midi_processor::get_cable_num(packet);
                 if (rppicomidi::Midi_processor_manager::instance().filter_midi_in(cable, packet)) {
                     tud_midi_packet_write(packet);
+                    rppicomidi::Flash_commit::instance().midi_activity();
                 }
             }
         }
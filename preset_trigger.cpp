@@ -0,0 +1,146 @@
+/* MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "preset_trigger.h"
+
+rppicomidi::Preset_trigger::Preset_trigger() :
+    type_off{"Off"}, type_program_change{"Program Change"}, type_control_change{"Control Change"},
+    port_midi_in{"MIDI IN"}, port_midi_out{"MIDI OUT"},
+    type{"trigger type", {type_off, type_program_change, type_control_change}},
+    port{"trigger port", {port_midi_in, port_midi_out}},
+    cable{"trigger cable", 1, 16, 1}, chan{"trigger chan", 1, 16, 16}, cc{"trigger cc", 0, 127, 0}
+{
+    load_defaults();
+}
+
+void rppicomidi::Preset_trigger::update()
+{
+    switch(type.get_ivalue()) {
+    case PROGRAM_CHANGE_IDX:
+        status = 0xC0 | (chan.get() - 1);
+        break;
+    case CONTROL_CHANGE_IDX:
+        status = 0xB0 | (chan.get() - 1);
+        break;
+    case OFF_IDX:
+    default:
+        status = 0;
+        break;
+    }
+    trigger_cable = cable.get() - 1;
+    trigger_cc = cc.get();
+    trigger_is_midi_in = port.get_ivalue() == MIDI_IN_IDX;
+}
+
+void rppicomidi::Preset_trigger::load_defaults()
+{
+    type.set(OFF_IDX);
+    port.set(MIDI_IN_IDX);
+    cable.set_default();
+    chan.set_default();
+    cc.set_default();
+    update();
+    dirty = false;
+}
+
+void rppicomidi::Preset_trigger::serialize(JSON_Object *root_object)
+{
+    JSON_Value *trigger_value = json_value_init_object();
+    JSON_Object *trigger_object = json_value_get_object(trigger_value);
+    type.serialize(trigger_object);
+    port.serialize(trigger_object);
+    cable.serialize(trigger_object);
+    chan.serialize(trigger_object);
+    cc.serialize(trigger_object);
+    json_object_set_value(root_object, "preset trigger", trigger_value);
+    dirty = false;
+}
+
+bool rppicomidi::Preset_trigger::deserialize(JSON_Object *root_object)
+{
+    JSON_Object* trigger_object = json_object_get_object(root_object, "preset trigger");
+    bool result = trigger_object != nullptr;
+
+    if (!result || !type.deserialize(trigger_object))
+        result = false;
+
+    if (!result || !port.deserialize(trigger_object))
+        result = false;
+
+    if (!result || !cable.deserialize(trigger_object))
+        result = false;
+
+    if (!result || !chan.deserialize(trigger_object))
+        result = false;
+
+    if (!result || !cc.deserialize(trigger_object))
+        result = false;
+    if (result) {
+        update();
+        dirty = false;
+    }
+    else {
+        load_defaults();
+    }
+    return result;
+}
+
+void rppicomidi::Preset_trigger::serialize(Settings_blob_writer& blob)
+{
+    blob.put<uint8_t>(type.get_ivalue());
+    blob.put<uint8_t>(port.get_ivalue());
+    blob.put(cable.get());
+    blob.put(chan.get());
+    blob.put(cc.get());
+    dirty = false;
+}
+
+bool rppicomidi::Preset_trigger::deserialize(Settings_blob_reader& blob)
+{
+    uint8_t type_, port_, cable_, chan_, cc_;
+    bool result = blob.get(type_) && blob.get(port_) && blob.get(cable_) && blob.get(chan_) && blob.get(cc_) &&
+        type.set(type_) && port.set(port_) && cable.set(cable_) && chan.set(chan_) && cc.set(cc_);
+    if (result) {
+        update();
+        dirty = false;
+    }
+    else {
+        load_defaults();
+    }
+    return result;
+}
+
+void rppicomidi::Preset_trigger::print()
+{
+    std::string typestr;
+    type.get(typestr);
+    if (status == 0) {
+        printf("preset trigger: %s\r\n", typestr.c_str());
+        return;
+    }
+    std::string portstr;
+    port.get(portstr);
+    printf("preset trigger: %s %s cable %u chan %u", typestr.c_str(), portstr.c_str(), cable.get(), chan.get());
+    if (type.get_ivalue() == CONTROL_CHANGE_IDX)
+        printf(" CC %u", cc.get());
+    printf("\r\n");
+}
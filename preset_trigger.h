@@ -0,0 +1,195 @@
+/**
+ * @file preset_trigger.h
+ * @brief this class holds the settings for the MIDI message that selects
+ * a preset and tests MIDI packets against it
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <string>
+#include "pico/stdlib.h"
+#include "parson.h"
+#include "settings_blob.h"
+#include "setting_number.h"
+#include "setting_string_enum.h"
+namespace rppicomidi
+{
+/**
+ * @brief The MIDI message that selects a preset without using the OLED menus
+ *
+ * The trigger is a Program Change message or a Control Change message with a
+ * particular CC number on one MIDI channel of one virtual cable in one direction.
+ * A value of 0-7 (the program number or the CC value) selects preset 1-8.
+ * The Midi_processor_manager checks every packet against the trigger before
+ * it runs the processing chain, so the check must stay cheap.
+ */
+class Preset_trigger
+{
+public:
+    Preset_trigger();
+
+    /**
+     * @brief test if packet is the preset trigger message
+     *
+     * @param cable the virtual cable number from 0
+     * @param is_midi_in true if the packet is from the connected device
+     * @param packet the 4-byte USB MIDI packet
+     * @param value set to the program number or CC value if the packet is the trigger
+     * @return true if the packet is the trigger message
+     */
+    bool match(uint8_t cable, bool is_midi_in, const uint8_t* packet, uint8_t& value) const
+    {
+        if (status == 0 || packet[1] != status || cable != trigger_cable || is_midi_in != trigger_is_midi_in)
+            return false;
+        if ((status & 0xf0) == 0xB0) {
+            if (packet[2] != trigger_cc)
+                return false;
+            value = packet[3];
+        }
+        else {
+            value = packet[2];
+        }
+        return true;
+    }
+
+    /**
+     * @brief add the trigger settings to the root object of the settings file
+     */
+    void serialize(JSON_Object *root_object);
+
+    /**
+     * @brief load the trigger settings from the root object of the settings file
+     *
+     * If the settings file has no trigger settings, the trigger is off.
+     * @return true if the settings were found and are valid
+     */
+    bool deserialize(JSON_Object *root_object);
+
+    /**
+     * @brief append the trigger settings in compact binary form to the blob
+     */
+    void serialize(Settings_blob_writer& blob);
+
+    /**
+     * @brief load the trigger settings from the compact binary form
+     *
+     * @return true if the settings are valid; if not, the trigger is off
+     */
+    bool deserialize(Settings_blob_reader& blob);
+
+    void load_defaults();
+
+    bool not_saved() const { return dirty; }
+
+    const std::vector<std::string>* get_all_possible_types() const { return type.get_all_possible_values(); }
+    size_t get_type() { return type.get_ivalue(); }
+    void get_type(std::string& typestr) { type.get(typestr); }
+    void set_type(size_t idx) { dirty = true; type.set(idx); update(); }
+    size_t get_port() { return port.get_ivalue(); }
+    void get_port(std::string& portstr) { port.get(portstr); }
+    void set_port(size_t idx) { dirty = true; port.set(idx); update(); }
+
+    static uint8_t static_get_cable(void* context)
+    {
+        auto me = reinterpret_cast<Preset_trigger*>(context);
+        return me->cable.get();
+    }
+
+    static uint8_t static_incr_cable(void* context, int delta)
+    {
+        auto me = reinterpret_cast<Preset_trigger*>(context);
+        uint8_t oldval = me->cable.get();
+        uint8_t newval = me->cable.incr(delta);
+        if (oldval != newval) {
+            me->dirty = true;
+            me->update();
+        }
+        return newval;
+    }
+
+    static uint8_t static_get_chan(void* context)
+    {
+        auto me = reinterpret_cast<Preset_trigger*>(context);
+        return me->chan.get();
+    }
+
+    static uint8_t static_incr_chan(void* context, int delta)
+    {
+        auto me = reinterpret_cast<Preset_trigger*>(context);
+        uint8_t oldval = me->chan.get();
+        uint8_t newval = me->chan.incr(delta);
+        if (oldval != newval) {
+            me->dirty = true;
+            me->update();
+        }
+        return newval;
+    }
+
+    static uint8_t static_get_cc(void* context)
+    {
+        auto me = reinterpret_cast<Preset_trigger*>(context);
+        return me->cc.get();
+    }
+
+    static uint8_t static_incr_cc(void* context, int delta)
+    {
+        auto me = reinterpret_cast<Preset_trigger*>(context);
+        uint8_t oldval = me->cc.get();
+        uint8_t newval = me->cc.incr(delta);
+        if (oldval != newval) {
+            me->dirty = true;
+            me->update();
+        }
+        return newval;
+    }
+
+    /**
+     * @brief print the trigger settings to the console
+     */
+    void print();
+private:
+    enum Type_idx {OFF_IDX=0, PROGRAM_CHANGE_IDX, CONTROL_CHANGE_IDX};
+    enum Port_idx {MIDI_IN_IDX=0, MIDI_OUT_IDX};
+
+    /**
+     * @brief recalculate the values match() uses from the settings
+     */
+    void update();
+
+    const std::string type_off;
+    const std::string type_program_change;
+    const std::string type_control_change;
+    const std::string port_midi_in;
+    const std::string port_midi_out;
+    Setting_string_enum type;           //!< Off, Program Change or Control Change
+    Setting_string_enum port;           //!< MIDI IN (from the connected device) or MIDI OUT (to the connected device)
+    Setting_number<uint8_t> cable;      //!< virtual cable number from 1
+    Setting_number<uint8_t> chan;       //!< MIDI channel number from 1
+    Setting_number<uint8_t> cc;         //!< CC number for the Control Change trigger
+    uint8_t status;                     //!< the status byte of the trigger message or 0 if the trigger is off
+    uint8_t trigger_cable;              //!< virtual cable number from 0
+    uint8_t trigger_cc;                 //!< same as cc.get()
+    bool trigger_is_midi_in;            //!< true if port is MIDI IN
+    bool dirty;
+};
+}
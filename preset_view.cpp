@@ -66,4 +66,32 @@ void rppicomidi::Preset_view::static_reset_callback(View* context_, View**)
     Midi_processor_manager::instance().clear_all_processors();
     Midi_processor_manager::instance().store_preset(me->next_preset.get());
     me->draw();
+}
+
+void rppicomidi::Preset_view::fix_trigger_text()
+{
+    auto& trigger = Midi_processor_manager::instance().get_preset_trigger();
+    std::string str;
+    trigger.get_type(str);
+    trigger_type_item->set_text((std::string{"Trig:"}+str).c_str());
+    trigger.get_port(str);
+    trigger_port_item->set_text((std::string{"Trig port:"}+str).c_str());
+}
+
+void rppicomidi::Preset_view::static_next_trigger_type(View* context_, View**)
+{
+    auto me = reinterpret_cast<Preset_view*>(context_);
+    auto& trigger = Midi_processor_manager::instance().get_preset_trigger();
+    trigger.set_type((trigger.get_type() + 1) % trigger.get_all_possible_types()->size());
+    me->fix_trigger_text();
+    me->draw();
+}
+
+void rppicomidi::Preset_view::static_next_trigger_port(View* context_, View**)
+{
+    auto me = reinterpret_cast<Preset_view*>(context_);
+    auto& trigger = Midi_processor_manager::instance().get_preset_trigger();
+    trigger.set_port((trigger.get_port() + 1) % 2);
+    me->fix_trigger_text();
+    me->draw();
 }
\ No newline at end of file
@@ -49,8 +49,22 @@ public:
         menu.add_menu_item(item);
         item = new Callback_menu_item("Reset next preset",screen, screen.get_font_12(), this, static_reset_callback, View::Select_result::exit_view);
         menu.add_menu_item(item);
+        auto& trigger = Midi_processor_manager::instance().get_preset_trigger();
+        trigger_type_item = new Callback_menu_item("Trig:", screen, screen.get_font_12(), this, static_next_trigger_type);
+        menu.add_menu_item(trigger_type_item);
+        trigger_port_item = new Callback_menu_item("Trig port:", screen, screen.get_font_12(), this, static_next_trigger_port);
+        menu.add_menu_item(trigger_port_item);
+        auto trigger_item = new Int_spinner_menu_item<uint8_t>("Trig cable:", screen, screen.get_font_12(), 2, 1, false,
+            Preset_trigger::static_get_cable, Preset_trigger::static_incr_cable, &trigger);
+        menu.add_menu_item(trigger_item);
+        trigger_item = new Int_spinner_menu_item<uint8_t>("Trig chan:", screen, screen.get_font_12(), 2, 1, false,
+            Preset_trigger::static_get_chan, Preset_trigger::static_incr_chan, &trigger);
+        menu.add_menu_item(trigger_item);
+        trigger_item = new Int_spinner_menu_item<uint8_t>("Trig CC:", screen, screen.get_font_12(), 3, 2, false,
+            Preset_trigger::static_get_cc, Preset_trigger::static_incr_cc, &trigger);
+        menu.add_menu_item(trigger_item);
     }
-    void entry() final {next_preset.set(Midi_processor_manager::instance().get_current_preset()); menu.entry(); }
+    void entry() final {next_preset.set(Midi_processor_manager::instance().get_current_preset()); fix_trigger_text(); menu.entry(); }
     void draw() final;
     Select_result on_select(View** new_view) final { return menu.on_select(new_view); }
     void on_increment(uint32_t delta, bool is_shifted) final {menu.on_increment(delta, is_shifted); };
@@ -61,7 +75,12 @@ private:
     static void static_save_callback(View*, View**);
     static void static_load_callback(View*, View**);
     static void static_reset_callback(View*, View**);
+    static void static_next_trigger_type(View*, View**);
+    static void static_next_trigger_port(View*, View**);
+    void fix_trigger_text();
     Menu menu;
     Setting_number<uint8_t> next_preset;
+    Callback_menu_item* trigger_type_item;
+    Callback_menu_item* trigger_port_item;
 };
 }
\ No newline at end of file
@@ -29,7 +29,8 @@
 rppicomidi::Restore_view::Restore_view(Mono_graphics& screen_) : 
     View{screen_, screen_.get_clip_rect()}, font{screen_.get_font_12()},
         menu{screen, static_cast<uint8_t>(font.height*2), font},
-        dir_chooser_menu{screen, static_cast<uint8_t>(font.height*2), font}
+        dir_chooser_menu{screen, static_cast<uint8_t>(font.height*2), font},
+        active{false}, restore_running{false}
 {
     current_menu = &menu;
 }
@@ -41,10 +42,12 @@ void rppicomidi::Restore_view::dir_select_callback(View* context, View**)
     me->filenames.clear();
     me->filenames.push_back(std::string(all_files_str));
     if (Settings_file::instance().get_all_preset_filenames(dirname, me->filenames)) {
+        // Read every file's product string now so scrolling does not read the drive
+        Settings_file::instance().get_backup_product_strings(dirname, me->filenames, me->product_strings);
         me->dir_chooser_menu.clear();
         for (auto& filename: me->filenames) {
             auto item = new Callback_menu_item(filename.c_str(), me->screen, me->font, me, file_select_callback);
-            item->set_select_action(Select_result::exit_view);
+            item->set_select_action(Select_result::no_op);
             me->dir_chooser_menu.add_menu_item(item);
         }
     }
@@ -65,17 +68,44 @@ void rppicomidi::Restore_view::file_select_callback(View* context, View**)
         strcat(restore_path,"/");
         strcat(restore_path, filename);
     }
-    if (Settings_file::instance().restore_presets(restore_path) != 0) {
-        printf("error restoring presets from %s", restore_path);
-        // clear the top line
-        me->screen.draw_rectangle(0, 0, me->screen.get_screen_width(),me->font.height,Pixel_state::PIXEL_ZERO, Pixel_state::PIXEL_ZERO);
-        me->screen.center_string(me->font, "Restore Failed", 0);
-        reinterpret_cast<Callback_menu_item*>(me->dir_chooser_menu.get_current_item())->set_select_action(Select_result::no_op);
+    if (me->restore_running)
+        return; // one restore at a time
+    me->restore_running = true;
+    me->show_status("Restoring");
+    Settings_file::instance().start_restore(restore_path, static_restore_progress, me);
+}
+
+void rppicomidi::Restore_view::show_status(const char* status)
+{
+    if (!active)
+        return; // another view is on the screen
+    // clear the top line
+    screen.draw_rectangle(0, 0, screen.get_screen_width(),font.height,Pixel_state::PIXEL_ZERO, Pixel_state::PIXEL_ZERO);
+    screen.center_string(font, status, 0);
+}
+
+void rppicomidi::Restore_view::static_restore_progress(void* context, Fs_job& job, Fs_job::Step_result result)
+{
+    auto me = reinterpret_cast<Restore_view*>(context);
+    if (result == Fs_job::STEP_MORE) {
+        char status[max_line_length+1];
+        snprintf(status, sizeof(status), "Restoring %u/%u", job.get_steps_done(), job.get_num_steps());
+        me->show_status(status);
+        return;
+    }
+    me->restore_running = false;
+    if (result == Fs_job::STEP_ERROR) {
+        printf("error restoring presets\r\n");
+        me->show_status("Restore Failed");
+    }
+    else {
+        me->show_status("Restore Done");
     }
 }
 
 void rppicomidi::Restore_view::entry()
 {
+    active = true;
     current_menu = &menu;
     // rebuild the menu based on the current backup directory list
     menu.clear();
@@ -91,6 +121,7 @@ void rppicomidi::Restore_view::entry()
 
 void rppicomidi::Restore_view::exit()
 {
+    active = false;
     current_menu = &menu;
     menu.exit();
     dir_chooser_menu.exit();
@@ -107,23 +138,14 @@ void rppicomidi::Restore_view::update_product_string_display()
 {
     if (current_menu == &dir_chooser_menu) {
         // update the device name display at the top of the screen
-        char prod_string[max_line_length*2+1];
         if (dir_chooser_menu.get_current_item_idx() == 0) {
             screen.draw_rectangle(0, 0, screen.get_screen_width(), 2*font.height,Pixel_state::PIXEL_ZERO, Pixel_state::PIXEL_ZERO);
             screen.center_string(font, "Restore presets", font.height);
         }
         else {
-            char* json_format;
-            if (Settings_file::instance().get_setting_file_json_string(menu.get_current_item()->get_text(),
-                    dir_chooser_menu.get_current_item()->get_text(), &json_format)) {
-                if (!Midi_processor_manager::instance().get_product_string_from_setting_data(json_format, prod_string, sizeof(prod_string))) {
-                    printf("failed to parse JSON data\r\n");
-                    delete[] json_format;
-                    return;
-                }
-                delete[] json_format;
-                screen.center_string_on_two_lines(font, prod_string, 0);
-            }
+            size_t idx = dir_chooser_menu.get_current_item_idx();
+            if (idx < product_strings.size() && product_strings[idx].length() != 0)
+                screen.center_string_on_two_lines(font, product_strings[idx].c_str(), 0);
         }
     }
 }
@@ -29,6 +29,7 @@
 #include "menu.h"
 #include "callback_menu_item.h"
 #include "text_item_chooser_menu.h"
+#include "fs_job_queue.h"
 namespace rppicomidi
 {
 class Restore_view : public View
@@ -46,12 +47,21 @@ public:
 private:
     static void dir_select_callback(View* context, View**);
     static void file_select_callback(View* context, View**);
+    static void static_restore_progress(void* context, Fs_job& job, Fs_job::Step_result result);
     void update_product_string_display();
+
+    /**
+     * @brief show status on the top line if this view is on the screen
+     */
+    void show_status(const char* status);
     const Mono_mono_font& font;
     Menu menu;
     Menu dir_chooser_menu;
     Menu* current_menu;
     std::vector<std::string> filenames;
+    std::vector<std::string> product_strings; // the product string of each file in filenames
+    bool active;            // true if this view is on the screen
+    bool restore_running;   // true from the start of a restore job until it finishes
     static constexpr const char* all_files_str="All files";
     static const uint8_t max_line_length = 21;
 };
@@ -0,0 +1,101 @@
+/**
+ * @file setting_label_enum.h
+ * @brief this file contains the Setting_label_enum class, a string enum
+ * setting whose labels live in a shared table in flash
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "parson.h"
+namespace rppicomidi
+{
+/**
+ * @brief A setting that is one of a fixed list of labels
+ *
+ * Unlike Setting_string_enum, this class does not copy the labels. It stores
+ * a pointer to a static const table of labels, which the linker places in
+ * flash, and the index of the current value. All instances of a processor
+ * share the same table. The JSON format is the same as Setting_string_enum:
+ * the setting name maps to the label text.
+ */
+class Setting_label_enum
+{
+public:
+    Setting_label_enum(const char* name_, const char* const* labels_, uint8_t nlabels_, uint8_t default_idx_=0) :
+        name{name_}, labels{labels_}, nlabels{nlabels_}, default_idx{default_idx_}, ivalue{default_idx_} {}
+    Setting_label_enum()=delete;
+
+    int get_ivalue() const { return ivalue; }
+
+    /**
+     * @brief set the current value to the label at index idx
+     *
+     * @return true if idx is in range, false otherwise
+     */
+    bool set(size_t idx)
+    {
+        if (idx >= nlabels)
+            return false;
+        ivalue = idx;
+        return true;
+    }
+
+    void set_default() { ivalue = default_idx; }
+
+    const char* get_label() const { return labels[ivalue]; }
+    const char* get_label(size_t idx) const { return idx < nlabels ? labels[idx] : nullptr; }
+    void get(std::string& str) const { str = labels[ivalue]; }
+    size_t get_num_values() const { return nlabels; }
+    const char* get_name() const { return name; }
+
+    void serialize(JSON_Object* root_object) const { json_object_set_string(root_object, name, labels[ivalue]); }
+
+    /**
+     * @brief set the current value from the label the setting name maps to in root_object
+     *
+     * @return true if root_object contains one of the labels, false otherwise
+     */
+    bool deserialize(JSON_Object* root_object)
+    {
+        const char* label = json_object_get_string(root_object, name);
+        if (label == nullptr)
+            return false;
+        for (uint8_t idx = 0; idx < nlabels; idx++) {
+            if (strcmp(label, labels[idx]) == 0) {
+                ivalue = idx;
+                return true;
+            }
+        }
+        return false;
+    }
+private:
+    const char* name;
+    const char* const* labels;
+    uint8_t nlabels;
+    uint8_t default_idx;
+    uint8_t ivalue;
+};
+}
@@ -0,0 +1,225 @@
+/**
+ * @file settings_blob.h
+ * @brief Compact little-endian binary encoding of processor settings
+ *
+ * MIT License
+ *
+ * Copyright (c) 2022 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+namespace rppicomidi
+{
+/**
+ * @brief Append settings to a little-endian binary blob
+ *
+ * Every multi-byte value is stored least significant byte first no matter
+ * what byte order the processor uses. Strings and nested blobs are stored
+ * with a length prefix so a reader can skip over data it does not understand.
+ */
+class Settings_blob_writer
+{
+public:
+    Settings_blob_writer(std::vector<uint8_t>& data_) : data{data_} {}
+
+    /**
+     * @brief append an integer value of any size
+     *
+     * @tparam T the integer type; sizeof(T) bytes are written
+     * @param value the value to append
+     */
+    template<typename T> void put(T value)
+    {
+        for (size_t idx = 0; idx < sizeof(T); idx++) {
+            data.push_back(static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8*idx)));
+        }
+    }
+
+    void put_bytes(const uint8_t* bytes, size_t nbytes) { data.insert(data.end(), bytes, bytes+nbytes); }
+
+    /**
+     * @brief append a string as an 8-bit length followed by the characters
+     *
+     * Strings longer than 255 characters are truncated.
+     */
+    void put_string(const char* str)
+    {
+        size_t len = strlen(str);
+        if (len > 255)
+            len = 255;
+        put<uint8_t>(len);
+        put_bytes(reinterpret_cast<const uint8_t*>(str), len);
+    }
+
+    /**
+     * @brief reserve space for a length prefix of type T
+     *
+     * @return size_t the offset to pass to end_length() after the
+     * data the length describes is appended
+     */
+    template<typename T> size_t begin_length()
+    {
+        size_t offset = data.size();
+        put<T>(0);
+        return offset;
+    }
+
+    /**
+     * @brief set the length prefix at offset to the number of bytes
+     * appended since the matching begin_length() call
+     */
+    template<typename T> void end_length(size_t offset)
+    {
+        put_at<T>(offset, data.size() - offset - sizeof(T));
+    }
+
+    /**
+     * @brief overwrite a value that was already appended
+     */
+    template<typename T> void put_at(size_t offset, T value)
+    {
+        for (size_t idx = 0; idx < sizeof(T); idx++) {
+            data[offset+idx] = static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8*idx));
+        }
+    }
+
+    size_t size() const { return data.size(); }
+    const uint8_t* get_data() const { return data.data(); }
+private:
+    std::vector<uint8_t>& data;
+};
+
+/**
+ * @brief Read settings from a little-endian binary blob written by
+ * Settings_blob_writer
+ *
+ * The reader never reads past the end of the blob; each get function
+ * returns false instead.
+ */
+class Settings_blob_reader
+{
+public:
+    Settings_blob_reader() : data{nullptr}, len{0}, offset{0} {}
+    Settings_blob_reader(const uint8_t* data_, size_t len_) : data{data_}, len{len_}, offset{0} {}
+
+    template<typename T> bool get(T& value)
+    {
+        if (get_remaining() < sizeof(T))
+            return false;
+        uint64_t result = 0;
+        for (size_t idx = 0; idx < sizeof(T); idx++) {
+            result |= static_cast<uint64_t>(data[offset++]) << (8*idx);
+        }
+        value = static_cast<T>(result);
+        return true;
+    }
+
+    /**
+     * @brief read a string written by Settings_blob_writer::put_string()
+     *
+     * @param str the buffer to receive the null terminated string
+     * @param max_str the size of the str buffer
+     * @return true if successful, false if the blob is too short or
+     * if the string does not fit in str
+     */
+    bool get_string(char* str, size_t max_str)
+    {
+        uint8_t slen;
+        if (!get(slen) || slen >= max_str || get_remaining() < slen)
+            return false;
+        memcpy(str, data+offset, slen);
+        str[slen] = '\0';
+        offset += slen;
+        return true;
+    }
+
+    /**
+     * @brief get a reader for the nested blob with a length prefix of type T
+     *
+     * @param blob set to a reader for the nested blob
+     * @return true if successful, false if the blob is too short
+     */
+    template<typename T> bool get_blob(Settings_blob_reader& blob)
+    {
+        T blob_len;
+        if (!get(blob_len) || get_remaining() < blob_len)
+            return false;
+        blob = Settings_blob_reader(data+offset, blob_len);
+        offset += blob_len;
+        return true;
+    }
+
+    /**
+     * @brief read bytes written by Settings_blob_writer::put_bytes()
+     *
+     * @return true if successful, false if the blob is too short
+     */
+    bool get_bytes(uint8_t* bytes, size_t nbytes)
+    {
+        if (get_remaining() < nbytes)
+            return false;
+        memcpy(bytes, data+offset, nbytes);
+        offset += nbytes;
+        return true;
+    }
+
+    bool skip(size_t nbytes)
+    {
+        if (get_remaining() < nbytes)
+            return false;
+        offset += nbytes;
+        return true;
+    }
+
+    size_t get_remaining() const { return len - offset; }
+    const uint8_t* get_ptr() const { return data + offset; }
+    size_t get_offset() const { return offset; }
+private:
+    const uint8_t* data;
+    size_t len;
+    size_t offset;
+};
+
+/**
+ * @brief calculate the CRC-32 (IEEE 802.3 polynomial) of a block of data
+ *
+ * This is the same CRC zlib computes. It is calculated a bit at a time
+ * to avoid a 1kbyte lookup table; it is only used when settings are
+ * loaded or stored.
+ *
+ * @param data the data
+ * @param nbytes the number of bytes of data
+ * @param crc the CRC of the preceding data, if the data is split into pieces
+ * @return uint32_t the CRC-32 of the data
+ */
+static inline uint32_t settings_crc32(const uint8_t* data, size_t nbytes, uint32_t crc = 0)
+{
+    crc = ~crc;
+    while (nbytes--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
+}
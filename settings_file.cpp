@@ -27,11 +27,52 @@
 #include <assert.h>
 #include "settings_file.h"
 #include "midi_processor_manager.h"
+#include "flash_commit.h"
+#include "json_stream_reader.h"
+#include "mem_stats.h"
 #include "rp2040_rtc.h"
+#include "diskio.h"
+#include "hardware/flash.h"
 
-rppicomidi::Settings_file::Settings_file() : vid{0}, pid{0}
+// The linker wraps the Pico SDK flash functions so the flash wear can be counted
+// and the time each call keeps core1 locked out can be measured
+static volatile uint32_t flash_erase_count = 0;  // the number of flash_range_erase() calls
+static volatile uint32_t flash_erase_bytes = 0;  // the number of bytes flash_range_erase() erased
+static volatile uint32_t flash_program_count = 0;// the number of flash_range_program() calls
+static volatile uint32_t flash_program_bytes = 0;// the number of bytes flash_range_program() programmed
+
+extern "C" {
+void __real_flash_range_erase(uint32_t flash_offs, size_t count);
+void __real_flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+void __wrap_flash_range_erase(uint32_t flash_offs, size_t count)
 {
-    // Make sure the flash filesystem is working
+    ++flash_erase_count;
+    flash_erase_bytes += count;
+    uint32_t start = time_us_32();
+    __real_flash_range_erase(flash_offs, count);
+    rppicomidi::Flash_commit::instance().record_flash_op(time_us_32() - start);
+}
+
+void __wrap_flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count)
+{
+    ++flash_program_count;
+    flash_program_bytes += count;
+    uint32_t start = time_us_32();
+    __real_flash_range_program(flash_offs, data, count);
+    rppicomidi::Flash_commit::instance().record_flash_op(time_us_32() - start);
+}
+}
+
+rppicomidi::Settings_file::Settings_file() : vid{0}, pid{0}, stored_current_preset{0}, bytes_written{0},
+    is_mounted{false}, fs_op_depth{0}, current_op{FS_OP_LOAD}, op_start_us{0}, nmounts{0}, nunmounts{0},
+    dir_cache_nentries{0}, dir_cache_valid{false}, dir_cache_hits{0}, dir_cache_misses{0}, index_loaded{false},
+    backup_dirnames_valid{false}, xfer_bytes{0}
+{
+    memset(&store_stats, 0, sizeof(store_stats));
+    memset(fs_op_stats, 0, sizeof(fs_op_stats));
+    forget_stored_records();
+    // Make sure the flash filesystem is working. It stays mounted from now on.
     int error_code = pico_mount(false);
     if (error_code != 0) {
         printf("Error %s mounting the flash file system\r\nFormatting...", pico_errmsg(error_code));
@@ -45,10 +86,116 @@ rppicomidi::Settings_file::Settings_file() : vid{0}, pid{0}
         }
     }
     printf("successfully mounted flash file system\r\n");
+    is_mounted = true;
+    ++nmounts;
+}
+
+int rppicomidi::Settings_file::begin_fs_op(Fs_op op)
+{
+    if (!is_mounted) {
+        int error_code = pico_mount(false);
+        if (error_code != LFS_ERR_OK)
+            return error_code;
+        is_mounted = true;
+        ++nmounts;
+    }
+    if (fs_op_depth++ == 0) {
+        current_op = op;
+        op_start_us = time_us_32();
+    }
+    if (!is_read_only_op(op)) {
+        // the files may change
+        dir_cache_valid = false;
+        dir_cache_nentries = 0;
+    }
+    return LFS_ERR_OK;
+}
+
+void rppicomidi::Settings_file::end_fs_op()
+{
+    assert(fs_op_depth > 0);
+    if (--fs_op_depth == 0) {
+        uint32_t elapsed = time_us_32() - op_start_us;
+        auto& stats = fs_op_stats[current_op];
+        ++stats.nops;
+        stats.last_us = elapsed;
+        if (elapsed > stats.max_us)
+            stats.max_us = elapsed;
+        stats.total_us += elapsed;
+    }
+}
+
+void rppicomidi::Settings_file::unmount()
+{
+    assert(fs_op_depth == 0);
+    if (is_mounted) {
+        pico_unmount();
+        is_mounted = false;
+        ++nunmounts;
+    }
+    dir_cache_valid = false;
+    dir_cache_nentries = 0;
+}
 
-    if (pico_unmount() != 0) {
-        printf("Failed to unmount the flash file system\r\n");
+int rppicomidi::Settings_file::format()
+{
+    Fs_job_queue::instance().flush();
+    unmount();
+    forget_stored_records();
+    preset_index.clear();
+    index_loaded = false;
+    int error_code = pico_mount(true); // format then mount
+    if (error_code == LFS_ERR_OK) {
+        is_mounted = true;
+        ++nmounts;
     }
+    return error_code;
+}
+
+int rppicomidi::Settings_file::lookup_dir_cache(const char* fn, lfs_size_t& size)
+{
+    if (!is_read_only_op(current_op))
+        return -1; // the files may have changed since the cache was filled
+    if (strchr(fn, '/') != nullptr)
+        return -1; // only the root directory is cached
+    if (dir_cache_valid) {
+        ++dir_cache_hits;
+    }
+    else {
+        // Read the whole root directory once; later lookups use the cache
+        ++dir_cache_misses;
+        dir_cache_nentries = 0;
+        lfs_dir_t dir;
+        struct lfs_info info;
+        if (lfs_dir_open(&dir, "/") != LFS_ERR_OK)
+            return -1;
+        bool complete = true;
+        int res;
+        while ((res = lfs_dir_read(&dir, &info)) > 0) {
+            if (info.type != LFS_TYPE_REG)
+                continue;
+            if (dir_cache_nentries >= SETTINGS_DIR_CACHE_ENTRIES || strlen(info.name) >= max_record_filename) {
+                complete = false;
+                break;
+            }
+            auto& entry = dir_cache[dir_cache_nentries++];
+            strcpy(entry.name, info.name);
+            entry.size = info.size;
+        }
+        lfs_dir_close(&dir);
+        if (res < 0 || !complete) {
+            dir_cache_nentries = 0;
+            return -1;
+        }
+        dir_cache_valid = true;
+    }
+    for (uint8_t idx = 0; idx < dir_cache_nentries; idx++) {
+        if (strcmp(dir_cache[idx].name, fn) == 0) {
+            size = dir_cache[idx].size;
+            return 1;
+        }
+    }
+    return 0;
 }
 
 void rppicomidi::Settings_file::add_all_cli_commands(EmbeddedCli *cli)
@@ -102,10 +249,17 @@ void rppicomidi::Settings_file::add_all_cli_commands(EmbeddedCli *cli)
         this,
         static_fatfs_ls
     }));
+    assert(embeddedCliAddBinding(cli, {
+        "fatstat",
+        "display USB drive transfer statistics. usage: fatstat [reset]",
+        true,
+        this,
+        static_fatfs_stat
+    }));
     assert(embeddedCliAddBinding(cli, {
         "backup",
-        "backup current presets. usage: backup",
-        false,
+        "backup current presets. usage: backup [archive|changes]",
+        true,
         this,
         static_fatfs_backup
     }));
@@ -135,7 +289,7 @@ int rppicomidi::Settings_file::load_settings_string(const char* settings_filenam
 {
     int error_code = 0;
     if (mount)
-        error_code = pico_mount(false);
+        error_code = begin_fs_op(FS_OP_LOAD);
     if (error_code != 0) {
         printf("unexpected error %s mounting flash\r\n", pico_errmsg(error_code));
         return error_code;
@@ -144,7 +298,7 @@ int rppicomidi::Settings_file::load_settings_string(const char* settings_filenam
     if (file < 0) {
         // file isn't there
         if (mount)
-            pico_unmount();
+            end_fs_op();
         return file; // the error code
     }
     else {
@@ -153,7 +307,7 @@ int rppicomidi::Settings_file::load_settings_string(const char* settings_filenam
         if (flen < 0) {
             // Something went wrong
             if (mount)
-                pico_unmount();
+                end_fs_op();
             return flen;
         }
         // create a string long enough
@@ -161,13 +315,13 @@ int rppicomidi::Settings_file::load_settings_string(const char* settings_filenam
         if (!raw_settings_ptr) {
             pico_close(file);
             if (mount)
-                pico_unmount();
+                end_fs_op();
             return LFS_ERR_NOMEM; // new failed
         }
         auto nread = pico_read(file, *raw_settings_ptr, flen);
         pico_close(file);
         if (mount)
-            pico_unmount();
+            end_fs_op();
         if (nread == (lfs_size_t)flen) {
             // Success!
             (*raw_settings_ptr)[flen]='\0'; // just in case, add null termination
@@ -182,384 +336,1346 @@ int rppicomidi::Settings_file::load_settings_string(const char* settings_filenam
     }
 }
 
-int rppicomidi::Settings_file::load_settings_string(char** raw_settings_ptr)
+int rppicomidi::Settings_file::load_settings_data(const char* settings_filename, std::vector<uint8_t>& data, bool mount)
 {
-    if (vid != 0 && pid != 0) {
-        char settings_filename[]="0000-0000.json";
-        get_filename(settings_filename);
-        return load_settings_string(settings_filename, raw_settings_ptr);
+    int error_code = 0;
+    if (mount)
+        error_code = begin_fs_op(FS_OP_LOAD);
+    if (error_code != 0) {
+        printf("unexpected error %s mounting flash\r\n", pico_errmsg(error_code));
+        return error_code;
+    }
+    lfs_size_t cached_size;
+    if (lookup_dir_cache(settings_filename, cached_size) == 0) {
+        // the directory cache says the file isn't there
+        if (mount)
+            end_fs_op();
+        return LFS_ERR_NOENT;
     }
-    return LFS_ERR_INVAL; // vid and pid are not valid yet
+    int file = pico_open(settings_filename, LFS_O_RDONLY);
+    if (file < 0) {
+        // file isn't there
+        if (mount)
+            end_fs_op();
+        return file; // the error code
+    }
+    auto flen = pico_size(file);
+    if (flen < 0) {
+        // Something went wrong
+        pico_close(file);
+        if (mount)
+            end_fs_op();
+        return flen;
+    }
+    data.resize(flen);
+    int nread = pico_read(file, data.data(), flen);
+    pico_close(file);
+    if (mount)
+        end_fs_op();
+    if (nread >= 0 && nread != flen) {
+        nread = LFS_ERR_IO;
+    }
+    if (nread < 0)
+        data.clear();
+    return nread;
 }
 
-bool rppicomidi::Settings_file::load()
+void rppicomidi::Settings_file::load_index()
 {
-    char* raw_settings = NULL;
-    auto error_code = load_settings_string(&raw_settings);
-    bool result = false;
-    if (error_code > 0) {
-        //printf("load (%04x-%04x):\r\n", vid, pid);
-        result = Midi_processor_manager::instance().deserialize(raw_settings);
+    if (index_loaded)
+        return;
+    preset_index.clear();
+    std::vector<uint8_t> data;
+    if (load_settings_data(index_filename, data, false) > 0) {
+        Settings_blob_reader reader(data.data(), data.size());
+        uint8_t version;
+        uint16_t nentries;
+        bool ok = reader.get(version) && version == 1 && reader.get(nentries);
+        for (uint16_t idx = 0; ok && idx < nentries; idx++) {
+            Index_entry entry;
+            ok = reader.get_string(entry.id, sizeof(entry.id)) && reader.get_string(entry.prod, sizeof(entry.prod)) &&
+                reader.get(entry.size) && reader.get(entry.mtime);
+            if (ok)
+                preset_index.push_back(entry);
+        }
+        if (ok) {
+            index_loaded = true;
+            return;
+        }
+        printf("preset index is corrupt; rebuilding it\r\n");
+        preset_index.clear();
     }
-    else {
-        char* default_raw_settings = Midi_processor_manager::instance().serialize_default();
-        if (!default_raw_settings) {
-            printf("Failed to allocate previous raw settings\r\n");
+    // There is no index file yet. Build it from the device records once.
+    std::vector<std::string> filenames;
+    lfs_dir_t dir;
+    struct lfs_info info;
+    if (lfs_dir_open(&dir, "/") == LFS_ERR_OK) {
+        while (lfs_dir_read(&dir, &info) > 0) {
+            if (info.type == LFS_TYPE_REG && has_extension(info.name, device_ext))
+                filenames.push_back(std::string(info.name));
+        }
+        lfs_dir_close(&dir);
+    }
+    for (auto& fn: filenames) {
+        std::vector<uint8_t> record;
+        if (load_settings_data(fn.c_str(), record, false) > 0) {
+            Index_entry entry;
+            snprintf(entry.id, sizeof(entry.id), "%.9s", fn.c_str());
+            if (!Midi_processor_manager::instance().get_product_string_from_setting_data(record.data(), record.size(), entry.prod, sizeof(entry.prod)))
+                entry.prod[0] = '\0';
+            entry.size = record.size();
+            entry.mtime = 0; // littlefs does not keep the time
+            preset_index.push_back(entry);
+        }
+    }
+    index_loaded = true;
+    store_index();
+}
+
+void rppicomidi::Settings_file::store_index()
+{
+    std::vector<uint8_t> data;
+    Settings_blob_writer writer(data);
+    writer.put<uint8_t>(1); // the index file format version
+    writer.put<uint16_t>(preset_index.size());
+    for (auto& entry: preset_index) {
+        writer.put_string(entry.id);
+        writer.put_string(entry.prod);
+        writer.put(entry.size);
+        writer.put(entry.mtime);
+    }
+    write_settings_data(index_filename, data.data(), data.size(), false);
+    // this may happen during a read-only operation, so the directory cache is stale
+    dir_cache_valid = false;
+    dir_cache_nentries = 0;
+}
+
+void rppicomidi::Settings_file::update_index_entry(const char* fn, const uint8_t* data, size_t len)
+{
+    load_index();
+    Index_entry* entry = nullptr;
+    for (auto& existing: preset_index) {
+        if (strncmp(existing.id, fn, 9) == 0) {
+            entry = &existing;
+            break;
         }
-        else {
-            printf("loading defaults:\r\n");
-            result = Midi_processor_manager::instance().deserialize(default_raw_settings);
-            json_free_serialized_string(default_raw_settings);
-        }        
     }
-    if (error_code != LFS_ERR_OK)
+    char prod[max_index_prod];
+    if (!Midi_processor_manager::instance().get_product_string_from_setting_data(data, len, prod, sizeof(prod)))
+        prod[0] = '\0';
+    if (entry == nullptr) {
+        preset_index.push_back(Index_entry{});
+        entry = &preset_index.back();
+        snprintf(entry->id, sizeof(entry->id), "%.9s", fn);
+    }
+    else if (entry->size == len && strcmp(entry->prod, prod) == 0) {
+        // A new time alone is not worth another flash write on every save
+        return;
+    }
+    strcpy(entry->prod, prod);
+    entry->size = len;
+    entry->mtime = get_fattime();
+    store_index();
+}
+
+void rppicomidi::Settings_file::remove_index_entry(const char* fn)
+{
+    load_index();
+    for (auto it = preset_index.begin(); it != preset_index.end(); ++it) {
+        if (strncmp(it->id, fn, 9) == 0) {
+            preset_index.erase(it);
+            store_index();
+            return;
+        }
+    }
+}
+
+bool rppicomidi::Settings_file::get_indexed_product_string(const char* filename, char* product_string, size_t max_string)
+{
+    if (!index_loaded) {
+        if (begin_fs_op(FS_OP_LOAD) != LFS_ERR_OK)
+            return false;
+        load_index();
+        end_fs_op();
+    }
+    for (auto& entry: preset_index) {
+        if (strncmp(entry.id, filename, 9) == 0 && has_extension(filename, device_ext)) {
+            snprintf(product_string, max_string, "%s", entry.prod);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool rppicomidi::Settings_file::has_extension(const char* fn, const char* ext)
+{
+    size_t fnlen = strlen(fn);
+    size_t extlen = strlen(ext);
+    return fnlen > extlen && strcmp(fn + fnlen - extlen, ext) == 0;
+}
+
+void rppicomidi::Settings_file::get_record_filename(char* fn, size_t max_fn, const char* id, uint8_t preset_num)
+{
+    snprintf(fn, max_fn, "%.9s.p%u", id, preset_num);
+}
+
+int rppicomidi::Settings_file::load_device_settings(const char* id, Device_settings& settings, bool mount)
+{
+    int error_code = LFS_ERR_OK;
+    if (mount)
+        error_code = begin_fs_op(FS_OP_LOAD);
+    if (error_code != 0) {
+        printf("unexpected error %s mounting flash\r\n", pico_errmsg(error_code));
+        return error_code;
+    }
+    char fn[max_record_filename];
+    snprintf(fn, sizeof(fn), "%.9s%s", id, device_ext);
+    int nread = load_settings_data(fn, settings.device, false);
+    settings.current_preset = 0;
+    settings.presets.clear();
+    settings.presets.resize(Device_settings::num_presets);
+    if (nread > 0) {
+        std::vector<uint8_t> current;
+        snprintf(fn, sizeof(fn), "%.9s%s", id, current_preset_ext);
+        if (load_settings_data(fn, current, false) == 1) {
+            settings.current_preset = current[0];
+        }
+        for (uint8_t preset_num = 1; preset_num <= Device_settings::num_presets; preset_num++) {
+            get_record_filename(fn, sizeof(fn), id, preset_num);
+            // A preset that was never stored has no record
+            int error_code = load_settings_data(fn, settings.presets[preset_num-1], false);
+            if (error_code < 0 && error_code != LFS_ERR_NOENT)
+                printf("error %s reading %s\r\n", pico_errmsg(error_code), fn);
+        }
+    }
+    if (mount)
+        end_fs_op();
+    return nread;
+}
+
+int rppicomidi::Settings_file::store_device_settings(const char* id, const Device_settings& settings, bool mount)
+{
+    int error_code = LFS_ERR_OK;
+    if (mount)
+        error_code = begin_fs_op(FS_OP_STORE);
+    if (error_code != 0) {
+        printf("unexpected error %s mounting flash\r\n", pico_errmsg(error_code));
+        return error_code;
+    }
+    char fn[max_record_filename];
+    snprintf(fn, sizeof(fn), "%.9s%s", id, device_ext);
+    error_code = write_settings_data(fn, settings.device.data(), settings.device.size(), false);
+    if (error_code == LFS_ERR_OK) {
+        snprintf(fn, sizeof(fn), "%.9s%s", id, current_preset_ext);
+        error_code = write_settings_data(fn, &settings.current_preset, 1, false);
+    }
+    for (uint8_t preset_num = 1; error_code == LFS_ERR_OK && preset_num <= Device_settings::num_presets; preset_num++) {
+        get_record_filename(fn, sizeof(fn), id, preset_num);
+        if (preset_num <= settings.presets.size() && settings.presets[preset_num-1].size() != 0)
+            error_code = write_settings_data(fn, settings.presets[preset_num-1].data(), settings.presets[preset_num-1].size(), false);
+        else
+            pico_remove(fn); // the preset has no record
+    }
+    if (mount)
+        end_fs_op();
+    return error_code;
+}
+
+int rppicomidi::Settings_file::delete_device_files(const char* filename)
+{
+    if (!has_extension(filename, device_ext))
+        return delete_file(filename);
+    Fs_job_queue::instance().flush();
+    int error_code = begin_fs_op(FS_OP_DELETE);
+    if (error_code != LFS_ERR_OK) {
+        printf("Unexpected Error %s mounting settings file system\r\n", pico_errmsg(error_code));
+        return error_code;
+    }
+    error_code = delete_file(filename, false);
+    char fn[max_record_filename];
+    snprintf(fn, sizeof(fn), "%.9s%s", filename, current_preset_ext);
+    pico_remove(fn);
+    for (uint8_t preset_num = 1; preset_num <= Device_settings::num_presets; preset_num++) {
+        get_record_filename(fn, sizeof(fn), filename, preset_num);
+        pico_remove(fn);
+    }
+    end_fs_op();
+    return error_code;
+}
+
+int rppicomidi::Settings_file::convert_legacy_settings_file(Device_settings& settings)
+{
+    char legacy_filename[]="0000-0000.json";
+    get_filename(legacy_filename);
+    char* raw_settings = nullptr;
+    int error_code = load_settings_string(legacy_filename, &raw_settings);
+    if (error_code <= 0) {
+        if (raw_settings)
+            delete[] raw_settings;
+        return error_code == 0 ? LFS_ERR_NOENT : error_code;
+    }
+    bool converted = Midi_processor_manager::instance().convert_from_json(raw_settings, settings);
+    delete[] raw_settings;
+    if (!converted) {
+        printf("could not convert %s\r\n", legacy_filename);
+        return LFS_ERR_CORRUPT;
+    }
+    error_code = store_device_settings(legacy_filename, settings);
+    if (error_code == LFS_ERR_OK) {
+        printf("converted %s to binary records\r\n", legacy_filename);
+        delete_file(legacy_filename);
+    }
+    return settings.device.size();
+}
+
+void rppicomidi::Settings_file::remember_record_hash(Record_hash& hash, const std::vector<uint8_t>& record)
+{
+    hash.valid = record.size() != 0;
+    hash.crc = hash.valid ? settings_crc32(record.data(), record.size()) : 0;
+}
+
+void rppicomidi::Settings_file::forget_stored_records()
+{
+    device_hash.valid = false;
+    for (auto& hash: preset_hashes)
+        hash.valid = false;
+    stored_current_preset = 0;
+}
+
+void rppicomidi::Settings_file::remember_stored_records(const Device_settings* settings)
+{
+    forget_stored_records();
+    if (settings) {
+        remember_record_hash(device_hash, settings->device);
+        for (size_t idx = 0; idx < Device_settings::num_presets && idx < settings->presets.size(); idx++)
+            remember_record_hash(preset_hashes[idx], settings->presets[idx]);
+        stored_current_preset = settings->current_preset;
+    }
+}
+
+int rppicomidi::Settings_file::write_record_if_changed(const char* fn, const std::vector<uint8_t>& record, Record_hash& hash)
+{
+    uint32_t crc = settings_crc32(record.data(), record.size());
+    if (hash.valid && hash.crc == crc) {
+        ++store_stats.skipped_writes;
+        return LFS_ERR_OK;
+    }
+    int error_code = write_settings_data(fn, record.data(), record.size(), false);
+    hash.valid = error_code == LFS_ERR_OK;
+    hash.crc = crc;
+    return error_code;
+}
+
+bool rppicomidi::Settings_file::static_fatfs_write_chunk(void* context, const uint8_t* data, size_t len)
+{
+    UINT written;
+    FRESULT fatres = f_write(reinterpret_cast<FIL*>(context), data, len, &written);
+    return fatres == FR_OK && written == len;
+}
+
+int32_t rppicomidi::Settings_file::static_lfs_read_chunk(void* context, uint8_t* data, size_t maxlen)
+{
+    return lfs_file_read(reinterpret_cast<lfs_file_t*>(context), data, maxlen);
+}
+
+int32_t rppicomidi::Settings_file::copy_lfs_to_fatfs(lfs_file_t* src, FIL* dest)
+{
+    Chunk_stream stream(copy_chunk, SETTINGS_COPY_CHUNK_BYTES, static_fatfs_write_chunk, dest);
+    if (!stream.copy(static_lfs_read_chunk, src))
+        return -1;
+    return stream.get_nwritten();
+}
+
+bool rppicomidi::Settings_file::static_console_write(void*, const char* data, size_t len)
+{
+    printf("%.*s", static_cast<int>(len), data);
+    return true;
+}
+
+int rppicomidi::Settings_file::write_settings_data(const char* settings_filename, const uint8_t* data, size_t len, bool mount)
+{
+    int error_code = LFS_ERR_OK;
+    if (mount)
+        error_code = begin_fs_op(FS_OP_STORE);
+    if (error_code != 0) {
+        printf("unexpected error %s mounting flash\r\n", pico_errmsg(error_code));
+        return error_code;
+    }
+    int file = pico_open(settings_filename, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+    if (file < 0) {
+        printf("error %s opening %s for writing\r\n", pico_errmsg(file), settings_filename);
+        if (mount)
+            end_fs_op();
+        return file;
+    }
+    error_code = pico_write(file, data, len);
+    pico_close(file);
+    if ((size_t)error_code == len && has_extension(settings_filename, device_ext))
+        update_index_entry(settings_filename, data, len);
+    if (mount)
+        end_fs_op();
+    if (error_code > 0)
+        bytes_written += error_code;
+    ++store_stats.file_writes;
+    if (error_code < 0) {
+        printf("error %s writing settings to file %s\r\n", pico_errmsg(error_code), settings_filename);
+        return error_code;
+    }
+    else if ((size_t)error_code < len) {
+        printf("store: Only %d bytes stored out of %u\r\n", error_code, len);
+        // hmm. no idea why that should happen
+        return LFS_ERR_IO;
+    }
+    return LFS_ERR_OK;
+}
+
+bool rppicomidi::Settings_file::load()
+{
+    Fs_job_queue::instance().flush();
+    Device_settings settings;
+    char id[]="0000-0000";
+    get_filename(id);
+    int error_code = LFS_ERR_INVAL; // vid and pid are not valid yet
+    if (vid != 0 && pid != 0) {
+        error_code = load_device_settings(id, settings);
+        if (error_code == LFS_ERR_NOENT)
+            error_code = convert_legacy_settings_file(settings);
+    }
+    if (error_code < 0) {
         printf("settings file load error %s\r\n", pico_errmsg(error_code));
-    if (raw_settings)
-        delete[] raw_settings;
-    return result;
+        printf("loading defaults:\r\n");
+        settings = Device_settings();
+    }
+    remember_stored_records(error_code > 0 ? &settings : nullptr);
+    return Midi_processor_manager::instance().deserialize(settings);
 }
 
-bool rppicomidi::Settings_file::get_next_backup_directory_name(char* dirname, size_t maxname)
+bool rppicomidi::Settings_file::scan_backup_directories()
 {
-    // 10 characters for the date plus a null terminator
-    if (maxname < 11)
-        return false;
+    if (backup_dirnames_valid)
+        return true;
     FRESULT fatres = f_chdrive("0:");
     if (fatres != FR_OK)
         return false; // Need to be able to access the drive
-
-    fatres = f_chdir("/");
+    backup_dirnames.clear();
+    DIR dir;
+    fatres = f_opendir(&dir, base_preset_path);
+    if (fatres == FR_NO_PATH) {
+        backup_dirnames_valid = true;
+        return true; // no backup has ever been done
+    }
     if (fatres != FR_OK)
-        return false; // need to at least be able to access the root directory
+        return false;
+    FILINFO info;
+    fatres = f_readdir(&dir, &info);
+    while (fatres == FR_OK && info.fname[0] != 0) {
+        if ((info.fattrib & AM_DIR) || is_archive_name(info.fname, strlen(info.fname))) {
+            backup_dirnames.push_back(std::string(info.fname));
+        }
+        fatres = f_readdir(&dir, &info);
+    }
+    f_closedir(&dir);
+    backup_dirnames_valid = fatres == FR_OK;
+    return backup_dirnames_valid;
+}
+
+bool rppicomidi::Settings_file::get_next_backup_directory_name(char* dirname, size_t maxname)
+{
+    // 10 characters for the date plus a null terminator
+    if (maxname < 11)
+        return false;
+    if (!scan_backup_directories())
+        return false;
     uint8_t month, day;
     uint16_t year;
     Rp2040_rtc::instance().get_date(year, month, day);
     sprintf(dirname, "%02u-%02u-%04u", month, day, year);
-    FRESULT res = f_chdir(base_preset_path);
-    if (res == FR_NO_PATH)
-        return true; // no backup has ever been done, so the dirname is correct
-    else if (res != FR_OK) {
-        return false; // the directory exists, but changing into it failed
+    // Mark the versions already used today: bit 0 is the plain date, bit N is date-N
+    uint32_t used[256/32] = {0};
+    for (auto& name: backup_dirnames) {
+        if (strncmp(name.c_str(), dirname, 10) != 0)
+            continue;
+        // an archive uses the same name as the directory it replaces
+        const char* suffix = name.c_str() + 10;
+        const char* end = name.c_str() + name.length();
+        if (is_archive_name(name.c_str(), name.length()))
+            end -= strlen(archive_ext);
+        if (suffix == end) {
+            used[0] |= 1;
+        }
+        else if (*suffix == '-' && suffix[1] != '0') {
+            char* endptr;
+            unsigned long version = strtoul(suffix+1, &endptr, 10);
+            if (endptr == end && version > 0 && version < 256)
+                used[version/32] |= 1ul << (version%32);
+        }
     }
-    DIR dir;
-    uint8_t version = 1;
-    while(res == FR_OK && version > 0) {
-        res = f_opendir(&dir, dirname);
-        if (res == FR_OK) {
-            res = f_closedir(&dir);
-            // need enough space for 4 more characters
-            if (res == FR_OK) {
-                if (maxname > 14) // 10 characters for the date, 1 for a dash, maximum of 3 for version, plus Null terminator
-                    sprintf(dirname+10, "-%u", version++); // version will wrap around if there are 256 backups on the same date
-                else
-                    return false; // not enough space for the filename
+    // Use the lowest free version, like the probe for each name in turn used to
+    for (unsigned version = 0; version < 256; version++) {
+        if ((used[version/32] & (1ul << (version%32))) == 0) {
+            if (version == 0)
+                return true;
+            if (maxname < 15) // 10 characters for the date, 1 for a dash, maximum of 3 for version, plus Null terminator
+                return false; // not enough space for the filename
+            sprintf(dirname+10, "-%u", version);
+            return true;
+        }
+    }
+    return false; // 256 backups on the same date
+}
+
+void rppicomidi::Settings_file::get_backup_name(const char* fn, char* backup_name)
+{
+    strcpy(backup_name, fn);
+    if (has_extension(backup_name, device_ext))
+        strcpy(backup_name+9, ".json");
+}
+
+bool rppicomidi::Settings_file::stream_backup_json(const char* fn, Chunk_stream& stream)
+{
+    if (has_extension(fn, device_ext)) {
+        // Backups are in JSON format
+        Device_settings settings;
+        if (load_device_settings(fn, settings, false) <= 0)
+            return false;
+        Json_stream_writer writer(Chunk_stream::static_write, &stream);
+        if (!Midi_processor_manager::instance().convert_to_json(settings, writer) || !writer.flush() || !stream.flush()) {
+            printf("could not convert %s to JSON\r\n", fn);
+            return false;
+        }
+        return true;
+    }
+    // legacy JSON settings files are copied as is
+    lfs_file_t file;
+    if (lfs_file_open(&file, fn, LFS_O_RDONLY) != LFS_ERR_OK)
+        return false;
+    bool result = stream.copy(static_lfs_read_chunk, &file);
+    lfs_file_close(&file);
+    return result;
+}
+
+bool rppicomidi::Settings_file::static_crc_write_chunk(void* context, const uint8_t* data, size_t len)
+{
+    auto writer = reinterpret_cast<Crc_writer*>(context);
+    writer->crc = settings_crc32(data, len, writer->crc);
+    return writer->file == nullptr || static_fatfs_write_chunk(writer->file, data, len);
+}
+
+int rppicomidi::Settings_file::list_backup_sources(std::vector<std::string>& sources)
+{
+    sources.clear();
+    lfs_dir_t dir;
+    int err = lfs_dir_open(&dir, "/");
+    if (err)
+        return err;
+    struct lfs_info info;
+    while ((err = lfs_dir_read(&dir, &info)) > 0) {
+        // Each device's device record file stands for all of its records
+        if (info.type == LFS_TYPE_REG && (has_extension(info.name, device_ext) || has_extension(info.name, ".json"))) {
+            if (strlen(info.name) >= max_record_filename) {
+                printf("skipping %s; the name is too long for a backup\r\n", info.name);
+                continue;
             }
+            sources.push_back(std::string(info.name));
         }
     }
-    return (version != 0) && res == FR_NO_PATH;
+    lfs_dir_close(&dir);
+    return err < 0 ? err : LFS_ERR_OK;
 }
 
-FRESULT rppicomidi::Settings_file::backup_all_presets()
+FRESULT rppicomidi::Settings_file::backup_all_presets_to_archive()
 {
-    FRESULT fatres = f_chdrive("0:");
+    Fs_job_queue::instance().flush();
+    Archive_job job;
+    job.run();
+    return job.fatres;
+}
+
+void rppicomidi::Settings_file::start_archive_backup(Fs_job_queue::Progress_fn progress_fn, void* context)
+{
+    auto job = new Archive_job;
+    assert(job);
+    Fs_job_queue::instance().add_job(job, progress_fn, context);
+}
+
+rppicomidi::Settings_file::Archive_job::~Archive_job()
+{
+    if (file_open) {
+        // the archive is not finished
+        f_close(&file);
+        f_unlink(path);
+    }
+}
+
+rppicomidi::Fs_job::Step_result rppicomidi::Settings_file::Archive_job::step()
+{
+    if (steps_done == 0)
+        fatres = start();
+    else if (steps_done <= toc.size())
+        fatres = write_entry(steps_done - 1);
+    else
+        fatres = finish();
+    ++steps_done;
+    if (fatres != FR_OK)
+        return STEP_ERROR;
+    return steps_done >= num_steps ? STEP_DONE : STEP_MORE;
+}
+
+FRESULT rppicomidi::Settings_file::Archive_job::start()
+{
+    auto& me = instance();
+    me.xfer_bytes = 0;
+    FRESULT res = f_chdrive("0:");
+    if (res != FR_OK)
+        return res;
+    if (!me.get_next_backup_directory_name(archive_name, sizeof(archive_name) - strlen(archive_ext)))
+        return FR_INT_ERR;
+    strcat(archive_name, archive_ext);
+    // The table of contents comes first, so list the settings files before writing anything
+    if (me.begin_fs_op(FS_OP_BACKUP) != LFS_ERR_OK)
+        return FR_INT_ERR;
+    int err = me.list_backup_sources(sources);
+    me.end_fs_op();
+    if (err != LFS_ERR_OK)
+        return FR_INT_ERR;
+    if (sources.size() == 0) {
+        num_steps = 1;
+        return FR_OK; // nothing to back up is not an error
+    }
+    for (auto& source: sources) {
+        Archive_entry entry;
+        memset(&entry, 0, sizeof(entry));
+        get_backup_name(source.c_str(), entry.name);
+        toc.push_back(entry);
+    }
+    num_steps = toc.size() + 2;
+    res = f_mkdir(base_preset_path);
+    if (res == FR_EXIST)
+        res = FR_OK;
+    if (res != FR_OK)
+        return res;
+    // Use the full path; other file operations may change the directory between steps
+    snprintf(path, sizeof(path), "%s/%s", base_preset_path, archive_name);
+    res = f_open(&file, path, FA_CREATE_NEW | FA_WRITE);
+    if (res != FR_OK)
+        return res;
+    file_open = true;
+    // Leave room for the header and the table of contents
+    std::vector<uint8_t> header;
+    get_archive_header(toc, header);
+    return write_archive_header(&file, header);
+}
+
+FRESULT rppicomidi::Settings_file::Archive_job::write_entry(size_t idx)
+{
+    auto& me = instance();
+    if (me.begin_fs_op(FS_OP_BACKUP) != LFS_ERR_OK)
+        return FR_INT_ERR;
+    FRESULT res = FR_OK;
+    Crc_writer writer{&file, 0};
+    toc[idx].offset = f_tell(&file);
+    Chunk_stream stream(me.copy_chunk, SETTINGS_COPY_CHUNK_BYTES, static_crc_write_chunk, &writer);
+    if (!me.stream_backup_json(sources[idx].c_str(), stream))
+        res = FR_INT_ERR;
+    me.end_fs_op();
+    toc[idx].length = stream.get_nwritten();
+    toc[idx].crc = writer.crc;
+    me.xfer_bytes += stream.get_nwritten();
+    if (res == FR_OK)
+        printf("backed up preset 0:%s/%s\r\n", path, toc[idx].name);
+    return res;
+}
+
+FRESULT rppicomidi::Settings_file::Archive_job::finish()
+{
+    // Now the offsets and CRCs are known
+    std::vector<uint8_t> header;
+    get_archive_header(toc, header);
+    FRESULT res = f_lseek(&file, 0);
+    if (res == FR_OK)
+        res = write_archive_header(&file, header);
+    FRESULT closeres = f_close(&file);
+    file_open = false;
+    if (res == FR_OK)
+        res = closeres;
+    if (res != FR_OK)
+        f_unlink(path);
+    else
+        instance().backup_dirnames.push_back(std::string(archive_name));
+    return res;
+}
+
+void rppicomidi::Settings_file::get_archive_header(const std::vector<Archive_entry>& toc, std::vector<uint8_t>& header)
+{
+    header.clear();
+    Settings_blob_writer blob(header);
+    blob.put_bytes(reinterpret_cast<const uint8_t*>(archive_magic), 4);
+    blob.put<uint16_t>(archive_format_version);
+    blob.put<uint16_t>(toc.size());
+    size_t crc_offset = blob.size();
+    blob.put<uint32_t>(0);
+    size_t toc_offset = blob.size();
+    for (auto& entry: toc) {
+        blob.put_bytes(reinterpret_cast<const uint8_t*>(entry.name), sizeof(entry.name));
+        blob.put<uint32_t>(entry.offset);
+        blob.put<uint32_t>(entry.length);
+        blob.put<uint32_t>(entry.crc);
+    }
+    blob.put_at<uint32_t>(crc_offset, settings_crc32(header.data() + toc_offset, header.size() - toc_offset));
+}
+
+FRESULT rppicomidi::Settings_file::write_archive_header(FIL* file, const std::vector<uint8_t>& header)
+{
+    UINT written;
+    FRESULT fatres = f_write(file, header.data(), header.size(), &written);
+    if (fatres == FR_OK && written != header.size())
+        fatres = FR_DENIED; // the drive is full
+    return fatres;
+}
+
+FRESULT rppicomidi::Settings_file::read_archive_toc(FIL* file, std::vector<Archive_entry>& toc)
+{
+    toc.clear();
+    uint8_t fixed[archive_header_bytes];
+    UINT nread;
+    FRESULT fatres = f_read(file, fixed, sizeof(fixed), &nread);
     if (fatres != FR_OK)
         return fatres;
-    fatres = f_chdir("/");
+    Settings_blob_reader blob(fixed, nread);
+    uint8_t magic[4];
+    uint16_t version, nentries;
+    uint32_t toc_crc;
+    if (nread != sizeof(fixed) || !blob.get_bytes(magic, sizeof(magic)) || memcmp(magic, archive_magic, sizeof(magic)) != 0 ||
+            !blob.get(version) || version != archive_format_version || !blob.get(nentries) || !blob.get(toc_crc)) {
+        return FR_NO_FILE; // not a preset archive
+    }
+    std::vector<uint8_t> toc_data(nentries * archive_toc_entry_bytes);
+    fatres = f_read(file, toc_data.data(), toc_data.size(), &nread);
     if (fatres != FR_OK)
         return fatres;
-    lfs_dir_t dir;
-    int err = pico_mount(false);
-    if (err)
-        return FR_INT_ERR;
-    err = lfs_dir_open(&dir, "/");
-    if (err) {
-        pico_unmount();
-        return FR_INT_ERR;
+    if (nread != toc_data.size() || settings_crc32(toc_data.data(), toc_data.size()) != toc_crc)
+        return FR_NO_FILE;
+    Settings_blob_reader toc_blob(toc_data.data(), toc_data.size());
+    for (uint16_t idx = 0; idx < nentries; idx++) {
+        Archive_entry entry;
+        toc_blob.get_bytes(reinterpret_cast<uint8_t*>(entry.name), sizeof(entry.name));
+        entry.name[sizeof(entry.name)-1] = '\0';
+        toc_blob.get(entry.offset);
+        toc_blob.get(entry.length);
+        toc_blob.get(entry.crc);
+        toc.push_back(entry);
     }
+    return FR_OK;
+}
 
-    struct lfs_info info;
-    bool flash_file_directory_ok = false;
-    char dirname[30];
-    while (true) {
-        int res = lfs_dir_read(&dir, &info);
-        if (res < 0) {
-            lfs_dir_close(&dir);
-            pico_unmount();
-            return FR_INT_ERR;
-        }
+FRESULT rppicomidi::Settings_file::open_backup_file(const char* directory, const char* filename, FIL* file,
+    Archive_entry& entry, bool& in_archive)
+{
+    char path[256];
+    in_archive = is_archive_name(directory, strlen(directory));
+    if (in_archive) {
+        snprintf(path, sizeof(path), "%s/%s", base_preset_path, directory);
+    }
+    else {
+        std::string location;
+        if (!resolve_backup_file(directory, filename, location))
+            return FR_NO_FILE;
+        snprintf(path, sizeof(path), "%s/%s/%s", base_preset_path, location.c_str(), filename);
+    }
+    FRESULT fatres = f_open(file, path, FA_READ);
+    if (fatres != FR_OK) {
+        printf("error %u opening file %s\r\n", fatres, path);
+        return fatres;
+    }
+    if (!in_archive) {
+        entry.offset = 0;
+        entry.length = f_size(file);
+        entry.crc = 0;
+        return FR_OK;
+    }
+    std::vector<Archive_entry> toc;
+    fatres = read_archive_toc(file, toc);
+    const Archive_entry* found = nullptr;
+    for (auto& toc_entry: toc) {
+        if (strcmp(toc_entry.name, filename) == 0)
+            found = &toc_entry;
+    }
+    if (fatres == FR_OK && found == nullptr)
+        fatres = FR_NO_FILE;
+    if (fatres == FR_OK)
+        fatres = f_lseek(file, found->offset); // go straight to the record
+    if (fatres == FR_OK)
+        entry = *found;
+    else
+        f_close(file);
+    return fatres;
+}
 
-        if (res == 0) {
-            break;
-        }
-        // There is at least one settings file. Make sure there is a directory to store it in.
-        // Presets are stored in 0:/rppicomidi-pico-usb-midi-processor/date[-version for that date]
-        if (!flash_file_directory_ok) {
-            if (!get_next_backup_directory_name(dirname, sizeof(dirname))) {
-                lfs_dir_close(&dir);
-                pico_unmount();
-                return FR_INT_ERR;
+FRESULT rppicomidi::Settings_file::stream_json_members(FIL* file, uint32_t length, Json_member_fn member_fn, void* context,
+    uint32_t* crc)
+{
+    char* window = reinterpret_cast<char*>(copy_chunk);
+    size_t window_size = sizeof(copy_chunk);
+    char* grown = nullptr;  // the heap window if a member does not fit in copy_chunk
+    size_t fill = 0;        // the number of bytes in the window
+    size_t pos = 0;         // the offset in the window of the first byte not parsed yet
+    bool in_object = false; // true after the opening brace is parsed
+    bool stopped = false;
+    uint32_t nremaining = length;
+    FRESULT fatres = FR_OK;
+    if (crc)
+        *crc = 0;
+    for (;;) {
+        Json_stream_reader reader(window + pos, fill - pos);
+        const char* key;
+        size_t key_len;
+        const char* value;
+        size_t span;
+        if (in_object || reader.begin_object()) {
+            if (!reader.next_member(key, key_len)) {
+                if (!reader.is_error())
+                    break; // the end of the object
             }
-            fatres = f_chdir(base_preset_path);
-            if (fatres == FR_NO_PATH) {
-                fatres = f_mkdir(base_preset_path);
-                if (fatres != FR_OK) {
-                    lfs_dir_close(&dir);
-                    pico_unmount();
-                    return fatres;
+            else if (reader.skip_value(&value, &span) && value + span < window + fill) {
+                // The member is complete. The character after the value is in the window
+                // too, so a valid document still has a comma or closing brace to read.
+                in_object = true;
+                pos = value + span - window;
+                if (!member_fn(context, window, key, key_len, value, span)) {
+                    stopped = true;
+                    break;
                 }
+                continue;
             }
-            fatres = f_chdir(base_preset_path);
-            if (fatres != FR_OK) {
-                lfs_dir_close(&dir);
-                pico_unmount();
-                return fatres;
-            }
-
-            fatres = f_mkdir(dirname);
-            if (fatres != FR_OK) {
-                lfs_dir_close(&dir);
-                pico_unmount();
-                return fatres;
-            }
-            fatres = f_chdir(dirname);
-            if (fatres != FR_OK) {
-                lfs_dir_close(&dir);
-                pico_unmount();
-                return fatres;
-            }
-            flash_file_directory_ok = true;
         }
-        char* raw_settings = nullptr;
-        if(info.type == LFS_TYPE_REG) {
-            int nread = load_settings_string(info.name, &raw_settings, false);
-            if (nread > 0) {
-                FIL bufile;
-                fatres = f_open(&bufile, info.name, FA_CREATE_NEW | FA_WRITE);
-                if (fatres != FR_OK) {
-                    lfs_dir_close(&dir);
-                    pico_unmount();
-                    return fatres;
-                }
-                UINT written;
-                fatres = f_write(&bufile, raw_settings, nread, &written);
-                delete[] raw_settings;
-                f_close(&bufile);
-                if (fatres != FR_OK) {
-                    lfs_dir_close(&dir);
-                    pico_unmount();
-                    return fatres;
-                }
-                printf("backed up preset 0:%s/%s/%s\r\n", base_preset_path, dirname, info.name);
-            }
-            else {
-                if (raw_settings) {
-                    delete[] raw_settings;
-                }
-                lfs_dir_close(&dir);
-                pico_unmount();
-                return FR_INT_ERR;
+        if (nremaining == 0) {
+            printf("JSON document is not a valid object\r\n");
+            fatres = FR_INT_ERR;
+            break;
+        }
+        // Keep the unparsed bytes and read up to the next chunk boundary in the file,
+        // so FatFs reads whole sectors straight into the window
+        memmove(window, window + pos, fill - pos);
+        fill -= pos;
+        pos = 0;
+        size_t nread = SETTINGS_COPY_CHUNK_BYTES - f_tell(file) % SETTINGS_COPY_CHUNK_BYTES;
+        if (nread > nremaining)
+            nread = nremaining;
+        if (fill + nread > window_size) {
+            // The member is longer than the window. Grow it a chunk at a time.
+            char* bigger;
+            {
+                Mem_tag_scope tag(MEM_TAG_FATFS);
+                bigger = new char[window_size + SETTINGS_COPY_CHUNK_BYTES];
             }
+            memcpy(bigger, window, fill);
+            delete[] grown;
+            grown = window = bigger;
+            window_size += SETTINGS_COPY_CHUNK_BYTES;
+        }
+        UINT bytes_read;
+        fatres = f_read(file, window + fill, nread, &bytes_read);
+        if (fatres == FR_OK && bytes_read != nread)
+            fatres = FR_INT_ERR;
+        if (fatres != FR_OK)
+            break;
+        if (crc)
+            *crc = settings_crc32(reinterpret_cast<uint8_t*>(window + fill), nread, *crc);
+        fill += nread;
+        nremaining -= nread;
+        xfer_bytes += nread;
+    }
+    delete[] grown;
+    // Read whatever follows the closing brace so the CRC covers the whole document
+    while (crc && fatres == FR_OK && !stopped && nremaining > 0) {
+        UINT nread = nremaining < sizeof(copy_chunk) ? nremaining : sizeof(copy_chunk);
+        UINT bytes_read;
+        fatres = f_read(file, copy_chunk, nread, &bytes_read);
+        if (fatres == FR_OK && bytes_read != nread)
+            fatres = FR_INT_ERR;
+        if (fatres == FR_OK) {
+            *crc = settings_crc32(copy_chunk, nread, *crc);
+            nremaining -= nread;
+            xfer_bytes += nread;
         }
     }
+    return fatres;
+}
+
+bool rppicomidi::Settings_file::static_convert_json_member(void* context, char* json_format, const char* key, size_t key_len,
+    const char* value, size_t span)
+{
+    auto state = reinterpret_cast<Midi_processor_manager::Json_convert_state*>(context);
+    return Midi_processor_manager::instance().convert_json_member(*state, json_format, key, key_len, value, span);
+}
+
+bool rppicomidi::Settings_file::static_product_string_member(void* context, char* json_format, const char* key, size_t key_len,
+    const char* value, size_t span)
+{
+    (void)json_format;
+    if (!Json_stream_reader::key_is(key, key_len, "prod"))
+        return true;
+    // The product string is near the start of the file, so stop reading it here
+    auto prod = reinterpret_cast<Product_string*>(context);
+    Json_stream_reader reader(value, span);
+    if (!reader.get_string(prod->str, prod->max_str))
+        prod->str[0] = '\0';
+    return false;
+}
+
+bool rppicomidi::Settings_file::is_archive_name(const char* name, size_t len)
+{
+    size_t ext_len = strlen(archive_ext);
+    return len > ext_len && strncmp(name + len - ext_len, archive_ext, ext_len) == 0;
+}
+
+FRESULT rppicomidi::Settings_file::backup_all_presets(bool changes_only)
+{
+    Fs_job_queue::instance().flush();
+    Backup_job job(changes_only);
+    job.run();
+    return job.fatres;
+}
+
+void rppicomidi::Settings_file::start_backup(bool changes_only, Fs_job_queue::Progress_fn progress_fn, void* context)
+{
+    auto job = new Backup_job(changes_only);
+    assert(job);
+    Fs_job_queue::instance().add_job(job, progress_fn, context);
+}
+
+rppicomidi::Fs_job::Step_result rppicomidi::Settings_file::Backup_job::step()
+{
+    if (steps_done == 0) {
+        fatres = start();
+    }
+    else if (steps_done <= sources.size()) {
+        fatres = backup_file(sources[steps_done - 1].c_str());
+    }
+    else {
+        char path[64];
+        snprintf(path, sizeof(path), "%s/%s/%s", base_preset_path, dirname, manifest_filename);
+        fatres = instance().write_backup_manifest(path, manifest);
+        if (fatres == FR_OK)
+            printf("wrote manifest 0:%s\r\n", path);
+    }
+    ++steps_done;
+    if (fatres != FR_OK)
+        return STEP_ERROR;
+    return steps_done >= num_steps ? STEP_DONE : STEP_MORE;
+}
 
-    err = lfs_dir_close(&dir);
-    if (err) {
-        pico_unmount();
+FRESULT rppicomidi::Settings_file::Backup_job::start()
+{
+    auto& me = instance();
+    me.xfer_bytes = 0;
+    FRESULT res = f_chdrive("0:");
+    if (res != FR_OK)
+        return res;
+    if (me.begin_fs_op(FS_OP_BACKUP) != LFS_ERR_OK)
+        return FR_INT_ERR;
+    int err = me.list_backup_sources(sources);
+    me.end_fs_op();
+    if (err != LFS_ERR_OK)
         return FR_INT_ERR;
+    num_steps = sources.size() + 2;
+    // Only the files that changed since the latest backup need to be written
+    if (changes_only) {
+        char latest[max_backup_dirname];
+        if (!me.get_latest_backup_directory(latest, sizeof(latest)) || !me.read_backup_manifest(latest, latest_manifest))
+            printf("the latest backup has no manifest; backing up all presets\r\n");
+    }
+    // Presets are stored in 0:/rppicomidi-pico-usb-midi-processor/date[-version for that date]
+    if (!me.get_next_backup_directory_name(dirname, sizeof(dirname)))
+        return FR_INT_ERR;
+    res = f_mkdir(base_preset_path);
+    if (res == FR_EXIST)
+        res = FR_OK;
+    if (res != FR_OK)
+        return res;
+    // Use full paths; other file operations may change the directory between steps
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%s", base_preset_path, dirname);
+    res = f_mkdir(path);
+    if (res == FR_OK)
+        me.backup_dirnames.push_back(std::string(dirname));
+    return res;
+}
+
+FRESULT rppicomidi::Settings_file::Backup_job::backup_file(const char* fn)
+{
+    auto& me = instance();
+    Manifest_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    get_backup_name(fn, entry.name);
+    const Manifest_entry* latest = nullptr;
+    for (auto& latest_entry: latest_manifest) {
+        if (strcmp(latest_entry.name, entry.name) == 0) {
+            latest = &latest_entry;
+            break;
+        }
     }
-    pico_unmount();
+    if (me.begin_fs_op(FS_OP_BACKUP) != LFS_ERR_OK)
+        return FR_INT_ERR;
+    if (latest) {
+        // Format the JSON once without writing it to see if it changed
+        Crc_writer hasher{nullptr, 0};
+        Chunk_stream stream(me.copy_chunk, SETTINGS_COPY_CHUNK_BYTES, static_crc_write_chunk, &hasher);
+        if (me.stream_backup_json(fn, stream) && hasher.crc == latest->crc && stream.get_nwritten() == latest->length) {
+            me.end_fs_op();
+            manifest.push_back(*latest);
+            printf("preset %s is unchanged since backup %s\r\n", entry.name, latest->dir);
+            return FR_OK;
+        }
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%s/%s", base_preset_path, dirname, entry.name);
+    FIL bufile;
+    FRESULT res = f_open(&bufile, path, FA_CREATE_NEW | FA_WRITE);
+    if (res != FR_OK) {
+        me.end_fs_op();
+        return res;
+    }
+    // Write the JSON to the file as it is formatted, a whole chunk at a time
+    Crc_writer writer{&bufile, 0};
+    Chunk_stream stream(me.copy_chunk, SETTINGS_COPY_CHUNK_BYTES, static_crc_write_chunk, &writer);
+    if (!me.stream_backup_json(fn, stream))
+        res = FR_INT_ERR;
+    me.end_fs_op();
+    me.xfer_bytes += stream.get_nwritten();
+    FRESULT closeres = f_close(&bufile);
+    if (res == FR_OK)
+        res = closeres;
+    if (res != FR_OK) {
+        f_unlink(path);
+        return res;
+    }
+    entry.crc = writer.crc;
+    entry.length = stream.get_nwritten();
+    entry.mtime = get_fattime();
+    snprintf(entry.dir, sizeof(entry.dir), "%s", dirname);
+    manifest.push_back(entry);
+    printf("backed up preset 0:%s\r\n", path);
     return FR_OK;
 }
 
-FRESULT rppicomidi::Settings_file::restore_one_file(const char* fullpath, const char* filename)
+bool rppicomidi::Settings_file::read_backup_manifest(const char* directory, std::vector<Manifest_entry>& manifest)
+{
+    if (manifest_cache_dir == directory) {
+        manifest = manifest_cache;
+        return true;
+    }
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s/%s", base_preset_path, directory, manifest_filename);
+    FIL file;
+    if (f_open(&file, path, FA_READ) != FR_OK)
+        return false;
+    manifest.clear();
+    char line[80];
+    unsigned version;
+    bool ok = f_gets(line, sizeof(line), &file) != nullptr && sscanf(line, "PUMP-MANIFEST %u", &version) == 1 &&
+        version == manifest_format_version;
+    while (ok && f_gets(line, sizeof(line), &file) != nullptr) {
+        // the field widths are max_record_filename-1 and max_backup_dirname-1
+        Manifest_entry entry;
+        unsigned long crc, length, mtime;
+        ok = sscanf(line, "%15s %lx %lu %lx %15s", entry.name, &crc, &length, &mtime, entry.dir) == 5;
+        if (ok) {
+            entry.crc = crc;
+            entry.length = length;
+            entry.mtime = mtime;
+            manifest.push_back(entry);
+        }
+    }
+    if (f_error(&file))
+        ok = false;
+    f_close(&file);
+    if (!ok) {
+        printf("backup manifest %s is not valid\r\n", path);
+        manifest.clear();
+        return false;
+    }
+    manifest_cache_dir = directory;
+    manifest_cache = manifest;
+    return true;
+}
+
+FRESULT rppicomidi::Settings_file::write_backup_manifest(const char* path, const std::vector<Manifest_entry>& manifest)
 {
-    printf("Restoring %s\r\n", filename);
     FIL file;
-    FRESULT fatres = f_open(&file, fullpath, FA_READ);
-    if (fatres != FR_OK) {
-        printf("error %u opening file %s\r\n", fatres, fullpath);
+    FRESULT fatres = f_open(&file, path, FA_CREATE_NEW | FA_WRITE);
+    if (fatres != FR_OK)
         return fatres;
+    // One line of text per file so the manifest is easy to read on a computer
+    Chunk_stream stream(copy_chunk, SETTINGS_COPY_CHUNK_BYTES, static_fatfs_write_chunk, &file);
+    char line[80];
+    int len = snprintf(line, sizeof(line), "PUMP-MANIFEST %u\r\n", manifest_format_version);
+    stream.write(line, len);
+    for (auto& entry: manifest) {
+        len = snprintf(line, sizeof(line), "%s %08lX %lu %08lX %s\r\n", entry.name, static_cast<unsigned long>(entry.crc),
+            static_cast<unsigned long>(entry.length), static_cast<unsigned long>(entry.mtime), entry.dir);
+        stream.write(line, len);
+    }
+    if (!stream.flush())
+        fatres = FR_INT_ERR;
+    xfer_bytes += stream.get_nwritten();
+    FRESULT closeres = f_close(&file);
+    if (fatres == FR_OK)
+        fatres = closeres;
+    if (fatres != FR_OK)
+        f_unlink(path);
+    return fatres;
+}
+
+bool rppicomidi::Settings_file::resolve_backup_file(const char* directory, const char* filename, std::string& location)
+{
+    location = directory;
+    for (uint8_t hop = 0; hop < max_manifest_hops; hop++) {
+        std::vector<Manifest_entry> manifest;
+        if (!read_backup_manifest(location.c_str(), manifest))
+            return true;
+        const Manifest_entry* found = nullptr;
+        for (auto& entry: manifest) {
+            if (strcmp(entry.name, filename) == 0) {
+                found = &entry;
+                break;
+            }
+        }
+        if (found == nullptr) {
+            printf("backup %s does not have %s\r\n", location.c_str(), filename);
+            return false;
+        }
+        if (location == found->dir)
+            return true;
+        location = found->dir;
     }
-    UINT filesize = f_size(&file);
-    char* buffer = new char[filesize];
-    UINT bytes_read;
-    fatres = f_read(&file, buffer, filesize, &bytes_read);
+    printf("too many backups in the chain for %s/%s\r\n", directory, filename);
+    return false;
+}
+
+FRESULT rppicomidi::Settings_file::restore_backup_file(const char* directory, const char* filename)
+{
+    FIL file;
+    Archive_entry entry;
+    bool in_archive;
+    FRESULT fatres = open_backup_file(directory, filename, &file, entry, in_archive);
+    if (fatres != FR_OK)
+        return fatres;
+    if (in_archive)
+        printf("Restoring %s from %s\r\n", filename, directory);
+    else
+        printf("Restoring %s\r\n", filename);
+    // The backup is in JSON format; the local file system stores presets in binary format
+    Device_settings settings;
+    auto& mgr = Midi_processor_manager::instance();
+    Midi_processor_manager::Json_convert_state state;
+    mgr.begin_convert_from_json(state, settings);
+    uint32_t crc;
+    fatres = stream_json_members(&file, entry.length, static_convert_json_member, &state, &crc);
     f_close(&file);
+    if (fatres == FR_OK && state.result && in_archive && crc != entry.crc) {
+        printf("archive %s entry %s is corrupt\r\n", directory, filename);
+        fatres = FR_INT_ERR;
+    }
     if (fatres != FR_OK) {
-        printf("error %u reading file %s\r\n", fatres, fullpath);
+        printf("error %u reading %s\r\n", fatres, filename);
         return fatres;
     }
-    int error_code = pico_mount(false);
-    if (error_code != 0) {
-        free((void*)buffer);
-        printf("unexpected error %s mounting flash\r\n", pico_errmsg(error_code));
+    if (!mgr.end_convert_from_json(state)) {
+        printf("error converting file %s\r\n", filename);
         return FR_INT_ERR;
     }
-    printf("opening file %s for read only\r\n", filename);
-    int localfile = pico_open(filename, LFS_O_RDONLY);
-    if (localfile < 0) {
-        // file does not exist
-        printf("opening/creating file %s for read/write\r\n", filename);
-        localfile = pico_open(filename, LFS_O_WRONLY | LFS_O_CREAT);
-        if (localfile < 0) {
-            printf("error %s creating %s for writing\r\n", pico_errmsg(localfile), filename);
-            free((void*)buffer);
-            pico_unmount();
-            return FR_INT_ERR;
-        }
-    }
-    else {
-        // file exists. Truncate it to 0 length in preparation for new data
-        error_code = pico_close(localfile);
-        if (error_code != LFS_ERR_OK) {
-            printf("error %s closing %s\r\n", pico_errmsg(error_code), filename);
-            free((void*)buffer);
-            pico_unmount();
-            return FR_INT_ERR;
-        }
+    return store_restored_settings(filename, settings);
+}
 
-        localfile = pico_open(filename, LFS_O_WRONLY);
-        if (localfile < 0) {
-            printf("error %s opening %s for writing\r\n", pico_errmsg(localfile), filename);
-            free((void*)buffer);
-            pico_unmount();
-            return FR_INT_ERR;
+bool rppicomidi::Settings_file::get_latest_backup_directory(char* dirname, size_t maxname)
+{
+    if (!scan_backup_directories())
+        return false;
+    const std::string* latest = nullptr;
+    uint32_t latest_key = 0;
+    for (auto& name: backup_dirnames) {
+        // an archive holds all of its files, so a manifest never points into one
+        if (is_archive_name(name.c_str(), name.length()))
+            continue;
+        unsigned month, day, year, version = 0;
+        if (sscanf(name.c_str(), "%2u-%2u-%4u-%u", &month, &day, &year, &version) < 3)
+            continue;
+        uint32_t key = ((year * 16 + month) * 32 + day) * 256 + version;
+        if (latest == nullptr || key > latest_key) {
+            latest = &name;
+            latest_key = key;
         }
     }
-    printf("writing settings to file %s\r\n", filename);
-    // file is open for writing; write the settings
-    error_code = pico_write(localfile, buffer, strlen(buffer)+1);
+    if (latest == nullptr || latest->length() >= maxname)
+        return false;
+    strcpy(dirname, latest->c_str());
+    return true;
+}
 
-    free(buffer);
-    pico_close(localfile);
-    pico_unmount();
-    if (error_code < 0) {
-        printf("error %s writing settings to file\r\n", pico_errmsg(error_code));
+FRESULT rppicomidi::Settings_file::store_restored_settings(const char* filename, const Device_settings& settings)
+{
+    int error_code = begin_fs_op(FS_OP_RESTORE);
+    if (error_code != 0) {
+        printf("unexpected error %s mounting flash\r\n", pico_errmsg(error_code));
         return FR_INT_ERR;
     }
-    else if ((size_t)error_code < strlen(buffer)) {
-        printf("store: Only %d bytes stored out of %u\r\n", error_code, strlen(buffer));
-        // hmm. no idea why that should happen
-        return FR_INT_ERR;
+    printf("writing settings records for %.9s\r\n", filename);
+    error_code = store_device_settings(filename, settings, false);
+    forget_stored_records();
+    if (error_code == LFS_ERR_OK) {
+        // a legacy JSON settings file for the same device would be stale now
+        char legacy_filename[]="0000-0000.json";
+        memcpy(legacy_filename, filename, 9);
+        pico_remove(legacy_filename);
     }
-    return FR_OK;
+    end_fs_op();
+    return error_code == LFS_ERR_OK ? FR_OK : FR_INT_ERR;
 }
 
-bool rppicomidi::Settings_file::get_setting_file_json_string(const char* directory, const char* filename, char** json_string)
+bool rppicomidi::Settings_file::get_setting_file_product_string(const char* directory, const char* filename, char* prod_string,
+    size_t max_string)
 {
     FIL file;
-    char restore_path[256];
-    size_t max_path = sizeof(restore_path)-1;
-    strncpy(restore_path, base_preset_path, max_path);
-    strncat(restore_path, "/", max_path);
-    strncat(restore_path, directory, max_path);
-    strncat(restore_path, "/", max_path);
-    strncat(restore_path, filename, max_path);
-    restore_path[max_path] = '\0';
-    FRESULT fatres = f_open(&file, restore_path, FA_READ);
-    *json_string = nullptr;
-    if (fatres != FR_OK) {
-        printf("error %u opening file %s\r\n", fatres, restore_path);
+    Archive_entry entry;
+    bool in_archive;
+    prod_string[0] = '\0';
+    if (open_backup_file(directory, filename, &file, entry, in_archive) != FR_OK)
         return false;
-    }
-    UINT filesize = f_size(&file);
-    char* buffer = new char[filesize];
-    UINT bytes_read;
-    fatres = f_read(&file, buffer, filesize, &bytes_read);
+    Product_string prod{prod_string, max_string};
+    FRESULT fatres = stream_json_members(&file, entry.length, static_product_string_member, &prod);
     f_close(&file);
-    if (fatres != FR_OK) {
-        printf("error %u reading file %s\r\n", fatres, restore_path);
-        delete[] buffer;
-        return false;
+    return fatres == FR_OK && prod_string[0] != '\0';
+}
+
+void rppicomidi::Settings_file::get_backup_product_strings(const char* directory, const std::vector<std::string>& filename_list,
+    std::vector<std::string>& product_list)
+{
+    product_list.clear();
+    for (auto& filename: filename_list) {
+        char prod_string[max_index_prod];
+        if (!get_setting_file_product_string(directory, filename.c_str(), prod_string, sizeof(prod_string)))
+            prod_string[0] = '\0';
+        product_list.push_back(std::string(prod_string));
     }
-    *json_string = buffer;
-    return true;
 }
 
 FRESULT rppicomidi::Settings_file::restore_presets(const char* backup_path)
 {
-    FRESULT fatres = f_chdrive("0:");
+    Fs_job_queue::instance().flush();
+    Restore_job job(backup_path);
+    job.run();
+    return job.fatres;
+}
+
+void rppicomidi::Settings_file::start_restore(const char* backup_path, Fs_job_queue::Progress_fn progress_fn, void* context)
+{
+    auto job = new Restore_job(backup_path);
+    assert(job);
+    Fs_job_queue::instance().add_job(job, progress_fn, context);
+}
+
+rppicomidi::Fs_job::Step_result rppicomidi::Settings_file::Restore_job::step()
+{
+    if (steps_done == 0)
+        fatres = start();
+    else
+        fatres = restore_file(steps_done - 1);
+    ++steps_done;
     if (fatres != FR_OK)
-        return fatres;
-    if (strlen(backup_path) >= strlen(".json")) {
-        char* ptr = strstr(backup_path, ".json");
-        if (ptr != nullptr && strlen(ptr) == strlen(".json")) {
-            // should be a single file
-            char fullpath[strlen(base_preset_path) + 1 + strlen(backup_path)]; // need space for base_preset path '/' backup_path
-            strcpy(fullpath, base_preset_path);
-            strcat(fullpath, "/");
-            strcat(fullpath, backup_path);
-            char* filename = strstr(fullpath, ".json") - 9;
-            if ((ptr - 9) >= backup_path && *(ptr-10) == '/') {
-                fatres = restore_one_file(fullpath, filename);
-            }
-            else {
-                printf("poorly formed backup_path=%s\r\n", backup_path);
-                fatres = FR_INVALID_PARAMETER;
-            }
+        return STEP_ERROR;
+    return steps_done >= num_steps ? STEP_DONE : STEP_MORE;
+}
+
+FRESULT rppicomidi::Settings_file::Restore_job::start()
+{
+    auto& me = instance();
+    me.xfer_bytes = 0;
+    FRESULT res = f_chdrive("0:");
+    if (res != FR_OK)
+        return res;
+    const char* path = backup_path.c_str();
+    // An archive path is the archive name optionally followed by '/' and one file name in it
+    const char* slash = strchr(path, '/');
+    size_t archive_len = slash ? static_cast<size_t>(slash - path) : strlen(path);
+    std::vector<Manifest_entry> manifest;
+    if (is_archive_name(path, archive_len)) {
+        std::string archive(path, archive_len);
+        std::vector<std::string> filenames;
+        if (slash)
+            filenames.push_back(std::string(slash + 1));
+        else if (!me.get_all_preset_filenames(archive.c_str(), filenames))
+            res = FR_NO_FILE;
+        for (auto& filename: filenames)
+            items.push_back(Item{archive, filename});
+    }
+    else if (strlen(path) < strlen(".json")) {
+        res = FR_INVALID_PARAMETER;
+    }
+    else if (has_extension(path, ".json")) {
+        // should be a single file; it may be in an earlier backup the manifest points to
+        const char* ptr = path + strlen(path) - strlen(".json");
+        if ((ptr - 10) >= path && *(ptr-10) == '/') {
+            items.push_back(Item{std::string(path, ptr - 10 - path), std::string(ptr - 9)});
         }
         else {
-            // need to restore every file in the directory
-            char fullpath[strlen(base_preset_path) + 1 + strlen(backup_path)+16]; // need space for base_preset path '/' backup_path + /xxxx-yyyy.json
-            char* filename = fullpath + strlen(base_preset_path) + strlen(backup_path) + 2; // +2 is for the two '/' characters
-            strcpy(fullpath, base_preset_path);
-            strcat(fullpath, "/");
-            strcat(fullpath, backup_path);
-            DIR dir;
-            fatres = f_opendir(&dir, fullpath);
-            if (fatres == FR_OK) {
-                FILINFO info;
-                strcat(fullpath, "/");
-                fatres = f_readdir(&dir, &info);
-                while (fatres == FR_OK && info.fname[0] != 0) {
-                    strncpy(filename, info.fname, 16);
-                    filename[15] = '\0';
-                    if (strncmp(filename+9, ".json", 5) != 0) {
-                        // filename is not formed correctly
-                        fatres = FR_NO_FILE;
-                    }
-                    else {
-                        fatres = restore_one_file(fullpath, filename);
-                        if (fatres == FR_OK) {
-                            fatres = f_readdir(&dir, &info);
-                        }
-                        else {
-                            printf("error %u restoring file %s\r\n", fatres, filename);
-                        }
-                    }
-                }
-                f_closedir(&dir);
-            }
-            else {
-                printf("error opening directory %s\r\n", fullpath);
-            }
+            printf("poorly formed backup_path=%s\r\n", path);
+            res = FR_INVALID_PARAMETER;
         }
     }
+    else if (me.read_backup_manifest(path, manifest)) {
+        // restore every file the manifest lists, wherever it is
+        for (auto& entry: manifest)
+            items.push_back(Item{std::string(entry.dir), std::string(entry.name)});
+    }
     else {
-        fatres = FR_INVALID_PARAMETER;
+        // need to restore every file in the directory
+        char fullpath[strlen(base_preset_path) + 1 + strlen(path) + 1];
+        strcpy(fullpath, base_preset_path);
+        strcat(fullpath, "/");
+        strcat(fullpath, path);
+        DIR dir;
+        res = f_opendir(&dir, fullpath);
+        if (res == FR_OK) {
+            FILINFO info;
+            res = f_readdir(&dir, &info);
+            while (res == FR_OK && info.fname[0] != 0) {
+                if (strlen(info.fname) != 14 || strncmp(info.fname+9, ".json", 5) != 0) {
+                    // filename is not formed correctly
+                    printf("unexpected file %s in backup %s\r\n", info.fname, path);
+                    res = FR_NO_FILE;
+                }
+                else {
+                    items.push_back(Item{backup_path, std::string(info.fname)});
+                    res = f_readdir(&dir, &info);
+                }
+            }
+            f_closedir(&dir);
+        }
+        else {
+            printf("error opening directory %s\r\n", fullpath);
+        }
     }
-    return fatres;
+    num_steps = items.size() + 1;
+    return res;
+}
+
+FRESULT rppicomidi::Settings_file::Restore_job::restore_file(size_t idx)
+{
+    auto& me = instance();
+    auto& item = items[idx];
+    FRESULT res = me.restore_backup_file(item.dir.c_str(), item.filename.c_str());
+    if (res != FR_OK)
+        printf("error %u restoring file %s\r\n", res, item.filename.c_str());
+    return res;
 }
 
 bool rppicomidi::Settings_file::get_all_preset_directory_names(std::vector<std::string>& dirname_list)
 {
-    FRESULT fatres = f_chdrive("0:");
-    if (fatres != FR_OK)
-        return false;
-    DIR dir;
-    fatres = f_opendir(&dir,  base_preset_path);
-    if (fatres != FR_OK) {
+    if (!scan_backup_directories())
         return false;
-    }
-    FILINFO info;
-    fatres = f_readdir(&dir, &info);
-    while (fatres == FR_OK && info.fname[0] != 0) {
-        if (info.fattrib & AM_DIR) {
-            dirname_list.push_back(std::string(info.fname));
-        }
-        fatres = f_readdir(&dir, &info);
-    }
-    return fatres == FR_OK;
+    dirname_list = backup_dirnames;
+    return true;
 }
 
 bool rppicomidi::Settings_file::get_all_preset_filenames(const char* directory_name, std::vector<std::string>& filename_list)
@@ -567,6 +1683,27 @@ bool rppicomidi::Settings_file::get_all_preset_filenames(const char* directory_n
     FRESULT fatres = f_chdrive("0:");
     if (fatres != FR_OK)
         return false;
+    if (is_archive_name(directory_name, strlen(directory_name))) {
+        // List the archive's table of contents
+        char path[256];
+        snprintf(path, sizeof(path), "%s/%s", base_preset_path, directory_name);
+        FIL file;
+        if (f_open(&file, path, FA_READ) != FR_OK)
+            return false;
+        std::vector<Archive_entry> toc;
+        fatres = read_archive_toc(&file, toc);
+        f_close(&file);
+        for (auto& entry: toc)
+            filename_list.push_back(std::string(entry.name));
+        return fatres == FR_OK;
+    }
+    std::vector<Manifest_entry> manifest;
+    if (read_backup_manifest(directory_name, manifest)) {
+        // List the files in this backup, including the ones in earlier backups
+        for (auto& entry: manifest)
+            filename_list.push_back(std::string(entry.name));
+        return true;
+    }
     fatres = f_chdir(base_preset_path);
     if (fatres != FR_OK)
         return false;
@@ -578,7 +1715,7 @@ bool rppicomidi::Settings_file::get_all_preset_filenames(const char* directory_n
     FILINFO info;
     fatres = f_readdir(&dir, &info);
     while (fatres == FR_OK && info.fname[0] != 0) {
-        if ((info.fattrib & AM_DIR) == 0)
+        if ((info.fattrib & AM_DIR) == 0 && strcmp(info.fname, manifest_filename) != 0)
             filename_list.push_back(std::string(info.fname));
         fatres = f_readdir(&dir, &info);
     }
@@ -587,110 +1724,96 @@ bool rppicomidi::Settings_file::get_all_preset_filenames(const char* directory_n
 
 bool rppicomidi::Settings_file::load_preset(uint8_t next_preset)
 {
-    char* raw_settings = NULL;
-    auto error_code = load_settings_string(&raw_settings);
-    bool result = false;
-    if (error_code > 0) {
-        printf("load (%04x-%04x):\r\n", vid, pid);
-        result = Midi_processor_manager::instance().deserialize_preset(next_preset, raw_settings);
+    if (next_preset < 1 || next_preset > Device_settings::num_presets)
+        return false;
+    // A queued store may not have written this preset yet
+    Fs_job_queue::instance().flush();
+    std::vector<uint8_t> record;
+    char id[]="0000-0000";
+    get_filename(id);
+    char fn[max_record_filename];
+    get_record_filename(fn, sizeof(fn), id, next_preset);
+    auto error_code = load_settings_data(fn, record);
+    if (error_code < 0 && error_code != LFS_ERR_NOENT) {
+        printf("settings file load error %s\r\n", pico_errmsg(error_code));
+        preset_hashes[next_preset-1].valid = false;
+        return false;
     }
-    else {
-        char* default_raw_settings = Midi_processor_manager::instance().serialize_default();
-        if (!default_raw_settings) {
-            printf("Failed to allocate previous raw settings\r\n");
-        }
-        else {
-            printf("loading defaults:\r\n");
-            result = Midi_processor_manager::instance().deserialize_preset(next_preset, default_raw_settings);
-            json_free_serialized_string(default_raw_settings);
-        }        
-    }
-    printf("settings file load error %s\r\n", pico_errmsg(error_code));
-    if (raw_settings)
-        delete[] raw_settings;
-    return result;
+    remember_record_hash(preset_hashes[next_preset-1], record);
+    // If the preset was never stored, record is empty and the preset has no processors
+    printf("load (%04x-%04x) preset %u:\r\n", vid, pid, next_preset);
+    return Midi_processor_manager::instance().deserialize_preset(next_preset, record);
 }
 
 int rppicomidi::Settings_file::store()
 {
-    // Get previous settings values
-    char* previous_raw_settings = NULL;
-    int error_code = load_settings_string(&previous_raw_settings);
-    if (error_code < 0) {
-        if (previous_raw_settings)
-            delete[] previous_raw_settings;
-        previous_raw_settings = Midi_processor_manager::instance().serialize_default();
-        if (!previous_raw_settings) {
-            printf("Failed to allocate previous raw settings\r\n");
-            return error_code;
-        }
-    }
-    // Serialize to a string for storage
-    char* settings_str = Midi_processor_manager::instance().serialize(Midi_processor_manager::instance().get_current_preset(), previous_raw_settings);
-    if (settings_str) {
-        printf("store (%04x-%04x):\r\n",vid,pid);
-    }
-    else {
-        return LFS_ERR_NOMEM;
-    }
-    // Move current settings file to a backup file if current settings file exists
-    error_code = pico_mount(false);
-    if (error_code != 0) {
-        free((void*)settings_str);
-        printf("unexpected error %s mounting flash\r\n", pico_errmsg(error_code));
-        return error_code;
-    }
+    Fs_job_queue::instance().flush();
+    Store_job job;
+    if (job.init())
+        job.run();
+    return job.error_code;
+}
 
-    char settings_filename[]="0000-0000.json";
-    get_filename(settings_filename);
-    printf("opening file %s for read only\r\n", settings_filename);
-    int file = pico_open(settings_filename, LFS_O_RDONLY);
-    if (file < 0) {
-        // file does not exist
-        printf("opening/creating file %s for read/write\r\n", settings_filename);
-        file = pico_open(settings_filename, LFS_O_WRONLY | LFS_O_CREAT);
-        if (file < 0) {
-            printf("error %s creating %s for writing\r\n", pico_errmsg(file), settings_filename);
-            free((void*)settings_str);
-            pico_unmount();
-            return file;
-        }
+bool rppicomidi::Settings_file::start_store(Fs_job_queue::Progress_fn progress_fn, void* context)
+{
+    auto job = new Store_job;
+    assert(job);
+    if (!job->init()) {
+        delete job;
+        return false;
     }
-    else {
-        // file exists. Truncate it to 0 length in preparation for new data
-        error_code = pico_close(file);
-        if (error_code != LFS_ERR_OK) {
-            printf("error %s closing %s\r\n", pico_errmsg(error_code), settings_filename);
-            free((void*)settings_str);
-            pico_unmount();
-            return file;
-        }
+    Fs_job_queue::instance().add_job(job, progress_fn, context);
+    return true;
+}
 
-        file = pico_open(settings_filename, LFS_O_WRONLY);
-        if (file < 0) {
-            printf("error %s opening %s for writing\r\n", pico_errmsg(file), settings_filename);
-            free((void*)settings_str);
-            pico_unmount();
-            return file;
-        }
+bool rppicomidi::Settings_file::Store_job::init()
+{
+    auto& manager = Midi_processor_manager::instance();
+    preset_num = manager.get_current_preset();
+    if (!manager.serialize_preset(preset_num, preset)) {
+        error_code = LFS_ERR_INVAL;
+        return false;
     }
-    printf("writing settings to file %s\r\n", settings_filename);
-    // file is open for writing; write the settings
-    error_code = pico_write(file, settings_str, strlen(settings_str)+1);
+    manager.serialize_device(device);
+    instance().get_filename(id);
+    return true;
+}
 
-    free(settings_str);
-    pico_close(file);
-    pico_unmount();
-    if (error_code < 0) {
-        printf("error %s writing settings to file\r\n", pico_errmsg(error_code));
-        return error_code;
-    }
-    else if ((size_t)error_code < strlen(settings_str)) {
-        printf("store: Only %d bytes stored out of %u\r\n", error_code, strlen(settings_str));
-        // hmm. no idea why that should happen
-        return LFS_ERR_IO;
-    }
-    return LFS_ERR_OK;
+rppicomidi::Fs_job::Step_result rppicomidi::Settings_file::Store_job::step()
+{
+    auto& me = instance();
+    error_code = me.begin_fs_op(FS_OP_STORE);
+    if (error_code != 0) {
+        printf("unexpected error %s mounting flash\r\n", pico_errmsg(error_code));
+        return STEP_ERROR;
+    }
+    // Only write the records that are different from the records in flash
+    char fn[max_record_filename];
+    if (steps_done == 0) {
+        printf("store (%s) preset %u:\r\n", id, preset_num);
+        start_bytes = me.bytes_written;
+        snprintf(fn, sizeof(fn), "%s%s", id, device_ext);
+        error_code = me.write_record_if_changed(fn, device, me.device_hash);
+    }
+    else if (steps_done == 1) {
+        get_record_filename(fn, sizeof(fn), id, preset_num);
+        error_code = me.write_record_if_changed(fn, preset, me.preset_hashes[preset_num-1]);
+    }
+    else if (me.stored_current_preset != preset_num) {
+        snprintf(fn, sizeof(fn), "%s%s", id, current_preset_ext);
+        error_code = me.write_settings_data(fn, &preset_num, 1, false);
+        if (error_code == LFS_ERR_OK)
+            me.stored_current_preset = preset_num;
+    }
+    me.end_fs_op();
+    ++steps_done;
+    if (error_code != LFS_ERR_OK || steps_done >= num_steps) {
+        ++me.store_stats.nstores;
+        me.store_stats.last_bytes = me.bytes_written - start_bytes;
+        me.store_stats.total_bytes += me.store_stats.last_bytes;
+        return error_code == LFS_ERR_OK ? STEP_DONE : STEP_ERROR;
+    }
+    return STEP_MORE;
 }
 
 int rppicomidi::Settings_file::lfs_ls(const char *path)
@@ -740,24 +1863,18 @@ int rppicomidi::Settings_file::lfs_ls(const char *path)
 void rppicomidi::Settings_file::static_file_system_format(EmbeddedCli*, char*, void*)
 {
     printf("formatting settings file system then mounting it\r\n");
-    int error_code = pico_mount(true);
+    int error_code = instance().format();
     if (error_code != LFS_ERR_OK) {
-
+        printf("unexpected error %s formatting settings file system\r\n", pico_errmsg(error_code));
     }
     else {
-        error_code = pico_unmount();
-        if (error_code != LFS_ERR_OK) {
-            printf("unexpected error %s unmounting settings file system\r\n", pico_errmsg(error_code));
-        }
-        else {
-            printf("File system successfully formated and unmounted\r\n");
-        }
+        printf("File system successfully formated and mounted\r\n");
     }
 }
 
 void rppicomidi::Settings_file::static_file_system_status(EmbeddedCli*, char*, void*)
 {
-    int error_code = pico_mount(false);
+    int error_code = instance().begin_fs_op(FS_OP_LIST);
     if (error_code != LFS_ERR_OK) {
         printf("can't mount settings file system\r\n");
         return;
@@ -770,10 +1887,35 @@ void rppicomidi::Settings_file::static_file_system_status(EmbeddedCli*, char*, v
     else {
         printf("could not read file system status\r\n");
     }
-    error_code = pico_unmount();
-    if (error_code != LFS_ERR_OK) {
-        printf("can't unmount settings file system\r\n");
-        return;
+    instance().end_fs_op();
+    auto& stats = instance().store_stats;
+    printf("preset stores: %lu, bytes written by last store %lu, by all stores %lu\r\n", stats.nstores, stats.last_bytes, stats.total_bytes);
+    if (stats.nstores > 0)
+        printf("average bytes written per store %lu\r\n", stats.total_bytes / stats.nstores);
+    printf("settings file writes %lu, writes skipped because flash matched %lu\r\n", stats.file_writes, stats.skipped_writes);
+    printf("bytes written to settings files since boot %lu\r\n", instance().bytes_written);
+    printf("flash erases %lu (%lu bytes), flash programs %lu (%lu bytes) since boot\r\n",
+        flash_erase_count, flash_erase_bytes, flash_program_count, flash_program_bytes);
+    auto& me = instance();
+    printf("file system mounts %lu, unmounts %lu; currently %s\r\n", me.nmounts, me.nunmounts, me.is_mounted ? "mounted":"not mounted");
+    printf("directory cache: %u entries, %lu hits, %lu directory reads\r\n", me.dir_cache_nentries, me.dir_cache_hits, me.dir_cache_misses);
+    if (me.index_loaded) {
+        printf("preset index:\r\n");
+        for (auto& entry: me.preset_index) {
+            printf("%s %6lu ", entry.id, entry.size);
+            if (entry.mtime != 0) {
+                me.print_fat_date(entry.mtime >> 16);
+                me.print_fat_time(entry.mtime & 0xffff);
+            }
+            printf("%s\r\n", entry.prod);
+        }
+    }
+    static const char* op_names[FS_OP_COUNT] = {"load", "store", "delete", "backup", "restore", "list"};
+    printf("%-8s %6s %10s %10s %10s\r\n", "op", "count", "last us", "max us", "avg us");
+    for (int op = 0; op < FS_OP_COUNT; op++) {
+        auto& op_stats = me.fs_op_stats[op];
+        printf("%-8s %6lu %10lu %10lu %10lu\r\n", op_names[op], op_stats.nops, op_stats.last_us, op_stats.max_us,
+            op_stats.nops ? static_cast<uint32_t>(op_stats.total_us / op_stats.nops) : 0);
     }
 }
 
@@ -792,7 +1934,7 @@ void rppicomidi::Settings_file::static_list_files(EmbeddedCli* cli, char* args,
         printf("usage: ls [path]\r\n");
     }
     auto me = reinterpret_cast<Settings_file*>(context);
-    int error_code = pico_mount(false);
+    int error_code = me->begin_fs_op(FS_OP_LIST);
     if (error_code != LFS_ERR_OK) {
         printf("can't mount settings file system\r\n");
         return;
@@ -802,11 +1944,7 @@ void rppicomidi::Settings_file::static_list_files(EmbeddedCli* cli, char* args,
     if (error_code != LFS_ERR_OK) {
         printf("error listing path \"/\"\r\n");
     }
-    error_code = pico_unmount();
-    if (error_code != LFS_ERR_OK) {
-        printf("can't unmount settings file system\r\n");
-        return;
-    }
+    me->end_fs_op();
 }
 
 void rppicomidi::Settings_file::print_fat_date(WORD wdate)
@@ -858,15 +1996,48 @@ void rppicomidi::Settings_file::static_fatfs_ls(EmbeddedCli *cli, char *args, vo
     }
 }
 
+void rppicomidi::Settings_file::static_fatfs_stat(EmbeddedCli *cli, char *args, void *)
+{
+    (void)cli;
+    if (embeddedCliGetTokenCount(args) == 1 && strcmp(embeddedCliGetToken(args, 1), "reset") == 0) {
+        msc_fat_reset_stats();
+        return;
+    }
+    msc_fat_stats_t stats;
+    msc_fat_get_stats(&stats);
+    printf("READ10 commands=%lu sectors=%lu\r\n", stats.read_cmds, stats.sectors_read);
+    printf("WRITE10 commands=%lu sectors=%lu coalesced writes=%lu\r\n", stats.write_cmds, stats.sectors_written, stats.coalesced_writes);
+    printf("read-ahead hits=%lu unused=%lu\r\n", stats.read_ahead_hits, stats.read_ahead_unused);
+    printf("sector cache (%u sectors) hits=%lu misses=%lu write backs=%lu\r\n", MSC_FAT_CACHE_SECTORS,
+        stats.cache_hits, stats.cache_misses, stats.cache_write_backs);
+    printf("time waiting for the drive=%llu ms\r\n", stats.wait_us / 1000);
+}
+
 void rppicomidi::Settings_file::static_fatfs_backup(EmbeddedCli *cli, char *args, void *context)
 {
     (void)cli;
-    (void)args;
     (void)context;
-    FRESULT res = instance().backup_all_presets();
+    uint16_t argc = embeddedCliGetTokenCount(args);
+    bool to_archive = argc == 1 && strcmp(embeddedCliGetToken(args, 1), "archive") == 0;
+    bool changes_only = argc == 1 && strcmp(embeddedCliGetToken(args, 1), "changes") == 0;
+    if (argc > 1 || (argc == 1 && !to_archive && !changes_only)) {
+        printf("usage: backup [archive|changes]\r\n");
+        return;
+    }
+    uint32_t start = time_us_32();
+    FRESULT res = to_archive ? instance().backup_all_presets_to_archive() : instance().backup_all_presets(changes_only);
     if (res != FR_OK) {
         printf("Error %u backing up files on drive\r\n", res);
     }
+    else {
+        instance().print_throughput("backed up", time_us_32() - start);
+    }
+}
+
+void rppicomidi::Settings_file::print_throughput(const char* what, uint32_t elapsed_us)
+{
+    uint32_t kbytes_per_sec = elapsed_us ? static_cast<uint32_t>((uint64_t)xfer_bytes * 1000000ull / 1024 / elapsed_us) : 0;
+    printf("%s %lu bytes in %lu ms (%lu KB/s)\r\n", what, xfer_bytes, elapsed_us / 1000, kbytes_per_sec);
 }
 
 void rppicomidi::Settings_file::static_fatfs_restore(EmbeddedCli* cli, char* args, void*)
@@ -877,7 +2048,10 @@ void rppicomidi::Settings_file::static_fatfs_restore(EmbeddedCli* cli, char* arg
     char path[256];
     if (argc == 1) {
         strncpy(path, embeddedCliGetToken(args, 1), sizeof(path)-1);
+        uint32_t start = time_us_32();
         res = Settings_file::instance().restore_presets(path);
+        if (res == FR_OK)
+            instance().print_throughput("restored", time_us_32() - start);
     }
     else {
         printf("usage: fatcd <new path>\r\n");
@@ -933,11 +2107,30 @@ void rppicomidi::Settings_file::static_print_file(EmbeddedCli* cli, char* args,
         return;
     }
     const char* fn=embeddedCliGetToken(args, 1);
-    char* raw_settings;
-    int error_code = me->load_settings_string(fn, &raw_settings);
+    std::vector<uint8_t> data;
+    Device_settings settings;
+    int error_code;
+    if (has_extension(fn, device_ext))
+        error_code = me->load_device_settings(fn, settings);
+    else
+        error_code = me->load_settings_data(fn, data);
     if (error_code > 0) {
-        printf("File: %s\r\n%s\r\n", fn, raw_settings);
-        delete[] raw_settings;
+        printf("File: %s\r\n", fn);
+        if (has_extension(fn, device_ext)) {
+            // Show all records of the device in JSON format
+            Json_stream_writer writer(static_console_write, nullptr);
+            Midi_processor_manager::instance().convert_to_json(settings, writer);
+            printf("\r\n");
+        }
+        else if (has_extension(fn, ".json")) {
+            data.push_back('\0');
+            printf("%s\r\n", reinterpret_cast<char*>(data.data()));
+        }
+        else {
+            for (size_t idx = 0; idx < data.size(); idx++) {
+                printf("%02x%s", data[idx], ((idx & 0xf) == 0xf || idx == data.size()-1) ? "\r\n":" ");
+            }
+        }
     }
     else {
         switch(error_code) {
@@ -964,9 +2157,14 @@ int rppicomidi::Settings_file::delete_file(const char* filename, bool mount)
 {
     int error_code = LFS_ERR_OK;
     if (mount)
-        error_code = pico_mount(false);
+        Fs_job_queue::instance().flush();
+    forget_stored_records();
+    if (mount)
+        error_code = begin_fs_op(FS_OP_DELETE);
     if (error_code == LFS_ERR_OK) {
         error_code = pico_remove(filename);
+        if (error_code == LFS_ERR_OK && has_extension(filename, device_ext))
+            remove_index_entry(filename);
         if (error_code != LFS_ERR_OK) {
             switch(error_code) {
             case LFS_ERR_NOENT:
@@ -987,18 +2185,19 @@ int rppicomidi::Settings_file::delete_file(const char* filename, bool mount)
             }
         }
         if (mount)
-            error_code = pico_unmount();
-        if (error_code != LFS_ERR_OK) {
-            printf("Unexpected Error %s unmounting settings file system\r\n", pico_errmsg(error_code));
-        }
+            end_fs_op();
     }
     return error_code;
 }
 
 int rppicomidi::Settings_file::delete_all_files(const char* path)
 {
-    int error_code = pico_mount(false);
+    Fs_job_queue::instance().flush();
+    int error_code = begin_fs_op(FS_OP_DELETE);
     if (error_code == LFS_ERR_OK) {
+        // Do not rewrite the index file for every device record deleted
+        preset_index.clear();
+        index_loaded = true;
         lfs_dir_t dir;
         struct lfs_info info;
         error_code = lfs_dir_open(&dir, path);
@@ -1006,7 +2205,7 @@ int rppicomidi::Settings_file::delete_all_files(const char* path)
             int res = lfs_dir_read(&dir, &info);
             if (res < 0) {
                 lfs_dir_close(&dir);
-                pico_unmount();
+                end_fs_op();
                 return res;
             }
             if (res == 0)
@@ -1027,13 +2226,16 @@ int rppicomidi::Settings_file::delete_all_files(const char* path)
                 }
                 if (error_code != LFS_ERR_OK) {
                     lfs_dir_close(&dir);
-                    pico_unmount();
+                    end_fs_op();
                     return error_code;
                 }
             }
         }
         lfs_dir_close(&dir);
-        pico_unmount();
+        // The index is empty now; the next load_index() rebuilds the file
+        pico_remove(index_filename);
+        index_loaded = false;
+        end_fs_op();
     }
     else {
         printf("Unexpected Error %s mounting settings file system\r\n", pico_errmsg(error_code));
@@ -1043,8 +2245,21 @@ int rppicomidi::Settings_file::delete_all_files(const char* path)
 
 bool rppicomidi::Settings_file::get_all_preset_filenames(std::vector<std::string>& filename_list)
 {
-    int error_code = pico_mount(false);
+    int error_code = begin_fs_op(FS_OP_LIST);
     if (error_code == LFS_ERR_OK) {
+        lfs_size_t size;
+        if (lookup_dir_cache("", size) >= 0) {
+            for (uint8_t idx = 0; idx < dir_cache_nentries; idx++) {
+                const char* name = dir_cache[idx].name;
+                if (has_extension(name, device_ext) || has_extension(name, ".json")) {
+                    // it's the device record file or a legacy JSON settings file. add it to the list
+                    filename_list.push_back(std::string(name));
+                }
+            }
+            end_fs_op();
+            return error_code;
+        }
+        // too many files to cache; read the directory
         lfs_dir_t dir;
         struct lfs_info info;
         error_code = lfs_dir_open(&dir, "/");
@@ -1052,18 +2267,18 @@ bool rppicomidi::Settings_file::get_all_preset_filenames(std::vector<std::string
             int res = lfs_dir_read(&dir, &info);
             if (res < 0) {
                 lfs_dir_close(&dir);
-                pico_unmount();
+                end_fs_op();
                 return res;
             }
             if (res == 0)
                 break;
-            if (info.type == LFS_TYPE_REG) {
-                // it's a file. add it to the list
+            if (info.type == LFS_TYPE_REG && (has_extension(info.name, device_ext) || has_extension(info.name, ".json"))) {
+                // it's the device record file or a legacy JSON settings file. add it to the list
                 filename_list.push_back(std::string(info.name));
             }
         }
         lfs_dir_close(&dir);
-        pico_unmount();
+        end_fs_op();
     }
     else {
         printf("Unexpected Error %s mounting settings file system\r\n", pico_errmsg(error_code));
@@ -1084,7 +2299,7 @@ void rppicomidi::Settings_file::static_delete_file(EmbeddedCli* cli, char* args,
 
 bool rppicomidi::Settings_file::save_screenshot(const uint8_t* bmp, const int nbytes)
 {
-    int err = pico_mount(false);
+    int err = begin_fs_op(FS_OP_STORE);
     if (err != LFS_ERR_OK)
         return false;
     lfs_dir_t dir;
@@ -1096,13 +2311,13 @@ bool rppicomidi::Settings_file::save_screenshot(const uint8_t* bmp, const int nb
         // directory does not exist. Need to create it
         err = pico_mkdir(base_screenshot_path);
         if (err != LFS_ERR_OK) {
-            pico_unmount();
+            end_fs_op();
             printf("cannot make directory %s\r\n", base_screenshot_path);
             return false;
         }
     }
     else {
-        pico_unmount();
+        end_fs_op();
         printf("error %s opening directory %s\r\n", pico_errmsg(err), base_screenshot_path);
         return false;
     }
@@ -1116,7 +2331,7 @@ bool rppicomidi::Settings_file::save_screenshot(const uint8_t* bmp, const int nb
     lfs_file_t file;
     err = lfs_file_open(&file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
     if (err != LFS_ERR_OK) {
-        pico_unmount();
+        end_fs_op();
         printf("error %s opening file %s for write\r\n", pico_errmsg(err), path);
         return false;
     }
@@ -1125,7 +2340,7 @@ bool rppicomidi::Settings_file::save_screenshot(const uint8_t* bmp, const int nb
         printf("error %s writing BMP data to %s\r\n", pico_errmsg(err), path);
     }
     lfs_file_close(&file);
-    pico_unmount();
+    end_fs_op();
     return err == nbytes;
 }
 
@@ -1138,12 +2353,12 @@ FRESULT rppicomidi::Settings_file::export_all_screenshots()
     if (fatres != FR_OK)
         return fatres;
     lfs_dir_t dir;
-    int err = pico_mount(false);
+    int err = begin_fs_op(FS_OP_BACKUP);
     if (err)
         return FR_INT_ERR;
     err = lfs_dir_open(&dir, base_screenshot_path);
     if (err) {
-        pico_unmount();
+        end_fs_op();
         return FR_INT_ERR;
     }
 
@@ -1153,7 +2368,7 @@ FRESULT rppicomidi::Settings_file::export_all_screenshots()
         int res = lfs_dir_read(&dir, &info);
         if (res < 0) {
             lfs_dir_close(&dir);
-            pico_unmount();
+            end_fs_op();
             return FR_INT_ERR;
         }
 
@@ -1167,14 +2382,14 @@ FRESULT rppicomidi::Settings_file::export_all_screenshots()
                 fatres = f_mkdir(base_screenshot_path);
                 if (fatres != FR_OK) {
                     lfs_dir_close(&dir);
-                    pico_unmount();
+                    end_fs_op();
                     return fatres;
                 }
             }
             fatres = f_chdir(base_screenshot_path);
             if (fatres != FR_OK) {
                 lfs_dir_close(&dir);
-                pico_unmount();
+                end_fs_op();
                 return fatres;
             }
 
@@ -1190,46 +2405,34 @@ FRESULT rppicomidi::Settings_file::export_all_screenshots()
             err = lfs_file_open(&file, path, LFS_O_RDONLY);
             if (err != LFS_ERR_OK) {
                 lfs_dir_close(&dir);
-                pico_unmount();
+                end_fs_op();
                 return FR_INT_ERR;
             }
-            uint8_t* bmp = new uint8_t[info.size];
-            lfs_size_t nread = lfs_file_read(&file, bmp, info.size);
-            lfs_file_close(&file);
-            if (nread == info.size) {
-                FIL bufile;
-                fatres = f_open(&bufile, info.name, FA_CREATE_ALWAYS | FA_WRITE);
-                if (fatres != FR_OK) {
-                    delete[] bmp;
-                    lfs_dir_close(&dir);
-                    pico_unmount();
-                    return fatres;
-                }
-                UINT written;
-                fatres = f_write(&bufile, bmp, nread, &written);
-                delete[] bmp;
-                f_close(&bufile);
-                if (fatres != FR_OK) {
-                    lfs_dir_close(&dir);
-                    pico_unmount();
-                    return fatres;
-                }
-                printf("exported BMP file 0:%s/%s\r\n", base_screenshot_path, info.name);
+            FIL bufile;
+            fatres = f_open(&bufile, info.name, FA_CREATE_ALWAYS | FA_WRITE);
+            if (fatres != FR_OK) {
+                lfs_file_close(&file);
+                lfs_dir_close(&dir);
+                end_fs_op();
+                return fatres;
             }
-            else {
-                delete[] bmp;
+            int32_t ncopied = copy_lfs_to_fatfs(&file, &bufile);
+            lfs_file_close(&file);
+            fatres = f_close(&bufile);
+            if (ncopied != static_cast<int32_t>(info.size) || fatres != FR_OK) {
                 lfs_dir_close(&dir);
-                pico_unmount();
-                return FR_INT_ERR;
+                end_fs_op();
+                return fatres != FR_OK ? fatres : FR_INT_ERR;
             }
+            printf("exported BMP file 0:%s/%s\r\n", base_screenshot_path, info.name);
         }
     }
 
     err = lfs_dir_close(&dir);
     if (err) {
-        pico_unmount();
+        end_fs_op();
         return FR_INT_ERR;
     }
-    pico_unmount();
+    end_fs_op();
     return FR_OK;
 }
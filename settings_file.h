@@ -37,6 +37,22 @@
 #include "littlefs-lib/pico_hal.h"
 #include "embedded_cli.h"
 #include "ff.h"
+#include "chunk_stream.h"
+#include "fs_job_queue.h"
+
+// The number of root directory entries Settings_file caches. Override this
+// with a compile definition if a build stores settings for many devices.
+#ifndef SETTINGS_DIR_CACHE_ENTRIES
+#define SETTINGS_DIR_CACHE_ENTRIES 32
+#endif
+
+// The number of bytes backup and restore copy at a time between the
+// settings flash and a USB flash drive. Keep it a multiple of 512, the
+// USB flash drive sector size.
+#ifndef SETTINGS_COPY_CHUNK_BYTES
+#define SETTINGS_COPY_CHUNK_BYTES 2048
+#endif
+static_assert(SETTINGS_COPY_CHUNK_BYTES % 512 == 0, "SETTINGS_COPY_CHUNK_BYTES must be a multiple of 512");
 
 namespace rppicomidi {
 /**
@@ -61,6 +77,16 @@ template <typename I> void n2hexstr(I w, char* hex_cstr, size_t max_cstr) {
         hex_cstr[hex_len] = '\0';
 }
 
+/**
+ * @brief the contents of all settings records of one device
+ */
+struct Device_settings {
+    static const uint8_t num_presets = 8;
+    std::vector<uint8_t> device;                //!< the VVVV-PPPP.bin device record
+    uint8_t current_preset = 0;                 //!< the VVVV-PPPP.cur record; 0 if not stored
+    std::vector<std::vector<uint8_t>> presets;  //!< the VVVV-PPPP.p1 to .p8 records; empty if not stored
+};
+
 class Settings_file {
 public:
     // Singleton Pattern
@@ -98,11 +124,23 @@ public:
      */
     bool load();
 
-    bool load_preset(uint8_t);
+    /**
+     * @brief load the settings of one preset from its preset record in flash
+     *
+     * @param next_preset the preset number 1-8
+     * @return true if successful or false if there was a problem loading settings
+     */
+    bool load_preset(uint8_t next_preset);
 
     /**
-     * @brief If the current settings are different from the settings in flash,
-     * write the settings to the flash
+     * @brief write the current preset's settings to the flash
+     *
+     * Each device has several small files in the compact binary format
+     * Midi_processor_manager describes: the device record VVVV-PPPP.bin,
+     * the current preset number VVVV-PPPP.cur and one preset record VVVV-PPPP.pN
+     * per stored preset. A store always writes the current preset's record
+     * but only writes the device and current preset records if they changed.
+     * The JSON format is only used for backups on a USB flash drive.
      *
      * @return 0 if successful, an negative number if there was an error and
      * a positive number if the number of bytes stored does not match the expected
@@ -111,6 +149,16 @@ public:
      */
     int store();
 
+    /**
+     * @brief queue a job that does what store() does one record per step
+     *
+     * The current preset is serialized now, so later changes are not stored
+     * @param progress_fn called after each step of the job, or nullptr
+     * @param context the context pointer for progress_fn
+     * @return true if the job is queued, false if the preset could not be serialized
+     */
+    bool start_store(Fs_job_queue::Progress_fn progress_fn, void* context);
+
     /**
      * @brief set buffer pointed to by fn to a null terminated
      * C-style character string VVVV-PPPP, where
@@ -130,15 +178,36 @@ public:
 
     /**
      * @brief copy all presets of all devices stored in the local file system
-     * to external flash drive
+     * to external flash drive, converting them to JSON format
      * 
-     * The presets will be stored in a directory named MM-DD-YYYY-HH-MM-SS
+     * The presets will be stored in a directory named like
+     * get_next_backup_directory_name() returns along with a manifest that lists the CRC-32, length and time of each
+     * JSON file and the backup directory that has it.
+     *
+     * @param changes_only if true, only write the files whose CRC-32 or length
+     * differ from the manifest of the latest backup. The manifest points at the
+     * earlier backup directories that have the unchanged files.
      * @return FR_OK if no error, an error code otherwise 
      */
-    FRESULT backup_all_presets();
+    FRESULT backup_all_presets(bool changes_only=false);
+
+    /**
+     * @brief copy all presets of all devices stored in the local file system
+     * to one archive file on the external flash drive
+     *
+     * The archive is named like the next backup directory plus ".arc" and goes
+     * in the same directory as the backup directories. It has a header, a table
+     * of contents with each entry's name, offset, length and CRC-32, then the JSON
+     * files a directory backup would have, one after the other. restore_presets(),
+     * get_all_preset_filenames() and get_backup_product_strings() accept an
+     * archive name wherever they accept a backup directory name.
+     * @return FR_OK if no error, an error code otherwise
+     */
+    FRESULT backup_all_presets_to_archive();
 
     /**
-     * @brief copy preset(s) specified in the backup path to local storage
+     * @brief copy preset(s) specified in the backup path to local storage,
+     * converting them from JSON format
      * 
      * @param backup_path if restoring all presets backed up, the backup_path
      * will be a string of the form returned by get_next_backup_directory_name().
@@ -149,8 +218,32 @@ public:
      */
     FRESULT restore_presets(const char* backup_path);
 
+    /**
+     * @brief queue a job that does what backup_all_presets() does one file per step
+     *
+     * @param changes_only see backup_all_presets()
+     * @param progress_fn called after each step of the job, or nullptr
+     * @param context the context pointer for progress_fn
+     */
+    void start_backup(bool changes_only, Fs_job_queue::Progress_fn progress_fn, void* context);
+
+    /**
+     * @brief queue a job that does what backup_all_presets_to_archive() does
+     * one file per step
+     */
+    void start_archive_backup(Fs_job_queue::Progress_fn progress_fn, void* context);
+
+    /**
+     * @brief queue a job that does what restore_presets() does one file per step
+     */
+    void start_restore(const char* backup_path, Fs_job_queue::Progress_fn progress_fn, void* context);
+
     /**
      * @brief Get the next backup directory name
+     *
+     * The name is the current date, or the date plus the lowest free "-N" suffix
+     * if there already is a backup with that name. It is computed from the list
+     * of backup directories that scan_backup_directories() reads.
      * 
      * @param dirname the character buffer where the next directory name is stored
      * @param maxname the length of the dirname buffer
@@ -161,6 +254,8 @@ public:
     /**
      * @brief Get the all preset directory names from a USB flash drive
      *
+     * The list comes from scan_backup_directories().
+     *
      * @param dirname_list returns all the preset directory names on USB flash
      * @return true if successful, false otherwise
      */
@@ -184,16 +279,42 @@ public:
     bool get_all_preset_filenames(std::vector<std::string>& filename_list);
 
     /**
-     * @brief Get the setting file json string object
-     * 
-     * @param directory The backup directory under base_preset_path
+     * @brief Get the product string of a backed up settings file
+     *
+     * Only the start of the file, up to the "prod" member, is read.
+     * @param directory The backup directory or archive under base_preset_path
      * @param filename The file name of the file under the backup directory
-     * @param json_string pointer to the pointer to JSON-formatted data read from the file or
-     * nullptr if the function fails. The user of this function must call delete[] to free
-     * json_string when it is no longer needed.
-     * @return true if json_string contains valid data, false otherwise
+     * @param prod_string set to the product string, or to an empty string
+     * if the function fails
+     * @param max_string the size of the prod_string buffer
+     * @return true if prod_string contains valid data, false otherwise
+     */
+    bool get_setting_file_product_string(const char* directory, const char* filename, char* prod_string, size_t max_string);
+
+    /**
+     * @brief get the product string of every settings file in a backup directory
+     *
+     * This reads each file once so that a view can scroll through the files
+     * without reading the USB flash drive again.
+     * @param directory The backup directory under base_preset_path
+     * @param filename_list the file names in the backup directory
+     * @param product_list set to the product string of each file in filename_list,
+     * or an empty string if the file could not be read
+     */
+    void get_backup_product_strings(const char* directory, const std::vector<std::string>& filename_list,
+        std::vector<std::string>& product_list);
+
+    /**
+     * @brief get the product string of a device record in local flash from the preset index
+     *
+     * The index is read from flash the first time this is called; after
+     * that, this function does no flash I/O.
+     * @param filename the VVVV-PPPP.bin device record file name
+     * @param product_string set to the product string
+     * @param max_string the size of the product_string buffer
+     * @return true if the index has an entry for filename, false otherwise
      */
-    bool get_setting_file_json_string(const char* directory, const char* file, char** json_string);
+    bool get_indexed_product_string(const char* filename, char* product_string, size_t max_string);
 
     bool save_screenshot(const uint8_t* bmp, const int nbytes);
     FRESULT export_all_screenshots();
@@ -202,7 +323,8 @@ public:
      * @brief remove a file from the lfs filesystem
      *
      * @param filename the full path to the file
-     * @param mount is true to mount the filesystem on entry and unmount it on exit
+     * @param mount is true to start a new file system operation, false if
+     * the caller has already started one
      * @return int LFS_ERR_OK if successful, a negative error code if not
      */
     int delete_file(const char* filename, bool mount=true);
@@ -225,25 +347,429 @@ public:
      * @param fn the file name in lfs flash that contains the preset settings
      * @param raw_settings_ptr will point to a new block of memory initialized to
      * contain the preset settings
-     * @param mount is true if the lfs filesystem needs to be mounted on entry
-     * and unmounted on exit
+     * @param mount is true to start a new file system operation, false if
+     * the caller has already started one
      * @return int the number of bytes in the settings string, or a negative
      * LFS error code if there was an error.
      */
     int load_settings_string(const char* fn, char** raw_settings_ptr, bool mount=true);
+
+    /**
+     * @brief read the whole contents of the settings file fn
+     *
+     * @param fn the file name in lfs flash that contains the preset settings
+     * @param data set to the file contents
+     * @param mount is true to start a new file system operation, false if
+     * the caller has already started one
+     * @return int the number of bytes read, or a negative LFS error code if
+     * there was an error.
+     */
+    int load_settings_data(const char* fn, std::vector<uint8_t>& data, bool mount=true);
+
+    /**
+     * @brief read all settings records of a device
+     *
+     * @param id the VVVV-PPPP device ID; only the first 9 characters are used
+     * so a file name like VVVV-PPPP.bin also works
+     * @param settings set to the contents of the device's records
+     * @param mount is true to start a new file system operation, false if
+     * the caller has already started one
+     * @return int the number of bytes in the device record, or a negative
+     * LFS error code if there was an error.
+     */
+    int load_device_settings(const char* id, Device_settings& settings, bool mount=true);
+
+    /**
+     * @brief create or replace all settings records of a device
+     *
+     * Preset records that are empty in settings are removed from flash
+     * @param id the VVVV-PPPP device ID; only the first 9 characters are used
+     * @param settings the contents of the device's records
+     * @param mount is true to start a new file system operation, false if
+     * the caller has already started one
+     * @return int LFS_ERR_OK if successful, a negative error code if not
+     */
+    int store_device_settings(const char* id, const Device_settings& settings, bool mount=true);
+
+    /**
+     * @brief remove the device record file filename and all other records of
+     * the same device from the lfs filesystem
+     *
+     * If filename is not a device record file, only remove filename
+     * @param filename the VVVV-PPPP.bin device record file name
+     * @return int LFS_ERR_OK if successful, a negative error code if not
+     */
+    int delete_device_files(const char* filename);
+
+    /**
+     * @brief make the next store() write all records of the connected device
+     *
+     * Call this after anything other than store() changes the files in flash
+     */
+    void forget_stored_records();
+
+    /**
+     * @brief format the lfs filesystem and mount it again
+     *
+     * @return int LFS_ERR_OK if successful, a negative error code if not
+     */
+    int format();
+
+    /**
+     * @brief unmount the lfs filesystem
+     *
+     * The filesystem stays mounted for the whole session. Every file system
+     * operation closes its files before it ends, so it is safe to reboot or
+     * to lock out the other core for a flash write between operations
+     * without unmounting. The next file system operation mounts it again.
+     */
+    void unmount();
 private:
     Settings_file();
 
     /**
-     * @brief get the JSON serialized string from the file named settings_filename
+     * @brief the kinds of file system operation timed for the fsstat command
+     */
+    enum Fs_op {FS_OP_LOAD, FS_OP_STORE, FS_OP_DELETE, FS_OP_BACKUP, FS_OP_RESTORE, FS_OP_LIST, FS_OP_COUNT};
+
+    /**
+     * @brief start a file system operation. Mount the lfs filesystem if
+     * it is not mounted already.
      *
-     * @param raw_settings_ptr 
-     * @return int the number of bytes in the settings string, or a negative
+     * Operations other than FS_OP_LOAD, FS_OP_LIST and FS_OP_BACKUP may
+     * change the files so they empty the directory cache.
+     * @param op the kind of operation for the timing statistics
+     * @return int LFS_ERR_OK if successful, a negative error code if not.
+     * Do not call end_fs_op() if this function fails.
+     */
+    int begin_fs_op(Fs_op op);
+
+    /**
+     * @brief end the file system operation begin_fs_op() started and
+     * record how long it took. The filesystem stays mounted.
+     */
+    void end_fs_op();
+
+    /**
+     * @brief look up fn in the cached list of the files in the root directory.
+     * Read the directory to fill the cache if it is empty
+     *
+     * @param fn the file name to look for
+     * @param size set to the size of the file if it is found
+     * @return int 1 if found, 0 if the cache says there is no such file, or
+     * a negative number if the cache does not know. The cache only answers
+     * during read-only operations.
+     * @note call this only during a file system operation
+     */
+    int lookup_dir_cache(const char* fn, lfs_size_t& size);
+
+    /**
+     * @brief read the preset index file into RAM if it is not there already.
+     * Build the index from the device records if the file is missing
+     *
+     * @note call this only during a file system operation
+     */
+    void load_index();
+
+    /**
+     * @brief write the preset index file from the index in RAM
+     *
+     * @note call this only during a file system operation
+     */
+    void store_index();
+
+    /**
+     * @brief create or replace the index entry for a device record
+     *
+     * The index file is only written if the entry is new or its product
+     * string or size changed.
+     * @param fn the VVVV-PPPP.bin device record file name
+     * @param data the device record contents
+     * @param len the number of bytes in data
+     * @note call this only during a file system operation
+     */
+    void update_index_entry(const char* fn, const uint8_t* data, size_t len);
+
+    /**
+     * @brief remove the index entry for a device record if there is one
+     *
+     * @note call this only during a file system operation
+     */
+    void remove_index_entry(const char* fn);
+
+    /**
+     * @brief return true if file system operations of kind op never change the files
+     */
+    static bool is_read_only_op(Fs_op op) { return op == FS_OP_LOAD || op == FS_OP_LIST || op == FS_OP_BACKUP; }
+
+    /**
+     * @brief convert the JSON settings file for the connected device to
+     * binary settings records and delete the JSON file
+     *
+     * @param settings set to the binary settings records
+     * @return int the number of bytes in the device record, or a negative
      * LFS error code if there was an error.
      */
-    int load_settings_string(char** raw_settings_ptr);
+    int convert_legacy_settings_file(Device_settings& settings);
 
-    FRESULT restore_one_file(const char* restore_path, const char* filename);
+    /**
+     * @brief return true if the file name fn ends in the extension ext
+     */
+    static bool has_extension(const char* fn, const char* ext);
+
+    /**
+     * @brief set fn to the VVVV-PPPP.pN preset record file name
+     *
+     * @param fn the buffer for the file name
+     * @param max_fn the size of the fn buffer
+     * @param id the VVVV-PPPP device ID; only the first 9 characters are used
+     * @param preset_num the preset number N
+     */
+    static void get_record_filename(char* fn, size_t max_fn, const char* id, uint8_t preset_num);
+
+    /**
+     * @brief the CRC32 of a record as it is stored in flash
+     */
+    struct Record_hash {
+        bool valid;         // true if crc is the CRC32 of the record in flash
+        uint32_t crc;
+    };
+
+    /**
+     * @brief set hash to the CRC32 of record; an empty record is not stored in flash
+     */
+    static void remember_record_hash(Record_hash& hash, const std::vector<uint8_t>& record);
+
+    /**
+     * @brief set all record hashes from the records loaded from flash
+     *
+     * @param settings the records loaded from flash, or nullptr if the device has no records
+     */
+    void remember_stored_records(const Device_settings* settings);
+
+    /**
+     * @brief write record to the file fn unless its CRC32 matches hash
+     *
+     * @param fn the file name in lfs flash
+     * @param record the record contents
+     * @param hash the hash of the record in flash; updated if the record is written
+     * @return int LFS_ERR_OK if successful, a negative error code if not
+     * @note the lfs filesystem must be mounted
+     */
+    int write_record_if_changed(const char* fn, const std::vector<uint8_t>& record, Record_hash& hash);
+
+    /**
+     * @brief create or replace the settings file fn
+     *
+     * @param fn the file name in lfs flash
+     * @param data the file contents
+     * @param len the number of bytes in data
+     * @param mount is true to start a new file system operation, false if
+     * the caller has already started one
+     * @return int LFS_ERR_OK if successful, a negative error code if not
+     */
+    int write_settings_data(const char* fn, const uint8_t* data, size_t len, bool mount=true);
+
+    /**
+     * @brief store the records converted from a backup JSON file
+     *
+     * @param filename the VVVV-PPPP.json backup file name
+     * @param settings the records of the device
+     * @return FR_OK if successful, an error code otherwise
+     */
+    FRESULT store_restored_settings(const char* filename, const Device_settings& settings);
+
+    /**
+     * @brief the function stream_json_members() calls for each member of the
+     * top level object of a JSON document
+     *
+     * @param context the context pointer passed to stream_json_members()
+     * @param json_format the window that holds the member. The character after
+     * the value may be changed while the function runs if it is restored.
+     * @param key the member's key; it is not null terminated
+     * @param key_len the number of characters in key
+     * @param value points to the first character of the member's value
+     * @param span the number of characters in the value
+     * @return true to get the next member, false to stop reading
+     */
+    typedef bool (*Json_member_fn)(void* context, char* json_format, const char* key, size_t key_len,
+        const char* value, size_t span);
+
+    /**
+     * @brief read the top level object of a JSON document in an open FatFs
+     * file and pass each of its members to member_fn
+     *
+     * The file is read up to SETTINGS_COPY_CHUNK_BYTES at a time, ending on chunk
+     * boundaries, into a window made of both halves of copy_chunk. A member may
+     * cross from one chunk into the next. A member longer than about one chunk
+     * is moved to a heap window that grows a chunk at a time, so the heap use
+     * is the size of the largest member, not the size of the file.
+     * @param file the open file at the first character of the document
+     * @param length the number of bytes in the document
+     * @param member_fn the function to call for each member
+     * @param context passed to member_fn
+     * @param crc if not nullptr, set to the CRC-32 of the bytes read. It covers
+     * the whole document unless member_fn stops the reading.
+     * @return FR_OK if the object was read or member_fn stopped the reading,
+     * FR_INT_ERR if the document is not a valid JSON object, or another error code
+     */
+    FRESULT stream_json_members(FIL* file, uint32_t length, Json_member_fn member_fn, void* context,
+        uint32_t* crc=nullptr);
+
+    /**
+     * @brief Json_member_fn for a Midi_processor_manager::Json_convert_state context
+     */
+    static bool static_convert_json_member(void* context, char* json_format, const char* key, size_t key_len,
+        const char* value, size_t span);
+
+    /**
+     * @brief Json_member_fn for a Product_string context; stops at the "prod" member
+     */
+    static bool static_product_string_member(void* context, char* json_format, const char* key, size_t key_len,
+        const char* value, size_t span);
+
+    /**
+     * @brief Chunk_stream write function for the open FatFs file context
+     */
+    static bool static_fatfs_write_chunk(void* context, const uint8_t* data, size_t len);
+
+    /**
+     * @brief Chunk_stream read function for the open littlefs file context
+     */
+    static int32_t static_lfs_read_chunk(void* context, uint8_t* data, size_t maxlen);
+
+    /**
+     * @brief copy an open littlefs file to an open FatFs file through the first chunk of copy_chunk
+     *
+     * @return the number of bytes copied or a negative number if there was an error
+     */
+    int32_t copy_lfs_to_fatfs(lfs_file_t* src, FIL* dest);
+
+    /**
+     * @brief set backup_name to the name the settings file fn has in a backup
+     *
+     * @param fn the device record or legacy JSON file name
+     * @param backup_name must have room for at least strlen(fn)+1 characters
+     */
+    static void get_backup_name(const char* fn, char* backup_name);
+
+    /**
+     * @brief list the settings files a backup copies
+     *
+     * @param sources set to the device record and legacy JSON file names
+     * @return LFS_ERR_OK if successful, a negative error code if not
+     * @note call this only during a file system operation
+     */
+    int list_backup_sources(std::vector<std::string>& sources);
+
+    /**
+     * @brief write the backup JSON of a device record or legacy JSON file to stream
+     *
+     * The stream is flushed on success
+     * @return true if successful
+     */
+    bool stream_backup_json(const char* fn, Chunk_stream& stream);
+
+    struct Archive_entry;
+    struct Manifest_entry;
+
+    /**
+     * @brief Chunk_stream write function for a Crc_writer context
+     */
+    static bool static_crc_write_chunk(void* context, const uint8_t* data, size_t len);
+
+    /**
+     * @brief read the manifest of a backup directory
+     *
+     * The last manifest read stays in RAM; a manifest never changes once
+     * its backup is written.
+     * @param directory the backup directory under base_preset_path
+     * @param manifest set to the manifest entries
+     * @return true if successful, false if the directory has no valid manifest
+     */
+    bool read_backup_manifest(const char* directory, std::vector<Manifest_entry>& manifest);
+
+    /**
+     * @brief write a manifest file
+     *
+     * @param path the full path of the manifest file
+     * @param manifest the manifest entries
+     * @return FR_OK if successful, an error code otherwise
+     */
+    FRESULT write_backup_manifest(const char* path, const std::vector<Manifest_entry>& manifest);
+
+    /**
+     * @brief find the backup directory that has the JSON file for filename
+     *
+     * Follow the manifests from directory until one says the file is in its
+     * own directory. A backup without a manifest has all of its files.
+     * @param directory the backup directory under base_preset_path
+     * @param filename the VVVV-PPPP.json file name
+     * @param location set to the backup directory that has the file
+     * @return true if successful, false if a manifest does not list filename
+     * or the chain of manifests is too long
+     */
+    bool resolve_backup_file(const char* directory, const char* filename, std::string& location);
+
+    /**
+     * @brief restore filename from the backup directory, or from the earlier
+     * backup directory its manifest points to
+     */
+    FRESULT restore_backup_file(const char* directory, const char* filename);
+
+    /**
+     * @brief get the name of the backup directory with the latest date and version
+     *
+     * @return true if successful, false if there are no backup directories
+     * or the name does not fit in maxname characters
+     */
+    bool get_latest_backup_directory(char* dirname, size_t maxname);
+
+    /**
+     * @brief format the archive header and table of contents
+     */
+    static void get_archive_header(const std::vector<Archive_entry>& toc, std::vector<uint8_t>& header);
+    static FRESULT write_archive_header(FIL* file, const std::vector<uint8_t>& header);
+
+    /**
+     * @brief read the table of contents of an open archive file
+     *
+     * @return FR_OK if successful, FR_NO_FILE if the file is not a valid archive
+     */
+    static FRESULT read_archive_toc(FIL* file, std::vector<Archive_entry>& toc);
+
+    /**
+     * @brief open one backed up JSON file in a backup directory or an archive
+     *
+     * @param directory the backup directory or archive under base_preset_path. A file
+     * the directory's manifest lists is opened in the directory that has it.
+     * @param filename the VVVV-PPPP.json file name
+     * @param file set to the open file at the first character of the JSON. The caller
+     * must close it with f_close() if this function succeeds.
+     * @param entry set to where the JSON is in the file, how long it is and, if
+     * it is in an archive, its CRC-32
+     * @param in_archive set to true if the file is in an archive
+     * @return FR_OK if successful, an error code otherwise
+     */
+    FRESULT open_backup_file(const char* directory, const char* filename, FIL* file, Archive_entry& entry, bool& in_archive);
+
+    /**
+     * @brief return true if the first len characters of name are an archive file name
+     */
+    static bool is_archive_name(const char* name, size_t len);
+
+    /**
+     * @brief print how many bytes the last backup or restore moved and how fast
+     *
+     * @param what the operation, e.g. "backed up"
+     * @param elapsed_us how long the operation took in microseconds
+     */
+    void print_throughput(const char* what, uint32_t elapsed_us);
+
+    /**
+     * @brief Json_stream_writer write function for the console
+     */
+    static bool static_console_write(void* context, const char* data, size_t len);
 
     /**
      * @brief See https://github.com/littlefs-project/littlefs/issues/2
@@ -261,6 +787,7 @@ private:
     static void static_delete_file(EmbeddedCli* cli, char* args, void*);
     static void static_fatfs_cd(EmbeddedCli* cli, char* args, void*);
     static void static_fatfs_ls(EmbeddedCli* cli, char* args, void*);
+    static void static_fatfs_stat(EmbeddedCli* cli, char* args, void*);
     static void static_fatfs_backup(EmbeddedCli* cli, char* args, void*);
     static void static_fatfs_restore(EmbeddedCli* cli, char* args, void*);
     static void static_fatfs_save_screenshots(EmbeddedCli*, char*, void*);
@@ -270,7 +797,183 @@ private:
     FRESULT create_preset_backup_directory(char* dirname);
     uint16_t vid;       // the idVendor of the connected device (not serialized here)
     uint16_t pid;       // the idProduct of the connected device (not serialized here)
+    Record_hash device_hash; // the hash of the connected device's device record in flash
+    Record_hash preset_hashes[Device_settings::num_presets]; // the hashes of the connected device's preset records in flash
+    uint8_t stored_current_preset; // the current preset record value in flash; 0 if unknown
+    uint32_t bytes_written; // the number of bytes written to settings files since boot
+    struct Store_stats {
+        uint32_t nstores;       // the number of calls to store()
+        uint32_t last_bytes;    // the number of bytes the last store() wrote
+        uint32_t total_bytes;   // the number of bytes all calls to store() wrote
+        uint32_t file_writes;   // the number of settings files written
+        uint32_t skipped_writes;// the number of record writes skipped because the record in flash matched
+    } store_stats;
+    static constexpr const char* device_ext = ".bin";
+    static constexpr const char* current_preset_ext = ".cur";
+    static const size_t max_record_filename = 16;
+    bool is_mounted;    // true if the lfs filesystem is mounted
+    uint8_t fs_op_depth; // the number of nested file system operations in progress
+    Fs_op current_op;   // the outermost file system operation in progress
+    uint32_t op_start_us; // the time the outermost file system operation started
+    struct Fs_op_stats {
+        uint32_t nops;          // the number of operations since boot
+        uint32_t last_us;       // how long the last operation took
+        uint32_t max_us;        // how long the longest operation took
+        uint64_t total_us;      // how long all operations took
+    } fs_op_stats[FS_OP_COUNT];
+    uint32_t nmounts;   // the number of times the lfs filesystem was mounted since boot
+    uint32_t nunmounts; // the number of times the lfs filesystem was unmounted since boot
+    struct Dir_cache_entry {
+        char name[max_record_filename];
+        lfs_size_t size;
+    } dir_cache[SETTINGS_DIR_CACHE_ENTRIES];
+    uint8_t dir_cache_nentries; // the number of entries in dir_cache
+    bool dir_cache_valid;       // true if dir_cache lists every file in the root directory
+    uint32_t dir_cache_hits;    // the number of file lookups the directory cache answered
+    uint32_t dir_cache_misses;  // the number of times the directory was read to fill the cache
+    static const size_t max_index_prod = 43; // room for the longest product string plus null termination
+    struct Index_entry {
+        char id[10];            // the VVVV-PPPP device ID
+        char prod[max_index_prod]; // the product string from the device record
+        uint32_t size;          // the number of bytes in the device record
+        uint32_t mtime;         // when the entry last changed in FatFs date and time format; 0 if unknown
+    };
+    std::vector<Index_entry> preset_index;
+    struct Archive_entry {
+        char name[max_record_filename]; // VVVV-PPPP.json
+        uint32_t offset;        // where the JSON starts in the archive file
+        uint32_t length;        // the number of bytes of JSON
+        uint32_t crc;           // the CRC-32 of the JSON
+    };
+    struct Product_string {
+        char* str;              // the buffer for the product string
+        size_t max_str;         // the size of the buffer
+    };
+    struct Crc_writer {
+        FIL* file;              // the file to write or nullptr to only compute the CRC-32
+        uint32_t crc;           // the CRC-32 of the data written so far
+    };
+    static const size_t max_backup_dirname = 16; // MM-DD-YYYY-VVV plus null termination
+    struct Manifest_entry {
+        char name[max_record_filename]; // VVVV-PPPP.json
+        uint32_t crc;           // the CRC-32 of the JSON
+        uint32_t length;        // the number of bytes of JSON
+        uint32_t mtime;         // when the JSON was written in FatFs date and time format
+        char dir[max_backup_dirname]; // the backup directory that has the JSON file
+    };
+    std::string manifest_cache_dir;     // the backup directory of the manifest in manifest_cache
+    std::vector<Manifest_entry> manifest_cache;
+
+    /**
+     * @brief store() as a job: write the device record, the preset record
+     * and the current preset record, one per step
+     */
+    class Store_job : public Fs_job {
+    public:
+        Store_job() : error_code{LFS_ERR_OK}, preset_num{0}, start_bytes{0} { num_steps = 3; }
+        /**
+         * @brief serialize the current preset of the connected device
+         *
+         * @return true if successful
+         */
+        bool init();
+        Step_result step() final;
+        bool next_step_writes_flash() const final { return true; }
+        int error_code;
+    private:
+        char id[10];            // the VVVV-PPPP device ID
+        uint8_t preset_num;
+        std::vector<uint8_t> device;
+        std::vector<uint8_t> preset;
+        uint32_t start_bytes;   // bytes_written when the job started
+    };
+
+    /**
+     * @brief backup_all_presets() as a job: list the files and make the
+     * backup directory, back up one file per step, then write the manifest
+     */
+    class Backup_job : public Fs_job {
+    public:
+        Backup_job(bool changes_only_) : fatres{FR_OK}, changes_only{changes_only_} {}
+        Step_result step() final;
+        FRESULT fatres;
+    private:
+        FRESULT start();
+        FRESULT backup_file(const char* fn);
+        bool changes_only;
+        char dirname[30];
+        std::vector<std::string> sources;           // the settings files to back up
+        std::vector<Manifest_entry> latest_manifest; // the manifest of the latest backup if changes_only
+        std::vector<Manifest_entry> manifest;       // the manifest of this backup
+    };
+
+    /**
+     * @brief backup_all_presets_to_archive() as a job: list the files and
+     * write a placeholder header, write one file per step, then write the
+     * real header
+     */
+    class Archive_job : public Fs_job {
+    public:
+        Archive_job() : fatres{FR_OK}, file_open{false} {}
+        virtual ~Archive_job();
+        Step_result step() final;
+        FRESULT fatres;
+    private:
+        FRESULT start();
+        FRESULT write_entry(size_t idx);
+        FRESULT finish();
+        char archive_name[30];
+        char path[64];          // the full path of the archive
+        std::vector<Archive_entry> toc;
+        std::vector<std::string> sources;   // the settings file for each toc entry
+        FIL file;
+        bool file_open;         // true if file is open; the destructor removes an unfinished archive
+    };
+
+    /**
+     * @brief restore_presets() as a job: list the files, then restore one file per step
+     */
+    class Restore_job : public Fs_job {
+    public:
+        Restore_job(const char* backup_path_) : fatres{FR_OK}, backup_path{backup_path_} {}
+        Step_result step() final;
+        // the first step only lists the files on the USB flash drive
+        bool next_step_writes_flash() const final { return steps_done > 0; }
+        FRESULT fatres;
+    private:
+        FRESULT start();
+        FRESULT restore_file(size_t idx);
+        struct Item {
+            std::string dir;    // the backup directory or archive to restore the file from
+            std::string filename;
+        };
+        std::string backup_path;
+        std::vector<Item> items;
+    };
+    bool index_loaded;      // true if preset_index matches the index file
+    /**
+     * @brief read the names of all backup directories on the USB flash drive
+     * into backup_dirnames with one pass over base_preset_path
+     *
+     * The list is only read once. Plugging in a different drive reboots
+     * the processor, and backup_all_presets() adds each directory it creates.
+     * @return true if backup_dirnames lists every backup directory
+     */
+    bool scan_backup_directories();
+    std::vector<std::string> backup_dirnames;
+    bool backup_dirnames_valid; // true if backup_dirnames lists every directory in base_preset_path
+    uint8_t copy_chunk[2*SETTINGS_COPY_CHUNK_BYTES]; // backup copies through the first chunk; restore reads through both
+    uint32_t xfer_bytes;    // the number of bytes the last backup or restore read or wrote on the USB drive
+    static constexpr const char* index_filename = "presets.idx";
     static constexpr const char* base_preset_path = "/rppicomidi-pico-usb-midi-processor";
+    static constexpr const char* manifest_filename = "backup.mnf";
+    static const unsigned manifest_format_version = 1;
+    static const uint8_t max_manifest_hops = 8; // more than this many manifests in a chain is an error
+    static constexpr const char* archive_ext = ".arc";
+    static constexpr const char* archive_magic = "PMAR";
+    static const uint16_t archive_format_version = 1;
+    static const size_t archive_header_bytes = 12;     // magic, version, number of entries, CRC-32 of the table of contents
+    static const size_t archive_toc_entry_bytes = max_record_filename + 12;
     static constexpr const char* base_screenshot_path = "/rppicomidi-screenshots";
 };
 }
\ No newline at end of file
@@ -65,15 +65,17 @@ void rppicomidi::Settings_flash_view::update_product_string_display()
         screen.draw_rectangle(0, 0, screen.get_screen_width(), 2*font.height,Pixel_state::PIXEL_ZERO, Pixel_state::PIXEL_ZERO);
         screen.center_string(font, "Delete presets", font.height);
     }
+    else if (Settings_file::instance().get_indexed_product_string(menu.get_current_item()->get_text(), prod_string, sizeof(prod_string))) {
+        screen.center_string_on_two_lines(font, prod_string, 0);
+    }
     else {
-        char* json_format;
-        if (Settings_file::instance().load_settings_string(menu.get_current_item()->get_text(), &json_format) > 0) {
-            if (!Midi_processor_manager::instance().get_product_string_from_setting_data(json_format, prod_string, sizeof(prod_string))) {
-                printf("failed to parse JSON data\r\n");
-                delete[] json_format;
+        // a legacy JSON settings file is not in the preset index
+        std::vector<uint8_t> data;
+        if (Settings_file::instance().load_settings_data(menu.get_current_item()->get_text(), data) > 0) {
+            if (!Midi_processor_manager::instance().get_product_string_from_setting_data(data.data(), data.size(), prod_string, sizeof(prod_string))) {
+                printf("failed to parse settings data\r\n");
                 return;
             }
-            delete[] json_format;
             screen.center_string_on_two_lines(font, prod_string, 0);
         }
     }
@@ -91,10 +93,7 @@ void rppicomidi::Settings_flash_view::static_delete_all(View* context, View**)
 void rppicomidi::Settings_flash_view::static_reformat(View* context, View**)
 {
     auto me = reinterpret_cast<Settings_flash_view*>(context);
-    int err = pico_mount(true);
-    if (err == LFS_ERR_OK) {
-        err = pico_unmount();
-    }
+    int err = Settings_file::instance().format();
     if (err != 0) {
         auto item = reinterpret_cast<Callback_menu_item*>(me->menu.get_current_item());
         item->set_select_action(Select_result::no_op); // do not exit this view.
@@ -104,7 +103,7 @@ void rppicomidi::Settings_flash_view::static_reformat(View* context, View**)
 void rppicomidi::Settings_flash_view::static_delete_file(View* context, View**)
 {
     auto me = reinterpret_cast<Settings_flash_view*>(context);
-    int err = Settings_file::instance().delete_file(me->menu.get_current_item()->get_text());
+    int err = Settings_file::instance().delete_device_files(me->menu.get_current_item()->get_text());
     if (err != 0) {
         auto item = reinterpret_cast<Callback_menu_item*>(me->menu.get_current_item());
         item->set_select_action(Select_result::no_op); // do not exit this view.
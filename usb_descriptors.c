@@ -27,6 +27,7 @@
 #include "tusb.h"
 #include "stdlib.h"
 #include "usb_descriptors.h"
+#include "mem_stats.h"
 #include "usb_midi_host.h"
 static tusb_desc_device_t desc_device_connected;
 
@@ -76,7 +77,7 @@ void set_descriptors_uncloned(void)
 static void clone_string_cb(tuh_xfer_t* xfer)
 {
   if (XFER_RESULT_SUCCESS == xfer->result) {
-    devstrings[langid_idx].string_list[string_idx] = malloc(xfer->buffer[0]);
+    devstrings[langid_idx].string_list[string_idx] = mem_tag_malloc(MEM_TAG_DESCRIPTORS, xfer->buffer[0]);
     memcpy(devstrings[langid_idx].string_list[string_idx], xfer->buffer, xfer->buffer[0]);
     if (++string_idx < nstrings) {
       clone_state = CLONE_NEXT_DESCRIPTOR;
@@ -156,7 +157,7 @@ static void clone_string_descriptors(uint8_t dev_addr)
     if (devstrings != NULL) {
       for (idx = 0; idx < num_langids; idx++) {
         for (jdx = 0; jdx < nstrings; jdx++) {
-          free(devstrings[idx].string_list[jdx]);
+          mem_tag_free(devstrings[idx].string_list[jdx]);
         }
         free(devstrings+idx);
       }